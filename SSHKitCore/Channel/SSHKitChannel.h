@@ -1,7 +1,7 @@
 #import <SSHKitCore/SSHKitCoreCommon.h>
 
 @protocol SSHKitChannelDelegate;
-@class SSHKitSession;
+@class SSHKitSession, SSHKitBufferPool, SSHKitChannelMetrics;
 
 // -----------------------------------------------------------------------------
 #pragma mark -
@@ -39,10 +39,57 @@
  */
 @property (nonatomic, readonly) NSInteger exitStatus;
 
+/**
+ Deliver received data in pooled buffers instead of one NSData per packet. Packets read while the
+ session queue is busy are coalesced into a single channel:didReadStdoutData: or channel:didReadStderrData:
+ call of at most maxCoalescedDataLength bytes. The data wraps the pooled buffer without copying,
+ it can be kept by delegate, buffer goes back to the pool once the data is released.
+ Defaults to NO.
+ */
+@property (nonatomic) BOOL coalescesReceivedData;
+
+/** Default 256 KB, limited by bufferSize of receiveBufferPool */
+@property (nonatomic) NSUInteger maxCoalescedDataLength;
+
+/** Default [SSHKitBufferPool sharedPool] */
+@property (nonatomic, strong) SSHKitBufferPool *receiveBufferPool;
+
+/** Bytes received from server */
+@property (nonatomic, readonly) unsigned long long receivedBytes;
+
+/** Buffers and NSData objects allocated to deliver received data, buffers taken from the pool without allocating are not counted */
+@property (nonatomic, readonly) NSUInteger receiveAllocationCount;
+
+/**
+ Bytes passed to writeData: but not yet accepted by the remote window. Updated on session queue.
+ */
+@property (nonatomic, readonly) NSUInteger queuedWriteBytes;
+
+/**
+ channelWriteQueueDidReachHighWatermark: is sent once queuedWriteBytes reaches writeQueueHighWatermark,
+ channelWriteQueueDidDrainToLowWatermark: once it falls back to writeQueueLowWatermark.
+ Defaults to 1 MB and 256 KB.
+ */
+@property (nonatomic) NSUInteger writeQueueHighWatermark;
+@property (nonatomic) NSUInteger writeQueueLowWatermark;
+
+/** Snapshot of traffic counters */
+- (SSHKitChannelMetrics *)metrics;
+
 - (void)close;
 
+/**
+ Queue data to be written, data is retained rather than copied unless it is mutable.
+ Data written before the channel is opened is sent once it is ready.
+ */
 - (void)writeData:(NSData *)data;
 
+/**
+ Half-close, tell the peer no more data follows once data already queued is written.
+ Reading goes on until channelDidReceiveEOF: or channelDidClose:withError:.
+ */
+- (void)sendEOF;
+
 @end
 
 /**
@@ -73,6 +120,24 @@
  **/
 - (void)channelDidWriteData:(SSHKitChannel *)channel;
 
+/**
+ * Called when queuedWriteBytes reaches writeQueueHighWatermark, producer should stop writing until
+ * channelWriteQueueDidDrainToLowWatermark: is called.
+ **/
+- (void)channelWriteQueueDidReachHighWatermark:(SSHKitChannel *)channel;
+
+- (void)channelWriteQueueDidDrainToLowWatermark:(SSHKitChannel *)channel;
+
+/**
+ * Called when the peer half-closed the channel, all data it sent was delivered before.
+ **/
+- (void)channelDidReceiveEOF:(SSHKitChannel *)channel;
+
+/**
+ * Called when the remote command exits, before channelDidClose:withError:. Also sets exitStatus.
+ **/
+- (void)channel:(SSHKitChannel *)channel didExitWithStatus:(NSInteger)status;
+
 /**
  * Called when a channel closes with or without error.
  **/
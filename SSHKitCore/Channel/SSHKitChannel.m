@@ -8,7 +8,33 @@ static channel_callbacks s_null_channel_callbacks = {0};
 
 @interface SSHKitChannel () {
     channel_callbacks   _callback;
-    NSData              *_pendingWriteData;
+    
+    // outbound data not yet accepted by libssh, first buffer is partially written up to _writeQueueOffset
+    NSMutableArray      *_writeQueue;
+    NSUInteger          _writeQueueOffset;
+    char                *_gatherBuffer;
+    BOOL                _writePaused;
+    BOOL                _sendsEOFWhenDrained;
+    BOOL                _sentEOF;
+    
+    // metrics
+    NSUInteger          _receivedPackets;
+    unsigned long long  _sentBytes;
+    NSUInteger          _sentPackets;
+    NSUInteger          _windowStalls;
+    BOOL                _windowStalled;
+    
+    // coalesced data not yet handed to delegate
+    void                *_receiveBuffer;
+    NSUInteger          _receiveLength;
+    BOOL                _receiveIsSTDError;
+    BOOL                _receiveFlushScheduled;
+    SSHKitBufferPool    *_receiveBufferPoolInUse;
+    
+    // EOF arrived while receiving was paused, told once kept data is delivered
+    BOOL                _pendingEOF;
+    // remote closed while receiving was paused, raw channel is freed once kept data is delivered
+    BOOL                _pendingClose;
 }
 
 @end
@@ -30,6 +56,11 @@ static channel_callbacks s_null_channel_callbacks = {0};
     if ((self = [super init])) {
         _session = session;
         _exitStatus = -1;
+        _maxCoalescedDataLength = 256 * 1024;
+        _writeQueue = [@[] mutableCopy];
+        _writeQueueHighWatermark = 1024 * 1024;
+        _writeQueueLowWatermark = 256 * 1024;
+        _receiveBufferPool = [SSHKitBufferPool sharedPool];
 		self.delegate = aDelegate;
         self.stage = SSHKitChannelStageInitial;
     }
@@ -37,6 +68,11 @@ static channel_callbacks s_null_channel_callbacks = {0};
     return self;
 }
 
+- (void)dealloc {
+    [_receiveBufferPoolInUse recycleBuffer:_receiveBuffer];
+    free(_gatherBuffer);
+}
+
 #pragma mark - Close Channel
 
 - (void)close {
@@ -63,6 +99,13 @@ static channel_callbacks s_null_channel_callbacks = {0};
     }
     
     self.stage = SSHKitChannelStageClosed;
+    _pendingClose = NO;
+    
+    [self.openTimer cancel];
+    self.openTimer = nil;
+    
+    // let session remove channel on next socket event
+    [self.session doScheduleChannel:self];
     
     // prevent server receive more then one close message
     if (ssh_channel_is_open(_rawChannel)) {
@@ -85,11 +128,66 @@ static channel_callbacks s_null_channel_callbacks = {0};
     }
     self->_rawChannel = NULL;
     
+    // data arrived before close message
+    [self doFlushReceivedData];
+    
+    [_writeQueue removeAllObjects];
+    _writeQueueOffset = 0;
+    _queuedWriteBytes = 0;
+    
     if (_delegateFlags.didCloseWithError) {
         [self.delegate channelDidClose:self withError:error];
     }
 }
 
+- (void)doSuspend {
+    NSAssert([self.session isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    if (self.stage == SSHKitChannelStageClosed) {
+        return;
+    }
+    
+    [self.openTimer cancel];
+    self.openTimer = nil;
+    
+    // raw channel dies with the raw session, nothing can be sent on it
+    [self _unregesterCallbacks];
+    
+    ssh_channel_free(self->_rawChannel);
+    self->_rawChannel = NULL;
+    if (self->_rawSFTPSession) {
+        sftp_free(self->_rawSFTPSession);
+        _rawSFTPSession = NULL;
+    }
+    
+    [self doFlushReceivedData];
+    
+    // data kept by libssh is gone with the raw channel, EOF is sent again on the new one
+    _pendingEOF = NO;
+    _pendingClose = NO;
+    _sentEOF = NO;
+    
+    // unsent data waits for the channel to be opened again, a partly sent buffer is sent from where it stopped
+    self.stage = SSHKitChannelStageInitial;
+}
+
+- (NSUInteger)doDiscardWriteQueue {
+    NSUInteger discarded = _queuedWriteBytes;
+    
+    [_writeQueue removeAllObjects];
+    _writeQueueOffset = 0;
+    _queuedWriteBytes = 0;
+    
+    if (_writePaused) {
+        _writePaused = NO;
+        if (_delegateFlags.writeQueueDidDrainToLowWatermark) {
+            [self.delegate channelWriteQueueDidDrainToLowWatermark:self];
+        }
+    }
+    
+    return discarded;
+}
+
 #pragma mark - Read / Write
 
 - (void)doOpen {
@@ -98,6 +196,162 @@ static channel_callbacks s_null_channel_callbacks = {0};
                                  userInfo:nil];
 }
 
+- (int)doReceiveBytes:(const void *)bytes length:(uint32_t)length isSTDError:(BOOL)isSTDError {
+    if (_receivePaused) {
+        // libssh keeps the bytes and stops growing the window once enough are kept
+        return 0;
+    }
+    
+    _receivedBytes += length;
+    _receivedPackets++;
+    
+    BOOL hasReader = isSTDError ? _delegateFlags.didReadStderrData : _delegateFlags.didReadStdoutData;
+    if (!_coalescesReceivedData || !hasReader) {
+        _receiveAllocationCount++;
+        return [self _didReceiveData:[NSData dataWithBytes:bytes length:length] isSTDError:isSTDError];
+    }
+    
+    SSHKitBufferPool *pool = _receiveBufferPoolInUse ?: _receiveBufferPool;
+    NSUInteger capacity = MIN(MAX(_maxCoalescedDataLength, SSHKIT_CHANNEL_MAX_PACKET), pool.bufferSize);
+    
+    if (_receiveBuffer && (isSTDError != _receiveIsSTDError || _receiveLength + length > capacity)) {
+        [self doFlushReceivedData];
+        pool = _receiveBufferPool;
+        capacity = MIN(MAX(_maxCoalescedDataLength, SSHKIT_CHANNEL_MAX_PACKET), pool.bufferSize);
+    }
+    
+    if (!_receiveBuffer && length <= capacity) {
+        NSUInteger allocationCount = pool.allocationCount;
+        _receiveBuffer = [pool takeBuffer];
+        _receiveAllocationCount += pool.allocationCount - allocationCount;
+        _receiveBufferPoolInUse = pool;
+        _receiveIsSTDError = isSTDError;
+    }
+    
+    if (!_receiveBuffer) {
+        // larger than a pooled buffer, or out of memory
+        _receiveAllocationCount++;
+        return [self _didReceiveData:[NSData dataWithBytes:bytes length:length] isSTDError:isSTDError];
+    }
+    
+    memcpy((char *)_receiveBuffer + _receiveLength, bytes, length);
+    _receiveLength += length;
+    
+    if (!_receiveFlushScheduled) {
+        // deliver once packets already read from socket are all consumed
+        _receiveFlushScheduled = YES;
+        
+        __weak SSHKitChannel *weakSelf = self;
+        [self.session dispatchAsyncOnSessionQueue:^{
+            __strong SSHKitChannel *strongSelf = weakSelf;
+            if (!strongSelf) {
+                return_from_block;
+            }
+            
+            strongSelf->_receiveFlushScheduled = NO;
+            [strongSelf doFlushReceivedData];
+        }];
+    }
+    
+    return length;
+}
+
+- (void)doFlushReceivedData {
+    if (!_receiveBuffer) {
+        return;
+    }
+    
+    NSData *readData = [_receiveBufferPoolInUse dataWithBuffer:_receiveBuffer length:_receiveLength];
+    _receiveAllocationCount++;
+    _receiveBuffer = NULL;
+    _receiveLength = 0;
+    _receiveBufferPoolInUse = nil;
+    
+    [self _didReceiveData:readData isSTDError:_receiveIsSTDError];
+}
+
+- (void)doPauseReceiving {
+    _receivePaused = YES;
+}
+
+- (void)doResumeReceiving {
+    NSAssert([self.session isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    if (!_receivePaused) {
+        return;
+    }
+    
+    // older data goes first
+    [self doFlushReceivedData];
+    
+    for (int isSTDError = 0; isSTDError <= 1; isSTDError++) {
+        while (_rawChannel && self.stage != SSHKitChannelStageClosed) {
+            void *buffer = [_receiveBufferPool takeBuffer];
+            uint32_t capacity = (uint32_t)MIN(_receiveBufferPool.bufferSize, UINT32_MAX);
+            
+            // still paused while reading, packets handled by libssh meanwhile queue up behind the kept bytes
+            int length = ssh_channel_read_nonblocking(_rawChannel, buffer, capacity, isSTDError);
+            if (length <= 0) {
+                [_receiveBufferPool recycleBuffer:buffer];
+                break;
+            }
+            
+            _receivedBytes += length;
+            _receivedPackets++;
+            _receiveAllocationCount++;
+            
+            // delegate may pause again
+            _receivePaused = NO;
+            [self _didReceiveData:[_receiveBufferPool dataWithBuffer:buffer length:length] isSTDError:isSTDError];
+            if (_receivePaused) {
+                return;
+            }
+            _receivePaused = YES;
+            
+            if ((uint32_t)length < capacity) {
+                // drained, without asking libssh for more packets
+                break;
+            }
+        }
+    }
+    
+    _receivePaused = NO;
+    
+    if (_pendingEOF) {
+        _pendingEOF = NO;
+        [self doReceiveEOF];
+    }
+    
+    if (_pendingClose) {
+        _pendingClose = NO;
+        [self doCloseWithError:nil];
+    }
+}
+
+- (void)doReceiveEOF {
+    if (_receivePaused) {
+        _pendingEOF = YES;
+        return;
+    }
+    
+    // data arrived before EOF
+    [self doFlushReceivedData];
+    
+    if (_delegateFlags.didReceiveEOF) {
+        [self.delegate channelDidReceiveEOF:self];
+    }
+}
+
+- (void)doReceiveClose {
+    if (_receivePaused) {
+        // freeing the raw channel now would drop what libssh kept, the stream would end short
+        _pendingClose = YES;
+        return;
+    }
+    
+    [self doCloseWithError:nil];
+}
+
 - (int)_didReceiveData:(NSData *)readData isSTDError:(BOOL)isSTDError {
     if (isSTDError) {
         if (self->_delegateFlags.didReadStderrData) {
@@ -116,62 +370,226 @@ static channel_callbacks s_null_channel_callbacks = {0};
         return;
     }
     
+    // immutable data is retained, not copied
+    data = [data copy];
+    
     __weak SSHKitChannel *weakSelf = self;
     
     [self.session dispatchAsyncOnSessionQueue:^{ @autoreleasepool {
         __strong SSHKitChannel *strongSelf = weakSelf;
-        
-        if (!strongSelf || strongSelf.stage != SSHKitChannelStageReady || !strongSelf.session.isConnected) {
-            // push data and wait for channel prepared
-            return_from_block;
+        [strongSelf doEnqueueData:data];
+    }}];
+}
+
+- (void)doEnqueueData:(NSData *)data {
+    NSAssert([self.session isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    if (self.stage == SSHKitChannelStageClosed || !(self.session.isConnected || self.session.isReconnecting)) {
+        return;
+    }
+    
+    // queue data and wait for channel prepared, or reopened after reconnecting
+    [_writeQueue addObject:data];
+    _queuedWriteBytes += data.length;
+    
+    if (!_writePaused && _queuedWriteBytes >= _writeQueueHighWatermark) {
+        _writePaused = YES;
+        if (_delegateFlags.writeQueueDidReachHighWatermark) {
+            [self.delegate channelWriteQueueDidReachHighWatermark:self];
         }
-        
-        strongSelf->_pendingWriteData = data;
-        
-        // do write if channel was opened
-        [strongSelf doWrite];
+    }
+    
+    // do write if channel was opened
+    if (self.stage == SSHKitChannelStageReady) {
+        [self doWrite];
+    }
+    
+    if (self.hasPendingWork) {
+        [self.session doScheduleChannel:self];
+    }
+}
+
+- (void)sendEOF {
+    __weak SSHKitChannel *weakSelf = self;
+    
+    [self.session dispatchAsyncOnSessionQueue:^{ @autoreleasepool {
+        __strong SSHKitChannel *strongSelf = weakSelf;
+        [strongSelf doSendEOF];
     }}];
 }
 
+- (void)doSendEOF {
+    NSAssert([self.session isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    _sendsEOFWhenDrained = YES;
+    
+    // sent right away if nothing is queued, otherwise once doWrite drains the queue
+    if (self.stage == SSHKitChannelStageReady) {
+        [self doWrite];
+    }
+}
+
+- (BOOL)hasPendingWork {
+    switch (self.stage) {
+        case SSHKitChannelStageOpening:
+            return YES;
+        case SSHKitChannelStageReady:
+            // waiting for remote window
+            return _writeQueue.count > 0;
+        default:
+            return NO;
+    }
+}
+
 NS_INLINE BOOL is_channel_writable(ssh_channel raw_channel) {
     return raw_channel && (ssh_channel_window_size(raw_channel) > 0);
 }
 
+/**
+ Small buffers are gathered into one SSH packet, instead of a packet for each of them.
+ Returns length of the gathered bytes, which are not consumed from queue.
+ */
+- (uint32_t)doGatherQueuedBytes:(uint32_t)maxLength {
+    if (!_gatherBuffer) {
+        _gatherBuffer = malloc(SSHKIT_CHANNEL_MAX_PACKET);
+    }
+    
+    uint32_t length = 0;
+    NSUInteger offset = _writeQueueOffset;
+    
+    for (NSData *data in _writeQueue) {
+        uint32_t chunk = (uint32_t)MIN(data.length - offset, maxLength - length);
+        memcpy(_gatherBuffer + length, (const char *)data.bytes + offset, chunk);
+        length += chunk;
+        offset = 0;
+        
+        if (length == maxLength) {
+            break;
+        }
+    }
+    
+    return length;
+}
+
+- (void)doConsumeQueuedBytes:(NSUInteger)length {
+    _queuedWriteBytes -= length;
+    
+    while (length) {
+        NSData *data = _writeQueue.firstObject;
+        NSUInteger remaining = data.length - _writeQueueOffset;
+        
+        if (length < remaining) {
+            _writeQueueOffset += length;
+            return;
+        }
+        
+        length -= remaining;
+        _writeQueueOffset = 0;
+        [_writeQueue removeObjectAtIndex:0];
+    }
+}
+
 - (void)doWrite {
     NSAssert([self.session isOnSessionQueue], @"Must be dispatched on session queue");
     
-    if ( !_pendingWriteData.length || !is_channel_writable(_rawChannel) ) {
-        return;
-    }
+    BOOL wroteAny = NO;
     
-    uint32_t datalen = (uint32_t)_pendingWriteData.length;
+    // drain as much as remote window allows
+    while ( _writeQueue.count && is_channel_writable(_rawChannel) ) {
+        NSData *head = _writeQueue.firstObject;
+        NSUInteger headLength = head.length - _writeQueueOffset;
+        const void *bytes = (const char *)head.bytes + _writeQueueOffset;
+        uint32_t datalen;
+        
+        if (headLength < SSHKIT_CHANNEL_MAX_PACKET && _writeQueue.count > 1) {
+            uint32_t maxLength = (uint32_t)MIN(MIN(_queuedWriteBytes, SSHKIT_CHANNEL_MAX_PACKET), ssh_channel_window_size(_rawChannel));
+            datalen = [self doGatherQueuedBytes:maxLength];
+            bytes = _gatherBuffer;
+        } else {
+            datalen = (uint32_t)MIN(headLength, UINT32_MAX);
+        }
+        
+        int wrote = ssh_channel_write(_rawChannel, bytes, datalen);
+        
+        if ( (wrote < 0) || (wrote>datalen) ) {
+            [self doCloseWithError:self.session.libsshError];
+            [self.session disconnectIfNeeded];
+            return;
+        }
+        
+        if (wrote==0) {
+            break;
+        }
+        
+        wroteAny = YES;
+        [self doConsumeQueuedBytes:wrote];
+        
+        // libssh splits a write into packets of at most remote max packet size
+        _sentBytes += wrote;
+        _sentPackets += (wrote + SSHKIT_CHANNEL_MAX_PACKET - 1) / SSHKIT_CHANNEL_MAX_PACKET;
+        
+        if (wrote!=datalen) {
+            // libssh will resize remote window, it's equivalent to E_AGAIN
+            break;
+        }
+    }
     
-    int wrote = ssh_channel_write(_rawChannel, _pendingWriteData.bytes, datalen);
+    if (wroteAny) {
+        _windowStalled = NO;
+    }
     
-    if ( (wrote < 0) || (wrote>datalen) ) {
-        [self doCloseWithError:self.session.libsshError];
-        [self.session disconnectIfNeeded];
-        return;
+    if (_writeQueue.count && !_windowStalled) {
+        // count once until window reopens
+        _windowStalled = YES;
+        _windowStalls++;
     }
     
-    if (wrote==0) {
-        return;
+    if (_sendsEOFWhenDrained && !_sentEOF && !_writeQueue.count && self.stage == SSHKitChannelStageReady) {
+        _sentEOF = YES;
+        ssh_channel_send_eof(_rawChannel);
     }
     
-    if (wrote!=datalen) {
-        // libssh will resize remote window, it's equivalent to E_AGAIN
-        _pendingWriteData = [_pendingWriteData subdataWithRange:NSMakeRange(wrote, datalen-wrote)];
+    if (!wroteAny) {
         return;
     }
     
-    // all data wrote
-    _pendingWriteData = nil;
+    if (_writePaused && _queuedWriteBytes <= _writeQueueLowWatermark) {
+        _writePaused = NO;
+        if (_delegateFlags.writeQueueDidDrainToLowWatermark) {
+            [self.delegate channelWriteQueueDidDrainToLowWatermark:self];
+        }
+    }
     
-    if (_delegateFlags.didWriteData) {
+    if (!_writeQueue.count && _delegateFlags.didWriteData) {
+        // all data wrote
         [self.delegate channelDidWriteData:self];
     }
 }
 
+#pragma mark - Metrics
+
+- (SSHKitChannelMetrics *)metrics {
+    __block SSHKitChannelMetrics *metrics = nil;
+    [self.session dispatchSyncOnSessionQueue:^{
+        metrics = [self doCollectMetrics];
+    }];
+    
+    return metrics;
+}
+
+- (SSHKitChannelMetrics *)doCollectMetrics {
+    SSHKitChannelMetrics *metrics = [[SSHKitChannelMetrics alloc] init];
+    metrics.bytesIn = _receivedBytes;
+    metrics.packetsIn = _receivedPackets;
+    metrics.bytesOut = _sentBytes;
+    metrics.packetsOut = _sentPackets;
+    metrics.queuedWriteBytes = _queuedWriteBytes;
+    metrics.windowStalls = _windowStalls;
+    metrics.receiveAllocationCount = _receiveAllocationCount;
+    
+    return metrics;
+}
+
 #pragma mark - Internal Utils
 
 - (void)_registerCallbacks {
@@ -211,6 +629,10 @@ NS_INLINE BOOL is_channel_writable(ssh_channel raw_channel) {
 
 #pragma mark - Properties
 
+- (BOOL)isSuspendable {
+    return YES;
+}
+
 - (BOOL)isOpen {
     __block BOOL flag = NO;
     [self.session dispatchSyncOnSessionQueue:^{
@@ -226,9 +648,13 @@ NS_INLINE BOOL is_channel_writable(ssh_channel raw_channel) {
         _delegateFlags.didReadStdoutData = [delegate respondsToSelector:@selector(channel:didReadStdoutData:)];
         _delegateFlags.didReadStderrData = [delegate respondsToSelector:@selector(channel:didReadStderrData:)];
         _delegateFlags.didWriteData = [delegate respondsToSelector:@selector(channelDidWriteData:)];
+        _delegateFlags.writeQueueDidReachHighWatermark = [delegate respondsToSelector:@selector(channelWriteQueueDidReachHighWatermark:)];
+        _delegateFlags.writeQueueDidDrainToLowWatermark = [delegate respondsToSelector:@selector(channelWriteQueueDidDrainToLowWatermark:)];
         _delegateFlags.didOpen = [delegate respondsToSelector:@selector(channelDidOpen:)];
         _delegateFlags.didCloseWithError = [delegate respondsToSelector:@selector(channelDidClose:withError:)];
         _delegateFlags.didChangePtySizeToColumnsRows = [delegate respondsToSelector:@selector(channel:didChangePtySizeToColumns:rows:withError:)];
+        _delegateFlags.didExitWithStatus = [delegate respondsToSelector:@selector(channel:didExitWithStatus:)];
+        _delegateFlags.didReceiveEOF = [delegate respondsToSelector:@selector(channelDidReceiveEOF:)];
     }
 }
 
@@ -245,23 +671,22 @@ static int channel_data_available(ssh_session session,
                                   int is_stderr,
                                   void *userdata) {
     SSHKitChannel *selfChannel = (__bridge SSHKitChannel *)userdata;
-    NSData *readData = [NSData dataWithBytes:data length:len];
     
-    return [selfChannel _didReceiveData:readData isSTDError:is_stderr];
+    return [selfChannel doReceiveBytes:data length:len isSTDError:is_stderr];
 }
 
 static void channel_close_received(ssh_session session,
                                    ssh_channel channel,
                                    void *userdata) {
     SSHKitChannel *selfChannel = (__bridge SSHKitChannel *)userdata;
-    [selfChannel doCloseWithError:nil];
+    [selfChannel doReceiveClose];
 }
 
 static void channel_eof_received(ssh_session session,
                                  ssh_channel channel,
                                  void *userdata) {
-    // SSHKitChannel *selfChannel = (__bridge SSHKitChannel *)userdata;
-    // TODO: call a new delegate here? i.e. channelDidReceiveEOF
+    SSHKitChannel *selfChannel = (__bridge SSHKitChannel *)userdata;
+    [selfChannel doReceiveEOF];
 }
 
 static void channel_exit_status(ssh_session session,
@@ -270,6 +695,13 @@ static void channel_exit_status(ssh_session session,
                                 void *userdata) {
     SSHKitChannel *selfChannel = (__bridge SSHKitChannel *)userdata;
     selfChannel->_exitStatus = exit_status;
+    
+    // output sent before exit status goes first
+    [selfChannel doFlushReceivedData];
+    
+    if (selfChannel->_delegateFlags.didExitWithStatus) {
+        [selfChannel.delegate channel:selfChannel didExitWithStatus:exit_status];
+    }
 }
 
 @end
@@ -0,0 +1,56 @@
+//
+//  SSHKitChannelPump.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+
+@class SSHKitChannel, SSHKitBufferPool;
+
+/** Called on session queue, error is nil once both directions reached EOF or the channel closed cleanly */
+typedef void(^SSHKitChannelPumpCompletionBlock)(NSError *error);
+
+/**
+ Tunnels a direct or forward channel to a local socket, copying bytes both ways on the session queue
+ without any delegate round trip.
+
+ Socket data is read into pooled buffers and queued on the channel as is, reads shorter than half a buffer
+ are copied so queued buffers hold at most twice the bytes the watermark counts. Reading stops while the
+ channel write queue is above its high watermark, which happens when the remote window is exhausted.
+ Channel data is written to the socket right away, what the socket does not take is kept and receiving
+ from the channel pauses once maxPendingBytes are kept, so the SSH window closes, until the socket drained
+ to maxPendingBytes / 4.
+
+ EOF is passed on in both directions, shutdown(SHUT_WR) on the socket for channel EOF and channel EOF
+ for socket EOF. The pump finishes once both directions ended, the channel closed, or the socket failed,
+ then closes channel and socket.
+
+ The pump becomes the channel delegate and keeps itself alive until it finished.
+ */
+@interface SSHKitChannelPump : NSObject
+
+/**
+ @param fd A connected stream socket, made non-blocking, owned by the pump
+ */
+- (instancetype)initWithChannel:(SSHKitChannel *)channel fileDescriptor:(int)fd;
+
+@property (nonatomic, readonly) SSHKitChannel *channel;
+@property (nonatomic, readonly) int fileDescriptor;
+
+/** Channel data the socket did not take yet before receiving pauses, default 1 MB */
+@property (nonatomic) NSUInteger maxPendingBytes;
+
+/** Buffers socket data is read into, default 64 KB buffers shared by all pumps */
+@property (nonatomic, strong) SSHKitBufferPool *bufferPool;
+
+/** Updated on session queue */
+@property (nonatomic, readonly) unsigned long long bytesToChannel;
+@property (nonatomic, readonly) unsigned long long bytesFromChannel;
+
+- (void)startWithCompletion:(SSHKitChannelPumpCompletionBlock)completion;
+
+/** Close channel and socket, completion is called with SSHKitErrorStop */
+- (void)stop;
+
+@end
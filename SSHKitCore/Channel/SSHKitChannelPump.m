@@ -0,0 +1,384 @@
+//
+//  SSHKitChannelPump.m
+//  SSHKitCore
+//
+
+#import "SSHKitChannelPump.h"
+#import "SSHKitCore+Protected.h"
+#import <fcntl.h>
+#import <unistd.h>
+
+#define PUMP_BUFFER_SIZE    (64 * 1024)
+
+static NSError *SSHKitPumpSocketError(int code) {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain
+                               code:code
+                           userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Tunnel socket failed: %s", strerror(code)] }];
+}
+
+@interface SSHKitChannelPump () <SSHKitChannelDelegate> {
+    dispatch_source_t   _readSource;
+    dispatch_source_t   _writeSource;
+    BOOL                _readSuspended;
+    BOOL                _writeSuspended;
+    NSUInteger          _liveSources;       // socket is closed once both sources are cancelled
+
+    // channel data the socket did not take yet, first one is written up to _pendingOffset
+    NSMutableArray<NSData *> *_pending;
+    NSUInteger          _pendingOffset;
+    NSUInteger          _pendingBytes;
+
+    BOOL                _started;
+    BOOL                _socketEOF;         // socket read end reached, EOF sent to channel
+    BOOL                _channelEOF;        // channel EOF received
+    BOOL                _socketShutdown;    // write side of socket shut down after channel EOF
+    BOOL                _channelClosed;
+    NSError             *_closeError;
+    BOOL                _finished;
+
+    SSHKitChannelPumpCompletionBlock _completion;
+    SSHKitChannelPump   *_retainedSelf;
+}
+
+@end
+
+@implementation SSHKitChannelPump
+
++ (SSHKitBufferPool *)sharedBufferPool {
+    static SSHKitBufferPool *sharedBufferPool = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedBufferPool = [[SSHKitBufferPool alloc] initWithBufferSize:PUMP_BUFFER_SIZE maxFreeBuffers:64];
+    });
+    return sharedBufferPool;
+}
+
+- (instancetype)initWithChannel:(SSHKitChannel *)channel fileDescriptor:(int)fd {
+    NSParameterAssert(channel && fd >= 0);
+
+    if ((self = [super init])) {
+        _channel = channel;
+        _fileDescriptor = fd;
+        _maxPendingBytes = 1024 * 1024;
+        _bufferPool = [SSHKitChannelPump sharedBufferPool];
+        _pending = [@[] mutableCopy];
+    }
+    return self;
+}
+
+#pragma mark - Start / Stop
+
+- (void)startWithCompletion:(SSHKitChannelPumpCompletionBlock)completion {
+    SSHKitSession *session = _channel.session;
+    if (!session) {
+        close(_fileDescriptor);
+        if (completion) {
+            completion([NSError errorWithDomain:SSHKitCoreErrorDomain
+                                           code:SSHKitErrorStop
+                                       userInfo:@{ NSLocalizedDescriptionKey : @"Session of tunnel is gone" }]);
+        }
+        return;
+    }
+
+    [session dispatchAsyncOnSessionQueue:^{ @autoreleasepool {
+        [self doStartWithCompletion:completion];
+    }}];
+}
+
+- (void)doStartWithCompletion:(SSHKitChannelPumpCompletionBlock)completion {
+    if (_started) {
+        return;
+    }
+
+    _started = YES;
+    _completion = [completion copy];
+    _retainedSelf = self;
+
+    [self doStartOnQueue:_channel.session.sessionQueue];
+}
+
+- (void)stop {
+    [_channel.session dispatchAsyncOnSessionQueue:^{ @autoreleasepool {
+        [self doFinishWithError:[NSError errorWithDomain:SSHKitCoreErrorDomain
+                                                    code:SSHKitErrorStop
+                                                userInfo:@{ NSLocalizedDescriptionKey : @"Tunnel stopped" }]];
+    }}];
+}
+
+- (void)doStartOnQueue:(dispatch_queue_t)queue {
+    int fd = _fileDescriptor;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    // fewer, larger writes to the socket
+    _channel.coalescesReceivedData = YES;
+    _channel.delegate = self;
+
+    _readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, fd, 0, queue);
+    _writeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, fd, 0, queue);
+    if (!_readSource || !_writeSource) {
+        _readSource = nil;
+        _writeSource = nil;
+        [self doFinishWithError:SSHKitPumpSocketError(ENOMEM)];
+        return;
+    }
+
+    dispatch_block_t cancelHandler = ^{
+        if (--_liveSources == 0) {
+            close(fd);
+        }
+    };
+    _liveSources = 2;
+
+    dispatch_source_set_event_handler(_readSource, ^{ @autoreleasepool {
+        [self doReadSocket];
+    }});
+    dispatch_source_set_cancel_handler(_readSource, cancelHandler);
+
+    dispatch_source_set_event_handler(_writeSource, ^{ @autoreleasepool {
+        [self doWriteSocket];
+    }});
+    dispatch_source_set_cancel_handler(_writeSource, cancelHandler);
+
+    // write source waits for data the socket could not take
+    _writeSuspended = YES;
+    dispatch_resume(_readSource);
+
+    if (_channel.stage == SSHKitChannelStageClosed) {
+        _channelClosed = YES;
+        [self doFinishIfNeeded];
+    }
+}
+
+- (void)doFinishWithError:(NSError *)error {
+    if (_finished || !_started) {
+        return;
+    }
+
+    _finished = YES;
+
+    // sources must not be released suspended
+    if (_readSource) {
+        if (_readSuspended) {
+            dispatch_resume(_readSource);
+        }
+        if (_writeSuspended) {
+            dispatch_resume(_writeSource);
+        }
+        dispatch_source_cancel(_readSource);
+        dispatch_source_cancel(_writeSource);
+        _readSource = nil;
+        _writeSource = nil;
+    } else {
+        close(_fileDescriptor);
+    }
+
+    [_pending removeAllObjects];
+    _pendingBytes = 0;
+
+    if (_channel.delegate == self) {
+        _channel.delegate = nil;
+    }
+    if (_channel.stage != SSHKitChannelStageClosed) {
+        [_channel doCloseWithError:nil];
+    }
+
+    SSHKitChannelPumpCompletionBlock completion = _completion;
+    _completion = nil;
+    if (completion) {
+        completion(error);
+    }
+
+    _retainedSelf = nil;
+}
+
+/** Both directions ended, or channel closed and everything it sent reached the socket */
+- (void)doFinishIfNeeded {
+    if (_pending.count) {
+        return;
+    }
+
+    if (_channelClosed) {
+        [self doFinishWithError:_closeError];
+        return;
+    }
+
+    if (_socketEOF && _socketShutdown && !_channel.queuedWriteBytes) {
+        [self doFinishWithError:nil];
+    }
+}
+
+#pragma mark - Socket to Channel
+
+- (void)doReadSocket {
+    if (_finished || _readSuspended) {
+        return;
+    }
+
+    void *buffer = [_bufferPool takeBuffer];
+    ssize_t length = read(_fileDescriptor, buffer, _bufferPool.bufferSize);
+
+    if (length > 0) {
+        _bytesToChannel += length;
+
+        if ((NSUInteger)length < _bufferPool.bufferSize / 2) {
+            // watermark counts payload only, a short read must not pin a whole buffer while the window is stalled
+            [_channel doEnqueueData:[NSData dataWithBytes:buffer length:length]];
+            [_bufferPool recycleBuffer:buffer];
+        } else {
+            // pooled buffer is queued as is and goes back to the pool once written
+            [_channel doEnqueueData:[_bufferPool dataWithBuffer:buffer length:length]];
+        }
+
+        if (_channel.queuedWriteBytes >= _channel.writeQueueHighWatermark) {
+            // remote window is full, resumed by channelWriteQueueDidDrainToLowWatermark:
+            [self doSuspendReading];
+        }
+        return;
+    }
+
+    [_bufferPool recycleBuffer:buffer];
+
+    if (length == 0) {
+        _socketEOF = YES;
+        [self doSuspendReading];
+        [_channel doSendEOF];
+        [self doFinishIfNeeded];
+        return;
+    }
+
+    if (errno != EAGAIN && errno != EINTR) {
+        [self doFinishWithError:SSHKitPumpSocketError(errno)];
+    }
+}
+
+- (void)doSuspendReading {
+    if (!_readSuspended) {
+        _readSuspended = YES;
+        dispatch_suspend(_readSource);
+    }
+}
+
+#pragma mark - Channel to Socket
+
+- (void)doWriteData:(NSData *)data {
+    if (_finished || _socketShutdown) {
+        return;
+    }
+
+    _bytesFromChannel += data.length;
+
+    NSUInteger written = 0;
+    if (!_pending.count) {
+        ssize_t result = write(_fileDescriptor, data.bytes, data.length);
+        if (result < 0 && errno != EAGAIN && errno != EINTR) {
+            [self doFinishWithError:SSHKitPumpSocketError(errno)];
+            return;
+        }
+
+        written = result > 0 ? (NSUInteger)result : 0;
+        if (written == data.length) {
+            return;
+        }
+
+        _pendingOffset = written;
+    }
+
+    [_pending addObject:data];
+    _pendingBytes += data.length - written;
+
+    if (_writeSuspended) {
+        _writeSuspended = NO;
+        dispatch_resume(_writeSource);
+    }
+
+    if (_pendingBytes >= _maxPendingBytes && !_channel.receivePaused) {
+        // libssh keeps what follows and stops opening the window
+        [_channel doPauseReceiving];
+    }
+}
+
+- (void)doWriteSocket {
+    if (_finished) {
+        return;
+    }
+
+    while (_pending.count) {
+        NSData *head = _pending.firstObject;
+        ssize_t result = write(_fileDescriptor, (const char *)head.bytes + _pendingOffset, head.length - _pendingOffset);
+
+        if (result < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                [self doFinishWithError:SSHKitPumpSocketError(errno)];
+                return;
+            }
+            break;
+        }
+
+        _pendingBytes -= result;
+        _pendingOffset += result;
+        if (_pendingOffset < head.length) {
+            continue;
+        }
+
+        _pendingOffset = 0;
+        [_pending removeObjectAtIndex:0];
+    }
+
+    if (!_pending.count && !_writeSuspended) {
+        _writeSuspended = YES;
+        dispatch_suspend(_writeSource);
+    }
+
+    if (_channel.receivePaused && !_channelClosed && _pendingBytes <= _maxPendingBytes / 4) {
+        // drained to low watermark, delivers what libssh kept, may fill the socket again
+        [_channel doResumeReceiving];
+    }
+
+    [self doShutdownSocketIfNeeded];
+    [self doFinishIfNeeded];
+}
+
+- (void)doShutdownSocketIfNeeded {
+    if (_channelEOF && !_socketShutdown && !_pending.count && !_finished) {
+        _socketShutdown = YES;
+        shutdown(_fileDescriptor, SHUT_WR);
+    }
+}
+
+#pragma mark - SSHKitChannelDelegate
+
+- (void)channel:(SSHKitChannel *)channel didReadStdoutData:(NSData *)data {
+    [self doWriteData:data];
+}
+
+- (void)channelDidReceiveEOF:(SSHKitChannel *)channel {
+    _channelEOF = YES;
+    [self doShutdownSocketIfNeeded];
+    [self doFinishIfNeeded];
+}
+
+- (void)channelWriteQueueDidDrainToLowWatermark:(SSHKitChannel *)channel {
+    if (_readSuspended && !_socketEOF && !_finished) {
+        _readSuspended = NO;
+        dispatch_resume(_readSource);
+    }
+}
+
+- (void)channelDidWriteData:(SSHKitChannel *)channel {
+    // channel EOF was sent once the last of the socket data left
+    [self doFinishIfNeeded];
+}
+
+- (void)channelDidClose:(SSHKitChannel *)channel withError:(NSError *)error {
+    _channelClosed = YES;
+    _closeError = error;
+
+    // what channel sent before closing still goes to the socket
+    [self doFinishIfNeeded];
+}
+
+@end
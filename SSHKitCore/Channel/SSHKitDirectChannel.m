@@ -21,6 +21,11 @@
     return self;
 }
 
+- (BOOL)isSuspendable {
+    // reopening makes a new TCP connection on the target, the rest of the stream would make no sense to it
+    return self.stage != SSHKitChannelStageReady;
+}
+
 - (void)doOpen {
     NSAssert([self.session isOnSessionQueue], @"Must be dispatched on session queue");
     
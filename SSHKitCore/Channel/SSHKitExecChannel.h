@@ -0,0 +1,21 @@
+//
+//  SSHKitExecChannel.h
+//  SSHKitCore
+//
+
+#import <SSHKitCore/SSHKitCoreCommon.h>
+#import "SSHKitChannel.h"
+
+/**
+ Runs one command without a pty, stdout and stderr arrive separately through channel:didReadStdoutData:
+ and channel:didReadStderrData:, then channel:didExitWithStatus: and channelDidClose:withError:.
+ Commands reading stdin until its end get it by writeData: followed by sendEOF.
+
+ Unlike a shell channel, an exec channel is not opened again after the session reconnects once the
+ command was sent, it is closed with the error that dropped the connection.
+ */
+@interface SSHKitExecChannel : SSHKitChannel
+
+@property (readonly, copy) NSString *command;
+
+@end
@@ -0,0 +1,106 @@
+//
+//  SSHKitExecChannel.m
+//  SSHKitCore
+//
+
+#import "SSHKitExecChannel.h"
+#import "SSHKitSession.h"
+#import "SSHKitCore+Protected.h"
+
+typedef NS_ENUM(NSUInteger, ExecChannelReqState) {
+    ExecChannelReqNone = 0,     // session channel has not been opened yet
+    ExecChannelReqExec,         // is requesting exec
+};
+
+@interface SSHKitExecChannel ()
+
+@property (nonatomic) ExecChannelReqState reqState;
+
+@end
+
+@implementation SSHKitExecChannel
+
+- (instancetype)initWithSession:(SSHKitSession *)session command:(NSString *)command delegate:(id<SSHKitChannelDelegate>)aDelegate {
+    if (self=[super initWithSession:session delegate:aDelegate]) {
+        _command = [command copy];
+        _reqState = ExecChannelReqNone;
+    }
+    
+    return self;
+}
+
+- (void)doOpen {
+    switch (self.reqState) {
+        case ExecChannelReqNone:
+            // 1. open session channel
+            [self _openSession];
+            break;
+            
+        case ExecChannelReqExec:
+            // 2. request exec
+            [self _requestExec];
+            break;
+    }
+}
+
+- (void)_openSession {
+    int result = ssh_channel_open_session(self.rawChannel);
+    
+    switch (result) {
+        case SSH_AGAIN:
+            // try next time
+            break;
+            
+        case SSH_OK:
+            // succeed, requests exec
+            self.reqState = ExecChannelReqExec;
+            [self _requestExec];
+            break;
+            
+        default:
+            // open failed
+            [self doCloseWithError:self.session.libsshError];
+            [self.session disconnectIfNeeded];
+            break;
+    }
+}
+
+- (void)_requestExec {
+    int result = ssh_channel_request_exec(self.rawChannel, _command.UTF8String);
+    
+    switch (result) {
+        case SSH_AGAIN:
+            // try next time
+            break;
+            
+        case SSH_OK:
+            // succeed, mark channel ready, reqState stays to tell command was sent
+            self.stage = SSHKitChannelStageReady;
+            if (_delegateFlags.didOpen) {
+                [self.delegate channelDidOpen:self];
+            }
+            
+            // flush data and EOF queued while channel was opening
+            [self doWrite];
+            break;
+            
+        default:
+            // exec failed
+            [self doCloseWithError:self.session.libsshError];
+            [self.session disconnectIfNeeded];
+            break;
+    }
+}
+
+- (BOOL)isSuspendable {
+    // running a command twice is not what caller asked for
+    return self.reqState == ExecChannelReqNone;
+}
+
+- (void)doSuspend {
+    [super doSuspend];
+    
+    self.reqState = ExecChannelReqNone;
+}
+
+@end
@@ -24,4 +24,9 @@
     // do nothing, forwarded-tcpip channel is created when remote server response a global channel request
 }
 
+- (BOOL)isSuspendable {
+    // forward channels belong to the connection, peer of the others waits for them
+    return NO;
+}
+
 @end
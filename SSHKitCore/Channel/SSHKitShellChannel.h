@@ -25,4 +25,8 @@
 @required
 - (void)channel:(SSHKitShellChannel *)channel didChangePtySizeToColumns:(NSInteger)columns rows:(NSInteger)rows withError:(NSError *)error;
 
+@optional
+/** Written data was dropped because the session reconnected, the new shell never sees it */
+- (void)channel:(SSHKitShellChannel *)channel didDiscardUnsentBytes:(NSUInteger)length;
+
 @end
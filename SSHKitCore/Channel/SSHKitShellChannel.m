@@ -81,6 +81,33 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     }
 }
 
+- (void)doSuspend {
+    [super doSuspend];
+    
+    // a new shell is requested from the start
+    self.reqState = SessionChannelReqNone;
+    
+    // rest of a half sent command would run as a fragment in a shell of another state
+    [self doDiscardUnsentData];
+}
+
+- (void)doEnqueueData:(NSData *)data {
+    [super doEnqueueData:data];
+    
+    // keystrokes typed while reconnecting follow input the old shell may or may not have got
+    if (self.session.isReconnecting && self.reqState == SessionChannelReqNone) {
+        [self doDiscardUnsentData];
+    }
+}
+
+- (void)doDiscardUnsentData {
+    NSUInteger discarded = [self doDiscardWriteQueue];
+    
+    if (discarded && [self.delegate respondsToSelector:@selector(channel:didDiscardUnsentBytes:)]) {
+        [self.delegate channel:self didDiscardUnsentBytes:discarded];
+    }
+}
+
 - (struct termios)termio_build_termdata:(BOOL) isUTF8 {
     struct termios term = { 0 };
     
@@ -0,0 +1,36 @@
+//
+//  SSHKitSFTPAttributeCache.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Thread safe cache of remote attributes, symlink targets and canonical paths, set on a SSHKitSFTPChannel
+ to answer repeated stat/exists checks without network round trips.
+
+ Filled by stats and directory listings of the channel, and invalidated by its own rename:, unlink:,
+ mkdir:, rmdir:, chmod:, symlink: and file writes. Changes made by other clients are only noticed
+ once entries expire, call invalidatePath: if you know better.
+ */
+@interface SSHKitSFTPAttributeCache : NSObject
+
+- (instancetype)initWithTimeToLive:(NSTimeInterval)timeToLive;
+
+/** Seconds an entry stays valid */
+@property (nonatomic, readonly) NSTimeInterval timeToLive;
+/** Entries kept per kind of lookup, expired entries are dropped first when exceeded. Default 10000 */
+@property (nonatomic) NSUInteger maxEntries;
+
+/** Lookups answered from cache, including cached "no such file" answers */
+@property (nonatomic, readonly) NSUInteger hitCount;
+/** Lookups that went to server */
+@property (nonatomic, readonly) NSUInteger missCount;
+/** Entries currently cached */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** Forget path, its parent directory and everything below it */
+- (void)invalidatePath:(NSString *)path;
+- (void)removeAllEntries;
+
+@end
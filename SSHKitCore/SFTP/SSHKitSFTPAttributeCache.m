@@ -0,0 +1,214 @@
+//
+//  SSHKitSFTPAttributeCache.m
+//  SSHKitCore
+//
+
+#import "SSHKitSFTPAttributeCache.h"
+#import "SSHKitCore+Protected.h"
+#import <pthread.h>
+#import <sys/stat.h>
+
+// "./a//b/" and "./a/b" are the same remote path
+static NSString *SSHKitSFTPCacheKey(NSString *path) {
+    if (!path.length) {
+        return @"";
+    }
+    return [NSString pathWithComponents:path.pathComponents];
+}
+
+/** A cached value, NSValue of SSHKitSFTPDirectoryEntry, NSString, or NSNull for a missing path */
+@interface SSHKitSFTPCacheRecord : NSObject {
+@public
+    id _value;
+    CFAbsoluteTime _expiresAt;
+}
+@end
+
+@implementation SSHKitSFTPCacheRecord
+@end
+
+@implementation SSHKitSFTPAttributeCache {
+    pthread_mutex_t _mutex;
+
+    NSMutableDictionary<NSString *, SSHKitSFTPCacheRecord *> *_attributes;         // lstat
+    NSMutableDictionary<NSString *, SSHKitSFTPCacheRecord *> *_targetAttributes;   // stat, follows symlinks
+    NSMutableDictionary<NSString *, SSHKitSFTPCacheRecord *> *_linkTargets;
+    NSMutableDictionary<NSString *, SSHKitSFTPCacheRecord *> *_canonicalPaths;
+}
+
+- (instancetype)initWithTimeToLive:(NSTimeInterval)timeToLive {
+    if ((self = [super init])) {
+        _timeToLive = timeToLive;
+        _maxEntries = 10000;
+
+        _attributes = [@{} mutableCopy];
+        _targetAttributes = [@{} mutableCopy];
+        _linkTargets = [@{} mutableCopy];
+        _canonicalPaths = [@{} mutableCopy];
+
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_mutex);
+}
+
+- (NSUInteger)count {
+    pthread_mutex_lock(&_mutex);
+    NSUInteger count = _attributes.count + _targetAttributes.count + _linkTargets.count + _canonicalPaths.count;
+    pthread_mutex_unlock(&_mutex);
+
+    return count;
+}
+
+#pragma mark - Records
+
+- (id)lookupValueInTable:(NSMutableDictionary *)table path:(NSString *)path {
+    NSString *key = SSHKitSFTPCacheKey(path);
+    id value = nil;
+
+    pthread_mutex_lock(&_mutex);
+    SSHKitSFTPCacheRecord *record = table[key];
+    if (record && record->_expiresAt < CFAbsoluteTimeGetCurrent()) {
+        [table removeObjectForKey:key];
+        record = nil;
+    }
+
+    if (record) {
+        value = record->_value;
+        _hitCount++;
+    } else {
+        _missCount++;
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    return value;
+}
+
+- (void)storeValue:(id)value inTable:(NSMutableDictionary *)table path:(NSString *)path {
+    SSHKitSFTPCacheRecord *record = [[SSHKitSFTPCacheRecord alloc] init];
+    record->_value = value;
+    record->_expiresAt = CFAbsoluteTimeGetCurrent() + _timeToLive;
+
+    pthread_mutex_lock(&_mutex);
+    if (table.count >= _maxEntries) {
+        [self purgeTable:table];
+    }
+    table[SSHKitSFTPCacheKey(path)] = record;
+    pthread_mutex_unlock(&_mutex);
+}
+
+/** Called with mutex held */
+- (void)purgeTable:(NSMutableDictionary *)table {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSMutableArray *expiredKeys = [@[] mutableCopy];
+
+    [table enumerateKeysAndObjectsUsingBlock:^(NSString *key, SSHKitSFTPCacheRecord *record, BOOL *stop) {
+        if (record->_expiresAt < now) {
+            [expiredKeys addObject:key];
+        }
+    }];
+    [table removeObjectsForKeys:expiredKeys];
+
+    if (table.count >= _maxEntries) {
+        [table removeAllObjects];
+    }
+}
+
+#pragma mark - Lookups
+
+- (BOOL)lookupAttributes:(SSHKitSFTPDirectoryEntry *)entry path:(NSString *)path followLinks:(BOOL)followLinks exists:(BOOL *)exists {
+    id value = [self lookupValueInTable:(followLinks ? _targetAttributes : _attributes) path:path];
+    if (!value) {
+        return NO;
+    }
+
+    *exists = value != [NSNull null];
+    if (*exists) {
+        [value getValue:entry];
+    }
+
+    return YES;
+}
+
+- (void)storeAttributes:(const SSHKitSFTPDirectoryEntry *)entry path:(NSString *)path followLinks:(BOOL)followLinks {
+    SSHKitSFTPDirectoryEntry copy = *entry;
+    copy.name = NULL;
+    copy.nameLength = 0;
+
+    NSValue *value = [NSValue valueWithBytes:&copy objCType:@encode(SSHKitSFTPDirectoryEntry)];
+    [self storeValue:value inTable:(followLinks ? _targetAttributes : _attributes) path:path];
+
+    // a regular file or directory is its own target
+    if (!followLinks && !S_ISLNK(entry->permissions)) {
+        [self storeValue:value inTable:_targetAttributes path:path];
+    }
+}
+
+- (void)storeMissingPath:(NSString *)path {
+    [self storeValue:[NSNull null] inTable:_attributes path:path];
+    [self storeValue:[NSNull null] inTable:_targetAttributes path:path];
+}
+
+- (void)storeDirectoryEntries:(SSHKitSFTPDirectoryEntries *)entries {
+    for (NSUInteger i = 0; i < entries.count; i++) {
+        const SSHKitSFTPDirectoryEntry *entry = &entries.entries[i];
+        if (!strcmp(entry->name, ".") || !strcmp(entry->name, "..")) {
+            continue;
+        }
+
+        [self storeAttributes:entry path:[entries.parentPath stringByAppendingPathComponent:[entries nameAtIndex:i]] followLinks:NO];
+    }
+}
+
+- (NSString *)lookupLinkTarget:(NSString *)path {
+    return [self lookupValueInTable:_linkTargets path:path];
+}
+
+- (void)storeLinkTarget:(NSString *)target path:(NSString *)path {
+    [self storeValue:[target copy] inTable:_linkTargets path:path];
+}
+
+- (NSString *)lookupCanonicalPath:(NSString *)path {
+    return [self lookupValueInTable:_canonicalPaths path:path];
+}
+
+- (void)storeCanonicalPath:(NSString *)canonicalPath path:(NSString *)path {
+    [self storeValue:[canonicalPath copy] inTable:_canonicalPaths path:path];
+}
+
+#pragma mark - Invalidation
+
+- (void)invalidatePath:(NSString *)path {
+    NSString *key = SSHKitSFTPCacheKey(path);
+    NSString *parentKey = SSHKitSFTPCacheKey(key.stringByDeletingLastPathComponent);
+    NSString *prefix = [key hasSuffix:@"/"] ? key : [key stringByAppendingString:@"/"];
+
+    pthread_mutex_lock(&_mutex);
+    NSMutableArray *keys = [@[key, parentKey] mutableCopy];
+    for (NSString *cachedKey in _attributes) {
+        if ([cachedKey hasPrefix:prefix]) {
+            [keys addObject:cachedKey];
+        }
+    }
+    [_attributes removeObjectsForKeys:keys];
+
+    // symlinks anywhere may lead here, resolved answers can't be trusted any more
+    [_targetAttributes removeAllObjects];
+    [_linkTargets removeAllObjects];
+    [_canonicalPaths removeAllObjects];
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (void)removeAllEntries {
+    pthread_mutex_lock(&_mutex);
+    [_attributes removeAllObjects];
+    [_targetAttributes removeAllObjects];
+    [_linkTargets removeAllObjects];
+    [_canonicalPaths removeAllObjects];
+    pthread_mutex_unlock(&_mutex);
+}
+
+@end
@@ -0,0 +1,45 @@
+//
+//  SSHKitSFTPChannel+Batch.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+#import "SSHKitSFTPChannel.h"
+
+/** Called on session queue once every request is answered. Maps each failed path to its error, paths not in it succeeded */
+typedef void(^SSHKitSFTPBatchCompletionBlock)(NSDictionary<NSString *, NSError *> *errors);
+
+/**
+ Metadata operations on many paths at once. Requests are sent without waiting for each other's reply,
+ a round trip is paid per dependency level instead of per path.
+ */
+@interface SSHKitSFTPChannel (Batch)
+
+// -----------------------------------------------------------------------------
+#pragma mark Batch Requests
+// -----------------------------------------------------------------------------
+
+/** Paths are independent of each other, they are processed in no particular order */
+- (void)unlinkPaths:(NSArray<NSString *> *)paths completion:(SSHKitSFTPBatchCompletionBlock)completion;
+- (void)rmdirPaths:(NSArray<NSString *> *)paths completion:(SSHKitSFTPBatchCompletionBlock)completion;
+- (void)mkdirPaths:(NSArray<NSString *> *)paths mode:(unsigned long)mode completion:(SSHKitSFTPBatchCompletionBlock)completion;
+- (void)chmodPaths:(NSArray<NSString *> *)paths mode:(unsigned long)mode completion:(SSHKitSFTPBatchCompletionBlock)completion;
+
+/** Keys are original paths, values new names. Errors are keyed by original path */
+- (void)renamePaths:(NSDictionary<NSString *, NSString *> *)paths completion:(SSHKitSFTPBatchCompletionBlock)completion;
+
+// -----------------------------------------------------------------------------
+#pragma mark Recursive Operations
+// -----------------------------------------------------------------------------
+
+/** rm -rf, children are removed before their directory, symlinks are removed, never followed */
+- (void)removeItemRecursivelyAtPath:(NSString *)path completion:(SSHKitSFTPBatchCompletionBlock)completion;
+
+/** mkdir -p, parents are created before their children, existing directories are not an error */
+- (void)createDirectoriesAtPaths:(NSArray<NSString *> *)paths mode:(unsigned long)mode completion:(SSHKitSFTPBatchCompletionBlock)completion;
+
+/** chmod -R, a directory is changed before it is listed, symlinks are skipped */
+- (void)chmodRecursivelyAtPath:(NSString *)path mode:(unsigned long)mode completion:(SSHKitSFTPBatchCompletionBlock)completion;
+
+@end
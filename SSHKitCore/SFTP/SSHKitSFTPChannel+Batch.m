@@ -0,0 +1,495 @@
+//
+//  SSHKitSFTPChannel+Batch.m
+//  SSHKitCore
+//
+
+#import "SSHKitSFTPChannel+Batch.h"
+#import "SSHKitCore+Protected.h"
+#import <sys/stat.h>
+
+// requests in flight per batch, bounds memory taken by a huge tree and leaves room to other users of the channel
+#define SFTP_BATCH_CONCURRENT_REQ_COUNT 64
+
+typedef BOOL (^SSHKitSFTPRequestFields)(ssh_buffer buffer);
+typedef void (^SSHKitSFTPBatchStatusBlock)(NSError *error);
+
+static SSHKitSFTPRequestFields sftp_path_fields(NSString *path) {
+    return ^BOOL(ssh_buffer buffer) {
+        return sftp_buffer_add_cstring(buffer, path.UTF8String);
+    };
+}
+
+// MKDIR and SETSTAT carry the same fields
+static SSHKitSFTPRequestFields sftp_path_mode_fields(NSString *path, unsigned long mode) {
+    return ^BOOL(ssh_buffer buffer) {
+        return sftp_buffer_add_cstring(buffer, path.UTF8String)
+            && sftp_buffer_add_u32(buffer, SSH_FILEXFER_ATTR_PERMISSIONS)
+            && sftp_buffer_add_u32(buffer, (uint32_t)mode);
+    };
+}
+
+NS_INLINE BOOL sftp_is_dot_entry(const SSHKitSFTPDirectoryEntry *entry) {
+    return !strcmp(entry->name, ".") || !strcmp(entry->name, "..");
+}
+
+#pragma mark - SSHKitSFTPBatch
+
+/**
+ Requests of one batch call. Sends at most SFTP_BATCH_CONCURRENT_REQ_COUNT at once, the rest wait in
+ order. Completion fires once nothing is in flight, waiting or about to be added.
+ */
+@interface SSHKitSFTPBatch : NSObject
+
+- (instancetype)initWithChannel:(SSHKitSFTPChannel *)channel completion:(SSHKitSFTPBatchCompletionBlock)completion;
+
+- (void)beginWork;
+- (void)endWork;
+
+- (void)setError:(NSError *)error forPath:(NSString *)path;
+
+- (void)sendStatusRequest:(uint8_t)type path:(NSString *)path fields:(SSHKitSFTPRequestFields)fields completion:(SSHKitSFTPBatchStatusBlock)completion;
+- (void)lstatPath:(NSString *)path completion:(void (^)(uint32_t permissions, NSError *error))completion;
+
+- (void)removeItemAtPath:(NSString *)path completion:(SSHKitSFTPBatchStatusBlock)completion;
+- (void)chmodItemAtPath:(NSString *)path permissions:(uint32_t)permissions mode:(unsigned long)mode;
+- (void)createDirectoriesInLevels:(NSArray<NSOrderedSet *> *)levels index:(NSUInteger)index mode:(unsigned long)mode failedPaths:(NSMutableSet *)failedPaths;
+
+@end
+
+@implementation SSHKitSFTPBatch {
+    __weak SSHKitSFTPChannel *_channel;
+    SSHKitSFTPBatchCompletionBlock _completion;
+    NSMutableDictionary<NSString *, NSError *> *_errors;
+
+    NSMutableArray<dispatch_block_t> *_waitingRequests;
+    NSUInteger _requestsInFlight;
+    NSUInteger _work;
+}
+
+- (instancetype)initWithChannel:(SSHKitSFTPChannel *)channel completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    if ((self = [super init])) {
+        _channel = channel;
+        _completion = [completion copy];
+        _errors = [@{} mutableCopy];
+        _waitingRequests = [@[] mutableCopy];
+    }
+    return self;
+}
+
+- (void)beginWork {
+    _work++;
+}
+
+- (void)endWork {
+    NSAssert(_work, @"Unbalanced endWork");
+
+    if (--_work || !_completion) {
+        return;
+    }
+
+    SSHKitSFTPBatchCompletionBlock completion = _completion;
+    _completion = nil;
+    completion([_errors copy]);
+}
+
+- (void)setError:(NSError *)error forPath:(NSString *)path {
+    if (!_errors[path]) {
+        _errors[path] = error;
+    }
+}
+
+#pragma mark Requests
+
+/** Reply handler is always called, with SSH_FXP_STATUS and NULL payload if request could not be sent */
+- (void)sendRequest:(uint8_t)type fields:(SSHKitSFTPRequestFields)fields replyHandler:(SSHKitSFTPReplyHandler)replyHandler {
+    [self beginWork];
+
+    // blocks keep the batch alive until its last reply
+    dispatch_block_t send = ^{
+        SSHKitSFTPChannel *channel = self->_channel;
+
+        self->_requestsInFlight++;
+        int rc = channel ? [channel doSendRequest:type fields:fields replyHandler:^(uint8_t replyType, ssh_buffer payload) {
+            self->_requestsInFlight--;
+            replyHandler(replyType, payload);
+            [self sendWaitingRequests];
+            [self endWork];
+        }] : SSH_ERROR;
+
+        if (rc < 0) {
+            self->_requestsInFlight--;
+            replyHandler(SSH_FXP_STATUS, NULL);
+            [self endWork];
+        }
+    };
+
+    if (_requestsInFlight < SFTP_BATCH_CONCURRENT_REQ_COUNT) {
+        send();
+    } else {
+        [_waitingRequests addObject:send];
+    }
+}
+
+- (void)sendWaitingRequests {
+    while (_requestsInFlight < SFTP_BATCH_CONCURRENT_REQ_COUNT && _waitingRequests.count) {
+        dispatch_block_t send = _waitingRequests.firstObject;
+        [_waitingRequests removeObjectAtIndex:0];
+        send();
+    }
+}
+
+- (NSError *)errorFromReply:(uint8_t)type payload:(ssh_buffer)payload {
+    if (!payload || !_channel) {
+        return [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                                   code:SSHKitSFTPErrorCodeConnectionLost
+                               userInfo:@{ NSLocalizedDescriptionKey : @"SFTP channel closed" }];
+    }
+
+    return [_channel errorFromStatusPayload:(type == SSH_FXP_STATUS ? payload : NULL)];
+}
+
+/** Request answered by a status, a failure is recorded under path */
+- (void)sendStatusRequest:(uint8_t)type path:(NSString *)path fields:(SSHKitSFTPRequestFields)fields completion:(SSHKitSFTPBatchStatusBlock)completion {
+    [self sendRequest:type fields:fields replyHandler:^(uint8_t replyType, ssh_buffer payload) {
+        NSError *error = [self errorFromReply:replyType payload:payload];
+        if (error) {
+            [self setError:error forPath:path];
+        }
+        if (completion) {
+            completion(error);
+        }
+    }];
+}
+
+/** Failure is not recorded, callers decide whether it is one */
+- (void)lstatPath:(NSString *)path completion:(void (^)(uint32_t permissions, NSError *error))completion {
+    [self sendRequest:SSH_FXP_LSTAT fields:sftp_path_fields(path) replyHandler:^(uint8_t type, ssh_buffer payload) {
+        if (type != SSH_FXP_ATTRS || !payload) {
+            completion(0, [self errorFromReply:type payload:payload]);
+            return_from_block;
+        }
+
+        sftp_attributes attributes = sftp_parse_attr(self->_channel.rawSFTPSession, payload, 0);
+        if (!attributes) {
+            completion(0, [self errorFromReply:SSH_FXP_ATTRS payload:payload]);
+            return_from_block;
+        }
+
+        uint32_t permissions = attributes->permissions;
+        [SSHKitSFTPChannel freeSFTPAttributes:attributes];
+        completion(permissions, nil);
+    }];
+}
+
+#pragma mark Directory Walking
+
+/** Entries are delivered as they arrive, next READDIR is already sent so listing goes on while they are handled */
+- (void)walkDirectory:(NSString *)path entries:(void (^)(SSHKitSFTPDirectoryEntries *entries))entriesBlock completion:(SSHKitSFTPBatchStatusBlock)completion {
+    [self sendRequest:SSH_FXP_OPENDIR fields:sftp_path_fields(path) replyHandler:^(uint8_t type, ssh_buffer payload) {
+        ssh_string handle = (type == SSH_FXP_HANDLE && payload) ? sftp_buffer_get_string(payload) : NULL;
+        if (!handle) {
+            NSError *error = [self errorFromReply:type payload:payload];
+            [self setError:error forPath:path];
+            completion(error);
+            return_from_block;
+        }
+
+        [self readDirectory:path handle:handle entries:entriesBlock completion:completion];
+    }];
+}
+
+- (void)readDirectory:(NSString *)path handle:(ssh_string)handle entries:(void (^)(SSHKitSFTPDirectoryEntries *entries))entriesBlock completion:(SSHKitSFTPBatchStatusBlock)completion {
+    [self sendRequest:SSH_FXP_READDIR fields:^BOOL(ssh_buffer buffer) {
+        return sftp_buffer_add_string(buffer, handle);
+    } replyHandler:^(uint8_t type, ssh_buffer payload) {
+        NSError *error = nil;
+
+        if (type == SSH_FXP_NAME && payload) {
+            SSHKitSFTPDirectoryEntries *entries = [[SSHKitSFTPDirectoryEntries alloc] initWithPayload:payload channel:self->_channel parentPath:path];
+            if (entries) {
+                [self readDirectory:path handle:handle entries:entriesBlock completion:completion];
+                entriesBlock(entries);
+                return_from_block;
+            }
+            error = [self errorFromReply:SSH_FXP_NAME payload:payload];
+        } else {
+            error = [self errorFromReply:type payload:payload];
+            if (error.code == SSHKitSFTPErrorCodeEOF) {
+                error = nil;
+            }
+        }
+
+        [self closeHandle:handle];
+        if (error) {
+            [self setError:error forPath:path];
+        }
+        completion(error);
+    }];
+}
+
+- (void)closeHandle:(ssh_string)handle {
+    [self sendRequest:SSH_FXP_CLOSE fields:^BOOL(ssh_buffer buffer) {
+        return sftp_buffer_add_string(buffer, handle);
+    } replyHandler:^(uint8_t type, ssh_buffer payload) {
+        // nothing could be done if server failed to close the handle
+        ssh_string_free(handle);
+    }];
+}
+
+#pragma mark Recursive Operations
+
+- (void)removeItemAtPath:(NSString *)path completion:(SSHKitSFTPBatchStatusBlock)completion {
+    [self lstatPath:path completion:^(uint32_t permissions, NSError *error) {
+        if (error) {
+            [self setError:error forPath:path];
+            completion(error);
+        } else if (S_ISDIR(permissions)) {
+            [self removeDirectory:path completion:completion];
+        } else {
+            [self sendStatusRequest:SSH_FXP_REMOVE path:path fields:sftp_path_fields(path) completion:completion];
+        }
+    }];
+}
+
+/** Directory is removed once listing is over and every child is gone */
+- (void)removeDirectory:(NSString *)path completion:(SSHKitSFTPBatchStatusBlock)completion {
+    __block NSUInteger remaining = 1;   // listing itself
+    __block NSError *childError = nil;
+
+    SSHKitSFTPBatchStatusBlock childCompletion = ^(NSError *error) {
+        childError = childError ?: error;
+        if (--remaining) {
+            return;
+        }
+
+        // failed child is already recorded, and is the reason the directory can not be removed
+        if (childError) {
+            completion(childError);
+        } else {
+            [self sendStatusRequest:SSH_FXP_RMDIR path:path fields:sftp_path_fields(path) completion:completion];
+        }
+    };
+
+    [self walkDirectory:path entries:^(SSHKitSFTPDirectoryEntries *entries) {
+        for (NSUInteger i = 0; i < entries.count; i++) {
+            const SSHKitSFTPDirectoryEntry *entry = &entries.entries[i];
+            if (sftp_is_dot_entry(entry)) {
+                continue;
+            }
+
+            NSString *childPath = [path stringByAppendingPathComponent:[entries nameAtIndex:i]];
+            remaining++;
+
+            // READDIR attributes are not followed, a symlink to a directory is unlinked
+            if (S_ISDIR(entry->permissions)) {
+                [self removeDirectory:childPath completion:childCompletion];
+            } else {
+                [self sendStatusRequest:SSH_FXP_REMOVE path:childPath fields:sftp_path_fields(childPath) completion:childCompletion];
+            }
+        }
+    } completion:childCompletion];
+}
+
+- (void)chmodItemAtPath:(NSString *)path permissions:(uint32_t)permissions mode:(unsigned long)mode {
+    // SETSTAT follows symlinks, chmod -R leaves them alone
+    if (S_ISLNK(permissions)) {
+        return;
+    }
+
+    [self sendStatusRequest:SSH_FXP_SETSTAT path:path fields:sftp_path_mode_fields(path, mode) completion:^(NSError *error) {
+        if (!S_ISDIR(permissions)) {
+            return;
+        }
+
+        // list even if chmod failed, directory may be readable already
+        [self walkDirectory:path entries:^(SSHKitSFTPDirectoryEntries *entries) {
+            for (NSUInteger i = 0; i < entries.count; i++) {
+                const SSHKitSFTPDirectoryEntry *entry = &entries.entries[i];
+                if (!sftp_is_dot_entry(entry)) {
+                    [self chmodItemAtPath:[path stringByAppendingPathComponent:[entries nameAtIndex:i]] permissions:entry->permissions mode:mode];
+                }
+            }
+        } completion:^(NSError *walkError) {}];
+    }];
+}
+
+/** Directories of one level are created together, next level starts once all of them are answered */
+- (void)createDirectoriesInLevels:(NSArray<NSOrderedSet *> *)levels index:(NSUInteger)index mode:(unsigned long)mode failedPaths:(NSMutableSet *)failedPaths {
+    if (index >= levels.count) {
+        return;
+    }
+
+    __block NSUInteger remaining = 1;
+    dispatch_block_t levelCompletion = ^{
+        if (--remaining == 0) {
+            [self createDirectoriesInLevels:levels index:index + 1 mode:mode failedPaths:failedPaths];
+        }
+    };
+
+    for (NSString *path in levels[index]) {
+        if ([failedPaths containsObject:path.stringByDeletingLastPathComponent]) {
+            // error of parent explains it
+            [failedPaths addObject:path];
+            continue;
+        }
+
+        remaining++;
+        [self createDirectory:path mode:mode completion:^(NSError *error) {
+            if (error) {
+                [failedPaths addObject:path];
+            }
+            levelCompletion();
+        }];
+    }
+
+    levelCompletion();
+}
+
+- (void)createDirectory:(NSString *)path mode:(unsigned long)mode completion:(SSHKitSFTPBatchStatusBlock)completion {
+    [self sendRequest:SSH_FXP_MKDIR fields:sftp_path_mode_fields(path, mode) replyHandler:^(uint8_t type, ssh_buffer payload) {
+        NSError *error = [self errorFromReply:type payload:payload];
+        if (!error || !payload) {
+            if (error) {
+                [self setError:error forPath:path];
+            }
+            completion(error);
+            return_from_block;
+        }
+
+        // OpenSSH answers SSH_FX_FAILURE for an existing path, find out whether it is a directory
+        [self lstatPath:path completion:^(uint32_t permissions, NSError *statError) {
+            if (!statError && S_ISDIR(permissions)) {
+                completion(nil);
+                return_from_block;
+            }
+
+            [self setError:error forPath:path];
+            completion(error);
+        }];
+    }];
+}
+
+@end
+
+#pragma mark - SSHKitSFTPChannel (Batch)
+
+@implementation SSHKitSFTPChannel (Batch)
+
+/** Run requests on session queue, cached attributes of paths are dropped before completion is called */
+- (void)doRunBatchInvalidatingPaths:(NSArray<NSString *> *)paths requests:(void (^)(SSHKitSFTPBatch *batch))requests completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    NSParameterAssert(completion);
+
+    __weak SSHKitSFTPChannel *weakSelf = self;
+    [self.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPChannel *strongSelf = weakSelf;
+
+        // without a channel every request fails, completion is still called
+        SSHKitSFTPBatch *batch = [[SSHKitSFTPBatch alloc] initWithChannel:strongSelf completion:^(NSDictionary<NSString *, NSError *> *errors) {
+            SSHKitSFTPAttributeCache *cache = strongSelf.attributeCache;
+            for (NSString *path in paths) {
+                [cache invalidatePath:path];
+            }
+            completion(errors);
+        }];
+
+        [batch beginWork];
+        requests(batch);
+        [batch endWork];
+    }];
+}
+
+#pragma mark - Batch Requests
+
+- (void)unlinkPaths:(NSArray<NSString *> *)paths completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    [self doRunBatchInvalidatingPaths:paths requests:^(SSHKitSFTPBatch *batch) {
+        for (NSString *path in paths) {
+            [batch sendStatusRequest:SSH_FXP_REMOVE path:path fields:sftp_path_fields(path) completion:nil];
+        }
+    } completion:completion];
+}
+
+- (void)rmdirPaths:(NSArray<NSString *> *)paths completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    [self doRunBatchInvalidatingPaths:paths requests:^(SSHKitSFTPBatch *batch) {
+        for (NSString *path in paths) {
+            [batch sendStatusRequest:SSH_FXP_RMDIR path:path fields:sftp_path_fields(path) completion:nil];
+        }
+    } completion:completion];
+}
+
+- (void)mkdirPaths:(NSArray<NSString *> *)paths mode:(unsigned long)mode completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    [self doRunBatchInvalidatingPaths:paths requests:^(SSHKitSFTPBatch *batch) {
+        for (NSString *path in paths) {
+            [batch sendStatusRequest:SSH_FXP_MKDIR path:path fields:sftp_path_mode_fields(path, mode) completion:nil];
+        }
+    } completion:completion];
+}
+
+- (void)chmodPaths:(NSArray<NSString *> *)paths mode:(unsigned long)mode completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    [self doRunBatchInvalidatingPaths:paths requests:^(SSHKitSFTPBatch *batch) {
+        for (NSString *path in paths) {
+            [batch sendStatusRequest:SSH_FXP_SETSTAT path:path fields:sftp_path_mode_fields(path, mode) completion:nil];
+        }
+    } completion:completion];
+}
+
+- (void)renamePaths:(NSDictionary<NSString *, NSString *> *)paths completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    NSArray *invalidatedPaths = [paths.allKeys arrayByAddingObjectsFromArray:paths.allValues];
+
+    [self doRunBatchInvalidatingPaths:invalidatedPaths requests:^(SSHKitSFTPBatch *batch) {
+        [paths enumerateKeysAndObjectsUsingBlock:^(NSString *original, NSString *newName, BOOL *stop) {
+            [batch sendStatusRequest:SSH_FXP_RENAME path:original fields:^BOOL(ssh_buffer buffer) {
+                return sftp_buffer_add_cstring(buffer, original.UTF8String)
+                    && sftp_buffer_add_cstring(buffer, newName.UTF8String);
+            } completion:nil];
+        }];
+    } completion:completion];
+}
+
+#pragma mark - Recursive Operations
+
+- (void)removeItemRecursivelyAtPath:(NSString *)path completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    [self doRunBatchInvalidatingPaths:@[path] requests:^(SSHKitSFTPBatch *batch) {
+        [batch removeItemAtPath:path completion:^(NSError *error) {}];
+    } completion:completion];
+}
+
+- (void)createDirectoriesAtPaths:(NSArray<NSString *> *)paths mode:(unsigned long)mode completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    // every missing ancestor, grouped by depth, so parents shared by many paths are created once
+    NSMutableArray<NSMutableOrderedSet *> *levels = [@[] mutableCopy];
+    for (NSString *path in paths) {
+        NSArray *components = path.pathComponents;
+        NSString *prefix = @"";
+
+        for (NSUInteger depth = 0; depth < components.count; depth++) {
+            NSString *component = components[depth];
+            prefix = depth ? [prefix stringByAppendingPathComponent:component] : component;
+
+            if ([component isEqualToString:@"/"] || [component isEqualToString:@"."] || [component isEqualToString:@".."]) {
+                continue;
+            }
+
+            while (levels.count <= depth) {
+                [levels addObject:[NSMutableOrderedSet orderedSet]];
+            }
+            [levels[depth] addObject:prefix];
+        }
+    }
+
+    [self doRunBatchInvalidatingPaths:paths requests:^(SSHKitSFTPBatch *batch) {
+        [batch createDirectoriesInLevels:levels index:0 mode:mode failedPaths:[NSMutableSet set]];
+    } completion:completion];
+}
+
+- (void)chmodRecursivelyAtPath:(NSString *)path mode:(unsigned long)mode completion:(SSHKitSFTPBatchCompletionBlock)completion {
+    [self doRunBatchInvalidatingPaths:@[path] requests:^(SSHKitSFTPBatch *batch) {
+        [batch lstatPath:path completion:^(uint32_t permissions, NSError *error) {
+            if (error) {
+                [batch setError:error forPath:path];
+                return_from_block;
+            }
+            [batch chmodItemAtPath:path permissions:permissions mode:mode];
+        }];
+    } completion:completion];
+}
+
+@end
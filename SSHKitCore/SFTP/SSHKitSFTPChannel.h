@@ -12,11 +12,14 @@
 @class SSHKitSession;
 @class SSHKitChannel;
 @class SSHKitSFTPFile;
+@class SSHKitSFTPAttributeCache;
 @class SSHKitSFTPRequest;  // define in SSHKitExtras
 
 @interface SSHKitSFTPChannel : SSHKitChannel
 
 @property (nonatomic) NSMutableArray *remoteFiles;
+/** Answers repeated stats, readlinks and canonicalizations from memory when set, nil by default */
+@property (nonatomic, strong) SSHKitSFTPAttributeCache *attributeCache;
 
 + (void)freeSFTPAttributes:(sshkit_sftp_attributes)attributes;
 - (SSHKitSFTPIsFileExist)isFileExist:(NSString *)path;
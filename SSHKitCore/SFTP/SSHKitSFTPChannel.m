@@ -14,9 +14,53 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     SessionChannelReqSFTP,       // is requesting a sftp
 };
 
+#pragma mark - sftp message queue
+
+sftp_message SSHKitSFTPTakeQueuedReply(sftp_session sftp, uint32_t requestId) {
+    sftp_request_queue prev = NULL;
+    
+    for (sftp_request_queue queue = sftp->queue; queue; prev = queue, queue = queue->next) {
+        if (queue->message->id != requestId) {
+            continue;
+        }
+        
+        if (prev) {
+            prev->next = queue->next;
+        } else {
+            sftp->queue = queue->next;
+        }
+        
+        sftp_message msg = queue->message;
+        free(queue);
+        return msg;
+    }
+    
+    return NULL;
+}
+
+BOOL SSHKitSFTPIsReplyQueued(sftp_session sftp, uint32_t requestId) {
+    for (sftp_request_queue queue = sftp->queue; queue; queue = queue->next) {
+        if (queue->message->id == requestId) {
+            return YES;
+        }
+    }
+    
+    return NO;
+}
+
+void SSHKitSFTPPumpReplies(sftp_session sftp) {
+    // no request ever uses id 0, so sftp_async_read queues every packet it reads, until channel runs dry
+    struct sftp_file_struct scratch = { .sftp = sftp, .nonblocking = 1 };
+    char unused = 0;
+    
+    sftp_async_read(&scratch, &unused, 0, 0);
+}
+
 @interface SSHKitSFTPChannel()
 
 @property (nonatomic) SessionChannelReqState   reqState;
+@property (nonatomic) BOOL                     transferScheduled;
+@property (nonatomic) NSMutableDictionary      *replyHandlers;
 
 @end
 
@@ -32,17 +76,8 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     return self;
 }
 
-- (int)_didReceiveData:(NSData *)readData isSTDError:(int)isSTDError {
-    if (!self.isOpen) {
-        return 0;
-    }
-    if (isSTDError) {
-    } else {
-        for (SSHKitSFTPFile *file in _remoteFiles) {
-            [file didReceiveData:readData];
-        }
-    }
-    // pass data to ssh_channel_read
+- (int)doReceiveBytes:(const void *)bytes length:(uint32_t)length isSTDError:(BOOL)isSTDError {
+    // pass data to ssh_channel_read, sftp packets are parsed by libssh, never copy them here
     return 0;
 }
 
@@ -129,18 +164,218 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     return YES;
 }
 
+- (BOOL)hasPendingWork {
+    if (self.stage == SSHKitChannelStageReady && (_remoteFiles.count || _replyHandlers.count)) {
+        return YES;
+    }
+    return [super hasPendingWork];
+}
+
+- (SSHKitChannelMetrics *)doCollectMetrics {
+    SSHKitChannelMetrics *metrics = [super doCollectMetrics];
+    
+    NSUInteger outstandingRequests = _replyHandlers.count;
+    for (SSHKitSFTPFile *file in _remoteFiles) {
+        outstandingRequests += [file doCollectMetrics].outstandingRequests;
+    }
+    metrics.outstandingRequests = outstandingRequests;
+    
+    return metrics;
+}
+
+- (void)doWrite {
+    [super doWrite];
+    [self doTransfer];
+}
+
+- (void)doTransfer {
+    NSAssert([self.session isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    if (self.stage != SSHKitChannelStageReady || (!_remoteFiles.count && !_replyHandlers.count)) {
+        return;
+    }
+    
+    // serviced on every socket event until transfers and requests are done
+    [self.session doScheduleChannel:self];
+    
+    [self doDispatchReplies];
+    
+    // file will remove from remoteFiles in loop
+    NSArray *files = [_remoteFiles copy];
+    BOOL needsMore = NO;
+    
+    for (SSHKitSFTPFile *file in files) {
+        needsMore |= [file doTransfer];
+    }
+    
+    // a reply may be read from channel by another file, after its own file was serviced
+    for (SSHKitSFTPFile *file in files) {
+        needsMore |= [file hasQueuedReply];
+    }
+    
+    for (NSNumber *requestId in _replyHandlers) {
+        needsMore |= SSHKitSFTPIsReplyQueued(self.rawSFTPSession, requestId.unsignedIntValue);
+    }
+    
+    if (!needsMore || self.transferScheduled) {
+        return;
+    }
+    
+    // yield to other channels and blocks on session queue, replies already buffered by libssh
+    // will not trigger socket read source again
+    self.transferScheduled = YES;
+    
+    __weak SSHKitSFTPChannel *weakSelf = self;
+    [self.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPChannel *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+        
+        strongSelf.transferScheduled = NO;
+        [strongSelf doTransfer];
+    }];
+}
+
+#pragma mark - Async Requests
+
+- (int)doSendRequest:(uint8_t)type fields:(BOOL (^)(ssh_buffer buffer))fields replyHandler:(SSHKitSFTPReplyHandler)replyHandler {
+    NSAssert([self.session isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    sftp_session sftp = self.rawSFTPSession;
+    if (self.stage != SSHKitChannelStageReady || !sftp) {
+        return SSH_ERROR;
+    }
+    
+    ssh_buffer buffer = ssh_buffer_new();
+    if (!buffer) {
+        return SSH_ERROR;
+    }
+    
+    uint32_t requestId = ++sftp->id_counter;
+    uint32_t netRequestId = CFSwapInt32HostToBig(requestId);
+    
+    if (ssh_buffer_add_data(buffer, &netRequestId, sizeof(netRequestId)) < 0 || !fields(buffer)) {
+        ssh_buffer_free(buffer);
+        return SSH_ERROR;
+    }
+    
+    // packet length and type fields are prepended by sftp_packet_write
+    int packetLength = (int)ssh_buffer_get_len(buffer) + 5;
+    int rc = sftp_packet_write(sftp, type, buffer);
+    ssh_buffer_free(buffer);
+    
+    if (rc != packetLength) {
+        return SSH_ERROR;
+    }
+    
+    self.replyHandlers[@(requestId)] = replyHandler;
+    [self.session doScheduleChannel:self];
+    
+    return (int)requestId;
+}
+
+- (void)doDispatchReplies {
+    sftp_session sftp = self.rawSFTPSession;
+    if (!_replyHandlers.count || !sftp) {
+        return;
+    }
+    
+    SSHKitSFTPPumpReplies(sftp);
+    
+    for (NSNumber *requestId in [_replyHandlers allKeys]) {
+        sftp_message msg = SSHKitSFTPTakeQueuedReply(sftp, requestId.unsignedIntValue);
+        if (!msg) {
+            continue;
+        }
+        
+        SSHKitSFTPReplyHandler replyHandler = _replyHandlers[requestId];
+        [_replyHandlers removeObjectForKey:requestId];
+        
+        replyHandler(msg->packet_type, msg->payload);
+        
+        ssh_buffer_free(msg->payload);
+        free(msg);
+    }
+}
+
+- (NSError *)errorFromStatusPayload:(ssh_buffer)payload {
+    uint32_t netStatus = 0;
+    
+    if (payload && ssh_buffer_get_data(payload, &netStatus, sizeof(netStatus)) == sizeof(netStatus)) {
+        self.rawSFTPSession->errnum = CFSwapInt32BigToHost(netStatus);
+        NSError *error = self.libsshSFTPError;
+        if (error || !netStatus) {
+            return error;
+        }
+    }
+    
+    return [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                               code:SSHKitSFTPErrorCodeBadMessage
+                           userInfo:@{ NSLocalizedDescriptionKey : @"Unexpected reply from SFTP server" }];
+}
+
+- (void)dispatchSyncOnSessionQueue:(dispatch_block_t)block {
+    if ([self.session isOnSessionQueue]) {
+        block();
+        return;
+    }
+    
+    [self.session dispatchSyncOnSessionQueue:block];
+    
+    // replies swallowed into sftp message queue won't trigger socket read source
+    __weak SSHKitSFTPChannel *weakSelf = self;
+    [self.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPChannel *strongSelf = weakSelf;
+        if (strongSelf.remoteFiles.count) {
+            [strongSelf doTransfer];
+        }
+    }];
+}
+
 - (void)doCloseWithError:(NSError *)error {
     // file will remove from remoteFiles in loop
-    // close file and other function
-    /*NSMutableArray *templateRemoteFiles = [self.remoteFiles copy];
-    for (SSHKitSFTPFile *file in templateRemoteFiles) {
-        [file doFileTransferFail:error];
-    }*/
+    NSArray *files = [_remoteFiles copy];
+    NSError *transferError = error ?: [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                                                          code:SSHKitSFTPErrorCodeConnectionLost
+                                                      userInfo:@{ NSLocalizedDescriptionKey : @"SFTP channel closed" }];
+    for (SSHKitSFTPFile *file in files) {
+        [file doAbortTransfer:transferError];
+    }
+    
+    NSDictionary *replyHandlers = _replyHandlers;
+    _replyHandlers = nil;
+    for (SSHKitSFTPReplyHandler replyHandler in replyHandlers.allValues) {
+        replyHandler(SSH_FXP_STATUS, NULL);
+    }
     
     // close channel
     [super doCloseWithError:error];
 }
 
+- (void)doSuspend {
+    // handles are gone with the connection, transfers fail so their owners can resume them once reopened
+    NSArray *files = [_remoteFiles copy];
+    NSError *transferError = [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                                                 code:SSHKitSFTPErrorCodeConnectionLost
+                                             userInfo:@{ NSLocalizedDescriptionKey : @"SFTP connection lost" }];
+    for (SSHKitSFTPFile *file in files) {
+        [file doAbortTransfer:transferError];
+    }
+    [_remoteFiles removeAllObjects];
+    
+    NSDictionary *replyHandlers = _replyHandlers;
+    _replyHandlers = nil;
+    for (SSHKitSFTPReplyHandler replyHandler in replyHandlers.allValues) {
+        replyHandler(SSH_FXP_STATUS, NULL);
+    }
+    
+    self.reqState = SessionChannelReqNone;
+    _connectionGeneration++;
+    
+    [super doSuspend];
+}
+
 #pragma mark - SFTP API
 
 + (void)freeSFTPAttributes:(sshkit_sftp_attributes)attributes {
@@ -154,18 +389,22 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     SSHKitSFTPFile* file = [[SSHKitSFTPFile alloc]init:self path:path isDirectory:NO];
     // TODO handle error
     __block SSHKitSFTPIsFileExist isExist;
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         isExist = [file isExist];
     }];
     return isExist;
 }
 
 - (NSString *)canonicalizePath:(NSString *)path errorPtr:(NSError **)errorPtr {
-    __block NSString *newPath = nil;
+    __block NSString *newPath = [_attributeCache lookupCanonicalPath:path];
     __block NSError *error;
+    
+    if (newPath) {
+        return newPath;
+    }
 
     __weak SSHKitSFTPChannel *weakSelf = self;
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -173,11 +412,15 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
         char *charNewPath = sftp_canonicalize_path(weakSelf.rawSFTPSession, [path UTF8String]);
         if (charNewPath) {
             newPath = [NSString stringWithUTF8String:charNewPath];
+            ssh_string_free_char(charNewPath);
         }
     }];
     if (!newPath && errorPtr) {
         *errorPtr = self.libsshSFTPError;
     }
+    if (newPath) {
+        [_attributeCache storeCanonicalPath:newPath path:path];
+    }
     return newPath;
 }
 
@@ -200,7 +443,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     __block NSError *error;
     __weak SSHKitSFTPChannel *weakSelf = self;
     
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -212,6 +455,9 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     if (error) {
         return error;
     }
+    
+    [_attributeCache invalidatePath:original];
+    [_attributeCache invalidatePath:newName];
     return [self libsshSFTPError:returnCode];
 }
 
@@ -221,7 +467,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     __weak SSHKitSFTPChannel *weakSelf = self;
     __block NSError *error;
 
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -233,6 +479,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
         return error;
     }
 
+    [_attributeCache invalidatePath:filePath];
     return [self libsshSFTPError:returnCode];
 }
 
@@ -242,7 +489,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     __weak SSHKitSFTPChannel *weakSelf = self;
     __block NSError *error;
 
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -255,6 +502,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
         return error;
     }
 
+    [_attributeCache invalidatePath:directoryPath];
     return [self libsshSFTPError:returnCode];
 }
 
@@ -263,7 +511,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     __weak SSHKitSFTPChannel *weakSelf = self;
     __block NSError *error;
 
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -276,6 +524,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
         return error;
     }
 
+    [_attributeCache invalidatePath:directoryPath];
     return [self libsshSFTPError:returnCode];
 }
 
@@ -284,7 +533,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     __weak SSHKitSFTPChannel *weakSelf = self;
     __block NSError *error;
 
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -296,15 +545,20 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     if (error) {
         return error;
     }
+    [_attributeCache invalidatePath:filePath];
     return [self libsshSFTPError:returnCode];
 }
 
 - (NSString *)readlink:(NSString *)path errorPtr:(NSError **)errorPtr {
-    __block NSString *symlinkTarget = nil;
+    __block NSString *symlinkTarget = [_attributeCache lookupLinkTarget:path];
     __weak typeof(self) weakSelf = self;
     __block NSError *error;
     
-    [self.session dispatchSyncOnSessionQueue:^{
+    if (symlinkTarget) {
+        return symlinkTarget;
+    }
+    
+    [self dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -314,9 +568,14 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
         if (cSymlinkTarget == NULL) {
         } else {
             symlinkTarget = [[NSString alloc]initWithUTF8String:cSymlinkTarget];
+            ssh_string_free_char(cSymlinkTarget);
         }
     }];
     
+    if (symlinkTarget) {
+        [_attributeCache storeLinkTarget:symlinkTarget path:path];
+    }
+    
     if (symlinkTarget == nil && errorPtr) {
         if (!error) {
             error = self.libsshSFTPError;
@@ -337,7 +596,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     __weak SSHKitSFTPChannel *weakSelf = self;
     __block NSError *error;
     
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -348,6 +607,7 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     if (error) {
         return error;
     }
+    [_attributeCache invalidatePath:destination];
     return [self libsshSFTPError:returnCode];
 }
 
@@ -360,13 +620,20 @@ typedef NS_ENUM(NSUInteger, SessionChannelReqState) {
     return _remoteFiles;
 }
 
+- (NSMutableDictionary *)replyHandlers {
+    if (_replyHandlers == nil) {
+        _replyHandlers = [@{} mutableCopy];
+    }
+    return _replyHandlers;
+}
+
 #pragma mark Diagnostics
 
 - (int)getSFTPErrorCode {
     __block int errorCode;
     __weak SSHKitSFTPChannel *weakSelf = self;
 
-    [self.session dispatchSyncOnSessionQueue:^{
+    [self dispatchSyncOnSessionQueue:^{
         errorCode = sftp_get_error(weakSelf.rawSFTPSession);
     }];
 
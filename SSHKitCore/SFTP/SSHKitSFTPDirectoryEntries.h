@@ -0,0 +1,50 @@
+//
+//  SSHKitSFTPDirectoryEntries.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+
+@class SSHKitSFTPChannel;
+
+/** Attributes of one directory entry, fields not sent by server are 0 and their bit is not set in flags */
+typedef struct {
+    const char          *name;          // NUL terminated, owned by SSHKitSFTPDirectoryEntries
+    uint32_t            nameLength;
+    uint32_t            flags;          // SSH_FILEXFER_ATTR_*
+    unsigned long long  size;
+    uint32_t            uid;
+    uint32_t            gid;
+    uint32_t            permissions;    // st_mode, file type included
+    uint32_t            atime;
+    uint32_t            mtime;
+} SSHKitSFTPDirectoryEntry;
+
+/**
+ One READDIR reply, entries are kept in two flat buffers, objects are only created when asked for.
+ */
+@interface SSHKitSFTPDirectoryEntries : NSObject
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) const SSHKitSFTPDirectoryEntry *entries;
+
+/** Full path of the listed directory */
+@property (nonatomic, readonly) NSString *parentPath;
+
+- (NSString *)nameAtIndex:(NSUInteger)index;
+- (BOOL)isDirectoryAtIndex:(NSUInteger)index;
+- (BOOL)isLinkAtIndex:(NSUInteger)index;
+
+/** Builds a SSHKitSFTPFile with the same attributes as returned by listDirectory: */
+- (SSHKitSFTPFile *)fileAtIndex:(NSUInteger)index;
+
+@end
+
+/**
+ Called on session queue for every batch, return SSHKitSFTPListDirFilterCodeCancel to stop listing,
+ entries not yet delivered are discarded.
+ */
+typedef SSHKitSFTPListDirFilterCode(^SSHKitSFTPDirectoryBatchBlock)(SSHKitSFTPDirectoryEntries *entries);
+/** Called on session queue once listing is over, error is nil when reached end of directory or cancelled */
+typedef void(^SSHKitSFTPDirectoryCompletionBlock)(NSError *error);
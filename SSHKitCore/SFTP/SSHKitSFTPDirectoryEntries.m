@@ -0,0 +1,152 @@
+//
+//  SSHKitSFTPDirectoryEntries.m
+//  SSHKitCore
+//
+
+#import "SSHKitSFTPDirectoryEntries.h"
+#import "SSHKitCore+Protected.h"
+
+NS_INLINE BOOL sftp_buffer_get_u32(ssh_buffer buffer, uint32_t *value) {
+    uint32_t netValue = 0;
+    if (ssh_buffer_get_data(buffer, &netValue, sizeof(netValue)) != sizeof(netValue)) {
+        return NO;
+    }
+    *value = CFSwapInt32BigToHost(netValue);
+    return YES;
+}
+
+NS_INLINE BOOL sftp_buffer_get_u64(ssh_buffer buffer, unsigned long long *value) {
+    uint64_t netValue = 0;
+    if (ssh_buffer_get_data(buffer, &netValue, sizeof(netValue)) != sizeof(netValue)) {
+        return NO;
+    }
+    *value = CFSwapInt64BigToHost(netValue);
+    return YES;
+}
+
+NS_INLINE BOOL sftp_buffer_skip_string(ssh_buffer buffer) {
+    uint32_t length = 0;
+    return sftp_buffer_get_u32(buffer, &length) && length <= ssh_buffer_get_len(buffer) && ssh_buffer_pass_bytes(buffer, length) == length;
+}
+
+@implementation SSHKitSFTPDirectoryEntries {
+    SSHKitSFTPDirectoryEntry *_entries;
+    char *_names;
+    __weak SSHKitSFTPChannel *_sftp;
+}
+
+- (instancetype)initWithPayload:(ssh_buffer)payload channel:(SSHKitSFTPChannel *)channel parentPath:(NSString *)parentPath {
+    if (!(self = [super init])) {
+        return nil;
+    }
+
+    _sftp = channel;
+    _parentPath = [parentPath copy];
+
+    uint32_t count = 0;
+    if (!sftp_buffer_get_u32(payload, &count)) {
+        return nil;
+    }
+
+    // every entry takes at least 4 bytes for each of name, longname and flags
+    uint32_t payloadLength = ssh_buffer_get_len(payload);
+    if (count > payloadLength / 12) {
+        return nil;
+    }
+
+    // names are never longer than payload, one extra byte per NUL terminator
+    _entries = calloc(MAX(count, 1), sizeof(SSHKitSFTPDirectoryEntry));
+    _names = malloc(payloadLength + count + 1);
+    if (!_entries || !_names) {
+        return nil;
+    }
+
+    char *name = _names;
+    for (uint32_t i = 0; i < count; i++) {
+        SSHKitSFTPDirectoryEntry *entry = &_entries[i];
+
+        uint32_t nameLength = 0;
+        if (!sftp_buffer_get_u32(payload, &nameLength) || nameLength > ssh_buffer_get_len(payload)
+            || ssh_buffer_get_data(payload, name, nameLength) != nameLength) {
+            return nil;
+        }
+        name[nameLength] = '\0';
+        entry->name = name;
+        entry->nameLength = nameLength;
+        name += nameLength + 1;
+
+        // longname is only meant for humans
+        if (!sftp_buffer_skip_string(payload) || !sftp_buffer_get_u32(payload, &entry->flags)) {
+            return nil;
+        }
+
+        uint32_t flags = entry->flags;
+        if ((flags & SSH_FILEXFER_ATTR_SIZE) && !sftp_buffer_get_u64(payload, &entry->size)) {
+            return nil;
+        }
+        if ((flags & SSH_FILEXFER_ATTR_UIDGID) && !(sftp_buffer_get_u32(payload, &entry->uid) && sftp_buffer_get_u32(payload, &entry->gid))) {
+            return nil;
+        }
+        if ((flags & SSH_FILEXFER_ATTR_PERMISSIONS) && !sftp_buffer_get_u32(payload, &entry->permissions)) {
+            return nil;
+        }
+        if ((flags & SSH_FILEXFER_ATTR_ACMODTIME) && !(sftp_buffer_get_u32(payload, &entry->atime) && sftp_buffer_get_u32(payload, &entry->mtime))) {
+            return nil;
+        }
+        if (flags & SSH_FILEXFER_ATTR_EXTENDED) {
+            uint32_t extendedCount = 0;
+            if (!sftp_buffer_get_u32(payload, &extendedCount)) {
+                return nil;
+            }
+            for (uint32_t j = 0; j < extendedCount; j++) {
+                if (!sftp_buffer_skip_string(payload) || !sftp_buffer_skip_string(payload)) {
+                    return nil;
+                }
+            }
+        }
+    }
+
+    _count = count;
+
+    return self;
+}
+
+- (void)dealloc {
+    free(_entries);
+    free(_names);
+}
+
+- (const SSHKitSFTPDirectoryEntry *)entries {
+    return _entries;
+}
+
+- (NSString *)nameAtIndex:(NSUInteger)index {
+    NSParameterAssert(index < _count);
+    return [[NSString alloc] initWithBytes:_entries[index].name length:_entries[index].nameLength encoding:NSUTF8StringEncoding];
+}
+
+- (BOOL)isDirectoryAtIndex:(NSUInteger)index {
+    NSParameterAssert(index < _count);
+    return S_ISDIR(_entries[index].permissions);
+}
+
+- (BOOL)isLinkAtIndex:(NSUInteger)index {
+    NSParameterAssert(index < _count);
+    return S_ISLNK(_entries[index].permissions);
+}
+
+- (SSHKitSFTPFile *)fileAtIndex:(NSUInteger)index {
+    NSParameterAssert(index < _count);
+
+    NSString *path = [_parentPath stringByAppendingPathComponent:[self nameAtIndex:index]];
+    SSHKitSFTPFile *file = [[SSHKitSFTPFile alloc] init:_sftp path:path isDirectory:NO];
+    [file populateValuesFromDirectoryEntry:&_entries[index]];
+
+    return file;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p> %@, %lu entries", NSStringFromClass(self.class), self, _parentPath, (unsigned long)_count];
+}
+
+@end
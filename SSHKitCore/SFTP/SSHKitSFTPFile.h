@@ -9,10 +9,11 @@
 #import <Foundation/Foundation.h>
 #import "SSHKitCoreCommon.h"
 #import "SSHKitChannel.h"
+#import "SSHKitSFTPDirectoryEntries.h"
 
 #define MAX_XFER_BUF_SIZE 32758  // 16384-13
 
-@class SSHKitSFTPChannel;
+@class SSHKitSFTPChannel, SSHKitSFTPFileMetrics;
 
 @interface SSHKitSFTPFile : NSObject
 
@@ -67,6 +68,22 @@
 
 @property (nonatomic, readonly) SSHKitSFTPFile *symlinkTarget;
 
+/**
+ Grow or shrink the number of outstanding READ requests and the size of each request
+ from measured round trip time and throughput while downloading. Defaults to NO, which
+ keeps CONCURRENT_REQ_COUNT requests of MAX_XFER_BUF_SIZE bytes in flight.
+ */
+@property (nonatomic) BOOL adaptiveTransfer;
+@property (nonatomic) NSUInteger minConcurrentRequests;
+@property (nonatomic) NSUInteger maxConcurrentRequests;
+@property (nonatomic) uint32_t minRequestSize;
+@property (nonatomic) uint32_t maxRequestSize;
+/** Upper bound of READ bytes in flight, window and request size never grow past it, 0 for none, default 0 */
+@property (nonatomic) unsigned long long maxBytesInFlight;
+
+/** Called on session queue every time adaptive transfer changes the window or request size */
+@property (nonatomic, copy) SSHKitSFTPClientTransferStatsBlock transferStatsBlock;
+
 + (instancetype)openDirectory:(SSHKitSFTPChannel *)sftpChannel path:(NSString *)path errorPtr:(NSError **)errorPtr;
 + (instancetype)openFile:(SSHKitSFTPChannel *)sftpChannel path:(NSString *)path errorPtr:(NSError **)errorPtr;
 + (instancetype)openFile:(SSHKitSFTPChannel *)sftpChannel path:(NSString *)path accessType:(int)accessType mode:(unsigned long)mode errorPtr:(NSError **)errorPtr;
@@ -76,6 +93,12 @@
 - (instancetype)init:(SSHKitSFTPChannel *)sftp path:(NSString *)path isDirectory:(BOOL)isDirectory;
 - (void)close;
 - (NSArray *)listDirectory:(SSHKitSFTPListDirFilter)filter;
+
+/**
+ Stream entries of an opened directory in batches, without creating objects per entry. READDIR
+ requests are pipelined, so don't mix with listDirectory: on the same directory.
+ */
+- (void)listDirectoryInBatches:(SSHKitSFTPDirectoryBatchBlock)batchBlock completion:(SSHKitSFTPDirectoryCompletionBlock)completion;
 - (void)seek64:(unsigned long long)offset;
 - (long)read:(char *)buffer errorPtr:(NSError **)errorPtr;
 - (void)asyncReadFile:(unsigned long long)offset
@@ -84,8 +107,77 @@
         fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
 fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock;
 - (void)cancelAsyncReadFile;
+
+/**
+ Download the opened file straight into a local file. Every READ reply is written at its own offset with
+ pwrite as soon as it arrives, replies are not reordered and no block is called per chunk.
+ Once the download succeeded a regular local file is truncated to the end of the remote file, so
+ downloading over a longer file leaves no stale bytes behind.
+
+ @param fd Local file opened for writing, stays open after the transfer
+ @param offset Remote offset to start at, data lands at the same local offset, pass local file size to resume
+ */
+- (void)asyncDownloadToFileDescriptor:(int)fd
+                               offset:(unsigned long long)offset
+                              options:(SSHKitSFTPDownloadOptions)options
+                        progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+             fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+                fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock;
+
+/** Same as above, local file is created if missing and closed once the transfer ends */
+- (void)asyncDownloadToPath:(NSString *)localPath
+                     offset:(unsigned long long)offset
+                    options:(SSHKitSFTPDownloadOptions)options
+              progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+   fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+      fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock;
+
+/**
+ Upload to the opened file, keeps up to CONCURRENT_REQ_COUNT WRITE requests in flight.
+
+ @param offset Remote offset to start writing at, pass the remote file size to resume an upload
+ @param length Total bytes going to be written, only used for progress report
+ @param writeFileBlock Called on session queue to fill next chunk, return 0 to finish the upload
+ */
+- (void)asyncWriteFile:(unsigned long long)offset
+                length:(unsigned long long)length
+        writeFileBlock:(SSHKitSFTPClientWriteFileBlock)writeFileBlock
+         progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+ fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock;
+- (void)cancelAsyncWriteFile;
+
+/**
+ Upload a local file to the opened file. Chunks are read ahead of the WRITE window into a pooled buffer,
+ with the kernel asked to prefetch further, or taken from a mapping of local file, no block is called per chunk.
+
+ @param fd Local file opened for reading, stays open after the transfer
+ @param offset Local and remote offset to start at, pass fileSize of a file opened by
+               openFileForWrite:shouldResume:YES to resume an upload
+ @param length Bytes to upload from offset, cut at end of local file
+ */
+- (void)asyncUploadFromFileDescriptor:(int)fd
+                               offset:(unsigned long long)offset
+                               length:(unsigned long long)length
+                              options:(SSHKitSFTPUploadOptions)options
+                        progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+             fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+                fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock;
+
+/** Same as above, uploads local file from offset to its end, local file is closed once the transfer ends */
+- (void)asyncUploadFromPath:(NSString *)localPath
+                     offset:(unsigned long long)offset
+                    options:(SSHKitSFTPUploadOptions)options
+              progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+   fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+      fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock;
+
+/** Pipelined write, returns bytes acknowledged by server, which is less than size on failure */
 -(long)write:(const void *)buffer size:(long)size errorPtr:(NSError **)errorPtr;
 
 - (NSError *)updateSymlinkTargetStat;  // get symlink's tagert info
 
+/** Counters of current or last asynchronous transfer */
+- (SSHKitSFTPFileMetrics *)metrics;
+
 @end
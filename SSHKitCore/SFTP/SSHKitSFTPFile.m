@@ -9,19 +9,409 @@
 #import "SSHKitSFTPFile.h"
 #import "SSHKitCore+Protected.h"
 #import <sys/stat.h>
+#import <fcntl.h>
+#import <sys/mman.h>
 
 #define CONCURRENT_REQ_COUNT 16
 
+// length, type, id, handle, offset and data length fields of a SSH_FXP_WRITE packet, with a handle of at most 256 bytes
+#define SFTP_WRITE_PACKET_OVERHEAD 512
+
+// errnum while waiting for a STATUS, left in place if none arrives, a lost channel is the usual cause
+#define SFTP_NO_STATUS SSH_FX_CONNECTION_LOST
+
+// replies handled by a transfer in one session queue wakeup, before yielding to other channels
+#define SFTP_TRANSFER_BUDGET 16
+
+// entries read from libssh per session queue hop by listDirectory:
+#define SFTP_LIST_DIR_BATCH_SIZE 256
+
+// READDIR requests in flight for listDirectoryInBatches:completion:
+#define SFTP_LIST_DIR_CONCURRENT_REQ_COUNT 4
+
 typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     SSHKitFileStageNone = 0,
     SSHKitFileStageReadingFile,
+    SSHKitFileStageWritingFile,
+    SSHKitFileStageDraining,    // transfer is over, discarding replies of requests still in flight
 };
 
+typedef struct {
+    uint32_t requestId;
+    uint32_t length;
+    CFAbsoluteTime issuedAt;
+} SSHKitSFTPWriteRequest;
+
+#pragma mark - libssh async write
+
+/**
+ * libssh only provides a blocking `sftp_write`, which waits for the status of a WRITE request before it returns,
+ * so every chunk costs a full round trip. Following functions split it into begin / end halves, just like
+ * `sftp_async_read_begin` and `sftp_async_read`, so multiple WRITE requests can be kept in flight.
+ */
+static int sftp_async_write_begin(sftp_file file, const void *data, uint32_t len, uint64_t offset) {
+    sftp_session sftp = file->sftp;
+    ssh_buffer buffer = ssh_buffer_new();
+    if (!buffer) {
+        return SSH_ERROR;
+    }
+    
+    uint32_t requestId = ++sftp->id_counter;
+    uint32_t netRequestId = CFSwapInt32HostToBig(requestId);
+    uint32_t netHandleLength = CFSwapInt32HostToBig((uint32_t)ssh_string_len(file->handle));
+    uint64_t netOffset = CFSwapInt64HostToBig(offset);
+    uint32_t netLength = CFSwapInt32HostToBig(len);
+    
+    if (ssh_buffer_add_data(buffer, &netRequestId, sizeof(netRequestId)) < 0 ||
+        ssh_buffer_add_data(buffer, &netHandleLength, sizeof(netHandleLength)) < 0 ||
+        ssh_buffer_add_data(buffer, ssh_string_data(file->handle), (uint32_t)ssh_string_len(file->handle)) < 0 ||
+        ssh_buffer_add_data(buffer, &netOffset, sizeof(netOffset)) < 0 ||
+        ssh_buffer_add_data(buffer, &netLength, sizeof(netLength)) < 0 ||
+        ssh_buffer_add_data(buffer, data, len) < 0) {
+        ssh_buffer_free(buffer);
+        return SSH_ERROR;
+    }
+    
+    // packet length and type fields are prepended by sftp_packet_write
+    int packetLength = (int)ssh_buffer_get_len(buffer) + 5;
+    int rc = sftp_packet_write(sftp, SSH_FXP_WRITE, buffer);
+    ssh_buffer_free(buffer);
+    
+    // a short write means the packet is truncated, the sftp stream is corrupted
+    if (rc != packetLength) {
+        return SSH_ERROR;
+    }
+    
+    return (int)requestId;
+}
+
+/**
+ * Same as `sftp_async_read`, but safe to be used in non-blocking mode.
+ *
+ * `sftp_async_read` always reads from channel before it looks into the message queue, so a reply which was
+ * already queued while waiting for another request is reported as SSH_AGAIN in non-blocking mode, or blocks
+ * until one more packet comes in blocking mode. Queued replies are handled here instead.
+ *
+ * @return bytes read, 0 on EOF, SSH_AGAIN if the reply is not arrived yet, or SSH_ERROR with status in `sftp_get_error`
+ */
+static int sftp_async_reply(sftp_file file, void *data, uint32_t size, uint32_t requestId, BOOL nonblocking) {
+    sftp_session sftp = file->sftp;
+    
+    // libssh returns 0 for every request once EOF flag is set, without dequeuing the reply
+    file->eof = 0;
+    
+    sftp_message msg = SSHKitSFTPTakeQueuedReply(sftp, requestId);
+    if (!msg) {
+        if (nonblocking) {
+            sftp_file_set_nonblocking(file);
+        }
+        int rc = sftp_async_read(file, data, size, requestId);
+        sftp_file_set_blocking(file);
+        return rc;
+    }
+    
+    int rc = SSH_ERROR;
+    uint32_t netValue = 0;
+    
+    if (ssh_buffer_get_data(msg->payload, &netValue, sizeof(netValue)) == sizeof(netValue)) {
+        uint32_t value = CFSwapInt32BigToHost(netValue);
+        
+        switch (msg->packet_type) {
+            case SSH_FXP_DATA:
+                // value is length of data
+                if (value <= size && ssh_buffer_get_data(msg->payload, data, value) == value) {
+                    rc = (int)value;
+                }
+                break;
+                
+            case SSH_FXP_STATUS:
+                // value is status code
+                sftp->errnum = value;
+                if (value == SSH_FX_EOF) {
+                    file->eof = 1;
+                    rc = 0;
+                }
+                break;
+                
+            default:
+                break;
+        }
+    }
+    
+    ssh_buffer_free(msg->payload);
+    free(msg);
+    
+    return rc;
+}
+
+/**
+ * Wait for the status of a WRITE request.
+ *
+ * Every status message other than EOF is reported as failure by `sftp_async_reply`,
+ * so a SSH_FX_OK status reported by `sftp_get_error` means the request was acknowledged.
+ * errnum is only set when a STATUS arrives, it is reset first so that a transport or parse
+ * failure without any STATUS is not taken for the OK of an earlier request.
+ *
+ * @return SSH_OK on success, SSH_AGAIN if nonblocking and the reply is not arrived yet
+ */
+static int sftp_async_write_end(sftp_file file, uint32_t requestId, BOOL nonblocking) {
+    char unused = 0;
+    file->sftp->errnum = SFTP_NO_STATUS;
+    int rc = sftp_async_reply(file, &unused, 0, requestId, nonblocking);
+    
+    if (rc == SSH_AGAIN) {
+        return SSH_AGAIN;
+    }
+    
+    if (rc == SSH_ERROR && sftp_get_error(file->sftp) == SSH_FX_OK) {
+        return SSH_OK;
+    }
+    
+    return SSH_ERROR;
+}
+
+/** Shrink length to what remote window can take right now, 0 means the window is exhausted. */
+NS_INLINE uint32_t sftp_writable_length(sftp_file file, uint32_t length) {
+    uint32_t window = ssh_channel_window_size(file->sftp->channel);
+    if (window <= SFTP_WRITE_PACKET_OVERHEAD) {
+        return 0;
+    }
+    
+    return MIN(length, window - SFTP_WRITE_PACKET_OVERHEAD);
+}
+
+#pragma mark - request packing
+
+// same mapping as sftp_open
+static uint32_t sftp_open_flags(int accessType) {
+    uint32_t flags = 0;
+    
+    if ((accessType & O_RDWR) == O_RDWR) {
+        flags |= SSH_FXF_WRITE | SSH_FXF_READ;
+    } else if ((accessType & O_WRONLY) == O_WRONLY) {
+        flags |= SSH_FXF_WRITE;
+    } else {
+        flags |= SSH_FXF_READ;
+    }
+    if ((accessType & O_CREAT) == O_CREAT) flags |= SSH_FXF_CREAT;
+    if ((accessType & O_TRUNC) == O_TRUNC) flags |= SSH_FXF_TRUNC;
+    if ((accessType & O_EXCL) == O_EXCL) flags |= SSH_FXF_EXCL;
+    if ((accessType & O_APPEND) == O_APPEND) flags |= SSH_FXF_APPEND;
+    
+    return flags;
+}
+
+#pragma mark - attribute cache
+
+static void sftp_directory_entry_from_attributes(SSHKitSFTPDirectoryEntry *entry, sftp_attributes attributes) {
+    *entry = (SSHKitSFTPDirectoryEntry) {
+        .flags = attributes->flags,
+        .size = attributes->size,
+        .uid = attributes->uid,
+        .gid = attributes->gid,
+        .permissions = attributes->permissions,
+        .atime = attributes->atime,
+        .mtime = attributes->mtime,
+    };
+}
+
+// same error a stat of a missing path gets from server
+static NSError *sftp_no_such_file_error(void) {
+    return [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                               code:SSHKitSFTPErrorCodeNoSuchFile
+                           userInfo:@{ NSLocalizedDescriptionKey : @"File doesn't exist." }];
+}
+
+#pragma mark - local file sink
+
+static BOOL sftp_pwrite_fully(int fd, const char *buffer, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, buffer, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NO;
+        }
+        buffer += written;
+        length -= written;
+        offset += written;
+    }
+    return YES;
+}
+
+#pragma mark - read window tuning
+
+typedef struct {
+    int requestId;
+    uint32_t length;
+    unsigned long long offset;
+    CFAbsoluteTime issuedAt;
+} SSHKitSFTPReadRequest;
+
+/**
+ * Sizes the READ pipeline of a download.
+ *
+ * Throughput is sampled over intervals of at least max(100ms, 2 * min RTT). The window is doubled while
+ * throughput keeps growing by more than 10%. Once smoothed RTT exceeds twice the minimum RTT, requests are
+ * queueing up somewhere, so the window shrinks toward twice the bandwidth-delay product. A window stuck at
+ * its upper bound asks for larger requests, a window stuck at its lower bound while still queueing asks for
+ * smaller ones.
+ */
+typedef struct {
+    NSUInteger window;
+    uint32_t requestSize;
+
+    NSUInteger minWindow;
+    NSUInteger maxWindow;
+    uint32_t minRequestSize;
+    uint32_t maxRequestSize;
+
+    CFTimeInterval minRTT;
+    CFTimeInterval smoothedRTT;
+
+    CFAbsoluteTime intervalStart;
+    unsigned long long intervalBytes;
+    double bytesPerSecond;
+} SSHKitSFTPReadTuner;
+
+static void sftp_read_tuner_init(SSHKitSFTPReadTuner *tuner, NSUInteger minWindow, NSUInteger maxWindow, uint32_t minRequestSize, uint32_t maxRequestSize) {
+    memset(tuner, 0, sizeof(SSHKitSFTPReadTuner));
+
+    tuner->minWindow = MAX(minWindow, 1);
+    tuner->maxWindow = MAX(maxWindow, tuner->minWindow);
+    tuner->minRequestSize = MAX(minRequestSize, 1);
+    tuner->maxRequestSize = MAX(maxRequestSize, tuner->minRequestSize);
+
+    tuner->window = tuner->minWindow;
+    tuner->requestSize = MIN(MAX(MAX_XFER_BUF_SIZE, tuner->minRequestSize), tuner->maxRequestSize);
+    tuner->intervalStart = CFAbsoluteTimeGetCurrent();
+}
+
+/** Keep maxWindow * maxRequestSize within bytes, as far as the lower bounds allow */
+static void sftp_read_tuner_cap(SSHKitSFTPReadTuner *tuner, unsigned long long bytes) {
+    tuner->maxRequestSize = (uint32_t)MAX(MIN((unsigned long long)tuner->maxRequestSize, bytes / tuner->minWindow), tuner->minRequestSize);
+    tuner->maxWindow = MAX(MIN(tuner->maxWindow, (NSUInteger)(bytes / tuner->maxRequestSize)), tuner->minWindow);
+    tuner->requestSize = MIN(tuner->requestSize, tuner->maxRequestSize);
+}
+
+/** Server returned less than asked for, it caps the size of a single read */
+static void sftp_read_tuner_limit_request_size(SSHKitSFTPReadTuner *tuner, uint32_t length) {
+    if (length < tuner->minRequestSize || length >= tuner->maxRequestSize) {
+        return;
+    }
+
+    tuner->maxRequestSize = length;
+    tuner->requestSize = MIN(tuner->requestSize, length);
+}
+
+/** Feed a completed request, returns true if window or request size changed */
+static BOOL sftp_read_tuner_sample(SSHKitSFTPReadTuner *tuner, CFTimeInterval rtt, uint32_t length, CFAbsoluteTime now) {
+    if (tuner->minRTT == 0 || rtt < tuner->minRTT) {
+        tuner->minRTT = rtt;
+    }
+    tuner->smoothedRTT = tuner->smoothedRTT == 0 ? rtt : tuner->smoothedRTT * 0.875 + rtt * 0.125;
+    tuner->intervalBytes += length;
+
+    CFTimeInterval interval = now - tuner->intervalStart;
+    if (interval < MAX(0.1, tuner->minRTT * 2)) {
+        return NO;
+    }
+
+    double lastBytesPerSecond = tuner->bytesPerSecond;
+    tuner->bytesPerSecond = tuner->intervalBytes / interval;
+    tuner->intervalStart = now;
+    tuner->intervalBytes = 0;
+
+    NSUInteger window = tuner->window;
+    uint32_t requestSize = tuner->requestSize;
+    BOOL queueing = tuner->smoothedRTT > tuner->minRTT * 2;
+
+    if (queueing) {
+        double bdp = tuner->bytesPerSecond * tuner->minRTT;
+        NSUInteger target = (NSUInteger)ceil(bdp * 2 / requestSize);
+        if (target < window) {
+            window = MAX(target, tuner->minWindow);
+        }
+    } else if (tuner->bytesPerSecond > lastBytesPerSecond * 1.1) {
+        window = MIN(window * 2, tuner->maxWindow);
+    }
+
+    if (window == tuner->maxWindow && !queueing) {
+        requestSize = MIN(requestSize * 2, tuner->maxRequestSize);
+    } else if (window == tuner->minWindow && queueing) {
+        requestSize = MAX(requestSize / 2, tuner->minRequestSize);
+    }
+
+    BOOL changed = window != tuner->window || requestSize != tuner->requestSize;
+    tuner->window = window;
+    tuner->requestSize = requestSize;
+
+    return changed;
+}
+
 @interface SSHKitSFTPFile () {
     dispatch_group_t _readChunkGroup;
     unsigned long long _totalBytes;
     dispatch_queue_t _readChunkQueue;
-    int _requestIds[CONCURRENT_REQ_COUNT];
+    unsigned long long _transferLength;
+
+    // READ requests in flight, a ring buffer with maxWindow slots
+    SSHKitSFTPReadRequest *_readRequests;
+    NSUInteger _readHead;
+    NSUInteger _readCount;
+    unsigned long long _readOffset;
+    SSHKitSFTPReadTuner _readTuner;
+    BOOL _readEof;
+    
+    // download straight into a local file, -1 when data goes to readFileBlock
+    int _sinkFd;
+    BOOL _sinkOwnsFd;
+    NSString *_sinkPath;
+    SSHKitSFTPDownloadOptions _sinkOptions;
+    
+    // upload straight from a local file, -1 when data comes from writeFileBlock
+    int _sourceFd;
+    BOOL _sourceOwnsFd;
+    NSString *_sourcePath;
+    unsigned long long _sourceEnd;
+    unsigned long long _sourcePrefetchedTo;
+    const char *_sourceMap;         // whole file mapped read-only, NULL unless asked for
+    size_t _sourceMapLength;
+    char *_sourceBuffer;            // pooled read-ahead buffer otherwise
+    unsigned long long _sourceBufferOffset;
+    size_t _sourceBufferLength;
+
+    // WRITE requests in flight
+    SSHKitSFTPWriteRequest _writeRequests[CONCURRENT_REQ_COUNT];
+    int _writeHead;
+    int _writeCount;
+    unsigned long long _writeOffset;
+    BOOL _writeSourceFinished;
+
+    char *_transferBuffer;
+    NSUInteger _handleGeneration;   // connectionGeneration of sftp the handles were opened on
+    CFAbsoluteTime _transferStartedAt;
+    CFAbsoluteTime _transferFinishedAt;
+    unsigned long long _transferStartOffset;
+    unsigned long long _committedOffset;
+    CFAbsoluteTime _progressUpdatedAt;
+    unsigned long _bytesAfterLastUpdate;
+    
+    // metrics of current or last transfer
+    NSUInteger _requestsSent;
+    unsigned long long _peakBytesInFlight;
+    SSHKitLatencyHistogram *_requestLatency;
+    
+    // batched directory listing
+    SSHKitSFTPDirectoryBatchBlock _listBatchBlock;
+    SSHKitSFTPDirectoryCompletionBlock _listCompletionBlock;
+    NSUInteger _listRequestCount;
+    NSError *_listError;
+    BOOL _listFinished;
+    BOOL _listCancelled;
+    
+    BOOL _hasPosixPermissions;
 }
 
 @property (nonatomic, readwrite) BOOL isDirectory;
@@ -29,7 +419,6 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
 @property (nonatomic, strong) NSDate *creationDate;
 @property (nonatomic, strong) NSDate *modificationDate;
 @property (nonatomic, strong) NSDate *lastAccess;
-@property (nonatomic, strong) NSNumber *fileSize;
 @property (nonatomic, readwrite) unsigned long ownerUserID;
 @property (nonatomic, readwrite) unsigned long ownerGroupID;
 @property (nonatomic, strong) NSString *ownerUserName;
@@ -39,6 +428,7 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
 
 @property (nonatomic) SSHKitFileStage stage;
 @property (nonatomic, copy) SSHKitSFTPClientReadFileBlock readFileBlock;
+@property (nonatomic, copy) SSHKitSFTPClientWriteFileBlock writeFileBlock;
 @property (nonatomic, copy) SSHKitSFTPClientProgressBlock progressBlock;
 @property (nonatomic, copy) SSHKitSFTPClientSuccessBlock fileTransferSuccessBlock;
 @property (nonatomic, copy) SSHKitSFTPClientFailureBlock fileTransferFailBlock;
@@ -47,9 +437,22 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
 
 @implementation SSHKitSFTPFile
 
+// transfer defaults shared by all initializers
+- (instancetype)init {
+    if ((self = [super init])) {
+        _minConcurrentRequests = 4;
+        _maxConcurrentRequests = 256;
+        _minRequestSize = 8192;
+        _maxRequestSize = 65536;
+        _sinkFd = -1;
+        _sourceFd = -1;
+    }
+    return self;
+}
+
 - (instancetype)init:(SSHKitSFTPChannel *)sftp path:(NSString *)path isDirectory:(BOOL)isDirectory {
     // https://github.com/dleehr/DLSFTPClient/blob/master/
-    if ((self = [super init])) {
+    if ((self = [self init])) {
         _readChunkGroup = dispatch_group_create();
         _readChunkQueue = dispatch_queue_create("com.codinn.readchunk", DISPATCH_QUEUE_SERIAL);
         self.isDirectory = isDirectory;
@@ -60,8 +463,15 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     return self;
 }
 
+- (void)dealloc {
+    [self doCloseSink];
+    [self doCloseSource];
+    free(_transferBuffer);
+    free(_readRequests);
+}
+
 - (instancetype)initWithSFTPAttributes:(sftp_attributes)fileAttributes parentPath:(NSString *)parentPath {
-    if ((self = [super init])) {
+    if ((self = [self init])) {
         [self populateValuesFromSFTPAttributes:fileAttributes parentPath:parentPath];
     }
     return self;
@@ -80,7 +490,7 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     SSHKitSFTPFile* directory = [SSHKitSFTPFile initDirectory:sftpChannel path:path];
     __block NSError *error;
 
-    [sftpChannel.session dispatchSyncOnSessionQueue:^{
+    [sftpChannel dispatchSyncOnSessionQueue:^{
         error = [SSHKitSFTPFile returnErrorIfNotConnected:sftpChannel.session];
         if (error) {
             return_from_block;
@@ -103,7 +513,7 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     SSHKitSFTPFile* file = [SSHKitSFTPFile initFile:sftpChannel path:path];
     __block NSError *error;
 
-    [sftpChannel.session dispatchSyncOnSessionQueue:^{
+    [sftpChannel dispatchSyncOnSessionQueue:^{
         error = [SSHKitSFTPFile returnErrorIfNotConnected:sftpChannel.session];
         if (error) {
             return_from_block;
@@ -126,7 +536,7 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     SSHKitSFTPFile* file = [SSHKitSFTPFile initFile:sftpChannel path:path];
     __block NSError *error;
 
-    [sftpChannel.session dispatchSyncOnSessionQueue:^{
+    [sftpChannel dispatchSyncOnSessionQueue:^{
         error = [SSHKitSFTPFile returnErrorIfNotConnected:sftpChannel.session];
         if (error) {
             return_from_block;
@@ -149,7 +559,7 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     SSHKitSFTPFile* file = [SSHKitSFTPFile initFile:sftpChannel path:path];
     __block NSError *error;
     
-    [sftpChannel.session dispatchSyncOnSessionQueue:^{
+    [sftpChannel dispatchSyncOnSessionQueue:^{
         error = [SSHKitSFTPFile returnErrorIfNotConnected:sftpChannel.session];
         if (error) {
             return_from_block;
@@ -174,14 +584,16 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     __weak SSHKitSFTPFile *weakSelf = self;
     __block NSError *error;
 
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
+    [self.sftp dispatchSyncOnSessionQueue:^{
         __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        [strongSelf doDropStaleHandles];
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
         }
 
         strongSelf->_rawDirectory = sftp_opendir(strongSelf.sftp.rawSFTPSession, [strongSelf.fullFilename UTF8String]);
+        strongSelf->_handleGeneration = strongSelf.sftp.connectionGeneration;
     }];
 
     if (error) {
@@ -200,17 +612,33 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
                                         code:SSHKitSFTPErrorCodeGenericFailure
                                     userInfo: @{ NSLocalizedDescriptionKey : @"Session not connected" }];
     }
+    SSHKitSFTPAttributeCache *cache = self.sftp.attributeCache;
+    SSHKitSFTPDirectoryEntry entry;
+    BOOL exists = NO;
+    
+    if ([cache lookupAttributes:&entry path:self.fullFilename followLinks:NO exists:&exists]) {
+        if (!exists) {
+            return sftp_no_such_file_error();
+        }
+        [self populateValuesFromDirectoryEntry:&entry];
+        return nil;
+    }
+    
     __block sftp_attributes file_attributes = NULL;
+    __block int errorCode = SSH_FX_OK;
     __weak SSHKitSFTPFile *weakSelf = self;
     __block NSError *error;
 
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
+    [self.sftp dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
         }
 
         file_attributes = sftp_lstat(weakSelf.sftp.rawSFTPSession, [weakSelf.fullFilename UTF8String]);
+        if (!file_attributes) {
+            errorCode = sftp_get_error(weakSelf.sftp.rawSFTPSession);
+        }
     }];
 
     if (error) {
@@ -218,9 +646,16 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     }
 
     if (file_attributes == NULL) {
+        if (errorCode == SSH_FX_NO_SUCH_FILE) {
+            [cache storeMissingPath:self.fullFilename];
+        }
         return self.sftp.session.libsshError;
     }
     [self populateValuesFromSFTPAttributes:file_attributes parentPath:nil];
+    if (cache) {
+        sftp_directory_entry_from_attributes(&entry, file_attributes);
+        [cache storeAttributes:&entry path:self.fullFilename followLinks:NO];
+    }
     [SSHKitSFTPChannel freeSFTPAttributes:file_attributes];
     return nil;
 }
@@ -239,7 +674,21 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
         return error;
     }
     
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
+    SSHKitSFTPAttributeCache *cache = self.sftp.attributeCache;
+    SSHKitSFTPDirectoryEntry entry;
+    BOOL exists = NO;
+    
+    if ([cache lookupAttributes:&entry path:self.fullFilename followLinks:YES exists:&exists]) {
+        if (!exists) {
+            return sftp_no_such_file_error();
+        }
+        SSHKitSFTPFile *symlinkTarget = [[SSHKitSFTPFile alloc] init:self.sftp path:symlinkTargetPath isDirectory:NO];
+        [symlinkTarget populateValuesFromDirectoryEntry:&entry];
+        self->_symlinkTarget = symlinkTarget;
+        return nil;
+    }
+    
+    [self.sftp dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -260,6 +709,11 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     symlinkTarget.filename = [symlinkTargetPath lastPathComponent];
     self->_symlinkTarget = symlinkTarget;
     
+    if (cache) {
+        sftp_directory_entry_from_attributes(&entry, file_attributes);
+        [cache storeAttributes:&entry path:self.fullFilename followLinks:YES];
+    }
+    
     [SSHKitSFTPChannel freeSFTPAttributes:file_attributes];
     return nil;
 }
@@ -317,14 +771,16 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     __weak SSHKitSFTPFile *weakSelf = self;
     __block NSError *error;
 
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
+    [self.sftp dispatchSyncOnSessionQueue:^{
         __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        [strongSelf doDropStaleHandles];
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
         }
 
         strongSelf->_rawFile = sftp_open(strongSelf.sftp.rawSFTPSession, [strongSelf.fullFilename UTF8String], accessType, mode);
+        strongSelf->_handleGeneration = strongSelf.sftp.connectionGeneration;
     }];
 
     if (error) {
@@ -334,16 +790,150 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     if (_rawFile == NULL) {
         return self.sftp.session.libsshError;
     }
+    if (accessType & (O_WRONLY | O_RDWR)) {
+        [self.sftp.attributeCache invalidatePath:self.fullFilename];
+    }
     return nil;
 }
 
+#pragma mark - non-blocking open/stat/close
+
++ (void)doOpenFile:(SSHKitSFTPChannel *)sftpChannel path:(NSString *)path accessType:(int)accessType mode:(unsigned long)mode completion:(void (^)(SSHKitSFTPFile *file, NSError *error))completion {
+    const char *filename = path.UTF8String;
+    __weak SSHKitSFTPChannel *weakChannel = sftpChannel;
+    
+    int rc = [sftpChannel doSendRequest:SSH_FXP_OPEN fields:^BOOL(ssh_buffer buffer) {
+        return sftp_buffer_add_cstring(buffer, filename)
+            && sftp_buffer_add_u32(buffer, sftp_open_flags(accessType))
+            && sftp_buffer_add_u32(buffer, SSH_FILEXFER_ATTR_PERMISSIONS)
+            && sftp_buffer_add_u32(buffer, (uint32_t)mode);
+    } replyHandler:^(uint8_t type, ssh_buffer payload) {
+        __strong SSHKitSFTPChannel *strongChannel = weakChannel;
+        
+        if (type != SSH_FXP_HANDLE || !payload) {
+            completion(nil, [strongChannel errorFromStatusPayload:payload]);
+            return_from_block;
+        }
+        
+        ssh_string handle = sftp_buffer_get_string(payload);
+        sftp_file rawFile = handle ? calloc(1, sizeof(struct sftp_file_struct)) : NULL;
+        if (!rawFile) {
+            ssh_string_free(handle);
+            completion(nil, [strongChannel errorFromStatusPayload:NULL]);
+            return_from_block;
+        }
+        
+        rawFile->sftp = strongChannel.rawSFTPSession;
+        rawFile->name = strdup(path.UTF8String);
+        rawFile->handle = handle;
+        
+        SSHKitSFTPFile *file = [[SSHKitSFTPFile alloc] init:strongChannel path:path isDirectory:NO];
+        file->_rawFile = rawFile;
+        file->_handleGeneration = strongChannel.connectionGeneration;
+        
+        if (accessType & (O_WRONLY | O_RDWR)) {
+            [strongChannel.attributeCache invalidatePath:path];
+        }
+        
+        completion(file, nil);
+    }];
+    
+    if (rc < 0) {
+        completion(nil, sftpChannel.session.libsshError);
+    }
+}
+
++ (void)doStatFile:(SSHKitSFTPChannel *)sftpChannel path:(NSString *)path completion:(void (^)(SSHKitSFTPFile *file, NSError *error))completion {
+    SSHKitSFTPDirectoryEntry entry;
+    BOOL exists = NO;
+    
+    if ([sftpChannel.attributeCache lookupAttributes:&entry path:path followLinks:YES exists:&exists]) {
+        if (!exists) {
+            completion(nil, sftp_no_such_file_error());
+            return;
+        }
+        SSHKitSFTPFile *file = [[SSHKitSFTPFile alloc] init:sftpChannel path:path isDirectory:NO];
+        [file populateValuesFromDirectoryEntry:&entry];
+        completion(file, nil);
+        return;
+    }
+    
+    const char *filename = path.UTF8String;
+    __weak SSHKitSFTPChannel *weakChannel = sftpChannel;
+    
+    int rc = [sftpChannel doSendRequest:SSH_FXP_STAT fields:^BOOL(ssh_buffer buffer) {
+        return sftp_buffer_add_cstring(buffer, filename);
+    } replyHandler:^(uint8_t type, ssh_buffer payload) {
+        __strong SSHKitSFTPChannel *strongChannel = weakChannel;
+        
+        if (type != SSH_FXP_ATTRS || !payload) {
+            NSError *error = [strongChannel errorFromStatusPayload:payload];
+            if (payload && error.code == SSHKitSFTPErrorCodeNoSuchFile) {
+                [strongChannel.attributeCache storeMissingPath:path];
+            }
+            completion(nil, error);
+            return_from_block;
+        }
+        
+        sftp_attributes attributes = sftp_parse_attr(strongChannel.rawSFTPSession, payload, 0);
+        if (!attributes) {
+            completion(nil, [strongChannel errorFromStatusPayload:NULL]);
+            return_from_block;
+        }
+        
+        SSHKitSFTPFile *file = [[SSHKitSFTPFile alloc] initWithSFTPAttributes:attributes parentPath:nil];
+        file->_sftp = strongChannel;
+        file.fullFilename = path;
+        file.filename = path.lastPathComponent;
+        
+        SSHKitSFTPAttributeCache *cache = strongChannel.attributeCache;
+        if (cache) {
+            SSHKitSFTPDirectoryEntry entry;
+            sftp_directory_entry_from_attributes(&entry, attributes);
+            [cache storeAttributes:&entry path:path followLinks:YES];
+        }
+        [SSHKitSFTPChannel freeSFTPAttributes:attributes];
+        
+        completion(file, nil);
+    }];
+    
+    if (rc < 0) {
+        completion(nil, sftpChannel.session.libsshError);
+    }
+}
+
+- (void)doCloseFile {
+    if (self.stage == SSHKitFileStageDraining) {
+        [self drainPendingRequests:NO];
+        self.stage = SSHKitFileStageNone;
+    }
+    [self.sftp.remoteFiles removeObject:self];
+    [self doDropStaleHandles];
+    
+    sftp_file rawFile = _rawFile;
+    _rawFile = NULL;
+    if (!rawFile) {
+        return;
+    }
+    
+    [self.sftp doSendRequest:SSH_FXP_CLOSE fields:^BOOL(ssh_buffer buffer) {
+        return sftp_buffer_add_string(buffer, rawFile->handle);
+    } replyHandler:^(uint8_t type, ssh_buffer payload) {
+        // nothing could be done if server failed to close the handle
+    }];
+    
+    ssh_string_free(rawFile->handle);
+    free(rawFile->name);
+    free(rawFile);
+}
+
 #pragma mark - SFTP Function warper
 
 - (void)seek64:(unsigned long long)offset {
     __weak SSHKitSFTPFile *weakSelf = self;
     __block NSError *error;
 
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
+    [self.sftp dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -353,19 +943,21 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     }];
 }
 
-- (int)asyncReadBegin:(NSError **)errorPtr {
+- (int)asyncReadBegin:(uint32_t)length offset:(unsigned long long)offset errorPtr:(NSError **)errorPtr {
     __weak SSHKitSFTPFile *weakSelf = self;
     __block NSError *error;
-    __block int requestNo = 0;
+    __block int requestNo = -1;
 
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
+    [self.sftp dispatchSyncOnSessionQueue:^{
         __strong SSHKitSFTPFile *strongSelf = weakSelf;
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
         }
 
-        requestNo = sftp_async_read_begin(strongSelf.rawFile, MAX_XFER_BUF_SIZE);
+        // sftp_async_read moves file offset back on a short read, so always position explicitly
+        sftp_seek64(strongSelf.rawFile, offset);
+        requestNo = sftp_async_read_begin(strongSelf.rawFile, length);
     }];
 
     if (requestNo < 0) {
@@ -381,33 +973,80 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     return requestNo;
 }
 
--(long)sftpWrite:(const void *)buffer size:(long)size errorPtr:(NSError **)errorPtr{
-    __block long writeLength = 0;
+- (int)asyncWriteBegin:(const void *)buffer length:(uint32_t)length offset:(unsigned long long)offset errorPtr:(NSError **)errorPtr {
     __weak SSHKitSFTPFile *weakSelf = self;
     __block NSError *error;
+    __block int requestNo = -1;
     
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
-        // ssh_set_blocking(weakSelf.sftp.session.rawSession, 1);
-        sftp_file_set_blocking(weakSelf.rawFile);
+    [self.sftp dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
         }
+        
+        requestNo = sftp_async_write_begin(weakSelf.rawFile, buffer, length, offset);
+    }];
+    
+    if (requestNo < 0) {
+        if (errorPtr) {
+            if (!error) {
+                error = self.sftp.session.libsshError;
+            }
+            *errorPtr = error ?: [self genericTransferError:@"Failed to send write request"];
+        }
+    }
+    
+    return requestNo;
+}
 
-        writeLength = sftp_write(weakSelf.rawFile, buffer, size);
+- (BOOL)asyncWriteEnd:(int)asyncRequest errorPtr:(NSError **)errorPtr {
+    __weak SSHKitSFTPFile *weakSelf = self;
+    __block NSError *error;
+    __block int result = SSH_ERROR;
+    
+    [self.sftp dispatchSyncOnSessionQueue:^{
+        error = [weakSelf returnErrorIfNotConnected];
+        if (error) {
+            return_from_block;
+        }
+        
+        result = sftp_async_write_end(weakSelf.rawFile, asyncRequest, NO);
     }];
     
-    if (writeLength < 0) {
+    if (result != SSH_OK) {
         if (errorPtr) {
-            if (error) {
-                *errorPtr = error;
-            } else {
-                *errorPtr = self.sftp.libsshSFTPError;
+            if (!error) {
+                error = self.sftp.libsshSFTPError;
             }
+            *errorPtr = error ?: [self genericTransferError:@"Failed to write file"];
+        }
+        return NO;
+    }
+    
+    return YES;
+}
+
+/** Block until remote window reopened, only used when no request is in flight */
+- (BOOL)waitForWritableWindow:(NSError **)errorPtr {
+    __weak SSHKitSFTPFile *weakSelf = self;
+    __block int result = SSH_ERROR;
+    
+    [self.sftp dispatchSyncOnSessionQueue:^{
+        if ([weakSelf returnErrorIfNotConnected]) {
+            return_from_block;
+        }
+        
+        result = ssh_channel_poll_timeout(weakSelf.sftp.rawChannel, 100, 0);
+    }];
+    
+    if (result == SSH_ERROR || result == SSH_EOF) {
+        if (errorPtr) {
+            *errorPtr = self.sftp.session.libsshError;
         }
+        return NO;
     }
     
-    return writeLength;
+    return YES;
 }
 
 #pragma mark - read/write file
@@ -419,7 +1058,7 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     __weak SSHKitSFTPFile *weakSelf = self;
     __block NSError *error;
     
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
+    [self.sftp dispatchSyncOnSessionQueue:^{
         error = [weakSelf returnErrorIfNotConnected];
         if (error) {
             return_from_block;
@@ -449,219 +1088,1145 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
         __strong SSHKitSFTPFile *strongSelf = weakSelf;
         // if not in transfer mode, ignore it.
         if (strongSelf == nil) return;
-        if (strongSelf.stage == SSHKitFileStageNone) {
+        if (strongSelf.stage != SSHKitFileStageReadingFile && strongSelf.stage != SSHKitFileStageWritingFile) {
             return;
         }
         
-        strongSelf.stage = SSHKitFileStageNone;
         NSError *lastError = error;
         if (!lastError) {
             lastError = strongSelf.sftp.libsshSFTPError;
         }
         
-        strongSelf.fileTransferFailBlock(lastError);
+        [strongSelf doFinishTransfer:lastError ?: [strongSelf genericTransferError:@"Transfer failed"]];
     }];
 }
 
-- (void)asyncBeginReadChunk {
-    NSError *error;
-    for (int i=0; i<CONCURRENT_REQ_COUNT; ++i){
-        _requestIds[i] = 0;
-    }
-    
-    self.stage = SSHKitFileStageReadingFile;
+#pragma mark - transfer engine
+
+/**
+ Transfers are driven by the socket read source of session, like `doOpen` / `doWrite` of channels:
+ every time replies arrive, SSHKitSFTPChannel calls `doTransfer` of each transferring file, which handles
+ at most SFTP_TRANSFER_BUDGET replies without blocking, so other channels of the session still get served.
+ 
+ @return YES if the budget ran out while more replies may be ready, caller should schedule another run
+ */
+- (BOOL)doTransfer {
+    NSAssert([self.sftp.session isOnSessionQueue], @"Must be dispatched on session queue");
     
-    unsigned long long beginReadBytes = _totalBytes;
-    for (int i = 0; i < CONCURRENT_REQ_COUNT; i++) {
-        if (beginReadBytes >= self.fileSize.unsignedLongLongValue) {
-            return;
-        }
-        
-        if (self.stage != SSHKitFileStageReadingFile) {
-            return;
-        }
-        
-        int requestNo = [self asyncReadBegin:&error];
-        if (error) {
-            [self doFileTransferFail:error];
-            return;
-        }
-        _requestIds[i] = requestNo;
-        beginReadBytes += MAX_XFER_BUF_SIZE;
+    switch (self.stage) {
+        case SSHKitFileStageReadingFile:
+            return [self doReadFile];
+            
+        case SSHKitFileStageWritingFile:
+            return [self doWriteFile];
+            
+        case SSHKitFileStageDraining:
+            if ([self drainPendingRequests:YES]) {
+                self.stage = SSHKitFileStageNone;
+            }
+            return NO;
+            
+        default:
+            return NO;
     }
 }
 
-- (void)asyncReadChunk:(NSError **)errorPtr {
-    BOOL isFinished = NO;
-    NSError *error;
+/** Reply of the oldest request was already read from channel while waiting for another one */
+- (BOOL)hasQueuedReply {
+    sftp_session sftp = self.sftp.rawSFTPSession;
+    if (!sftp) {
+        return NO;
+    }
     
-    char *buffer = malloc(sizeof(char) * MAX_XFER_BUF_SIZE);
-    int i = 0;
+    if (_readCount && _sinkFd >= 0) {
+        // replies of a download to local file are taken in any order
+        for (NSUInteger i = 0; i < _readCount; i++) {
+            SSHKitSFTPReadRequest request = _readRequests[(_readHead + i) % _readTuner.maxWindow];
+            if (request.requestId >= 0 && SSHKitSFTPIsReplyQueued(sftp, request.requestId)) {
+                return YES;
+            }
+        }
+        return NO;
+    }
     
-    NSDate *lastUpdatedOn = [NSDate date];
-    int readedBytesAfterLastUpdate = 0;
+    if (_readCount) {
+        return SSHKitSFTPIsReplyQueued(sftp, _readRequests[_readHead].requestId);
+    }
     
-    if (_totalBytes == self.fileSize.longLongValue) {
-        self.fileTransferSuccessBlock();
-        isFinished = YES;
+    if (_writeCount) {
+        return SSHKitSFTPIsReplyQueued(sftp, _writeRequests[_writeHead].requestId);
     }
     
-    while(_totalBytes < self.fileSize.unsignedLongLongValue){
-        @autoreleasepool {
-            if (self.stage != SSHKitFileStageReadingFile) {
-                free(buffer);
-                self.progressBlock(readedBytesAfterLastUpdate, _totalBytes, self.fileSize.longLongValue);
-                return;
-            }
-            int requestNo = _requestIds[i];
-            int readBytes = [self asyncRead:requestNo buffer:buffer errorPtr:&error];
-            
-            if (!error) {
-                _requestIds[i] = [self asyncReadBegin:&error];
-            }
-            
+    return NO;
+}
+
+- (void)doReportProgress:(BOOL)force {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (!force && now - _progressUpdatedAt < 0.1) {
+        return;
+    }
+    
+    unsigned long long bytesTotal = self.stage == SSHKitFileStageWritingFile ? MAX(_transferLength, _totalBytes) : self.fileSize.unsignedLongLongValue;
+    self.progressBlock(_bytesAfterLastUpdate, _totalBytes, bytesTotal);
+    _progressUpdatedAt = now;
+    _bytesAfterLastUpdate = 0;
+}
+
+/**
+ Discard replies of requests still in flight after a failure or cancellation,
+ otherwise they will stay in libssh sftp message queue forever.
+ 
+ @return YES if nothing left in flight
+ */
+- (BOOL)drainPendingRequests:(BOOL)nonblocking {
+    sftp_file file = self.rawFile;
+    
+    while (_readCount) {
+        SSHKitSFTPReadRequest request = _readRequests[_readHead];
+        // a negative id is a request already answered out of order
+        if (request.requestId >= 0 && file && self.sftp.session.isConnected) {
+            int rc = sftp_async_reply(file, _transferBuffer, request.length, request.requestId, nonblocking);
+            if (rc == SSH_AGAIN) {
+                return NO;
+            }
+        }
+        
+        _readHead = (_readHead + 1) % _readTuner.maxWindow;
+        _readCount--;
+    }
+    
+    while (_writeCount) {
+        SSHKitSFTPWriteRequest request = _writeRequests[_writeHead];
+        if (file && self.sftp.session.isConnected) {
+            if (sftp_async_write_end(file, request.requestId, nonblocking) == SSH_AGAIN) {
+                return NO;
+            }
+        }
+        
+        _writeHead = (_writeHead + 1) % CONCURRENT_REQ_COUNT;
+        _writeCount--;
+    }
+    
+    free(_transferBuffer);
+    _transferBuffer = NULL;
+    free(_readRequests);
+    _readRequests = NULL;
+    
+    return YES;
+}
+
+/**
+ End current transfer, a nil error means it succeeded. Requests still in flight are drained
+ in background, the file stays in `remoteFiles` until then.
+ */
+- (void)doFinishTransfer:(NSError *)error {
+    SSHKitFileStage stage = self.stage;
+    if (stage != SSHKitFileStageReadingFile && stage != SSHKitFileStageWritingFile) {
+        return;
+    }
+    
+    [self doUpdateCommittedOffset];
+    
+    [self doReportProgress:YES];
+    _transferFinishedAt = CFAbsoluteTimeGetCurrent();
+    
+    if (stage == SSHKitFileStageWritingFile) {
+        // only acknowledged bytes count, so a retry continues from the right position
+        sftp_seek64(self.rawFile, _totalBytes);
+        [self.sftp.attributeCache invalidatePath:self.fullFilename];
+    }
+    
+    [self doCloseSink];
+    [self doCloseSource];
+    
+    self.stage = SSHKitFileStageDraining;
+    if ([self drainPendingRequests:YES]) {
+        self.stage = SSHKitFileStageNone;
+    }
+    
+    if (error) {
+        self.fileTransferFailBlock(error);
+        return;
+    }
+    
+    self.fileTransferSuccessBlock();
+}
+
+- (void)doUpdateCommittedOffset {
+    _committedOffset = _totalBytes;
+    
+    if (_sinkFd < 0) {
+        // replies are taken in order, and writes are acknowledged in order
+        return;
+    }
+    
+    // replies to a local file are written as they come, first range still missing ends what is on disk
+    for (NSUInteger i = 0; i < _readCount; i++) {
+        SSHKitSFTPReadRequest request = _readRequests[(_readHead + i) % _readTuner.maxWindow];
+        if (request.requestId >= 0) {
+            _committedOffset = request.offset;
+            return;
+        }
+    }
+}
+
+/** Stop a running transfer, replies of requests in flight are drained as long as the channel is open */
+- (void)doCancelTransfer:(NSError *)error {
+    if (!self.rawFile || self.sftp.stage != SSHKitChannelStageReady || !self.sftp.session.isConnected) {
+        [self doAbortTransfer:error];
+        return;
+    }
+    
+    [self doFinishTransfer:error];
+}
+
+/** Channel was closed, nothing can be drained any more */
+- (void)doAbortTransfer:(NSError *)error {
+    SSHKitFileStage stage = self.stage;
+    
+    if (stage == SSHKitFileStageReadingFile || stage == SSHKitFileStageWritingFile) {
+        [self doUpdateCommittedOffset];
+    }
+    
+    _readCount = 0;
+    _writeCount = 0;
+    [self drainPendingRequests:YES];
+    [self doCloseSink];
+    [self doCloseSource];
+    self.stage = SSHKitFileStageNone;
+    
+    if (stage == SSHKitFileStageReadingFile || stage == SSHKitFileStageWritingFile) {
+        self.fileTransferFailBlock(error);
+    }
+}
+
+/** Issue READ requests until the window is full or the whole file is requested */
+- (BOOL)fillReadWindow:(NSError **)errorPtr {
+    unsigned long long fileSize = self.fileSize.unsignedLongLongValue;
+    
+    while (!_readEof && _readCount < _readTuner.window && _readOffset < fileSize) {
+        uint32_t length = (uint32_t)MIN((unsigned long long)_readTuner.requestSize, fileSize - _readOffset);
+        int requestNo = [self asyncReadBegin:length offset:_readOffset errorPtr:errorPtr];
+        if (requestNo < 0) {
+            return NO;
+        }
+        
+        _readRequests[(_readHead + _readCount) % _readTuner.maxWindow] = (SSHKitSFTPReadRequest){ requestNo, length, _readOffset, CFAbsoluteTimeGetCurrent() };
+        _readCount++;
+        _requestsSent++;
+        _readOffset += length;
+    }
+    
+    // window is full now, holes left by replies taken out of order are not in flight
+    unsigned long long bytesInFlight = 0;
+    for (NSUInteger i = 0; i < _readCount; i++) {
+        SSHKitSFTPReadRequest request = _readRequests[(_readHead + i) % _readTuner.maxWindow];
+        if (request.requestId >= 0) {
+            bytesInFlight += request.length;
+        }
+    }
+    _peakBytesInFlight = MAX(_peakBytesInFlight, bytesInFlight);
+    
+    return YES;
+}
+
+- (BOOL)doReadFile {
+    if (_sinkFd >= 0) {
+        return [self doReadFileToSink];
+    }
+    
+    unsigned long long fileSize = self.fileSize.unsignedLongLongValue;
+    NSError *error = nil;
+    
+    for (int budget = SFTP_TRANSFER_BUDGET; budget > 0; budget--) {
+        if (_totalBytes >= fileSize) {
+            [self doFinishTransfer:nil];
+            return NO;
+        }
+        
+        if (![self fillReadWindow:&error]) {
+            [self doFinishTransfer:error ?: [self genericTransferError:@"Failed to read file"]];
+            return NO;
+        }
+        
+        SSHKitSFTPReadRequest request = _readRequests[_readHead];
+        int readBytes = sftp_async_reply(self.rawFile, _transferBuffer, request.length, request.requestId, YES);
+        if (readBytes == SSH_AGAIN) {
+            return NO;
+        }
+        
+        _readHead = (_readHead + 1) % _readTuner.maxWindow;
+        _readCount--;
+        
+        if (readBytes < 0) {
+            [self doFinishTransfer:self.sftp.libsshSFTPError ?: [self genericTransferError:@"Failed to read file"]];
+            return NO;
+        }
+        
+        if (readBytes == 0) {  // file is shorter than expected
+            [self doFinishTransfer:nil];
+            return NO;
+        }
+        
+        if ((uint32_t)readBytes < request.length) {
+            // server caps the size of a single read, ask for the rest right away and keep it
+            // at head of the ring, so readFileBlock still sees data in file order
+            sftp_read_tuner_limit_request_size(&_readTuner, readBytes);
+            
+            SSHKitSFTPReadRequest rest = { 0, request.length - readBytes, request.offset + readBytes, CFAbsoluteTimeGetCurrent() };
+            rest.requestId = [self asyncReadBegin:rest.length offset:rest.offset errorPtr:&error];
+            if (rest.requestId < 0) {
+                [self doFinishTransfer:error ?: [self genericTransferError:@"Failed to read file"]];
+                return NO;
+            }
+            
+            _readHead = (_readHead + _readTuner.maxWindow - 1) % _readTuner.maxWindow;
+            _readRequests[_readHead] = rest;
+            _readCount++;
+            _requestsSent++;
+        }
+        
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        [_requestLatency recordValue:now - request.issuedAt];
+        
+        _totalBytes += readBytes;
+        _bytesAfterLastUpdate += readBytes;
+        
+        self.readFileBlock(_transferBuffer, readBytes);
+        
+        if (sftp_read_tuner_sample(&_readTuner, now - request.issuedAt, readBytes, now) && self.transferStatsBlock) {
+            self.transferStatsBlock(_readTuner.window, _readTuner.requestSize, _readTuner.smoothedRTT, _readTuner.bytesPerSecond);
+        }
+        
+        [self doReportProgress:NO];
+        
+        if (self.stage != SSHKitFileStageReadingFile) {
+            // cancelled or failed from a callback
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+/** Called on session queue, sets up the READ pipeline and kicks off the transfer */
+- (void)doStartReadingFile:(unsigned long long)offset {
+    if (self.stage == SSHKitFileStageDraining) {
+        // previous transfer is still in flight
+        [self drainPendingRequests:NO];
+    }
+    
+    if (self.adaptiveTransfer) {
+        sftp_read_tuner_init(&_readTuner, self.minConcurrentRequests, self.maxConcurrentRequests, self.minRequestSize, self.maxRequestSize);
+    } else {
+        sftp_read_tuner_init(&_readTuner, CONCURRENT_REQ_COUNT, CONCURRENT_REQ_COUNT, MAX_XFER_BUF_SIZE, MAX_XFER_BUF_SIZE);
+    }
+    if (self.maxBytesInFlight) {
+        sftp_read_tuner_cap(&_readTuner, self.maxBytesInFlight);
+    }
+    
+    _readRequests = malloc(sizeof(SSHKitSFTPReadRequest) * _readTuner.maxWindow);
+    _readHead = 0;
+    _readCount = 0;
+    _readOffset = offset;
+    _totalBytes = offset;
+    _transferStartOffset = offset;
+    
+    // tuner only shrinks maxRequestSize, so the buffer fits every request
+    _transferBuffer = malloc(sizeof(char) * _readTuner.maxRequestSize);
+    _transferStartedAt = CFAbsoluteTimeGetCurrent();
+    _progressUpdatedAt = _transferStartedAt;
+    _transferFinishedAt = 0;
+    _requestsSent = 0;
+    _peakBytesInFlight = 0;
+    _requestLatency = [[SSHKitLatencyHistogram alloc] init];
+    _bytesAfterLastUpdate = 0;
+    _readEof = NO;
+    
+    self.stage = SSHKitFileStageReadingFile;
+    [self.sftp doTransfer];
+}
+
+- (void)asyncReadFile:(unsigned long long)offset
+        readFileBlock:(SSHKitSFTPClientReadFileBlock)readFileBlock
+        progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+        fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+        fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+    self.readFileBlock = readFileBlock;
+    self.progressBlock = progressBlock;
+    self.fileTransferFailBlock = fileTransferFailBlock;
+    self.fileTransferSuccessBlock = fileTransferSuccessBlock;
+    
+    __weak SSHKitSFTPFile *weakSelf = self;
+    
+    [self.sftp.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+        
+        NSError *error = [strongSelf returnErrorIfNotConnected];
+        if (error) {
+            strongSelf.fileTransferFailBlock(error);
+            return_from_block;
+        }
+        
+        strongSelf->_sinkFd = -1;
+        [strongSelf doStartReadingFile:offset];
+    }];
+}
+
+- (void)cancelAsyncReadFile {
+    __weak SSHKitSFTPFile *weakSelf = self;
+    [self.sftp.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        if (strongSelf.stage != SSHKitFileStageReadingFile) {
+            return_from_block;
+        }
+        
+        [strongSelf doReportProgress:YES];
+        [strongSelf doCloseSink];
+        strongSelf.stage = SSHKitFileStageDraining;
+        if ([strongSelf drainPendingRequests:YES]) {
+            strongSelf.stage = SSHKitFileStageNone;
+        }
+    }];
+}
+
+#pragma mark - download to local file
+
+/**
+ Same pipeline as doReadFile, but replies are taken in whatever order they arrive. A request answered
+ before the head of ring leaves a hole, marked by a negative id, which is skipped once it reaches the head.
+ */
+- (BOOL)doReadFileToSink {
+    unsigned long long fileSize = self.fileSize.unsignedLongLongValue;
+    NSError *error = nil;
+    
+    for (int budget = SFTP_TRANSFER_BUDGET; budget > 0; budget--) {
+        while (_readCount && _readRequests[_readHead].requestId < 0) {
+            _readHead = (_readHead + 1) % _readTuner.maxWindow;
+            _readCount--;
+        }
+        
+        if (!_readCount && (_readEof || _readOffset >= fileSize)) {
+            error = [self doTruncateSink];
+            if (!error && (_sinkOptions & SSHKitSFTPDownloadOptionSyncOnCompletion)) {
+                error = [self doSyncSink];
+            }
+            [self doFinishTransfer:error];
+            return NO;
+        }
+        
+        if (![self fillReadWindow:&error]) {
+            [self doFinishTransfer:error ?: [self genericTransferError:@"Failed to read file"]];
+            return NO;
+        }
+        
+        // reply of head is read from channel, others may have been queued meanwhile
+        NSUInteger slot = _readHead;
+        SSHKitSFTPReadRequest request = _readRequests[slot];
+        int readBytes = sftp_async_reply(self.rawFile, _transferBuffer, request.length, request.requestId, YES);
+        
+        for (NSUInteger i = 1; readBytes == SSH_AGAIN && i < _readCount; i++) {
+            slot = (_readHead + i) % _readTuner.maxWindow;
+            request = _readRequests[slot];
+            if (request.requestId >= 0 && SSHKitSFTPIsReplyQueued(self.sftp.rawSFTPSession, request.requestId)) {
+                readBytes = sftp_async_reply(self.rawFile, _transferBuffer, request.length, request.requestId, YES);
+            }
+        }
+        
+        if (readBytes == SSH_AGAIN) {
+            return NO;
+        }
+        
+        _readRequests[slot].requestId = -1;
+        
+        if (readBytes < 0) {
+            [self doFinishTransfer:self.sftp.libsshSFTPError ?: [self genericTransferError:@"Failed to read file"]];
+            return NO;
+        }
+        
+        if (readBytes == 0) {  // file is shorter than expected, wait for requests below this offset
+            _readEof = YES;
+            continue;
+        }
+        
+        if (!sftp_pwrite_fully(_sinkFd, _transferBuffer, readBytes, (off_t)request.offset)) {
+            [self doFinishTransfer:SSHKitPOSIXError(errno, _sinkPath)];
+            return NO;
+        }
+        
+        if ((uint32_t)readBytes < request.length) {
+            // server caps the size of a single read, the rest takes over the slot
+            sftp_read_tuner_limit_request_size(&_readTuner, readBytes);
+            
+            SSHKitSFTPReadRequest rest = { 0, request.length - readBytes, request.offset + readBytes, CFAbsoluteTimeGetCurrent() };
+            rest.requestId = [self asyncReadBegin:rest.length offset:rest.offset errorPtr:&error];
+            if (rest.requestId < 0) {
+                [self doFinishTransfer:error ?: [self genericTransferError:@"Failed to read file"]];
+                return NO;
+            }
+            
+            _readRequests[slot] = rest;
+            _requestsSent++;
+        }
+        
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        [_requestLatency recordValue:now - request.issuedAt];
+        
+        _totalBytes += readBytes;
+        _bytesAfterLastUpdate += readBytes;
+        
+        if (sftp_read_tuner_sample(&_readTuner, now - request.issuedAt, readBytes, now) && self.transferStatsBlock) {
+            self.transferStatsBlock(_readTuner.window, _readTuner.requestSize, _readTuner.smoothedRTT, _readTuner.bytesPerSecond);
+        }
+        
+        [self doReportProgress:NO];
+        
+        if (self.stage != SSHKitFileStageReadingFile) {
+            // cancelled from progress block
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+- (NSError *)doPreallocateSink {
+    off_t size = (off_t)self.fileSize.unsignedLongLongValue;
+    struct stat localStat;
+    
+    if (fstat(_sinkFd, &localStat) != 0) {
+        return SSHKitPOSIXError(errno, _sinkPath);
+    }
+    
+    if (localStat.st_size >= size) {
+        return nil;
+    }
+    
+#ifdef F_PREALLOCATE
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, size - localStat.st_size, 0 };
+    if (fcntl(_sinkFd, F_PREALLOCATE, &store) < 0) {
+        // contiguous space is a wish, any space will do, and none at all is not fatal
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(_sinkFd, F_PREALLOCATE, &store);
+    }
+#endif
+    
+    if (ftruncate(_sinkFd, size) != 0) {
+        return SSHKitPOSIXError(errno, _sinkPath);
+    }
+    
+    return nil;
+}
+
+/** Bytes of an older, longer local file past the end of the download are cut off */
+- (NSError *)doTruncateSink {
+    struct stat localStat;
+    
+    if (fstat(_sinkFd, &localStat) != 0) {
+        return SSHKitPOSIXError(errno, _sinkPath);
+    }
+    
+    // pipes and sockets have no length
+    if (!S_ISREG(localStat.st_mode) || localStat.st_size <= (off_t)_totalBytes) {
+        return nil;
+    }
+    
+    if (ftruncate(_sinkFd, (off_t)_totalBytes) != 0) {
+        return SSHKitPOSIXError(errno, _sinkPath);
+    }
+    
+    return nil;
+}
+
+- (NSError *)doSyncSink {
+#ifdef F_FULLFSYNC
+    // fsync only reaches the drive cache on Darwin
+    if (fcntl(_sinkFd, F_FULLFSYNC) == 0) {
+        return nil;
+    }
+#endif
+    
+    if (fsync(_sinkFd) != 0) {
+        return SSHKitPOSIXError(errno, _sinkPath);
+    }
+    
+    return nil;
+}
+
+- (void)doCloseSink {
+    if (_sinkFd >= 0 && _sinkOwnsFd) {
+        close(_sinkFd);
+    }
+    
+    _sinkFd = -1;
+    _sinkOwnsFd = NO;
+}
+
+- (void)doDownloadToFileDescriptor:(int)fd
+                              path:(NSString *)localPath
+                            offset:(unsigned long long)offset
+                           options:(SSHKitSFTPDownloadOptions)options
+                     progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+          fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+             fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+    self.readFileBlock = nil;
+    self.progressBlock = progressBlock;
+    self.fileTransferFailBlock = fileTransferFailBlock;
+    self.fileTransferSuccessBlock = fileTransferSuccessBlock;
+    
+    __weak SSHKitSFTPFile *weakSelf = self;
+    
+    [self.sftp.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+        
+        NSError *error = [strongSelf returnErrorIfNotConnected];
+        if (error) {
+            strongSelf.fileTransferFailBlock(error);
+            return_from_block;
+        }
+        
+        int sinkFd = fd;
+        if (localPath) {
+            sinkFd = open(localPath.fileSystemRepresentation, O_WRONLY | O_CREAT, (mode_t)(strongSelf.posixPermissions & 0777) | S_IRUSR | S_IWUSR);
+            if (sinkFd < 0) {
+                strongSelf.fileTransferFailBlock(SSHKitPOSIXError(errno, localPath));
+                return_from_block;
+            }
+        }
+        
+        strongSelf->_sinkFd = sinkFd;
+        strongSelf->_sinkOwnsFd = localPath != nil;
+        strongSelf->_sinkPath = localPath ?: [NSString stringWithFormat:@"/dev/fd/%d", fd];
+        strongSelf->_sinkOptions = options;
+        
+        if (options & SSHKitSFTPDownloadOptionPreallocate) {
+            error = [strongSelf doPreallocateSink];
             if (error) {
-                [self doFileTransferFail:error];
-                if (errorPtr) {
-                    *errorPtr = error;
-                }
-                free(buffer);
-                self.progressBlock(readedBytesAfterLastUpdate, _totalBytes, self.fileSize.longLongValue);
-                return;
+                [strongSelf doCloseSink];
+                strongSelf.fileTransferFailBlock(error);
+                return_from_block;
+            }
+        }
+        
+        [strongSelf doStartReadingFile:offset];
+    }];
+}
+
+- (void)asyncDownloadToFileDescriptor:(int)fd
+                               offset:(unsigned long long)offset
+                              options:(SSHKitSFTPDownloadOptions)options
+                        progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+             fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+                fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+    NSParameterAssert(fd >= 0);
+    
+    [self doDownloadToFileDescriptor:fd path:nil offset:offset options:options progressBlock:progressBlock fileTransferSuccessBlock:fileTransferSuccessBlock fileTransferFailBlock:fileTransferFailBlock];
+}
+
+- (void)asyncDownloadToPath:(NSString *)localPath
+                     offset:(unsigned long long)offset
+                    options:(SSHKitSFTPDownloadOptions)options
+              progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+   fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+      fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+    NSParameterAssert(localPath);
+    
+    [self doDownloadToFileDescriptor:-1 path:localPath offset:offset options:options progressBlock:progressBlock fileTransferSuccessBlock:fileTransferSuccessBlock fileTransferFailBlock:fileTransferFailBlock];
+}
+
+- (int)asyncRead:(int)asyncRequest buffer:(char *)buffer length:(uint32_t)length errorPtr:(NSError **)errorPtr {
+    // [self dispatchSyncOnSessionQueue:
+    // `sftp_async_read
+    __block int result = -1;
+    __weak SSHKitSFTPFile *weakSelf = self;
+    __block NSError *error;
+
+    [self.sftp dispatchSyncOnSessionQueue:^{
+        error = [weakSelf returnErrorIfNotConnected];
+        if (error) {
+            return_from_block;
+        }
+
+        result = sftp_async_reply(weakSelf.rawFile, buffer, length, asyncRequest, NO);
+    }];
+    
+    if (result < 0 && result != -2) {
+        if (errorPtr) {
+            if (error) {
+                *errorPtr = error;
+            } else {
+                *errorPtr = self.sftp.libsshSFTPError;
+            }
+        }
+    }
+    
+    return result;
+}
+
+- (unsigned long long)rawFileOffset {
+    __block unsigned long long offset = 0;
+    __weak SSHKitSFTPFile *weakSelf = self;
+    
+    [self.sftp dispatchSyncOnSessionQueue:^{
+        if (weakSelf.rawFile) {
+            offset = sftp_tell64(weakSelf.rawFile);
+        }
+    }];
+    
+    return offset;
+}
+
+- (NSError *)genericTransferError:(NSString *)description {
+    return [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                               code:SSHKitSFTPErrorCodeGenericFailure
+                           userInfo:@{ NSLocalizedDescriptionKey : description }];
+}
+
+/**
+ Drain replies of requests still in flight after a failure or cancellation,
+ otherwise they will stay in libssh sftp message queue forever.
+ */
+- (void)drainWriteRequests:(SSHKitSFTPWriteRequest *)requests head:(int)head count:(int)count {
+    for (int i = 0; i < count; i++) {
+        if (![self asyncWriteEnd:requests[(head + i) % CONCURRENT_REQ_COUNT].requestId errorPtr:nil] && !self.sftp.session.isConnected) {
+            return;
+        }
+    }
+}
+
+-(long)write:(const void *)buffer size:(long)size errorPtr:(NSError **)errorPtr {
+    SSHKitSFTPWriteRequest requests[CONCURRENT_REQ_COUNT];
+    int head = 0, count = 0;
+    
+    const char *bytes = buffer;
+    unsigned long long offset = [self rawFileOffset];
+    long sentLength = 0;
+    long totalWriteLength = 0;
+    NSError *error = nil;
+    
+    while (totalWriteLength < size) {
+        // keep the pipeline full
+        while (count < CONCURRENT_REQ_COUNT && sentLength < size) {
+            uint32_t length = sftp_writable_length(self.rawFile, (uint32_t)MIN(size - sentLength, MAX_XFER_BUF_SIZE));
+            if (!length) {
+                break;
+            }
+            
+            int requestNo = [self asyncWriteBegin:bytes + sentLength length:length offset:offset + sentLength errorPtr:&error];
+            if (requestNo < 0) {
+                break;
+            }
+            
+            requests[(head + count) % CONCURRENT_REQ_COUNT] = (SSHKitSFTPWriteRequest){ requestNo, length };
+            count++;
+            sentLength += length;
+        }
+        
+        if (error) {
+            break;
+        }
+        
+        if (!count) {
+            // remote window is exhausted and nothing in flight
+            if (![self waitForWritableWindow:&error]) {
+                error = error ?: [self genericTransferError:@"Failed to write file"];
+                break;
+            }
+            continue;
+        }
+        
+        // replies may arrive out of order, libssh queues them by request id
+        if (![self asyncWriteEnd:requests[head].requestId errorPtr:&error]) {
+            head = (head + 1) % CONCURRENT_REQ_COUNT;
+            count--;
+            break;
+        }
+        
+        totalWriteLength += requests[head].length;
+        head = (head + 1) % CONCURRENT_REQ_COUNT;
+        count--;
+    }
+    
+    if (count) {
+        [self drainWriteRequests:requests head:head count:count];
+    }
+    
+    // only acknowledged bytes count, so a retry continues from the right position
+    [self seek64:offset + totalWriteLength];
+    
+    if (totalWriteLength) {
+        [self.sftp.attributeCache invalidatePath:self.fullFilename];
+    }
+    
+    if (totalWriteLength < size && errorPtr) {
+        *errorPtr = error ?: [self genericTransferError:@"Failed to write file"];
+    }
+    
+    return totalWriteLength;
+}
+
+- (BOOL)doWriteFile {
+    NSError *error = nil;
+    
+    for (int budget = SFTP_TRANSFER_BUDGET; budget > 0; budget--) {
+        // collect acknowledgements first, they free pipeline slots
+        if (_writeCount) {
+            SSHKitSFTPWriteRequest request = _writeRequests[_writeHead];
+            int rc = sftp_async_write_end(self.rawFile, request.requestId, YES);
+            
+            if (rc != SSH_AGAIN) {
+                _writeHead = (_writeHead + 1) % CONCURRENT_REQ_COUNT;
+                _writeCount--;
             }
             
-            if (readBytes > 0) {
-                _totalBytes += readBytes;
-                readedBytesAfterLastUpdate += readBytes;
-                
-                if ([lastUpdatedOn timeIntervalSinceNow] <= -0.1) {
-                    self.progressBlock(readedBytesAfterLastUpdate, _totalBytes, self.fileSize.longLongValue);
-                    lastUpdatedOn = [NSDate date];
-                    readedBytesAfterLastUpdate = 0;
-                }
-                
-                self.readFileBlock(buffer, readBytes);
+            if (rc == SSH_ERROR) {
+                [self doFinishTransfer:self.sftp.libsshSFTPError ?: [self genericTransferError:@"Failed to write file"]];
+                return NO;
+            }
+            
+            if (rc == SSH_OK) {
+                [_requestLatency recordValue:CFAbsoluteTimeGetCurrent() - request.issuedAt];
+                _totalBytes += request.length;
+                _bytesAfterLastUpdate += request.length;
+                [self doReportProgress:NO];
+                continue;
+            }
+        }
+        
+        // keep the pipeline full
+        BOOL issued = NO;
+        while (!_writeSourceFinished && _writeCount < CONCURRENT_REQ_COUNT) {
+            // an exhausted remote window is reopened by a WINDOW_ADJUST message, which wakes us up again
+            uint32_t length = sftp_writable_length(self.rawFile, MAX_XFER_BUF_SIZE);
+            if (!length) {
+                break;
             }
             
-            if (readBytes == 0) {  // finished?
-                isFinished = YES;
+            const char *chunk = _transferBuffer;
+            int filled = _sourceFd >= 0 ? [self doTakeSourceChunk:&chunk length:length errorPtr:&error] : self.writeFileBlock(_transferBuffer, (int)length);
+            if (filled < 0) {
+                error = error ?: [self genericTransferError:@"Upload aborted"];
+                break;
             }
             
-            if (_totalBytes == self.fileSize.longLongValue) {
-                self.fileTransferSuccessBlock();
-                isFinished = YES;
+            if (filled == 0) {
+                _writeSourceFinished = YES;
+                break;
             }
             
-            if (isFinished) {
-                free(buffer);
-                self.progressBlock(readedBytesAfterLastUpdate, _totalBytes, self.fileSize.longLongValue);
-                return;
+            uint32_t chunkLength = MIN((uint32_t)filled, length);
+            int requestNo = [self asyncWriteBegin:chunk length:chunkLength offset:_writeOffset errorPtr:&error];
+            if (requestNo < 0) {
+                break;
             }
             
-            i = (i+1) % CONCURRENT_REQ_COUNT;
+            _writeRequests[(_writeHead + _writeCount) % CONCURRENT_REQ_COUNT] = (SSHKitSFTPWriteRequest){ requestNo, chunkLength, CFAbsoluteTimeGetCurrent() };
+            _writeCount++;
+            _requestsSent++;
+            _writeOffset += chunkLength;
+            issued = YES;
+        }
+        
+        if (error) {
+            [self doFinishTransfer:error];
+            return NO;
+        }
+        
+        if (_writeSourceFinished && !_writeCount) {
+            [self doFinishTransfer:nil];
+            return NO;
+        }
+        
+        if (!issued || self.stage != SSHKitFileStageWritingFile) {
+            // wait for acknowledgements or remote window
+            return NO;
         }
     }
     
-    free(buffer);
-    self.progressBlock(readedBytesAfterLastUpdate, _totalBytes, self.fileSize.longLongValue);
-    return;
+    return YES;
 }
 
-- (void)asyncReadFile:(unsigned long long)offset
-        readFileBlock:(SSHKitSFTPClientReadFileBlock)readFileBlock
-        progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
-        fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
-        fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+/** Called on session queue, sets up the WRITE pipeline and kicks off the transfer */
+- (void)doStartWritingFile:(unsigned long long)offset length:(unsigned long long)length {
+    if (self.stage == SSHKitFileStageDraining) {
+        // previous transfer is still in flight
+        [self drainPendingRequests:NO];
+    }
+    
+    _writeHead = 0;
+    _writeCount = 0;
+    _writeOffset = offset;
+    _writeSourceFinished = NO;
     _totalBytes = offset;
+    _transferStartOffset = offset;
+    _transferLength = length;
+    
+    if (_sourceFd < 0) {
+        _transferBuffer = malloc(sizeof(char) * MAX_XFER_BUF_SIZE);
+    }
+    _transferStartedAt = CFAbsoluteTimeGetCurrent();
+    _progressUpdatedAt = _transferStartedAt;
+    _transferFinishedAt = 0;
+    _requestsSent = 0;
+    _peakBytesInFlight = 0;
+    _requestLatency = [[SSHKitLatencyHistogram alloc] init];
+    _bytesAfterLastUpdate = 0;
+    
+    self.stage = SSHKitFileStageWritingFile;
+    [self.sftp doTransfer];
+}
 
-    self.readFileBlock = readFileBlock;
+- (void)asyncWriteFile:(unsigned long long)offset
+                length:(unsigned long long)length
+        writeFileBlock:(SSHKitSFTPClientWriteFileBlock)writeFileBlock
+         progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+ fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+    self.writeFileBlock = writeFileBlock;
     self.progressBlock = progressBlock;
     self.fileTransferFailBlock = fileTransferFailBlock;
     self.fileTransferSuccessBlock = fileTransferSuccessBlock;
-
-    if (offset > 0) {
-        [self seek64:offset];
-    }
     
     __weak SSHKitSFTPFile *weakSelf = self;
     
-        [self.sftp.session dispatchAsyncOnSessionQueue:^{
-            __strong SSHKitSFTPFile *strongSelf = weakSelf;
-            
-            NSError *error;
-            NSDate *startTime = [NSDate date];
-            
-            [weakSelf asyncBeginReadChunk];
-            [weakSelf asyncReadChunk:&error];
-            
-            NSDate *finishTime = [NSDate date];
-            NSTimeInterval usedTime = [finishTime timeIntervalSinceDate:startTime];
-            long long speed = strongSelf->_totalBytes / usedTime;
-            NSString *formatedSpeed = [NSByteCountFormatter stringFromByteCount:speed countStyle:NSByteCountFormatterCountStyleDecimal];
-            NSString *formatedFileSize = [NSByteCountFormatter stringFromByteCount:strongSelf->_totalBytes countStyle:NSByteCountFormatterCountStyleDecimal];
-            NSLog(@"SSHKitCore download succ: size %@, time(sec) %f, speed %@", formatedFileSize, usedTime, formatedSpeed);
-        }];
-}
-
-- (void)cancelAsyncReadFile {
-    self.stage = SSHKitFileStageNone;
+    [self.sftp.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+        
+        NSError *error = [strongSelf returnErrorIfNotConnected];
+        if (error) {
+            strongSelf.fileTransferFailBlock(error);
+            return_from_block;
+        }
+        
+        strongSelf->_sourceFd = -1;
+        [strongSelf doStartWritingFile:offset length:length];
+    }];
 }
 
-- (int)asyncRead:(int)asyncRequest buffer:(char *)buffer errorPtr:(NSError **)errorPtr {
-    // [self dispatchSyncOnSessionQueue:
-    // `sftp_async_read
-    __block int result = -1;
+- (void)cancelAsyncWriteFile {
     __weak SSHKitSFTPFile *weakSelf = self;
-    __block NSError *error;
-
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
-        error = [weakSelf returnErrorIfNotConnected];
-        if (error) {
+    [self.sftp.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        if (strongSelf.stage != SSHKitFileStageWritingFile) {
             return_from_block;
         }
-
-        result = sftp_async_read(weakSelf.rawFile, buffer, MAX_XFER_BUF_SIZE, asyncRequest);
+        
+        [strongSelf doReportProgress:YES];
+        [strongSelf doCloseSource];
+        sftp_seek64(strongSelf.rawFile, strongSelf->_totalBytes);
+        strongSelf.stage = SSHKitFileStageDraining;
+        if ([strongSelf drainPendingRequests:YES]) {
+            strongSelf.stage = SSHKitFileStageNone;
+        }
     }];
+}
+
+#pragma mark - upload from local file
+
+/** Keep the kernel reading local file up to two windows ahead of WRITE requests */
+- (void)doPrefetchSource {
+    unsigned long long window = CONCURRENT_REQ_COUNT * MAX_XFER_BUF_SIZE;
+    if (_sourcePrefetchedTo >= MIN(_writeOffset + window, _sourceEnd)) {
+        return;
+    }
     
-    if (result < 0 && result != -2) {
-        if (errorPtr) {
-            if (error) {
-                *errorPtr = error;
-            } else {
-                *errorPtr = self.sftp.libsshSFTPError;
-            }
-        }
+    unsigned long long from = MAX(_sourcePrefetchedTo, _writeOffset);
+    unsigned long long to = MIN(_writeOffset + 2 * window, _sourceEnd);
+    
+    if (_sourceMap) {
+        unsigned long long alignedFrom = from & ~((unsigned long long)getpagesize() - 1);
+        madvise((void *)(_sourceMap + alignedFrom), (size_t)(to - alignedFrom), MADV_WILLNEED);
+    } else {
+#ifdef F_RDADVISE
+        struct radvisory advisory = { (off_t)from, (int)(to - from) };
+        fcntl(_sourceFd, F_RDADVISE, &advisory);
+#endif
     }
     
-    return result;
+    _sourcePrefetchedTo = to;
 }
 
--(long)write:(const void *)buffer size:(long)size errorPtr:(NSError **)errorPtr {
-    long totoalWriteLength = 0;
-    NSError *error;
-    long writeLength = [self sftpWrite:buffer size:size errorPtr:&error];
-    totoalWriteLength += writeLength;
+/**
+ Point chunk at local data at current write offset
+ 
+ @return bytes available at chunk, at most length, 0 once the whole range is sent, or -1 on error
+ */
+- (int)doTakeSourceChunk:(const char **)chunk length:(uint32_t)length errorPtr:(NSError **)errorPtr {
+    if (_writeOffset >= _sourceEnd) {
+        return 0;
+    }
     
-    if (writeLength < 0) {
-        if (errorPtr) {
-            *errorPtr = error;
+    [self doPrefetchSource];
+    length = (uint32_t)MIN((unsigned long long)length, _sourceEnd - _writeOffset);
+    
+    if (_sourceMap) {
+        *chunk = _sourceMap + _writeOffset;
+        return (int)length;
+    }
+    
+    if (_writeOffset < _sourceBufferOffset || _writeOffset >= _sourceBufferOffset + _sourceBufferLength) {
+        size_t capacity = (size_t)MIN((unsigned long long)[SSHKitBufferPool sharedPool].bufferSize, _sourceEnd - _writeOffset);
+        ssize_t readLength;
+        do {
+            readLength = pread(_sourceFd, _sourceBuffer, capacity, (off_t)_writeOffset);
+        } while (readLength < 0 && errno == EINTR);
+        
+        if (readLength <= 0) {
+            *errorPtr = readLength ? SSHKitPOSIXError(errno, _sourcePath) : [self genericTransferError:@"Local file changed during upload"];
+            return -1;
         }
-        return totoalWriteLength;
+        
+        _sourceBufferOffset = _writeOffset;
+        _sourceBufferLength = readLength;
+    }
+    
+    *chunk = _sourceBuffer + (_writeOffset - _sourceBufferOffset);
+    return (int)MIN((unsigned long long)length, _sourceBufferOffset + _sourceBufferLength - _writeOffset);
+}
+
+- (void)doCloseSource {
+    if (_sourceMap) {
+        munmap((void *)_sourceMap, _sourceMapLength);
+        _sourceMap = NULL;
+    }
+    
+    if (_sourceBuffer) {
+        [[SSHKitBufferPool sharedPool] recycleBuffer:_sourceBuffer];
+        _sourceBuffer = NULL;
     }
     
-    // TODO check window size?
-    while (writeLength >= 0 && totoalWriteLength < size) {
-        writeLength = [self sftpWrite:buffer size:size errorPtr:&error];
+    if (_sourceFd >= 0 && _sourceOwnsFd) {
+        close(_sourceFd);
+    }
+    
+    _sourceFd = -1;
+    _sourceOwnsFd = NO;
+}
+
+- (void)doUploadFromFileDescriptor:(int)fd
+                              path:(NSString *)localPath
+                            offset:(unsigned long long)offset
+                            length:(unsigned long long)length
+                           options:(SSHKitSFTPUploadOptions)options
+                     progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+          fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+             fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+    self.writeFileBlock = nil;
+    self.progressBlock = progressBlock;
+    self.fileTransferFailBlock = fileTransferFailBlock;
+    self.fileTransferSuccessBlock = fileTransferSuccessBlock;
+    
+    __weak SSHKitSFTPFile *weakSelf = self;
+    
+    [self.sftp.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
         
-        if (writeLength < 0) {
-            *errorPtr = error;
-            return totoalWriteLength;
+        NSError *error = [strongSelf returnErrorIfNotConnected];
+        if (error) {
+            strongSelf.fileTransferFailBlock(error);
+            return_from_block;
+        }
+        
+        int sourceFd = localPath ? open(localPath.fileSystemRepresentation, O_RDONLY) : fd;
+        NSString *sourcePath = localPath ?: [NSString stringWithFormat:@"/dev/fd/%d", fd];
+        struct stat localStat;
+        
+        if (sourceFd < 0 || fstat(sourceFd, &localStat) != 0) {
+            error = SSHKitPOSIXError(errno, sourcePath);
+            if (localPath && sourceFd >= 0) {
+                close(sourceFd);
+            }
+            strongSelf.fileTransferFailBlock(error);
+            return_from_block;
+        }
+        
+        unsigned long long size = localStat.st_size;
+        strongSelf->_sourceFd = sourceFd;
+        strongSelf->_sourceOwnsFd = localPath != nil;
+        strongSelf->_sourcePath = sourcePath;
+        strongSelf->_sourceEnd = MIN(size, offset + MIN(length, size));
+        strongSelf->_sourcePrefetchedTo = offset;
+        strongSelf->_sourceBufferOffset = 0;
+        strongSelf->_sourceBufferLength = 0;
+        
+        if ((options & SSHKitSFTPUploadOptionMapLocalFile) && strongSelf->_sourceEnd > offset) {
+            void *map = mmap(NULL, (size_t)strongSelf->_sourceEnd, PROT_READ, MAP_SHARED, sourceFd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, (size_t)strongSelf->_sourceEnd, MADV_SEQUENTIAL);
+                strongSelf->_sourceMap = map;
+                strongSelf->_sourceMapLength = (size_t)strongSelf->_sourceEnd;
+            }
+        }
+        
+        if (!strongSelf->_sourceMap) {
+            // a file which can't be mapped is read into buffers
+            strongSelf->_sourceBuffer = [[SSHKitBufferPool sharedPool] takeBuffer];
         }
         
-        totoalWriteLength += writeLength;
+        [strongSelf doStartWritingFile:offset length:strongSelf->_sourceEnd];
+    }];
+}
+
+- (void)asyncUploadFromFileDescriptor:(int)fd
+                               offset:(unsigned long long)offset
+                               length:(unsigned long long)length
+                              options:(SSHKitSFTPUploadOptions)options
+                        progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+             fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+                fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+    NSParameterAssert(fd >= 0);
+    
+    [self doUploadFromFileDescriptor:fd path:nil offset:offset length:length options:options progressBlock:progressBlock fileTransferSuccessBlock:fileTransferSuccessBlock fileTransferFailBlock:fileTransferFailBlock];
+}
+
+- (void)asyncUploadFromPath:(NSString *)localPath
+                     offset:(unsigned long long)offset
+                    options:(SSHKitSFTPUploadOptions)options
+              progressBlock:(SSHKitSFTPClientProgressBlock)progressBlock
+   fileTransferSuccessBlock:(SSHKitSFTPClientSuccessBlock)fileTransferSuccessBlock
+      fileTransferFailBlock:(SSHKitSFTPClientFailureBlock)fileTransferFailBlock {
+    NSParameterAssert(localPath);
+    
+    [self doUploadFromFileDescriptor:-1 path:localPath offset:offset length:ULLONG_MAX options:options progressBlock:progressBlock fileTransferSuccessBlock:fileTransferSuccessBlock fileTransferFailBlock:fileTransferFailBlock];
+}
+
+#pragma mark - metrics
+
+- (SSHKitSFTPFileMetrics *)metrics {
+    __block SSHKitSFTPFileMetrics *metrics = nil;
+    [self.sftp dispatchSyncOnSessionQueue:^{
+        metrics = [self doCollectMetrics];
+    }];
+    
+    return metrics;
+}
+
+- (SSHKitSFTPFileMetrics *)doCollectMetrics {
+    SSHKitSFTPFileMetrics *metrics = [[SSHKitSFTPFileMetrics alloc] init];
+    metrics.requestsSent = _requestsSent;
+    metrics.outstandingRequests = _readCount + _writeCount;
+    metrics.bytesTransferred = _totalBytes - _transferStartOffset;
+    metrics.peakBytesInFlight = _peakBytesInFlight;
+    metrics.requestLatency = [_requestLatency copy] ?: [[SSHKitLatencyHistogram alloc] init];
+    
+    if (_transferStartedAt) {
+        metrics.transferDuration = (_transferFinishedAt ?: CFAbsoluteTimeGetCurrent()) - _transferStartedAt;
+        metrics.throughput = metrics.bytesTransferred / MAX(metrics.transferDuration, 0.001);
     }
     
-    return totoalWriteLength;
+    return metrics;
 }
 
 #pragma mark - file information
@@ -693,6 +2258,22 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     self.flags = fileAttributes->flags;
 }
 
+- (void)populateValuesFromDirectoryEntry:(const SSHKitSFTPDirectoryEntry *)entry {
+    self.modificationDate = [NSDate dateWithTimeIntervalSince1970:entry->mtime];
+    self.creationDate = [NSDate dateWithTimeIntervalSince1970:0];
+    self.lastAccess = [NSDate dateWithTimeIntervalSince1970:entry->atime];
+    self.fileSize = @(entry->size);
+    self.ownerUserID = entry->uid;
+    self.ownerGroupID = entry->gid;
+    self.posixPermissions = entry->permissions;
+    self->_fileTypeLetter = [self fileTypeLetter:entry->permissions];
+    self.isDirectory = S_ISDIR(entry->permissions);
+#ifdef S_ISLNK
+    self.isLink = S_ISLNK(entry->permissions);
+#endif
+    self.flags = entry->flags;
+}
+
 - (NSString *)kindOfFile {
     NSString *kind = @"";
     if (self.isDirectory) {
@@ -723,6 +2304,7 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     __weak SSHKitSFTPFile *weakSelf = self;
     [self.sftp.session dispatchAsyncOnSessionQueue:^{
         __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        [strongSelf doDropStaleHandles];
         if (strongSelf.rawDirectory) {
             sftp_closedir(strongSelf.rawDirectory);
             strongSelf->_rawDirectory = nil;
@@ -730,6 +2312,10 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     }];
     [self.sftp.session dispatchAsyncOnSessionQueue:^{
         __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        if (strongSelf.stage == SSHKitFileStageDraining) {
+            [strongSelf drainPendingRequests:NO];
+            strongSelf.stage = SSHKitFileStageNone;
+        }
         if (strongSelf.rawFile) {
             sftp_close(strongSelf.rawFile);
             strongSelf->_rawFile = nil;
@@ -760,53 +2346,176 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     return sftp_dir_eof(self.rawDirectory);
 }
 
-- (SSHKitSFTPFile *)readDirectory {
-    __block sftp_attributes attributes = nil;
+- (NSArray *)listDirectory:(SSHKitSFTPListDirFilter)filter {
+    NSMutableArray *files = [@[] mutableCopy];
+    NSMutableArray *batch = [NSMutableArray arrayWithCapacity:SFTP_LIST_DIR_BATCH_SIZE];
+    
+    do {
+        // one session queue hop per batch, entries are already buffered by libssh
+        [batch removeAllObjects];
+        [self readDirectoryEntries:batch maxCount:SFTP_LIST_DIR_BATCH_SIZE];
+        
+        for (SSHKitSFTPFile *file in batch) {
+            SSHKitSFTPListDirFilterCode code = SSHKitSFTPListDirFilterCodeAdd;
+            if (filter) {
+                code = filter(file);
+            }
+            switch (code) {
+                case SSHKitSFTPListDirFilterCodeAdd:
+                    [files addObject:file];
+                    break;
+                case SSHKitSFTPListDirFilterCodeCancel:
+                    return files;
+                    break;
+                case SSHKitSFTPListDirFilterCodeIgnore:
+                    break;
+                default:
+                    break;
+            }
+        }
+    } while (batch.count == SFTP_LIST_DIR_BATCH_SIZE);
+    
+    return files;
+}
+
+- (void)readDirectoryEntries:(NSMutableArray *)files maxCount:(NSUInteger)maxCount {
+    sftp_attributes attributes[SFTP_LIST_DIR_BATCH_SIZE];
+    __block NSUInteger count = 0;
     __weak SSHKitSFTPFile *weakSelf = self;
-    __block NSError *error;
     
-    [self.sftp.session dispatchSyncOnSessionQueue:^{
-        error = [weakSelf returnErrorIfNotConnected];
-        if (error) {
+    maxCount = MIN(maxCount, SFTP_LIST_DIR_BATCH_SIZE);
+    
+    [self.sftp dispatchSyncOnSessionQueue:^{
+        __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        if ([strongSelf returnErrorIfNotConnected]) {
             return_from_block;
         }
-        attributes = sftp_readdir(weakSelf.sftp.rawSFTPSession, weakSelf.rawDirectory);
+        
+        while (count < maxCount) {
+            sftp_attributes entry = sftp_readdir(strongSelf.sftp.rawSFTPSession, strongSelf.rawDirectory);
+            if (!entry) {
+                break;
+            }
+            attributes[count++] = entry;
+        }
     }];
     
-    if (!attributes) {
-        return nil;
+    SSHKitSFTPAttributeCache *cache = self.sftp.attributeCache;
+    
+    for (NSUInteger i = 0; i < count; i++) {
+        SSHKitSFTPFile *file = [[SSHKitSFTPFile alloc] initWithSFTPAttributes:attributes[i] parentPath:self.fullFilename];
+        [files addObject:file];
+        
+        if (cache && strcmp(attributes[i]->name, ".") && strcmp(attributes[i]->name, "..")) {
+            SSHKitSFTPDirectoryEntry entry;
+            sftp_directory_entry_from_attributes(&entry, attributes[i]);
+            [cache storeAttributes:&entry path:file.fullFilename followLinks:NO];
+        }
+        [SSHKitSFTPChannel freeSFTPAttributes:attributes[i]];
     }
+}
+
+- (void)listDirectoryInBatches:(SSHKitSFTPDirectoryBatchBlock)batchBlock completion:(SSHKitSFTPDirectoryCompletionBlock)completion {
+    NSParameterAssert(batchBlock && completion);
+    
+    __weak SSHKitSFTPFile *weakSelf = self;
+    [self.sftp.session dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSFTPFile *strongSelf = weakSelf;
+        
+        NSError *error = [strongSelf returnErrorIfNotConnected];
+        if (!error && !strongSelf.rawDirectory) {
+            error = [strongSelf genericTransferError:@"Directory is not open"];
+        }
+        if (error) {
+            completion(error);
+            return_from_block;
+        }
+        
+        strongSelf->_listBatchBlock = [batchBlock copy];
+        strongSelf->_listCompletionBlock = [completion copy];
+        strongSelf->_listError = nil;
+        strongSelf->_listFinished = NO;
+        strongSelf->_listCancelled = NO;
+        strongSelf->_listRequestCount = 0;
+        
+        [strongSelf doSendReadDirectoryRequests];
+    }];
+}
+
+/** Keep SFTP_LIST_DIR_CONCURRENT_REQ_COUNT READDIR requests in flight, server answers them one batch after another */
+- (void)doSendReadDirectoryRequests {
+    sftp_dir rawDirectory = self.rawDirectory;
+    NSString *parentPath = self.fullFilename;
+    __weak SSHKitSFTPFile *weakSelf = self;
     
-    SSHKitSFTPFile *instance = [[SSHKitSFTPFile alloc] initWithSFTPAttributes: attributes parentPath:self.fullFilename];
-    [SSHKitSFTPChannel freeSFTPAttributes:attributes];
+    while (_listRequestCount < SFTP_LIST_DIR_CONCURRENT_REQ_COUNT && !_listFinished && !_listCancelled && !_listError) {
+        int rc = [self.sftp doSendRequest:SSH_FXP_READDIR fields:^BOOL(ssh_buffer buffer) {
+            return sftp_buffer_add_string(buffer, rawDirectory->handle);
+        } replyHandler:^(uint8_t type, ssh_buffer payload) {
+            __strong SSHKitSFTPFile *strongSelf = weakSelf;
+            if (!strongSelf) {
+                return_from_block;
+            }
+            
+            strongSelf->_listRequestCount--;
+            [strongSelf doHandleReadDirectoryReply:type payload:payload parentPath:parentPath];
+        }];
+        
+        if (rc < 0) {
+            _listError = self.sftp.session.libsshError ?: [self genericTransferError:@"Failed to list directory"];
+            break;
+        }
+        
+        _listRequestCount++;
+    }
     
-    return instance;
+    [self doFinishListingIfNeeded];
 }
 
-- (NSArray *)listDirectory:(SSHKitSFTPListDirFilter)filter {
-    // add call back to cancel it?
-    NSMutableArray *files = [@[] mutableCopy];
-    SSHKitSFTPFile *file = [self readDirectory];
-    while (file != nil) {
-        SSHKitSFTPListDirFilterCode code = SSHKitSFTPListDirFilterCodeAdd;
-        if (filter) {
-            code = filter(file);
-        }
-        switch (code) {
-            case SSHKitSFTPListDirFilterCodeAdd:
-                [files addObject:file];
-                break;
-            case SSHKitSFTPListDirFilterCodeCancel:
-                return files;
-                break;
-            case SSHKitSFTPListDirFilterCodeIgnore:
-                break;
-            default:
-                break;
+- (void)doHandleReadDirectoryReply:(uint8_t)type payload:(ssh_buffer)payload parentPath:(NSString *)parentPath {
+    if (_listCancelled || _listError || _listFinished) {
+        // reply of a request sent before listing was over
+        [self doFinishListingIfNeeded];
+        return;
+    }
+    
+    if (type == SSH_FXP_NAME && payload) {
+        SSHKitSFTPDirectoryEntries *entries = [[SSHKitSFTPDirectoryEntries alloc] initWithPayload:payload channel:self.sftp parentPath:parentPath];
+        if (!entries) {
+            _listError = [self genericTransferError:@"Malformed directory entries"];
+        } else {
+            [self.sftp.attributeCache storeDirectoryEntries:entries];
+            if (_listBatchBlock(entries) == SSHKitSFTPListDirFilterCodeCancel) {
+                _listCancelled = YES;
+            }
+        }
+    } else {
+        NSError *error = [self.sftp errorFromStatusPayload:payload];
+        if (error.code == SSHKitSFTPErrorCodeEOF) {
+            _listFinished = YES;
+            self.rawDirectory->eof = 1;
+        } else {
+            _listError = error;
         }
-        file = [self readDirectory];
     }
-    return files;
+    
+    [self doSendReadDirectoryRequests];
+}
+
+- (void)doFinishListingIfNeeded {
+    if (_listRequestCount || !_listCompletionBlock) {
+        return;
+    }
+    
+    if (!_listFinished && !_listCancelled && !_listError) {
+        return;
+    }
+    
+    SSHKitSFTPDirectoryCompletionBlock completion = _listCompletionBlock;
+    _listCompletionBlock = nil;
+    _listBatchBlock = nil;
+    
+    completion(_listError);
 }
 
 #pragma mark - Permissions conversion methods
@@ -906,7 +2615,18 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
 
 - (void)setPosixPermissions:(unsigned long)posixPermissions {
     _posixPermissions = posixPermissions;
-    self.permissions = [self convertPermissionToSymbolicNotation:posixPermissions];
+    _hasPosixPermissions = YES;
+    
+    // symbolic notation is built on first use
+    _permissions = nil;
+}
+
+- (NSString *)permissions {
+    if (!_permissions && _hasPosixPermissions) {
+        _permissions = [self convertPermissionToSymbolicNotation:_posixPermissions];
+    }
+    
+    return _permissions;
 }
 
 - (void)setStage:(SSHKitFileStage)stage {
@@ -919,8 +2639,12 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
     }
     switch (stage) {
         case SSHKitFileStageReadingFile:
+        case SSHKitFileStageWritingFile:
             [self.sftp.remoteFiles addObject:self];
             break;
+        case SSHKitFileStageDraining:
+            // stay in remoteFiles until replies in flight are discarded
+            break;
         case SSHKitFileStageNone:
             [self.sftp.remoteFiles removeObject:self];
             break;
@@ -940,10 +2664,41 @@ typedef NS_ENUM(NSInteger, SSHKitFileStage)  {
 }
 
 - (NSError *)returnErrorIfNotConnected {
+    if ([self doDropStaleHandles]) {
+        return [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                                   code:SSHKitSFTPErrorCodeConnectionLost
+                               userInfo:@{ NSLocalizedDescriptionKey : @"File handle was lost with connection" }];
+    }
     return [SSHKitSFTPFile returnErrorIfNotConnected:self.sftp.session];
 }
 
-- (void)didReceiveData:(NSData *)data {
+/**
+ Handles opened before the session reconnected belong to a freed sftp session, server forgot them as well.
+ Free them without sending anything.
+ 
+ @return YES if a handle was dropped
+ */
+- (BOOL)doDropStaleHandles {
+    if ((!_rawFile && !_rawDirectory) || _handleGeneration == self.sftp.connectionGeneration) {
+        return NO;
+    }
+    
+    if (_rawFile) {
+        ssh_string_free(_rawFile->handle);
+        free(_rawFile->name);
+        free(_rawFile);
+        _rawFile = NULL;
+    }
+    
+    if (_rawDirectory) {
+        ssh_string_free(_rawDirectory->handle);
+        ssh_buffer_free(_rawDirectory->buffer);
+        free(_rawDirectory->name);
+        free(_rawDirectory);
+        _rawDirectory = NULL;
+    }
+    
+    return YES;
 }
 
 
@@ -0,0 +1,60 @@
+//
+//  SSHKitSFTPStripedTransfer.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+
+@class SSHKitSFTPChannel;
+
+/** Called on callback queue, resumeData is nil on success, pass it to next transfer of the same file to continue */
+typedef void(^SSHKitSFTPStripedTransferCompletionBlock)(NSData *resumeData, NSError *error);
+
+/**
+ Transfers one large file as byte ranges over several SFTP channels at once. Channels of different sessions
+ are encrypted on different session queues, so throughput scales with connections and cores, while channels
+ of one session only add windows.
+
+ Every range is read or written by the regular asynchronous transfer of a SSHKitSFTPFile, a failed range
+ restarts where it stopped on the next open channel, or once a reconnecting session has reopened its channel.
+ Size of the copy is checked once all ranges are done.
+ One transfer runs at a time.
+ */
+@interface SSHKitSFTPStripedTransfer : NSObject
+
+- (instancetype)initWithChannels:(NSArray<SSHKitSFTPChannel *> *)channels;
+
+@property (nonatomic, readonly) NSArray<SSHKitSFTPChannel *> *channels;
+
+/** Ranges a file is split into, default number of channels */
+@property (nonatomic) NSUInteger stripeCount;
+/** Files smaller than stripeCount ranges of this size get fewer ranges, default 4 MB */
+@property (nonatomic) unsigned long long minStripeSize;
+/** Restarts of one range before the transfer fails, default 3 */
+@property (nonatomic) NSUInteger maxRetriesPerStripe;
+
+/** Queue for blocks, default main queue */
+@property (nonatomic, strong) dispatch_queue_t callbackQueue;
+/** Aggregate progress of all ranges, at most every 0.1 seconds */
+@property (nonatomic, copy) SSHKitSFTPClientProgressBlock progressBlock;
+
+@property (nonatomic, readonly) unsigned long long totalBytes;
+@property (nonatomic, readonly) unsigned long long transferredBytes;
+
+/** Local file is created if missing, and never truncated below what resumeData says is already there */
+- (void)downloadFile:(NSString *)remotePath
+              toPath:(NSString *)localPath
+          resumeData:(NSData *)resumeData
+          completion:(SSHKitSFTPStripedTransferCompletionBlock)completion;
+
+/** Remote file is created, or truncated unless resuming, with permissions of the local file */
+- (void)uploadFile:(NSString *)localPath
+            toPath:(NSString *)remotePath
+        resumeData:(NSData *)resumeData
+        completion:(SSHKitSFTPStripedTransferCompletionBlock)completion;
+
+/** Stop running transfer, completion is called with SSHKitErrorStop and resume data */
+- (void)cancel;
+
+@end
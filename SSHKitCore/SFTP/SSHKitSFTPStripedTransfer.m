@@ -0,0 +1,622 @@
+//
+//  SSHKitSFTPStripedTransfer.m
+//  SSHKitCore
+//
+
+#import "SSHKitSFTPStripedTransfer.h"
+#import "SSHKitCore+Protected.h"
+#import <sys/stat.h>
+
+// seconds between looks for an open channel while a session reconnects
+#define SFTP_STRIPE_CHANNEL_POLL_INTERVAL 0.5
+
+static NSString * const SSHKitStripedResumeDirectionKey = @"direction";
+static NSString * const SSHKitStripedResumeRemotePathKey = @"remotePath";
+static NSString * const SSHKitStripedResumeLocalPathKey = @"localPath";
+static NSString * const SSHKitStripedResumeSizeKey = @"size";
+static NSString * const SSHKitStripedResumeStripesKey = @"stripes";
+
+static NSError *SSHKitStripedTransferError(NSString *description) {
+    return [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                               code:SSHKitSFTPErrorCodeGenericFailure
+                           userInfo:@{ NSLocalizedDescriptionKey : description }];
+}
+
+/** One byte range, values are only changed on transfer queue, file only on session queue of its channel */
+@interface SSHKitSFTPStripe : NSObject
+
+@property (nonatomic) unsigned long long offset;
+@property (nonatomic) unsigned long long length;
+/** Bytes from offset known to be written at destination */
+@property (nonatomic) unsigned long long transferred;
+@property (nonatomic) NSUInteger retries;
+@property (nonatomic) NSUInteger channelIndex;
+@property (nonatomic, getter = isRunning) BOOL running;
+
+@property (nonatomic, strong) SSHKitSFTPFile *file;
+
+@end
+
+@implementation SSHKitSFTPStripe
+@end
+
+@interface SSHKitSFTPStripedTransfer ()
+
+/** Set once transfer fails or is cancelled, read from session queues to skip ranges not started yet */
+@property (atomic) BOOL stopping;
+
+@end
+
+@implementation SSHKitSFTPStripedTransfer {
+    dispatch_queue_t _transferQueue;
+
+    SSHKitSFTPTransferDirection _direction;
+    NSString *_remotePath;
+    NSString *_localPath;
+    int _fd;
+
+    NSArray<SSHKitSFTPStripe *> *_stripes;
+    NSUInteger _runningStripes;
+    BOOL _verifying;
+    NSError *_error;
+    SSHKitSFTPStripedTransferCompletionBlock _completion;
+
+    unsigned long long _reportedBytes;
+    CFAbsoluteTime _progressReportedAt;
+}
+
+- (instancetype)initWithChannels:(NSArray<SSHKitSFTPChannel *> *)channels {
+    NSParameterAssert(channels.count);
+
+    if ((self = [super init])) {
+        _channels = [channels copy];
+        _stripeCount = channels.count;
+        _minStripeSize = 4 * 1024 * 1024;
+        _maxRetriesPerStripe = 3;
+        _callbackQueue = dispatch_get_main_queue();
+
+        _transferQueue = dispatch_queue_create("com.codinn.sftp.striped", DISPATCH_QUEUE_SERIAL);
+        _fd = -1;
+    }
+    return self;
+}
+
+#pragma mark - Transfers
+
+- (void)downloadFile:(NSString *)remotePath toPath:(NSString *)localPath resumeData:(NSData *)resumeData completion:(SSHKitSFTPStripedTransferCompletionBlock)completion {
+    NSParameterAssert(completion);
+
+    dispatch_async(_transferQueue, ^{
+        SSHKitSFTPStripedTransferCompletionBlock current = [self doBeginTransfer:SSHKitSFTPTransferDirectionDownload remotePath:remotePath localPath:localPath completion:completion];
+        SSHKitSFTPChannel *channel = [self doFindOpenChannelFromIndex:0];
+        if (!current || !channel) {
+            [self doFailIfCurrent:current error:SSHKitStripedTransferError(@"No open SFTP channel")];
+            return_from_block;
+        }
+
+        [channel.session dispatchAsyncOnSessionQueue:^{
+            [SSHKitSFTPFile doStatFile:channel path:remotePath completion:^(SSHKitSFTPFile *file, NSError *statError) {
+                dispatch_async(_transferQueue, ^{
+                    if (_completion != current || _error) {
+                        return_from_block;
+                    }
+
+                    NSError *error = statError;
+                    if (!error && file.isDirectory) {
+                        error = SSHKitPOSIXError(EISDIR, remotePath);
+                    }
+                    if (error) {
+                        [self doFailIfCurrent:current error:error];
+                        return_from_block;
+                    }
+
+                    [self doStartDownloadOfSize:file.fileSize.unsignedLongLongValue permissions:file.posixPermissions & 0777 resumeData:resumeData];
+                });
+            }];
+        }];
+    });
+}
+
+- (void)uploadFile:(NSString *)localPath toPath:(NSString *)remotePath resumeData:(NSData *)resumeData completion:(SSHKitSFTPStripedTransferCompletionBlock)completion {
+    NSParameterAssert(completion);
+
+    dispatch_async(_transferQueue, ^{
+        SSHKitSFTPStripedTransferCompletionBlock current = [self doBeginTransfer:SSHKitSFTPTransferDirectionUpload remotePath:remotePath localPath:localPath completion:completion];
+        if (!current) {
+            return_from_block;
+        }
+
+        struct stat localStat;
+        _fd = open(localPath.fileSystemRepresentation, O_RDONLY);
+        if (_fd < 0 || fstat(_fd, &localStat) != 0) {
+            [self doFailIfCurrent:current error:SSHKitPOSIXError(errno, localPath)];
+            return_from_block;
+        }
+
+        unsigned long long size = localStat.st_size;
+        unsigned long permissions = localStat.st_mode & 0777;
+        _totalBytes = size;
+        _stripes = [self doStripesFromResumeData:resumeData size:size];
+        if (_stripes) {
+            [self doStartStripes];
+            return_from_block;
+        }
+
+        // ranges only ever open the file for writing, so it is created or truncated once up front
+        _stripes = [self doStripesOfSize:size];
+        SSHKitSFTPChannel *channel = [self doFindOpenChannelFromIndex:0];
+        if (!channel) {
+            [self doFailIfCurrent:current error:SSHKitStripedTransferError(@"No open SFTP channel")];
+            return_from_block;
+        }
+
+        [channel.session dispatchAsyncOnSessionQueue:^{
+            [SSHKitSFTPFile doOpenFile:channel path:remotePath accessType:O_WRONLY | O_CREAT | O_TRUNC mode:permissions completion:^(SSHKitSFTPFile *file, NSError *error) {
+                [file doCloseFile];
+
+                dispatch_async(_transferQueue, ^{
+                    if (_completion != current || _error) {
+                        return_from_block;
+                    }
+                    if (error) {
+                        [self doFailIfCurrent:current error:error];
+                        return_from_block;
+                    }
+                    [self doStartStripes];
+                });
+            }];
+        }];
+    });
+}
+
+- (void)cancel {
+    dispatch_async(_transferQueue, ^{
+        if (!_completion || _error) {
+            return_from_block;
+        }
+
+        [self doStopWithError:SSHKitTransferCancelledError()];
+        [self doFinishIfNeeded];
+    });
+}
+
+#pragma mark - Stripes
+
+/** @return stored completion to compare with in later callbacks, nil if another transfer is running */
+- (SSHKitSFTPStripedTransferCompletionBlock)doBeginTransfer:(SSHKitSFTPTransferDirection)direction remotePath:(NSString *)remotePath localPath:(NSString *)localPath completion:(SSHKitSFTPStripedTransferCompletionBlock)completion {
+    if (_completion) {
+        dispatch_async(_callbackQueue, ^{
+            completion(nil, SSHKitStripedTransferError(@"Another transfer is running"));
+        });
+        return nil;
+    }
+
+    _direction = direction;
+    _remotePath = [remotePath copy];
+    _localPath = [localPath copy];
+    _completion = [completion copy];
+    _stripes = nil;
+    _runningStripes = 0;
+    _verifying = NO;
+    _error = nil;
+    _totalBytes = 0;
+    _transferredBytes = 0;
+    _reportedBytes = 0;
+    _progressReportedAt = 0;
+    self.stopping = NO;
+
+    return _completion;
+}
+
+- (NSArray<SSHKitSFTPStripe *> *)doStripesOfSize:(unsigned long long)size {
+    if (!size) {
+        return @[];
+    }
+
+    unsigned long long count = MAX(1ULL, MIN((unsigned long long)_stripeCount, size / MAX(_minStripeSize, 1ULL)));
+    unsigned long long stripeSize = size / count;
+    NSMutableArray *stripes = [NSMutableArray arrayWithCapacity:(NSUInteger)count];
+
+    for (unsigned long long index = 0; index < count; index++) {
+        SSHKitSFTPStripe *stripe = [[SSHKitSFTPStripe alloc] init];
+        stripe.offset = index * stripeSize;
+        // last range takes the remainder
+        stripe.length = index + 1 == count ? size - stripe.offset : stripeSize;
+        stripe.channelIndex = (NSUInteger)(index % _channels.count);
+        [stripes addObject:stripe];
+    }
+
+    return stripes;
+}
+
+- (NSData *)doResumeData {
+    if (!_stripes.count) {
+        return nil;
+    }
+
+    NSMutableArray *stripes = [NSMutableArray arrayWithCapacity:_stripes.count];
+    for (SSHKitSFTPStripe *stripe in _stripes) {
+        [stripes addObject:@[ @(stripe.offset), @(stripe.length), @(stripe.transferred) ]];
+    }
+
+    NSDictionary *plist = @{ SSHKitStripedResumeDirectionKey : @(_direction),
+                             SSHKitStripedResumeRemotePathKey : _remotePath,
+                             SSHKitStripedResumeLocalPathKey : _localPath,
+                             SSHKitStripedResumeSizeKey : @(_totalBytes),
+                             SSHKitStripedResumeStripesKey : stripes };
+
+    return [NSPropertyListSerialization dataWithPropertyList:plist format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+}
+
+/** nil if resume data does not belong to this file, or the source changed size since */
+- (NSArray<SSHKitSFTPStripe *> *)doStripesFromResumeData:(NSData *)resumeData size:(unsigned long long)size {
+    if (!resumeData) {
+        return nil;
+    }
+
+    NSDictionary *plist = [NSPropertyListSerialization propertyListWithData:resumeData options:NSPropertyListImmutable format:NULL error:nil];
+    if (![plist isKindOfClass:[NSDictionary class]]
+        || [plist[SSHKitStripedResumeDirectionKey] integerValue] != _direction
+        || ![plist[SSHKitStripedResumeRemotePathKey] isEqual:_remotePath]
+        || ![plist[SSHKitStripedResumeLocalPathKey] isEqual:_localPath]
+        || [plist[SSHKitStripedResumeSizeKey] unsignedLongLongValue] != size) {
+        return nil;
+    }
+
+    NSMutableArray *stripes = [@[] mutableCopy];
+    unsigned long long nextOffset = 0;
+    unsigned long long transferredBytes = 0;
+
+    for (NSArray *values in plist[SSHKitStripedResumeStripesKey]) {
+        if (![values isKindOfClass:[NSArray class]] || values.count != 3) {
+            return nil;
+        }
+
+        SSHKitSFTPStripe *stripe = [[SSHKitSFTPStripe alloc] init];
+        stripe.offset = [values[0] unsignedLongLongValue];
+        stripe.length = [values[1] unsignedLongLongValue];
+        stripe.transferred = [values[2] unsignedLongLongValue];
+        stripe.channelIndex = stripes.count % _channels.count;
+
+        // ranges must follow each other and cover the whole file
+        if (stripe.offset != nextOffset || stripe.transferred > stripe.length) {
+            return nil;
+        }
+        nextOffset += stripe.length;
+
+        transferredBytes += stripe.transferred;
+        [stripes addObject:stripe];
+    }
+
+    if (nextOffset != size) {
+        return nil;
+    }
+
+    _transferredBytes = transferredBytes;
+    _reportedBytes = transferredBytes;
+    return stripes;
+}
+
+- (void)doStartDownloadOfSize:(unsigned long long)size permissions:(unsigned long)permissions resumeData:(NSData *)resumeData {
+    _totalBytes = size;
+    _stripes = [self doStripesFromResumeData:resumeData size:size] ?: [self doStripesOfSize:size];
+
+    _fd = open(_localPath.fileSystemRepresentation, O_WRONLY | O_CREAT, (mode_t)permissions | S_IRUSR | S_IWUSR);
+    // ranges are written in place, a longer leftover is cut and a resumed file keeps its ranges
+    if (_fd < 0 || ftruncate(_fd, size) != 0) {
+        [self doFailIfCurrent:_completion error:SSHKitPOSIXError(errno, _localPath)];
+        return;
+    }
+
+    [self doStartStripes];
+}
+
+- (void)doStartStripes {
+    for (SSHKitSFTPStripe *stripe in _stripes) {
+        if (_error) {
+            break;
+        }
+        if (stripe.transferred < stripe.length) {
+            [self doStartStripe:stripe];
+        }
+    }
+
+    [self doReportProgress:YES];
+    [self doFinishIfNeeded];
+}
+
+- (SSHKitSFTPChannel *)doFindOpenChannelFromIndex:(NSUInteger)index {
+    for (NSUInteger i = 0; i < _channels.count; i++) {
+        SSHKitSFTPChannel *channel = _channels[(index + i) % _channels.count];
+        if (channel.isOpen) {
+            return channel;
+        }
+    }
+    return nil;
+}
+
+- (BOOL)doHasReconnectingChannel {
+    for (SSHKitSFTPChannel *channel in _channels) {
+        if (channel.session.isReconnecting) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (void)doStartStripe:(SSHKitSFTPStripe *)stripe {
+    SSHKitSFTPChannel *channel = [self doFindOpenChannelFromIndex:stripe.channelIndex];
+    if (!channel && [self doHasReconnectingChannel]) {
+        [self doWaitForChannelOfStripe:stripe];
+        return;
+    }
+    if (!channel) {
+        [self doStopWithError:SSHKitStripedTransferError(@"No open SFTP channel")];
+        return;
+    }
+
+    stripe.channelIndex = [_channels indexOfObject:channel];
+    stripe.running = YES;
+    _runningStripes++;
+
+    unsigned long long position = stripe.offset + stripe.transferred;
+    unsigned long long end = stripe.offset + stripe.length;
+
+    if (_direction == SSHKitSFTPTransferDirectionDownload) {
+        [self doDownloadStripe:stripe channel:channel from:position to:end];
+    } else {
+        [self doUploadStripe:stripe channel:channel from:position to:end];
+    }
+}
+
+/** Range counts as running while its channel comes back, so the transfer does not end meanwhile */
+- (void)doWaitForChannelOfStripe:(SSHKitSFTPStripe *)stripe {
+    stripe.running = YES;
+    _runningStripes++;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(SFTP_STRIPE_CHANNEL_POLL_INTERVAL * NSEC_PER_SEC)), _transferQueue, ^{
+        stripe.running = NO;
+        _runningStripes--;
+
+        if (!_error) {
+            [self doStartStripe:stripe];
+        }
+        [self doFinishIfNeeded];
+    });
+}
+
+- (void)doDownloadStripe:(SSHKitSFTPStripe *)stripe channel:(SSHKitSFTPChannel *)channel from:(unsigned long long)position to:(unsigned long long)end {
+    int fd = _fd;
+    NSString *remotePath = _remotePath;
+
+    [channel.session dispatchAsyncOnSessionQueue:^{
+        [SSHKitSFTPFile doOpenFile:channel path:remotePath accessType:O_RDONLY mode:0 completion:^(SSHKitSFTPFile *file, NSError *error) {
+            if (error || self.stopping) {
+                [self didFinishStripe:stripe file:file from:position error:error ?: SSHKitTransferCancelledError()];
+                return_from_block;
+            }
+
+            // reads stop at fileSize, which is the end of range
+            stripe.file = file;
+            file.fileSize = @(end);
+
+            __weak SSHKitSFTPFile *weakFile = file;
+
+            [file asyncDownloadToFileDescriptor:fd offset:position options:SSHKitSFTPDownloadOptionNone progressBlock:[self progressBlockForStripe:stripe] fileTransferSuccessBlock:^{
+                [self didFinishStripe:stripe file:weakFile from:position error:nil];
+            } fileTransferFailBlock:^(NSError *error) {
+                [self didFinishStripe:stripe file:weakFile from:position error:error];
+            }];
+        }];
+    }];
+}
+
+- (void)doUploadStripe:(SSHKitSFTPStripe *)stripe channel:(SSHKitSFTPChannel *)channel from:(unsigned long long)position to:(unsigned long long)end {
+    int fd = _fd;
+    NSString *remotePath = _remotePath;
+
+    [channel.session dispatchAsyncOnSessionQueue:^{
+        [SSHKitSFTPFile doOpenFile:channel path:remotePath accessType:O_WRONLY mode:0 completion:^(SSHKitSFTPFile *file, NSError *error) {
+            if (error || self.stopping) {
+                [self didFinishStripe:stripe file:file from:position error:error ?: SSHKitTransferCancelledError()];
+                return_from_block;
+            }
+
+            stripe.file = file;
+
+            __weak SSHKitSFTPFile *weakFile = file;
+
+            // a local file shrunk since is sent short, which fails the range
+            [file asyncUploadFromFileDescriptor:fd offset:position length:end - position options:SSHKitSFTPUploadOptionNone progressBlock:[self progressBlockForStripe:stripe] fileTransferSuccessBlock:^{
+                [self didFinishStripe:stripe file:weakFile from:position error:nil];
+            } fileTransferFailBlock:^(NSError *error) {
+                [self didFinishStripe:stripe file:weakFile from:position error:error];
+            }];
+        }];
+    }];
+}
+
+- (SSHKitSFTPClientProgressBlock)progressBlockForStripe:(SSHKitSFTPStripe *)stripe {
+    return ^(unsigned long bytesNewReceived, unsigned long long bytesReceived, unsigned long long bytesTotal) {
+        dispatch_async(_transferQueue, ^{
+            // file reports its position, which is offset of range plus bytes done
+            unsigned long long transferred = MIN(bytesReceived - stripe.offset, stripe.length);
+            if (bytesReceived < stripe.offset || transferred <= stripe.transferred) {
+                return_from_block;
+            }
+
+            _transferredBytes += transferred - stripe.transferred;
+            stripe.transferred = transferred;
+            [self doReportProgress:NO];
+        });
+    };
+}
+
+// called on session queue of channel
+- (void)didFinishStripe:(SSHKitSFTPStripe *)stripe file:(SSHKitSFTPFile *)file from:(unsigned long long)position error:(NSError *)error {
+    // progress of a download counts replies taken out of order, a failed range keeps only what is contiguous.
+    // a file that never started stays below position
+    unsigned long long committedOffset = MAX(file.committedOffset, position);
+    [file doCloseFile];
+    stripe.file = nil;
+
+    dispatch_async(_transferQueue, ^{
+        stripe.running = NO;
+        _runningStripes--;
+
+        unsigned long long committed = MIN(committedOffset - stripe.offset, stripe.length);
+        if (error && committed < stripe.transferred) {
+            _transferredBytes -= stripe.transferred - committed;
+            stripe.transferred = committed;
+        }
+
+        NSError *stripeError = error;
+        BOOL retryable = YES;
+        if (!stripeError && stripe.transferred < stripe.length) {
+            // source is shorter than it was, trying again won't help
+            stripeError = SSHKitStripedTransferError(@"File changed during transfer");
+            retryable = NO;
+        }
+
+        if (stripeError && retryable && !_error && stripe.retries < _maxRetriesPerStripe) {
+            // continue where it stopped, on next channel, the failed one may be gone
+            stripe.retries++;
+            stripe.channelIndex = (stripe.channelIndex + 1) % _channels.count;
+            [self doStartStripe:stripe];
+        } else if (stripeError) {
+            [self doStopWithError:stripeError];
+        }
+
+        [self doFinishIfNeeded];
+    });
+}
+
+- (void)doStopWithError:(NSError *)error {
+    if (_error) {
+        return;
+    }
+
+    _error = error;
+    self.stopping = YES;
+
+    for (SSHKitSFTPStripe *stripe in _stripes) {
+        if (!stripe.running) {
+            continue;
+        }
+
+        // a range still opening its file is stopped by the stopping flag
+        SSHKitSFTPChannel *channel = _channels[stripe.channelIndex];
+        [channel.session dispatchAsyncOnSessionQueue:^{
+            [stripe.file doCancelTransfer:error];
+        }];
+    }
+}
+
+#pragma mark - Completion
+
+- (void)doFinishIfNeeded {
+    if (_runningStripes || !_completion) {
+        return;
+    }
+
+    if (_error) {
+        [self doCompleteWithError:_error];
+        return;
+    }
+
+    if (_verifying) {
+        return;
+    }
+
+    if (_direction == SSHKitSFTPTransferDirectionDownload) {
+        struct stat localStat;
+        NSError *error = nil;
+        if (fstat(_fd, &localStat) != 0) {
+            error = SSHKitPOSIXError(errno, _localPath);
+        } else if ((unsigned long long)localStat.st_size != _totalBytes || _transferredBytes != _totalBytes) {
+            error = SSHKitStripedTransferError(@"Size of downloaded file does not match");
+        }
+        [self doCompleteWithError:error];
+        return;
+    }
+
+    _verifying = YES;
+    [self doVerifyRemoteSize];
+}
+
+- (void)doVerifyRemoteSize {
+    SSHKitSFTPStripedTransferCompletionBlock current = _completion;
+    SSHKitSFTPChannel *channel = [self doFindOpenChannelFromIndex:0];
+    NSString *remotePath = _remotePath;
+
+    if (!channel) {
+        [self doCompleteWithError:SSHKitStripedTransferError(@"No open SFTP channel")];
+        return;
+    }
+
+    [channel.session dispatchAsyncOnSessionQueue:^{
+        // ranges were written through other channels, their cached size is stale
+        [channel.attributeCache invalidatePath:remotePath];
+
+        [SSHKitSFTPFile doStatFile:channel path:remotePath completion:^(SSHKitSFTPFile *file, NSError *statError) {
+            dispatch_async(_transferQueue, ^{
+                if (_completion != current) {
+                    return_from_block;
+                }
+
+                NSError *error = statError;
+                if (!error && (file.fileSize.unsignedLongLongValue != _totalBytes || _transferredBytes != _totalBytes)) {
+                    error = SSHKitStripedTransferError(@"Size of uploaded file does not match");
+                }
+                [self doCompleteWithError:error];
+            });
+        }];
+    }];
+}
+
+- (void)doFailIfCurrent:(SSHKitSFTPStripedTransferCompletionBlock)current error:(NSError *)error {
+    if (!current || _completion != current) {
+        return;
+    }
+
+    [self doStopWithError:error];
+    [self doFinishIfNeeded];
+}
+
+- (void)doCompleteWithError:(NSError *)error {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+
+    [self doReportProgress:YES];
+
+    NSData *resumeData = error ? [self doResumeData] : nil;
+    SSHKitSFTPStripedTransferCompletionBlock completion = _completion;
+    _completion = nil;
+    _stripes = nil;
+
+    dispatch_async(_callbackQueue, ^{
+        completion(resumeData, error);
+    });
+}
+
+- (void)doReportProgress:(BOOL)force {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    SSHKitSFTPClientProgressBlock progressBlock = self.progressBlock;
+    if (!progressBlock || (!force && now - _progressReportedAt < 0.1)) {
+        return;
+    }
+    _progressReportedAt = now;
+
+    unsigned long bytesNew = (unsigned long)(_transferredBytes - _reportedBytes);
+    unsigned long long transferredBytes = _transferredBytes;
+    unsigned long long totalBytes = _totalBytes;
+    _reportedBytes = _transferredBytes;
+
+    dispatch_async(_callbackQueue, ^{
+        progressBlock(bytesNew, transferredBytes, totalBytes);
+    });
+}
+
+@end
@@ -0,0 +1,63 @@
+//
+//  SSHKitSFTPTransferJob.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+
+@class SSHKitSFTPTransferJob;
+
+typedef NS_ENUM(NSInteger, SSHKitSFTPTransferDirection) {
+    SSHKitSFTPTransferDirectionDownload = 0,
+    SSHKitSFTPTransferDirectionUpload,
+};
+
+typedef void(^SSHKitSFTPTransferJobProgressBlock) (unsigned long long bytesTransferred, unsigned long long bytesTotal, NSUInteger finishedItems, NSUInteger totalItems);
+typedef void(^SSHKitSFTPTransferJobCompletionBlock) (SSHKitSFTPTransferJob *job);
+
+/**
+ A single file of a transfer job. Values are updated by the scheduler as the file goes.
+ */
+@interface SSHKitSFTPTransferItem : NSObject
+
++ (instancetype)downloadItemWithRemotePath:(NSString *)remotePath localPath:(NSString *)localPath;
++ (instancetype)uploadItemWithLocalPath:(NSString *)localPath remotePath:(NSString *)remotePath;
+
+@property (nonatomic, readonly) NSString *remotePath;
+@property (nonatomic, readonly) NSString *localPath;
+@property (nonatomic, readonly) SSHKitSFTPTransferDirection direction;
+
+/** Size of the source file, 0 until it is known */
+@property (nonatomic, readonly) unsigned long long totalBytes;
+@property (nonatomic, readonly) unsigned long long transferredBytes;
+
+@property (nonatomic, readonly, getter = isFinished) BOOL finished;
+@property (nonatomic, readonly) NSError *error;
+
+@end
+
+/**
+ A batch of files queued on SSHKitSFTPTransferScheduler. Blocks are called on the callback queue of scheduler.
+ */
+@interface SSHKitSFTPTransferJob : NSObject
+
+@property (nonatomic, readonly) NSArray<SSHKitSFTPTransferItem *> *items;
+@property (nonatomic, readonly) NSArray<SSHKitSFTPTransferItem *> *failedItems;
+
+@property (nonatomic, readonly) unsigned long long totalBytes;
+@property (nonatomic, readonly) unsigned long long transferredBytes;
+@property (nonatomic, readonly) NSUInteger finishedItemCount;
+
+@property (nonatomic, readonly, getter = isCancelled) BOOL cancelled;
+@property (nonatomic, readonly, getter = isFinished) BOOL finished;
+
+/** Aggregate progress of all items, at most every 0.1 seconds */
+@property (nonatomic, copy) SSHKitSFTPTransferJobProgressBlock progressBlock;
+/** Called once every item finished or the job is cancelled, inspect failedItems for errors */
+@property (nonatomic, copy) SSHKitSFTPTransferJobCompletionBlock completionBlock;
+
+/** Stop pending and running items, they fail with SSHKitErrorStop */
+- (void)cancel;
+
+@end
@@ -0,0 +1,74 @@
+//
+//  SSHKitSFTPTransferJob.m
+//  SSHKitCore
+//
+
+#import "SSHKitSFTPTransferJob.h"
+#import "SSHKitCore+Protected.h"
+
+@implementation SSHKitSFTPTransferItem
+
++ (instancetype)downloadItemWithRemotePath:(NSString *)remotePath localPath:(NSString *)localPath {
+    return [[self alloc] initWithRemotePath:remotePath localPath:localPath direction:SSHKitSFTPTransferDirectionDownload];
+}
+
++ (instancetype)uploadItemWithLocalPath:(NSString *)localPath remotePath:(NSString *)remotePath {
+    return [[self alloc] initWithRemotePath:remotePath localPath:localPath direction:SSHKitSFTPTransferDirectionUpload];
+}
+
+- (instancetype)initWithRemotePath:(NSString *)remotePath localPath:(NSString *)localPath direction:(SSHKitSFTPTransferDirection)direction {
+    if ((self = [super init])) {
+        _remotePath = remotePath;
+        _localPath = localPath;
+        _direction = direction;
+        _channelIndex = NSNotFound;
+        _posixPermissions = 0644;
+    }
+    return self;
+}
+
+- (NSString *)description {
+    NSString *arrow = self.direction == SSHKitSFTPTransferDirectionDownload ? @"<-" : @"->";
+    return [NSString stringWithFormat:@"%@ %@ %@ (%llu/%llu)", self.localPath, arrow, self.remotePath, self.transferredBytes, self.totalBytes];
+}
+
+@end
+
+@implementation SSHKitSFTPTransferJob {
+    NSMutableArray *_items;
+}
+
+- (instancetype)initWithScheduler:(SSHKitSFTPTransferScheduler *)scheduler {
+    if ((self = [super init])) {
+        _scheduler = scheduler;
+        _items = [@[] mutableCopy];
+    }
+    return self;
+}
+
+- (NSArray *)items {
+    return [_items copy];
+}
+
+- (NSUInteger)itemCount {
+    return _items.count;
+}
+
+- (NSArray *)failedItems {
+    NSPredicate *predicate = [NSPredicate predicateWithBlock:^BOOL(SSHKitSFTPTransferItem *item, NSDictionary *bindings) {
+        return item.error != nil;
+    }];
+    return [self.items filteredArrayUsingPredicate:predicate];
+}
+
+- (void)addItem:(SSHKitSFTPTransferItem *)item {
+    item.job = self;
+    [_items addObject:item];
+    _totalBytes += item.totalBytes;
+}
+
+- (void)cancel {
+    [self.scheduler cancelJob:self];
+}
+
+@end
@@ -0,0 +1,61 @@
+//
+//  SSHKitSFTPTransferScheduler.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+#import "SSHKitSFTPTransferJob.h"
+
+@class SSHKitSFTPChannel;
+
+/**
+ Runs many file transfers at once over one or more SFTP channels, which may belong to different sessions.
+
+ Files are spread over the least busy channel. Large files are limited to maxConcurrentTransfersPerChannel
+ per channel, while files not larger than smallFileThreshold are batched up to smallFileBatchSize per
+ channel, so their OPEN/READ/CLOSE round trips overlap instead of running one after another.
+ Memory is bounded by maxBytesInFlight, every running file reserves the bytes it may have in flight.
+ A file cut off because its session lost the connection continues from the last byte known to have
+ arrived, on whichever channel opens first, see SSHKitSession reconnectsAutomatically.
+ */
+@interface SSHKitSFTPTransferScheduler : NSObject
+
+- (instancetype)initWithChannels:(NSArray<SSHKitSFTPChannel *> *)channels;
+
+@property (nonatomic, readonly) NSArray<SSHKitSFTPChannel *> *channels;
+
+/** Default 4 */
+@property (nonatomic) NSUInteger maxConcurrentTransfersPerChannel;
+/** Default 32 */
+@property (nonatomic) NSUInteger smallFileBatchSize;
+/** Default 128 KB */
+@property (nonatomic) unsigned long long smallFileThreshold;
+/** Default 64 MB, at least one file always runs */
+@property (nonatomic) unsigned long long maxBytesInFlight;
+
+/** Queue for job blocks, default main queue */
+@property (nonatomic, strong) dispatch_queue_t callbackQueue;
+
+/** Download remote files, items without known size are stat'ed first */
+- (SSHKitSFTPTransferJob *)downloadItems:(NSArray<SSHKitSFTPTransferItem *> *)items
+                           progressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                         completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock;
+
+- (SSHKitSFTPTransferJob *)uploadItems:(NSArray<SSHKitSFTPTransferItem *> *)items
+                         progressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                       completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock;
+
+/** Recursively download a remote directory into localPath, creating local directories as needed */
+- (SSHKitSFTPTransferJob *)downloadDirectory:(NSString *)remotePath
+                                     toPath:(NSString *)localPath
+                              progressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                            completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock;
+
+/** Recursively upload a local directory into remotePath, creating remote directories as needed */
+- (SSHKitSFTPTransferJob *)uploadDirectory:(NSString *)localPath
+                                   toPath:(NSString *)remotePath
+                            progressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                          completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock;
+
+@end
@@ -0,0 +1,640 @@
+//
+//  SSHKitSFTPTransferScheduler.m
+//  SSHKitCore
+//
+
+#import "SSHKitSFTPTransferScheduler.h"
+#import "SSHKitCore+Protected.h"
+
+// bytes a running file may have in flight, uploads keep CONCURRENT_REQ_COUNT requests of MAX_XFER_BUF_SIZE,
+// downloads are capped to it whatever the read window of the file
+#define SFTP_TRANSFER_RESERVATION (16 * MAX_XFER_BUF_SIZE)
+
+// an item cut off by a lost connection continues from its committed offset at most this many times
+#define SFTP_TRANSFER_MAX_RESUMES 5
+// seconds between looks for an open channel while sessions reconnect
+#define SFTP_TRANSFER_RESUME_POLL_INTERVAL 0.5
+
+@interface SSHKitSFTPTransferScheduler () {
+    dispatch_queue_t _schedulerQueue;
+    dispatch_queue_t _expandQueue;
+
+    NSMutableArray *_pendingSmallItems;
+    NSMutableArray *_pendingLargeItems;
+    NSMutableSet *_jobs;
+
+    NSUInteger *_smallRunning;
+    NSUInteger *_largeRunning;
+    NSUInteger _runningCount;
+    unsigned long long _bytesInFlight;
+    NSUInteger _statChannelIndex;
+
+    dispatch_source_t _resumeTimer;
+}
+
+@end
+
+@implementation SSHKitSFTPTransferScheduler
+
+- (instancetype)initWithChannels:(NSArray<SSHKitSFTPChannel *> *)channels {
+    NSParameterAssert(channels.count);
+
+    if ((self = [super init])) {
+        _channels = [channels copy];
+        _maxConcurrentTransfersPerChannel = 4;
+        _smallFileBatchSize = 32;
+        _smallFileThreshold = 128 * 1024;
+        _maxBytesInFlight = 64 * 1024 * 1024;
+        _callbackQueue = dispatch_get_main_queue();
+
+        _schedulerQueue = dispatch_queue_create("com.codinn.sftp.scheduler", DISPATCH_QUEUE_SERIAL);
+        _expandQueue = dispatch_queue_create("com.codinn.sftp.scheduler.expand", DISPATCH_QUEUE_SERIAL);
+
+        _pendingSmallItems = [@[] mutableCopy];
+        _pendingLargeItems = [@[] mutableCopy];
+        _jobs = [NSMutableSet set];
+
+        _smallRunning = calloc(channels.count, sizeof(NSUInteger));
+        _largeRunning = calloc(channels.count, sizeof(NSUInteger));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_resumeTimer) {
+        dispatch_source_cancel(_resumeTimer);
+    }
+    free(_smallRunning);
+    free(_largeRunning);
+}
+
+#pragma mark - Jobs
+
+- (SSHKitSFTPTransferJob *)downloadItems:(NSArray<SSHKitSFTPTransferItem *> *)items
+                           progressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                         completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock {
+    SSHKitSFTPTransferJob *job = [self jobWithProgressBlock:progressBlock completionBlock:completionBlock];
+
+    dispatch_async(_schedulerQueue, ^{
+        [self doAddItems:items toJob:job];
+    });
+
+    return job;
+}
+
+- (SSHKitSFTPTransferJob *)uploadItems:(NSArray<SSHKitSFTPTransferItem *> *)items
+                         progressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                       completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock {
+    SSHKitSFTPTransferJob *job = [self jobWithProgressBlock:progressBlock completionBlock:completionBlock];
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (SSHKitSFTPTransferItem *item in items) {
+        NSDictionary *attributes = [fileManager attributesOfItemAtPath:item.localPath error:nil];
+        if (attributes) {
+            item.totalBytes = attributes.fileSize;
+            item.posixPermissions = attributes.filePosixPermissions & 0777;
+            item.sizeKnown = YES;
+        }
+    }
+
+    dispatch_async(_schedulerQueue, ^{
+        [self doAddItems:items toJob:job];
+    });
+
+    return job;
+}
+
+- (SSHKitSFTPTransferJob *)downloadDirectory:(NSString *)remotePath
+                                     toPath:(NSString *)localPath
+                              progressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                            completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock {
+    SSHKitSFTPTransferJob *job = [self jobWithProgressBlock:progressBlock completionBlock:completionBlock];
+    job.expanding = YES;
+
+    // listing is synchronous, keep it off the caller and scheduler queues
+    dispatch_async(_expandQueue, ^{
+        NSMutableArray *items = [@[] mutableCopy];
+        [self expandRemoteDirectory:remotePath localPath:localPath items:items job:job];
+
+        dispatch_async(_schedulerQueue, ^{
+            job.expanding = NO;
+            [self doAddItems:items toJob:job];
+        });
+    });
+
+    return job;
+}
+
+- (SSHKitSFTPTransferJob *)uploadDirectory:(NSString *)localPath
+                                   toPath:(NSString *)remotePath
+                            progressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                          completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock {
+    SSHKitSFTPTransferJob *job = [self jobWithProgressBlock:progressBlock completionBlock:completionBlock];
+    job.expanding = YES;
+
+    dispatch_async(_expandQueue, ^{
+        NSMutableArray *items = [@[] mutableCopy];
+        [self expandLocalDirectory:localPath remotePath:remotePath items:items job:job];
+
+        dispatch_async(_schedulerQueue, ^{
+            job.expanding = NO;
+            [self doAddItems:items toJob:job];
+        });
+    });
+
+    return job;
+}
+
+- (SSHKitSFTPTransferJob *)jobWithProgressBlock:(SSHKitSFTPTransferJobProgressBlock)progressBlock
+                                completionBlock:(SSHKitSFTPTransferJobCompletionBlock)completionBlock {
+    SSHKitSFTPTransferJob *job = [[SSHKitSFTPTransferJob alloc] initWithScheduler:self];
+    job.progressBlock = progressBlock;
+    job.completionBlock = completionBlock;
+
+    dispatch_async(_schedulerQueue, ^{
+        // keep job alive until it finishes, items only reference their job weakly
+        [_jobs addObject:job];
+    });
+
+    return job;
+}
+
+- (void)cancelJob:(SSHKitSFTPTransferJob *)job {
+    dispatch_async(_schedulerQueue, ^{
+        if (job.cancelled || job.finished) {
+            return_from_block;
+        }
+        job.cancelled = YES;
+
+        for (NSMutableArray *pendingItems in @[ _pendingSmallItems, _pendingLargeItems ]) {
+            NSIndexSet *indexes = [pendingItems indexesOfObjectsPassingTest:^BOOL(SSHKitSFTPTransferItem *item, NSUInteger idx, BOOL *stop) {
+                return item.job == job;
+            }];
+            NSArray *cancelledItems = [pendingItems objectsAtIndexes:indexes];
+            [pendingItems removeObjectsAtIndexes:indexes];
+
+            for (SSHKitSFTPTransferItem *item in cancelledItems) {
+                [self doFinishItem:item error:SSHKitTransferCancelledError()];
+            }
+        }
+
+        // running items fail through their transfer callbacks
+        for (SSHKitSFTPTransferItem *item in job.items) {
+            if (item.finished || item.channelIndex == NSNotFound) {
+                continue;
+            }
+
+            SSHKitSFTPChannel *channel = _channels[item.channelIndex];
+            [channel.session dispatchAsyncOnSessionQueue:^{
+                [item.file doCancelTransfer:SSHKitTransferCancelledError()];
+            }];
+        }
+
+        [self doCompleteJobIfNeeded:job];
+    });
+}
+
+#pragma mark - Expanding Directories
+
+- (void)expandRemoteDirectory:(NSString *)remotePath localPath:(NSString *)localPath items:(NSMutableArray *)items job:(SSHKitSFTPTransferJob *)job {
+    if (job.cancelled) {
+        return;
+    }
+
+    NSError *error = nil;
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:localPath withIntermediateDirectories:YES attributes:nil error:&error]) {
+        [items addObject:[self failedItemWithRemotePath:remotePath localPath:localPath direction:SSHKitSFTPTransferDirectionDownload error:error]];
+        return;
+    }
+
+    SSHKitSFTPFile *directory = [SSHKitSFTPFile openDirectory:_channels.firstObject path:remotePath errorPtr:&error];
+    if (!directory) {
+        [items addObject:[self failedItemWithRemotePath:remotePath localPath:localPath direction:SSHKitSFTPTransferDirectionDownload error:error]];
+        return;
+    }
+
+    NSArray *files = [directory listDirectory:^SSHKitSFTPListDirFilterCode(SSHKitSFTPFile *file) {
+        if ([file.filename isEqualToString:@"."] || [file.filename isEqualToString:@".."]) {
+            return SSHKitSFTPListDirFilterCodeIgnore;
+        }
+        return SSHKitSFTPListDirFilterCodeAdd;
+    }];
+    [directory close];
+
+    for (SSHKitSFTPFile *file in files) {
+        NSString *remoteFilePath = [remotePath stringByAppendingPathComponent:file.filename];
+        NSString *localFilePath = [localPath stringByAppendingPathComponent:file.filename];
+
+        if (file.isDirectory) {
+            [self expandRemoteDirectory:remoteFilePath localPath:localFilePath items:items job:job];
+            continue;
+        }
+
+        SSHKitSFTPTransferItem *item = [SSHKitSFTPTransferItem downloadItemWithRemotePath:remoteFilePath localPath:localFilePath];
+        // size of a symlink is not the size of its target
+        if (!file.isLink) {
+            item.totalBytes = file.fileSize.unsignedLongLongValue;
+            item.posixPermissions = file.posixPermissions & 0777;
+            item.sizeKnown = YES;
+        }
+        [items addObject:item];
+    }
+}
+
+- (void)expandLocalDirectory:(NSString *)localPath remotePath:(NSString *)remotePath items:(NSMutableArray *)items job:(SSHKitSFTPTransferJob *)job {
+    SSHKitSFTPChannel *channel = _channels.firstObject;
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+
+    NSError *error = [channel mkdir:remotePath mode:0755];
+    if (error && error.code != SSHKitSFTPErrorCodeFileAlreadyExists) {
+        [items addObject:[self failedItemWithRemotePath:remotePath localPath:localPath direction:SSHKitSFTPTransferDirectionUpload error:error]];
+        return;
+    }
+
+    NSDirectoryEnumerator *enumerator = [fileManager enumeratorAtPath:localPath];
+    for (NSString *relativePath in enumerator) {
+        if (job.cancelled) {
+            return;
+        }
+
+        NSString *localFilePath = [localPath stringByAppendingPathComponent:relativePath];
+        NSString *remoteFilePath = [remotePath stringByAppendingPathComponent:relativePath];
+        NSDictionary *attributes = enumerator.fileAttributes;
+
+        if ([attributes.fileType isEqualToString:NSFileTypeDirectory]) {
+            error = [channel mkdir:remoteFilePath mode:attributes.filePosixPermissions & 0777];
+            if (error && error.code != SSHKitSFTPErrorCodeFileAlreadyExists) {
+                [items addObject:[self failedItemWithRemotePath:remoteFilePath localPath:localFilePath direction:SSHKitSFTPTransferDirectionUpload error:error]];
+                [enumerator skipDescendants];
+            }
+            continue;
+        }
+
+        if (![attributes.fileType isEqualToString:NSFileTypeRegular]) {
+            continue;
+        }
+
+        SSHKitSFTPTransferItem *item = [SSHKitSFTPTransferItem uploadItemWithLocalPath:localFilePath remotePath:remoteFilePath];
+        item.totalBytes = attributes.fileSize;
+        item.posixPermissions = attributes.filePosixPermissions & 0777;
+        item.sizeKnown = YES;
+        [items addObject:item];
+    }
+}
+
+- (SSHKitSFTPTransferItem *)failedItemWithRemotePath:(NSString *)remotePath localPath:(NSString *)localPath direction:(SSHKitSFTPTransferDirection)direction error:(NSError *)error {
+    SSHKitSFTPTransferItem *item;
+    if (direction == SSHKitSFTPTransferDirectionDownload) {
+        item = [SSHKitSFTPTransferItem downloadItemWithRemotePath:remotePath localPath:localPath];
+    } else {
+        item = [SSHKitSFTPTransferItem uploadItemWithLocalPath:localPath remotePath:remotePath];
+    }
+    item.error = error;
+    return item;
+}
+
+#pragma mark - Scheduling
+
+- (void)doAddItems:(NSArray *)items toJob:(SSHKitSFTPTransferJob *)job {
+    for (SSHKitSFTPTransferItem *item in items) {
+        [job addItem:item];
+    }
+
+    for (SSHKitSFTPTransferItem *item in items) {
+        if (item.error || job.cancelled) {
+            [self doFinishItem:item error:item.error ?: SSHKitTransferCancelledError()];
+        } else if (item.sizeKnown) {
+            [self doEnqueueItem:item];
+        } else {
+            [self doStatItem:item];
+        }
+    }
+
+    [self doSchedule];
+    [self doCompleteJobIfNeeded:job];
+}
+
+- (void)doEnqueueItem:(SSHKitSFTPTransferItem *)item {
+    item.small = item.totalBytes <= _smallFileThreshold;
+    if (item.small) {
+        [_pendingSmallItems addObject:item];
+    } else {
+        [_pendingLargeItems addObject:item];
+    }
+}
+
+- (void)doStatItem:(SSHKitSFTPTransferItem *)item {
+    // stats are cheap, spread them over channels so they are pipelined
+    SSHKitSFTPChannel *channel = _channels[_statChannelIndex++ % _channels.count];
+
+    [channel.session dispatchAsyncOnSessionQueue:^{
+        [SSHKitSFTPFile doStatFile:channel path:item.remotePath completion:^(SSHKitSFTPFile *file, NSError *statError) {
+            dispatch_async(_schedulerQueue, ^{
+                NSError *error = statError;
+                if (!error && file.isDirectory) {
+                    error = SSHKitPOSIXError(EISDIR, item.remotePath);
+                }
+                if (error || item.job.cancelled) {
+                    [self doFinishItem:item error:error ?: SSHKitTransferCancelledError()];
+                    return_from_block;
+                }
+
+                item.totalBytes = file.fileSize.unsignedLongLongValue;
+                item.posixPermissions = file.posixPermissions & 0777;
+                item.sizeKnown = YES;
+                item.job.totalBytes += item.totalBytes;
+
+                [self doEnqueueItem:item];
+                [self doSchedule];
+            });
+        }];
+    }];
+}
+
+- (NSUInteger)doFindChannelForSmallItem:(BOOL)small {
+    NSUInteger bestIndex = NSNotFound;
+    NSUInteger bestLoad = NSUIntegerMax;
+
+    for (NSUInteger index = 0; index < _channels.count; index++) {
+        if (!_channels[index].isOpen) {
+            continue;
+        }
+
+        NSUInteger running = small ? _smallRunning[index] : _largeRunning[index];
+        NSUInteger limit = small ? _smallFileBatchSize : _maxConcurrentTransfersPerChannel;
+        NSUInteger load = _smallRunning[index] + _largeRunning[index];
+
+        if (running < limit && load < bestLoad) {
+            bestIndex = index;
+            bestLoad = load;
+        }
+    }
+
+    return bestIndex;
+}
+
+- (void)doSchedule {
+    for (NSMutableArray *pendingItems in @[ _pendingLargeItems, _pendingSmallItems ]) {
+        while (pendingItems.count) {
+            SSHKitSFTPTransferItem *item = pendingItems.firstObject;
+
+            unsigned long long reservation = MIN(item.totalBytes, (unsigned long long)SFTP_TRANSFER_RESERVATION);
+            if (_runningCount && _bytesInFlight + reservation > _maxBytesInFlight) {
+                break;
+            }
+
+            NSUInteger channelIndex = [self doFindChannelForSmallItem:item.small];
+            if (channelIndex == NSNotFound) {
+                break;
+            }
+
+            [pendingItems removeObjectAtIndex:0];
+
+            item.channelIndex = channelIndex;
+            item.reservedBytes = reservation;
+            _bytesInFlight += reservation;
+            _runningCount++;
+            if (item.small) {
+                _smallRunning[channelIndex]++;
+            } else {
+                _largeRunning[channelIndex]++;
+            }
+
+            if (item.direction == SSHKitSFTPTransferDirectionDownload) {
+                [self startDownloadItem:item channel:_channels[channelIndex]];
+            } else {
+                [self startUploadItem:item channel:_channels[channelIndex]];
+            }
+        }
+    }
+}
+
+- (void)doReleaseItem:(SSHKitSFTPTransferItem *)item {
+    if (item.channelIndex == NSNotFound) {
+        return;
+    }
+
+    _bytesInFlight -= item.reservedBytes;
+    _runningCount--;
+    if (item.small) {
+        _smallRunning[item.channelIndex]--;
+    } else {
+        _largeRunning[item.channelIndex]--;
+    }
+    item.channelIndex = NSNotFound;
+}
+
+- (void)doFinishItem:(SSHKitSFTPTransferItem *)item error:(NSError *)error {
+    if (item.finished) {
+        return;
+    }
+
+    [self doReleaseItem:item];
+
+    item.finished = YES;
+    item.error = error;
+
+    SSHKitSFTPTransferJob *job = item.job;
+    job.finishedItemCount++;
+    [self doReportProgressOfJob:job force:NO];
+    [self doCompleteJobIfNeeded:job];
+}
+
+- (void)doCompleteJobIfNeeded:(SSHKitSFTPTransferJob *)job {
+    if (!job || job.finished || job.expanding || job.finishedItemCount < job.itemCount) {
+        return;
+    }
+
+    job.finished = YES;
+    [self doReportProgressOfJob:job force:YES];
+    [_jobs removeObject:job];
+
+    SSHKitSFTPTransferJobCompletionBlock completionBlock = job.completionBlock;
+    if (completionBlock) {
+        dispatch_async(_callbackQueue, ^{
+            completionBlock(job);
+        });
+    }
+}
+
+- (void)doReportProgressOfJob:(SSHKitSFTPTransferJob *)job force:(BOOL)force {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    SSHKitSFTPTransferJobProgressBlock progressBlock = job.progressBlock;
+    if (!progressBlock || (!force && now - job.progressReportedAt < 0.1)) {
+        return;
+    }
+    job.progressReportedAt = now;
+
+    unsigned long long transferredBytes = job.transferredBytes;
+    unsigned long long totalBytes = job.totalBytes;
+    NSUInteger finishedItems = job.finishedItemCount;
+    NSUInteger totalItems = job.itemCount;
+
+    dispatch_async(_callbackQueue, ^{
+        progressBlock(transferredBytes, totalBytes, finishedItems, totalItems);
+    });
+}
+
+#pragma mark - Resuming
+
+- (BOOL)doShouldResumeItem:(SSHKitSFTPTransferItem *)item error:(NSError *)error {
+    return [error.domain isEqualToString:SSHKitLibsshSFTPErrorDomain]
+        && error.code == SSHKitSFTPErrorCodeConnectionLost
+        && !item.job.cancelled
+        && item.resumeCount < SFTP_TRANSFER_MAX_RESUMES;
+}
+
+/** Queue item again ahead of others, bytes past offset are transferred again */
+- (void)doResumeItem:(SSHKitSFTPTransferItem *)item fromOffset:(unsigned long long)offset {
+    [self doReleaseItem:item];
+
+    if (item.transferredBytes > offset) {
+        item.job.transferredBytes -= item.transferredBytes - offset;
+        item.transferredBytes = offset;
+    }
+    item.resumeOffset = offset;
+    item.resumeCount++;
+
+    [(item.small ? _pendingSmallItems : _pendingLargeItems) insertObject:item atIndex:0];
+    [self doSetupResumeTimer];
+}
+
+/** Channels of a reconnecting session are not open, look for them until resumed items are running */
+- (void)doSetupResumeTimer {
+    if (_resumeTimer) {
+        return;
+    }
+
+    _resumeTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _schedulerQueue);
+    if (!_resumeTimer) {
+        return;
+    }
+
+    uint64_t interval = (uint64_t)(SFTP_TRANSFER_RESUME_POLL_INTERVAL * NSEC_PER_SEC);
+    dispatch_source_set_timer(_resumeTimer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, interval / 10);
+
+    __weak SSHKitSFTPTransferScheduler *weakSelf = self;
+    dispatch_source_set_event_handler(_resumeTimer, ^{
+        [weakSelf doPollChannels];
+    });
+    dispatch_resume(_resumeTimer);
+}
+
+- (void)doPollChannels {
+    [self doSchedule];
+
+    BOOL waiting = NO;
+    for (SSHKitSFTPChannel *channel in _channels) {
+        waiting |= channel.session.isReconnecting;
+    }
+
+    if (!_pendingSmallItems.count && !_pendingLargeItems.count) {
+        waiting = NO;
+    } else if (!waiting && !_runningCount) {
+        // every channel is gone for good, nothing would ever pick pending items up
+        NSError *error = [NSError errorWithDomain:SSHKitLibsshSFTPErrorDomain
+                                             code:SSHKitSFTPErrorCodeConnectionLost
+                                         userInfo:@{ NSLocalizedDescriptionKey : @"No open SFTP channel" }];
+        NSArray *pendingItems = [_pendingLargeItems arrayByAddingObjectsFromArray:_pendingSmallItems];
+        [_pendingLargeItems removeAllObjects];
+        [_pendingSmallItems removeAllObjects];
+        for (SSHKitSFTPTransferItem *item in pendingItems) {
+            [self doFinishItem:item error:error];
+        }
+    }
+
+    if (!waiting) {
+        dispatch_source_cancel(_resumeTimer);
+        _resumeTimer = nil;
+    }
+}
+
+#pragma mark - Transfers
+
+// called on session queue of channel
+- (void)didFinishItem:(SSHKitSFTPTransferItem *)item fd:(int)fd error:(NSError *)error {
+    if (fd >= 0) {
+        close(fd);
+    }
+    // a file that never started stays below resume offset
+    unsigned long long committedOffset = MAX(item.file.committedOffset, item.resumeOffset);
+    [item.file doCloseFile];
+    item.file = nil;
+
+    dispatch_async(_schedulerQueue, ^{
+        if ([self doShouldResumeItem:item error:error]) {
+            [self doResumeItem:item fromOffset:committedOffset];
+        } else {
+            [self doFinishItem:item error:error];
+        }
+        [self doSchedule];
+    });
+}
+
+- (SSHKitSFTPClientProgressBlock)progressBlockForItem:(SSHKitSFTPTransferItem *)item {
+    return ^(unsigned long bytesNewReceived, unsigned long long bytesReceived, unsigned long long bytesTotal) {
+        dispatch_async(_schedulerQueue, ^{
+            item.transferredBytes = bytesReceived;
+            item.job.transferredBytes += bytesNewReceived;
+            [self doReportProgressOfJob:item.job force:NO];
+        });
+    };
+}
+
+- (void)startDownloadItem:(SSHKitSFTPTransferItem *)item channel:(SSHKitSFTPChannel *)channel {
+    [channel.session dispatchAsyncOnSessionQueue:^{
+        // a resumed item keeps what is already on disk
+        int flags = O_WRONLY | O_CREAT | (item.resumeOffset ? 0 : O_TRUNC);
+        int fd = open(item.localPath.fileSystemRepresentation, flags, (mode_t)item.posixPermissions | S_IWUSR | S_IRUSR);
+        if (fd < 0) {
+            [self didFinishItem:item fd:-1 error:SSHKitPOSIXError(errno, item.localPath)];
+            return_from_block;
+        }
+
+        [SSHKitSFTPFile doOpenFile:channel path:item.remotePath accessType:O_RDONLY mode:0 completion:^(SSHKitSFTPFile *file, NSError *error) {
+            item.file = file;
+            if (error || item.job.cancelled) {
+                [self didFinishItem:item fd:fd error:error ?: SSHKitTransferCancelledError()];
+                return_from_block;
+            }
+
+            // size comes from listing or stat, the file was opened without stat
+            file.fileSize = @(item.totalBytes);
+            file.maxBytesInFlight = SFTP_TRANSFER_RESERVATION;
+
+            [file asyncDownloadToFileDescriptor:fd offset:item.resumeOffset options:SSHKitSFTPDownloadOptionNone progressBlock:[self progressBlockForItem:item] fileTransferSuccessBlock:^{
+                [self didFinishItem:item fd:fd error:nil];
+            } fileTransferFailBlock:^(NSError *error) {
+                [self didFinishItem:item fd:fd error:error];
+            }];
+        }];
+    }];
+}
+
+- (void)startUploadItem:(SSHKitSFTPTransferItem *)item channel:(SSHKitSFTPChannel *)channel {
+    [channel.session dispatchAsyncOnSessionQueue:^{
+        int fd = open(item.localPath.fileSystemRepresentation, O_RDONLY);
+        if (fd < 0) {
+            [self didFinishItem:item fd:-1 error:SSHKitPOSIXError(errno, item.localPath)];
+            return_from_block;
+        }
+
+        int accessType = O_WRONLY | O_CREAT | (item.resumeOffset ? 0 : O_TRUNC);
+        [SSHKitSFTPFile doOpenFile:channel path:item.remotePath accessType:accessType mode:item.posixPermissions completion:^(SSHKitSFTPFile *file, NSError *error) {
+            item.file = file;
+            if (error || item.job.cancelled) {
+                [self didFinishItem:item fd:fd error:error ?: SSHKitTransferCancelledError()];
+                return_from_block;
+            }
+
+            // a file grown since it was listed is uploaded as a whole
+            [file asyncUploadFromFileDescriptor:fd offset:item.resumeOffset length:ULLONG_MAX options:SSHKitSFTPUploadOptionNone progressBlock:[self progressBlockForItem:item] fileTransferSuccessBlock:^{
+                [self didFinishItem:item fd:fd error:nil];
+            } fileTransferFailBlock:^(NSError *error) {
+                [self didFinishItem:item fd:fd error:error];
+            }];
+        }];
+    }];
+}
+
+@end
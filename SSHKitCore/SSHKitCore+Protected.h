@@ -8,14 +8,80 @@
 #import "SSHKitChannel.h"
 #import "SSHKitKeyPair.h"
 #import "SSHKitHostKey.h"
+#import "SSHKitBufferPool.h"
+#import "SSHKitMetrics.h"
 #import "SSHKitSFTPChannel.h"
 #import "SSHKitSFTPFile.h"
+#import "SSHKitSFTPTransferJob.h"
+#import "SSHKitSFTPTransferScheduler.h"
+#import "SSHKitSFTPAttributeCache.h"
+#import "SSHKitReactor.h"
+#import "SSHKitTimerWheel.h"
+#import "SSHKitChannelPump.h"
+#import "SSHKitLocalForward.h"
 
 NSString * SSHKitGetBase64FromHostKey(ssh_key key);
 
+/** Unlink the reply of a request from sftp message queue, NULL if it has not been read from channel yet */
+sftp_message SSHKitSFTPTakeQueuedReply(sftp_session sftp, uint32_t requestId);
+BOOL SSHKitSFTPIsReplyQueued(sftp_session sftp, uint32_t requestId);
+/** Read every packet already available on channel into sftp message queue, without blocking */
+void SSHKitSFTPPumpReplies(sftp_session sftp);
+
+// SFTP request packing, values are in network byte order
+NS_INLINE BOOL sftp_buffer_add_u32(ssh_buffer buffer, uint32_t value) {
+    uint32_t netValue = CFSwapInt32HostToBig(value);
+    return ssh_buffer_add_data(buffer, &netValue, sizeof(netValue)) == 0;
+}
+
+NS_INLINE BOOL sftp_buffer_add_cstring(ssh_buffer buffer, const char *string) {
+    uint32_t length = (uint32_t)strlen(string);
+    return sftp_buffer_add_u32(buffer, length) && ssh_buffer_add_data(buffer, string, length) == 0;
+}
+
+NS_INLINE BOOL sftp_buffer_add_string(ssh_buffer buffer, ssh_string string) {
+    uint32_t length = (uint32_t)ssh_string_len(string);
+    return sftp_buffer_add_u32(buffer, length) && ssh_buffer_add_data(buffer, ssh_string_data(string), length) == 0;
+}
+
+NS_INLINE ssh_string sftp_buffer_get_string(ssh_buffer buffer) {
+    uint32_t netLength = 0;
+    if (ssh_buffer_get_data(buffer, &netLength, sizeof(netLength)) != sizeof(netLength)) {
+        return NULL;
+    }
+    
+    uint32_t length = CFSwapInt32BigToHost(netLength);
+    if (length > ssh_buffer_get_len(buffer)) {
+        return NULL;
+    }
+    
+    ssh_string string = ssh_string_new(length);
+    if (string && ssh_buffer_get_data(buffer, ssh_string_data(string), length) != length) {
+        ssh_string_free(string);
+        return NULL;
+    }
+    
+    return string;
+}
+
 #define SSHKIT_MAX_BUF_SIZE             4096    // Same size as libssh MAX_BUF_SIZE
 #define SSHKIT_CHANNEL_MAX_PACKET       32768
 #define SSHKIT_SESSION_DEFAULT_TIMEOUT  120     // two minutes
+#define SSHKIT_SESSION_MAX_RECONNECT_DELAY 30   // seconds between reconnect attempts at most
+
+// errors of file transfers
+NS_INLINE NSError *SSHKitPOSIXError(int code, NSString *path) {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain
+                               code:code
+                           userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"%s: %@", strerror(code), path],
+                                       NSFilePathErrorKey : path }];
+}
+
+NS_INLINE NSError *SSHKitTransferCancelledError(void) {
+    return [NSError errorWithDomain:SSHKitCoreErrorDomain
+                               code:SSHKitErrorStop
+                           userInfo:@{ NSLocalizedDescriptionKey : @"Transfer cancelled" }];
+}
 
 /*
  * 1. Session Queue could not dispatch write queue sync
@@ -36,10 +102,21 @@ typedef NS_ENUM(NSInteger, SSHKitChannelStage) {
 @interface SSHKitSession () {
     NSMutableArray      *_forwardRequests;
     NSMutableArray      *_channels;
+    
+    // channels to be serviced on next socket event: opening, waiting for remote window, or running sftp requests
+    NSMutableOrderedSet *_pendingChannels;
+    
+    // while reconnecting: channels to open again, and forwards to listen on again once authenticated
+    NSMutableArray      *_suspendedChannels;
+    NSMutableArray      *_listeningForwards;
+    
+    // local listeners, they live across reconnects and close with the session
+    NSMutableArray      *_localForwards;
 }
 
 /** Raw libssh session instance. */
 @property (nonatomic, readonly) ssh_session rawSession;
+@property (nonatomic, readonly) dispatch_queue_t sessionQueue;
 
 - (NSError *)libsshError;
 
@@ -48,6 +125,13 @@ typedef NS_ENUM(NSInteger, SSHKitChannelStage) {
 
 - (void)channel:(SSHKitChannel *)channel hasRaisedError:(NSError *)error;
 
+/** Service channel on socket events until it has no pending work */
+- (void)doScheduleChannel:(SSHKitChannel *)channel;
+- (void)doServicePendingChannels;
+
+/** Close channel with SSHKitErrorTimeout unless server confirms it within session timeout */
+- (void)doSetupOpenTimerForChannel:(SSHKitChannel *)channel;
+
 @end
 
 @interface SSHKitChannel () {
@@ -59,6 +143,10 @@ typedef NS_ENUM(NSInteger, SSHKitChannelStage) {
         unsigned int didOpen : 1;
         unsigned int didCloseWithError : 1;
         unsigned int didChangePtySizeToColumnsRows : 1;
+        unsigned int writeQueueDidReachHighWatermark : 1;
+        unsigned int writeQueueDidDrainToLowWatermark : 1;
+        unsigned int didExitWithStatus : 1;
+        unsigned int didReceiveEOF : 1;
     } _delegateFlags;
 }
 
@@ -75,10 +163,42 @@ typedef NS_ENUM(NSInteger, SSHKitChannelStage) {
 @property (nonatomic, readonly) sftp_session rawSFTPSession;
 
 @property (nonatomic, readwrite) SSHKitChannelStage stage;
+/** Whether channel is opened again after session reconnects, or closed with the connection, default YES */
+@property (nonatomic, readonly, getter = isSuspendable) BOOL suspendable;
+/** Deadline of opening, cancelled once channel leaves opening stage */
+@property (nonatomic, strong) SSHKitWheelTimer *openTimer;
 
 - (void)doOpen;
 - (void)doWrite;
 - (void)doCloseWithError:(NSError *)error;
+/** Connection lost while session reconnects, drop raw channel without telling delegate, channel is opened again on the new connection */
+- (void)doSuspend;
+
+/** Called from libssh data callback, returns bytes consumed, bytes not consumed are kept for ssh_channel_read */
+- (int)doReceiveBytes:(const void *)bytes length:(uint32_t)length isSTDError:(BOOL)isSTDError;
+/** Hand coalesced data to delegate */
+- (void)doFlushReceivedData;
+
+/** Leave received bytes to libssh, which stops opening the window once enough are kept, may be called from delegate callbacks */
+@property (nonatomic, readonly) BOOL receivePaused;
+- (void)doPauseReceiving;
+/** Deliver bytes kept by libssh, then receive as usual unless delegate paused again */
+- (void)doResumeReceiving;
+/** Tell delegate about EOF once received data is delivered */
+- (void)doReceiveEOF;
+/** Remote closed, closes once bytes kept while receiving was paused are delivered */
+- (void)doReceiveClose;
+
+/** writeData: on session queue */
+- (void)doEnqueueData:(NSData *)data;
+/** Drop data not yet accepted by libssh, returns the bytes dropped */
+- (NSUInteger)doDiscardWriteQueue;
+- (void)doSendEOF;
+
+/** Whether session should keep servicing channel on socket events */
+@property (nonatomic, readonly) BOOL hasPendingWork;
+
+- (SSHKitChannelMetrics *)doCollectMetrics;
 @end
 
 
@@ -100,6 +220,51 @@ typedef NS_ENUM(NSInteger, SSHKitChannelStage) {
 
 @end
 
+@interface SSHKitExecChannel()
+
+- (instancetype)initWithSession:(SSHKitSession *)session command:(NSString *)command delegate:(id<SSHKitChannelDelegate>)aDelegate;
+
+@end
+
+@interface SSHKitChannelPump ()
+
+/** Start right away, must be called on session queue */
+- (void)doStartWithCompletion:(SSHKitChannelPumpCompletionBlock)completion;
+
+@end
+
+@interface SSHKitLocalForward ()
+
+- (instancetype)initWithSession:(SSHKitSession *)session proxyType:(SSHKitProxyType)proxyType targetHost:(NSString *)targetHost targetPort:(NSUInteger)targetPort;
+
+- (BOOL)doListenOnAddress:(NSString *)address port:(uint16_t)port error:(NSError **)errorPtr;
+- (void)doCloseWithError:(NSError *)error;
+
+@end
+
+/** A serial queue of SSHKitReactor, counters are updated by the sessions living on it */
+@interface SSHKitReactorWorker : NSObject
+
+- (instancetype)initWithIndex:(NSUInteger)index;
+
+@property (nonatomic, readonly) NSUInteger index;
+@property (nonatomic, readonly) dispatch_queue_t queue;
+@property (nonatomic, readonly) NSUInteger sessionCount;
+
+- (void)doRetainSession;
+- (void)doReleaseSession;
+- (void)doRecordWakeup:(NSTimeInterval)wakeupTime;
+- (SSHKitReactorWorkerStats *)stats;
+
+@end
+
+@interface SSHKitReactor ()
+
+/** Worker with fewest sessions, its session count already includes the caller */
+- (SSHKitReactorWorker *)doTakeWorker;
+
+@end
+
 @interface SSHKitKeyPair ()
 
 @property (nonatomic, readonly) ssh_key privateKey;
@@ -115,10 +280,31 @@ typedef NS_ENUM(NSInteger, SSHKitChannelStage) {
 
 @end
 
+/** Called on session queue with reply type and payload positioned after request id, payload is NULL if channel closed */
+typedef void (^ SSHKitSFTPReplyHandler)(uint8_t type, ssh_buffer payload);
+
 @interface SSHKitSFTPChannel()
 
 @property (nonatomic, readwrite) sftp_session rawSFTPSession;
 @property (nonatomic, readonly) NSError* libsshSFTPError;
+/** Bumped each time the channel loses its connection, handles opened on an earlier one are invalid */
+@property (nonatomic, readonly) NSUInteger connectionGeneration;
+
+/** Service every transferring file, schedules another run if some of them still have replies ready */
+- (void)doTransfer;
+
+/** Synchronous sftp requests may read replies of transfers from channel, resume transfers after them */
+- (void)dispatchSyncOnSessionQueue:(dispatch_block_t)block;
+
+/**
+ Send a request without waiting for its reply, fields are appended after request id.
+
+ @return request id, or SSH_ERROR if the request could not be sent
+ */
+- (int)doSendRequest:(uint8_t)type fields:(BOOL (^)(ssh_buffer buffer))fields replyHandler:(SSHKitSFTPReplyHandler)replyHandler;
+
+/** Reply status carried by a SSH_FXP_STATUS payload, as NSError */
+- (NSError *)errorFromStatusPayload:(ssh_buffer)payload;
 
 @end
 
@@ -128,12 +314,169 @@ typedef NS_ENUM(NSInteger, SSHKitChannelStage) {
 @property (nonatomic, readonly) sftp_dir rawDirectory;
 @property (nonatomic, readonly) sftp_file rawFile;
 
+/** Downloads stop at fileSize, set it on files opened without stat */
+@property (nonatomic, strong) NSNumber *fileSize;
+
 - (NSError *)open;
 - (NSError *)openFileForWrite:(BOOL)shouldResume mode:(unsigned long)mode;
 - (NSError *)openFile:(int)accessType mode:(unsigned long)mode;
-- (void)didReceiveData:(NSData *)data;
 - (NSError *)updateStat;
 - (SSHKitSFTPIsFileExist)isExist;
 - (void)doFileTransferFail:(NSError *)error;
 
+- (BOOL)doTransfer;
+- (BOOL)hasQueuedReply;
+/** Fail running transfer with error, draining replies still in flight unless the channel is closed */
+- (void)doCancelTransfer:(NSError *)error;
+/** Fail running transfer with error once the channel is closed, nothing is drained */
+- (void)doAbortTransfer:(NSError *)error;
+
+/** Offset before which every byte has reached its destination, valid once a transfer ended. Transfers resume from it */
+@property (nonatomic, readonly) unsigned long long committedOffset;
+
+/** Non-blocking open, completion is called on session queue */
++ (void)doOpenFile:(SSHKitSFTPChannel *)sftpChannel path:(NSString *)path accessType:(int)accessType mode:(unsigned long)mode completion:(void (^)(SSHKitSFTPFile *file, NSError *error))completion;
+
+/** Non-blocking stat, follows symlinks, completion is called on session queue */
++ (void)doStatFile:(SSHKitSFTPChannel *)sftpChannel path:(NSString *)path completion:(void (^)(SSHKitSFTPFile *file, NSError *error))completion;
+
+/** Close without waiting for the status of CLOSE request */
+- (void)doCloseFile;
+
+- (SSHKitSFTPFileMetrics *)doCollectMetrics;
+
+- (void)populateValuesFromDirectoryEntry:(const SSHKitSFTPDirectoryEntry *)entry;
+
+@end
+
+@interface SSHKitSFTPTransferItem ()
+
+@property (nonatomic, weak) SSHKitSFTPTransferJob *job;
+@property (nonatomic, readwrite) unsigned long long totalBytes;
+@property (nonatomic, readwrite) unsigned long long transferredBytes;
+@property (nonatomic, readwrite, getter = isFinished) BOOL finished;
+@property (nonatomic, readwrite) NSError *error;
+@property (nonatomic) BOOL sizeKnown;
+@property (nonatomic) unsigned long posixPermissions;
+
+// scheduler bookkeeping, only touched on scheduler queue
+@property (nonatomic) NSUInteger channelIndex;
+@property (nonatomic) unsigned long long reservedBytes;
+@property (nonatomic) BOOL small;
+/** Where the transfer continues after a lost connection, and how often it did */
+@property (nonatomic) unsigned long long resumeOffset;
+@property (nonatomic) NSUInteger resumeCount;
+
+/** Remote file being transferred, only touched on session queue */
+@property (nonatomic, strong) SSHKitSFTPFile *file;
+
+@end
+
+@interface SSHKitSFTPTransferJob ()
+
+- (instancetype)initWithScheduler:(SSHKitSFTPTransferScheduler *)scheduler;
+- (void)addItem:(SSHKitSFTPTransferItem *)item;
+
+/** items.count without copying items */
+@property (nonatomic, readonly) NSUInteger itemCount;
+
+@property (nonatomic, weak) SSHKitSFTPTransferScheduler *scheduler;
+@property (nonatomic, readwrite) unsigned long long totalBytes;
+@property (nonatomic, readwrite) unsigned long long transferredBytes;
+@property (nonatomic, readwrite) NSUInteger finishedItemCount;
+@property (nonatomic, readwrite, getter = isCancelled) BOOL cancelled;
+@property (nonatomic, readwrite, getter = isFinished) BOOL finished;
+@property (nonatomic) BOOL expanding;
+@property (nonatomic) CFAbsoluteTime progressReportedAt;
+
+@end
+
+@interface SSHKitSFTPTransferScheduler ()
+
+- (void)cancelJob:(SSHKitSFTPTransferJob *)job;
+
+@end
+
+@interface SSHKitChannelMetrics ()
+
+@property (nonatomic, readwrite) unsigned long long bytesIn;
+@property (nonatomic, readwrite) unsigned long long bytesOut;
+@property (nonatomic, readwrite) NSUInteger packetsIn;
+@property (nonatomic, readwrite) NSUInteger packetsOut;
+@property (nonatomic, readwrite) NSUInteger queuedWriteBytes;
+@property (nonatomic, readwrite) NSUInteger windowStalls;
+@property (nonatomic, readwrite) NSUInteger receiveAllocationCount;
+@property (nonatomic, readwrite) NSUInteger outstandingRequests;
+
+@end
+
+@interface SSHKitSFTPFileMetrics ()
+
+@property (nonatomic, readwrite) NSUInteger requestsSent;
+@property (nonatomic, readwrite) NSUInteger outstandingRequests;
+@property (nonatomic, readwrite) unsigned long long bytesTransferred;
+@property (nonatomic, readwrite) NSTimeInterval transferDuration;
+@property (nonatomic, readwrite) double throughput;
+@property (nonatomic, readwrite) unsigned long long peakBytesInFlight;
+@property (nonatomic, readwrite) SSHKitLatencyHistogram *requestLatency;
+
+@end
+
+@interface SSHKitLocalForwardMetrics ()
+
+@property (nonatomic, readwrite) NSDate *date;
+@property (nonatomic, readwrite) unsigned long long bytesToRemote;
+@property (nonatomic, readwrite) unsigned long long bytesFromRemote;
+@property (nonatomic, readwrite) double throughput;
+@property (nonatomic, readwrite) NSUInteger activeConnections;
+@property (nonatomic, readwrite) NSUInteger openingConnections;
+@property (nonatomic, readwrite) NSUInteger totalConnections;
+@property (nonatomic, readwrite) NSUInteger failedConnections;
+@property (nonatomic, readwrite) NSUInteger limitStalls;
+@property (nonatomic, readwrite) SSHKitLatencyHistogram *openLatency;
+
+@end
+
+@interface SSHKitSessionMetrics ()
+
+@property (nonatomic, readwrite) NSDate *date;
+@property (nonatomic, readwrite) unsigned long long bytesIn;
+@property (nonatomic, readwrite) unsigned long long bytesOut;
+@property (nonatomic, readwrite) NSUInteger packetsIn;
+@property (nonatomic, readwrite) NSUInteger packetsOut;
+@property (nonatomic, readwrite) NSUInteger windowStalls;
+@property (nonatomic, readwrite) NSDictionary *handshakeDurations;
+@property (nonatomic, readwrite) NSUInteger wakeups;
+@property (nonatomic, readwrite) NSTimeInterval wakeupTime;
+@property (nonatomic, readwrite) NSTimeInterval maxWakeupTime;
+@property (nonatomic, readwrite) NSUInteger channelServices;
+@property (nonatomic, readwrite) NSArray *channels;
+
+@end
+
+@interface SSHKitSFTPDirectoryEntries ()
+
+/** Parse a SSH_FXP_NAME payload, nil if malformed */
+- (instancetype)initWithPayload:(ssh_buffer)payload channel:(SSHKitSFTPChannel *)channel parentPath:(NSString *)parentPath;
+
+@end
+
+@interface SSHKitSFTPAttributeCache ()
+
+/**
+ Cached lstat, or stat if followLinks, of path
+
+ @return NO on miss, otherwise exists tells whether path was found, entry is only filled if it was
+ */
+- (BOOL)lookupAttributes:(SSHKitSFTPDirectoryEntry *)entry path:(NSString *)path followLinks:(BOOL)followLinks exists:(BOOL *)exists;
+- (void)storeAttributes:(const SSHKitSFTPDirectoryEntry *)entry path:(NSString *)path followLinks:(BOOL)followLinks;
+/** Remember server answered "no such file" */
+- (void)storeMissingPath:(NSString *)path;
+- (void)storeDirectoryEntries:(SSHKitSFTPDirectoryEntries *)entries;
+
+- (NSString *)lookupLinkTarget:(NSString *)path;
+- (void)storeLinkTarget:(NSString *)target path:(NSString *)path;
+- (NSString *)lookupCanonicalPath:(NSString *)path;
+- (void)storeCanonicalPath:(NSString *)canonicalPath path:(NSString *)path;
+
 @end
@@ -7,5 +7,23 @@
 #import "SSHKitShellChannel.h"
 #import "SSHKitKeyPair.h"
 #import "SSHKitHostKey.h"
+#import "SSHKitBufferPool.h"
 #import "SSHKitSFTPChannel.h"
-#import "SSHKitSFTPFile.h"
\ No newline at end of file
+#import "SSHKitSFTPFile.h"
+#import "SSHKitSFTPTransferJob.h"
+#import "SSHKitSFTPTransferScheduler.h"
+#import "SSHKitMetrics.h"
+#import "SSHKitSessionPool.h"
+#import "SSHKitSFTPDirectoryEntries.h"
+#import "SSHKitSFTPAttributeCache.h"
+#import "SSHKitSFTPChannel+Batch.h"
+#import "SSHKitSFTPStripedTransfer.h"
+#import "SSHKitAddressRacer.h"
+#import "SSHKitIdentityCache.h"
+#import "SSHKitCipherProbe.h"
+#import "SSHKitReactor.h"
+#import "SSHKitTimerWheel.h"
+#import "SSHKitExecChannel.h"
+#import "SSHKitExecRunner.h"
+#import "SSHKitChannelPump.h"
+#import "SSHKitLocalForward.h"
\ No newline at end of file
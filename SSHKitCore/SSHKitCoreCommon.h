@@ -25,7 +25,7 @@
 #define SSHKit_SSH_AGAIN -2 /* The nonblocking call must be repeated */
 #define SSHKit_SSH_EOF -127 /* We have already a eof */
 
-@class SSHKitSFTPFile;
+@class SSHKitSFTPFile, SSHKitSessionMetrics;
 
 typedef NS_ENUM(NSInteger, SSHKitErrorCode) {
     // error code from libssh
@@ -84,6 +84,22 @@ typedef NS_ENUM(NSUInteger, SSHKitSFTPIsFileExist) {
     SSHKitSFTPIsFileExistDirectory,
 };
 
+typedef NS_OPTIONS(NSUInteger, SSHKitSFTPDownloadOptions) {
+    SSHKitSFTPDownloadOptionNone = 0,
+    // reserve size of remote file on local disk before first write, avoids fragmentation of large files.
+    // local file gets its final size at once, so its size can't tell where to resume any more
+    SSHKitSFTPDownloadOptionPreallocate = 1 << 0,
+    // flush local file to permanent storage before reporting success
+    SSHKitSFTPDownloadOptionSyncOnCompletion = 1 << 1,
+};
+
+typedef NS_OPTIONS(NSUInteger, SSHKitSFTPUploadOptions) {
+    SSHKitSFTPUploadOptionNone = 0,
+    // send straight from a read-only mapping of local file instead of reading it into buffers,
+    // local file must not shrink during the upload, or the process is killed by SIGBUS
+    SSHKitSFTPUploadOptionMapLocalFile = 1 << 0,
+};
+
 typedef struct sftp_attributes_struct* sshkit_sftp_attributes;
 
 /* All implementations MUST be able to process packets with an
@@ -98,12 +114,17 @@ typedef NSArray *(^ SSHKitAskInteractiveInfoBlock)(NSInteger, NSString *, NSStri
 
 typedef void (^ SSHKitListeningRequestCompletionBlock)(BOOL success, uint16_t boundPort, NSError *error);
 
+typedef void (^ SSHKitSessionMetricsHandler)(SSHKitSessionMetrics *metrics);
+
 // Block typedefs
 typedef SSHKitSFTPListDirFilterCode(^SSHKitSFTPListDirFilter)(SSHKitSFTPFile *sftpFile);
 typedef void(^SSHKitSFTPClientSuccessBlock)(void);
 typedef void(^SSHKitSFTPClientFailureBlock)(NSError *error);
 typedef void(^SSHKitSFTPClientProgressBlock) (unsigned long bytesNewReceived, unsigned long long bytesReceived, unsigned long long bytesTotal);
 typedef void(^SSHKitSFTPClientReadFileBlock) (char *buffer, int bufferLength);
+typedef void(^SSHKitSFTPClientTransferStatsBlock) (NSUInteger concurrentRequests, uint32_t requestSize, NSTimeInterval roundTripTime, double bytesPerSecond);
+// fill buffer with at most bufferLength bytes, return bytes filled, 0 if no more data, or -1 to abort the transfer
+typedef int(^SSHKitSFTPClientWriteFileBlock) (char *buffer, int bufferLength);
 
 // -----------------------------------------------------------------------------
 #pragma mark Advanced SSH Options
@@ -116,6 +137,8 @@ extern NSString * const kVTKitMACAlgorithmsKey;
 extern NSString * const kVTKitKeyExchangeAlgorithmsKey;
 extern NSString * const kVTKitServerAliveCountMaxKey;   // <=0 will disable keepalive mech.
 extern NSString * const kVTKitDebugLevelKey;
+extern NSString * const kVTKitAuthenticationTimeoutKey; // seconds from key exchange until authenticated, <=0 waits forever
+extern NSString * const kVTKitProbeAlgorithmsKey;       // @YES to order ciphers and MACs by SSHKitCipherProbe, unless given explicitly
 
 // default preferred ciphers order
 extern NSString * const kVTKitDefaultEncryptionCiphers;
@@ -161,5 +184,9 @@ typedef void (^ SSHKitLogHandler)(NSInteger priority, NSString *function, NSStri
  Get trace output, packet information
     SSH_LOG_TRACE 4
 */
+/* Registrations on one queue are counted, the queue logs until the last of them is removed. libssh does
+ * not tell which session logs, messages go to the handler registered last. */
 void SSHKitRegisterLogCallback(NSInteger level, SSHKitLogHandler block, dispatch_queue_t queue);
+/* Remove the registration of block, pass nil for the one made last */
+void SSHKitUnregisterLogHandler(SSHKitLogHandler block, dispatch_queue_t queue);
 void SSHKitUnregisterLogCallback(dispatch_queue_t queue);
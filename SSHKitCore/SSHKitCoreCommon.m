@@ -64,30 +64,89 @@ NSString * const kVTKitMACAlgorithmsKey     = @"VTKitMACAlgorithmsKey";
 NSString * const kVTKitKeyExchangeAlgorithmsKey = @"VTKitKeyExchangeAlgorithmsKey";
 NSString * const kVTKitServerAliveCountMaxKey   = @"VTKitServerAliveCountMaxKey";
 NSString * const kVTKitDebugLevelKey            = @"VTKitDebugLevelKey";
+NSString * const kVTKitProbeAlgorithmsKey       = @"VTKitProbeAlgorithmsKey";
+NSString * const kVTKitAuthenticationTimeoutKey = @"VTKitAuthenticationTimeoutKey";
 
 #pragma mark - Libssh logging
 
+/** Handlers registered on one queue, sessions sharing a reactor worker register on the same queue */
+@interface SSHKitLogRegistration : NSObject
+
+@property (nonatomic, strong) NSMutableArray<SSHKitLogHandler> *handlers;
+
+@end
+
+@implementation SSHKitLogRegistration
+@end
+
+/** Queue to its registration, guarded by itself */
+static NSMapTable *SSHKitLogRegistrations() {
+    static NSMapTable *registrations = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        registrations = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+                                              valueOptions:NSPointerFunctionsStrongMemory];
+    });
+    return registrations;
+}
+
 static void raw_session_log_callback(int priority, const char *function, const char *message, void *userdata) {
     if (!userdata) return;
     
+    SSHKitLogHandler block = nil;
+    @synchronized (SSHKitLogRegistrations()) {
+        // libssh does not tell which session logs, latest registration gets it
+        block = ((__bridge SSHKitLogRegistration *)userdata).handlers.lastObject;
+    }
+    if (!block) return;
+    
     NSString *functionName = function ? @(function) : nil;
     NSString *messageString = message ? @(message) : nil;
     
-    SSHKitLogHandler block = (__bridge SSHKitLogHandler)userdata;
     block(priority, functionName, messageString);
 }
 
 void SSHKitRegisterLogCallback(NSInteger level, SSHKitLogHandler block, dispatch_queue_t queue) {
+    NSCParameterAssert(block && queue);
+    
+    SSHKitLogRegistration *registration = nil;
+    @synchronized (SSHKitLogRegistrations()) {
+        registration = [SSHKitLogRegistrations() objectForKey:queue];
+        if (!registration) {
+            registration = [[SSHKitLogRegistration alloc] init];
+            registration.handlers = [@[] mutableCopy];
+            [SSHKitLogRegistrations() setObject:registration forKey:queue];
+        }
+        [registration.handlers addObject:[block copy]];
+    }
+    
+    // registration stays in the table while it has handlers, userdata needs no reference of its own
     ssh_set_log_callback_dispatch(raw_session_log_callback, queue);
-    ssh_set_log_userdata_dispatch((__bridge_retained void *)(block), queue);
+    ssh_set_log_userdata_dispatch((__bridge void *)registration, queue);
     ssh_set_log_level_dispatch((int)level, queue);
 }
 
-void SSHKitUnregisterLogCallback(dispatch_queue_t queue) {
-    // transfer object to ARC
-    SSHKitLogHandler handler = (__bridge_transfer SSHKitLogHandler)ssh_get_log_userdata();
-    
-    if (handler) {
-        ssh_set_log_userdata_dispatch(NULL, queue);
+void SSHKitUnregisterLogHandler(SSHKitLogHandler block, dispatch_queue_t queue) {
+    @synchronized (SSHKitLogRegistrations()) {
+        SSHKitLogRegistration *registration = [SSHKitLogRegistrations() objectForKey:queue];
+        if (!registration) {
+            return;
+        }
+        
+        NSUInteger index = block ? [registration.handlers indexOfObjectIdenticalTo:block] : registration.handlers.count - 1;
+        if (index == NSNotFound) {
+            return;
+        }
+        [registration.handlers removeObjectAtIndex:index];
+        
+        // other sessions on the queue keep logging
+        if (!registration.handlers.count) {
+            ssh_set_log_userdata_dispatch(NULL, queue);
+            [SSHKitLogRegistrations() removeObjectForKey:queue];
+        }
     }
 }
+
+void SSHKitUnregisterLogCallback(dispatch_queue_t queue) {
+    SSHKitUnregisterLogHandler(nil, queue);
+}
@@ -0,0 +1,76 @@
+//
+//  SSHKitExecRunner.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+
+@class SSHKitSessionPool;
+
+/** Outcome of the command on one host */
+@interface SSHKitExecResult : NSObject
+
+@property (nonatomic, readonly) NSString *host;
+
+@property (nonatomic, readonly) NSData *stdoutData;
+@property (nonatomic, readonly) NSData *stderrData;
+/** Output beyond maxOutputLength of the runner was dropped */
+@property (nonatomic, readonly, getter = isStdoutTruncated) BOOL stdoutTruncated;
+@property (nonatomic, readonly, getter = isStderrTruncated) BOOL stderrTruncated;
+
+/** -1 if command did not report one */
+@property (nonatomic, readonly) NSInteger exitStatus;
+/** nil if command ran to its end, whatever its exit status, SSHKitErrorTimeout past hostTimeout */
+@property (nonatomic, readonly) NSError *error;
+/** From acquiring a session until channel closed */
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+@end
+
+/** Called on callback queue once per host, in the order hosts finish */
+typedef void(^SSHKitExecRunnerResultBlock)(SSHKitExecResult *result);
+/** Called on callback queue, results are in the order hosts finished */
+typedef void(^SSHKitExecRunnerCompletionBlock)(NSArray<SSHKitExecResult *> *results);
+
+/**
+ Runs one command on many hosts through SSHKitExecChannel, at most maxConcurrentHosts at a time.
+
+ Sessions are acquired from the pool and released once the command on them closed, so hosts run again
+ soon reuse their connection, a one-off fan-out over thousands of hosts wants a short idleTimeout of the
+ pool. Every host gets hostTimeout to connect, authenticate and run the command, the channel of a
+ host running late is closed and the output read so far is kept. A host timing out while its session
+ is still connecting is reported at once, but keeps its slot until the pool gave up on the connection.
+ One run at a time.
+ */
+@interface SSHKitExecRunner : NSObject
+
+- (instancetype)initWithSessionPool:(SSHKitSessionPool *)sessionPool;
+
+@property (nonatomic, readonly) SSHKitSessionPool *sessionPool;
+
+/** Default 64 */
+@property (nonatomic) NSUInteger maxConcurrentHosts;
+/** Seconds per host, 0 for no limit, default 60 */
+@property (nonatomic) NSTimeInterval hostTimeout;
+/** Bytes kept of stdout and of stderr per host, default 1 MB */
+@property (nonatomic) NSUInteger maxOutputLength;
+
+/** Queue for blocks, default main queue */
+@property (nonatomic, strong) dispatch_queue_t callbackQueue;
+@property (nonatomic, copy) SSHKitExecRunnerResultBlock resultBlock;
+
+/** Hosts connecting or running the command */
+@property (nonatomic, readonly) NSUInteger runningCount;
+
+- (void)runCommand:(NSString *)command
+           onHosts:(NSArray<NSString *> *)hosts
+              port:(uint16_t)port
+              user:(NSString *)user
+           options:(NSDictionary *)options
+        completion:(SSHKitExecRunnerCompletionBlock)completion;
+
+/** Hosts not finished yet get SSHKitErrorStop, completion is still called */
+- (void)cancel;
+
+@end
@@ -0,0 +1,370 @@
+//
+//  SSHKitExecRunner.m
+//  SSHKitCore
+//
+
+#import "SSHKitExecRunner.h"
+#import "SSHKitSessionPool.h"
+#import "SSHKitSession+Channels.h"
+#import "SSHKitExecChannel.h"
+#import "SSHKitCore+Protected.h"
+
+static NSError *SSHKitExecRunnerError(SSHKitErrorCode code, NSString *description) {
+    return [NSError errorWithDomain:SSHKitCoreErrorDomain
+                               code:code
+                           userInfo:@{ NSLocalizedDescriptionKey : description }];
+}
+
+@interface SSHKitExecResult ()
+
+@property (nonatomic, readwrite, copy) NSString *host;
+@property (nonatomic, readwrite, strong) NSData *stdoutData;
+@property (nonatomic, readwrite, strong) NSData *stderrData;
+@property (nonatomic, readwrite, getter = isStdoutTruncated) BOOL stdoutTruncated;
+@property (nonatomic, readwrite, getter = isStderrTruncated) BOOL stderrTruncated;
+@property (nonatomic, readwrite) NSInteger exitStatus;
+@property (nonatomic, readwrite, strong) NSError *error;
+@property (nonatomic, readwrite) NSTimeInterval duration;
+
+@end
+
+@implementation SSHKitExecResult
+@end
+
+#pragma mark - Tasks
+
+/**
+ Command on one host. Until a session is acquired the task lives on the runner queue, afterwards its
+ output and result are built on the session queue, by channel callbacks.
+ */
+@interface SSHKitExecTask : NSObject <SSHKitChannelDelegate>
+
+@property (nonatomic, copy) NSString *host;
+@property (nonatomic) CFAbsoluteTime startedAt;
+@property (nonatomic) NSUInteger maxOutputLength;
+
+// runner queue
+@property (nonatomic, strong) SSHKitSession *session;
+@property (nonatomic, strong) SSHKitExecChannel *channel;
+@property (nonatomic, strong) SSHKitWheelTimer *deadline;
+/** Finished before a session was acquired, still holds its slot until the acquire completes */
+@property (nonatomic) BOOL abandoned;
+
+// session queue
+@property (nonatomic, strong) NSMutableData *stdoutData;
+@property (nonatomic, strong) NSMutableData *stderrData;
+@property (nonatomic) BOOL stdoutTruncated;
+@property (nonatomic) BOOL stderrTruncated;
+/** Why runner closed the channel */
+@property (nonatomic, strong) NSError *abortError;
+
+/** Called on session queue once channel closed */
+@property (nonatomic, copy) void (^ closeHandler)(SSHKitExecResult *result);
+
+@end
+
+@implementation SSHKitExecTask
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _stdoutData = [NSMutableData data];
+        _stderrData = [NSMutableData data];
+    }
+    return self;
+}
+
+- (SSHKitExecResult *)resultWithError:(NSError *)error {
+    SSHKitExecResult *result = [[SSHKitExecResult alloc] init];
+    result.host = _host;
+    result.stdoutData = [_stdoutData copy];
+    result.stderrData = [_stderrData copy];
+    result.stdoutTruncated = _stdoutTruncated;
+    result.stderrTruncated = _stderrTruncated;
+    result.exitStatus = _channel ? _channel.exitStatus : -1;
+    result.error = error;
+    result.duration = CFAbsoluteTimeGetCurrent() - _startedAt;
+
+    return result;
+}
+
+/** @return whether data was cut */
+- (BOOL)doAppendData:(NSData *)data toBuffer:(NSMutableData *)buffer {
+    NSUInteger room = _maxOutputLength > buffer.length ? _maxOutputLength - buffer.length : 0;
+    if (data.length <= room) {
+        [buffer appendData:data];
+        return NO;
+    }
+
+    [buffer appendBytes:data.bytes length:room];
+    return YES;
+}
+
+#pragma mark - SSHKitChannelDelegate
+
+- (void)channel:(SSHKitChannel *)channel didReadStdoutData:(NSData *)data {
+    if ([self doAppendData:data toBuffer:_stdoutData]) {
+        _stdoutTruncated = YES;
+    }
+}
+
+- (void)channel:(SSHKitChannel *)channel didReadStderrData:(NSData *)data {
+    if ([self doAppendData:data toBuffer:_stderrData]) {
+        _stderrTruncated = YES;
+    }
+}
+
+- (void)channelDidClose:(SSHKitChannel *)channel withError:(NSError *)error {
+    void (^ closeHandler)(SSHKitExecResult *) = _closeHandler;
+    _closeHandler = nil;
+
+    if (closeHandler) {
+        closeHandler([self resultWithError:_abortError ?: error]);
+    }
+}
+
+@end
+
+#pragma mark -
+
+@interface SSHKitExecRunner () {
+    dispatch_queue_t _runnerQueue;
+
+    NSString *_command;
+    uint16_t _port;
+    NSString *_user;
+    NSDictionary *_options;
+
+    NSMutableArray<NSString *> *_pendingHosts;
+    NSMutableSet<SSHKitExecTask *> *_runningTasks;
+    NSMutableSet<SSHKitExecTask *> *_abandonedTasks;
+    NSMutableArray<SSHKitExecResult *> *_results;
+    SSHKitExecRunnerCompletionBlock _completion;
+}
+
+@end
+
+@implementation SSHKitExecRunner
+
+- (instancetype)initWithSessionPool:(SSHKitSessionPool *)sessionPool {
+    NSParameterAssert(sessionPool);
+
+    if ((self = [super init])) {
+        _sessionPool = sessionPool;
+        _maxConcurrentHosts = 64;
+        _hostTimeout = 60;
+        _maxOutputLength = 1024 * 1024;
+        _callbackQueue = dispatch_get_main_queue();
+
+        _runnerQueue = dispatch_queue_create("com.codinn.libssh.exec_runner", DISPATCH_QUEUE_SERIAL);
+        _pendingHosts = [@[] mutableCopy];
+        _runningTasks = [NSMutableSet set];
+        _abandonedTasks = [NSMutableSet set];
+        _results = [@[] mutableCopy];
+    }
+    return self;
+}
+
+- (NSUInteger)runningCount {
+    __block NSUInteger count = 0;
+    dispatch_sync(_runnerQueue, ^{
+        count = _runningTasks.count + _abandonedTasks.count;
+    });
+    return count;
+}
+
+#pragma mark - Running
+
+- (void)runCommand:(NSString *)command
+           onHosts:(NSArray<NSString *> *)hosts
+              port:(uint16_t)port
+              user:(NSString *)user
+           options:(NSDictionary *)options
+        completion:(SSHKitExecRunnerCompletionBlock)completion {
+    NSParameterAssert(command && completion);
+
+    dispatch_async(_runnerQueue, ^{
+        if (_completion) {
+            NSMutableArray *results = [NSMutableArray arrayWithCapacity:hosts.count];
+            for (NSString *host in hosts) {
+                SSHKitExecResult *result = [[SSHKitExecResult alloc] init];
+                result.host = host;
+                result.exitStatus = -1;
+                result.error = SSHKitExecRunnerError(SSHKitErrorStop, @"Another run is in progress");
+                [results addObject:result];
+            }
+
+            dispatch_async(_callbackQueue, ^{
+                completion(results);
+            });
+            return_from_block;
+        }
+
+        _command = [command copy];
+        _port = port;
+        _user = [user copy];
+        _options = [options copy];
+        _completion = [completion copy];
+        [_pendingHosts setArray:hosts];
+        [_results removeAllObjects];
+
+        [self doStartTasks];
+        [self doFinishIfNeeded];
+    });
+}
+
+- (void)cancel {
+    dispatch_async(_runnerQueue, ^{
+        NSError *error = SSHKitExecRunnerError(SSHKitErrorStop, @"Run cancelled");
+
+        NSArray *hosts = [_pendingHosts copy];
+        [_pendingHosts removeAllObjects];
+        for (NSString *host in hosts) {
+            SSHKitExecTask *task = [[SSHKitExecTask alloc] init];
+            task.host = host;
+            task.startedAt = CFAbsoluteTimeGetCurrent();
+            [self doReportResult:[task resultWithError:error]];
+        }
+
+        for (SSHKitExecTask *task in [_runningTasks copy]) {
+            [self doAbortTask:task error:error];
+        }
+
+        [self doFinishIfNeeded];
+    });
+}
+
+- (void)doStartTasks {
+    // abandoned tasks count, the pool is still connecting for them
+    while (_pendingHosts.count && _runningTasks.count + _abandonedTasks.count < MAX(_maxConcurrentHosts, 1)) {
+        SSHKitExecTask *task = [[SSHKitExecTask alloc] init];
+        task.host = _pendingHosts.firstObject;
+        task.startedAt = CFAbsoluteTimeGetCurrent();
+        task.maxOutputLength = _maxOutputLength;
+        [_pendingHosts removeObjectAtIndex:0];
+        [_runningTasks addObject:task];
+
+        __weak SSHKitExecRunner *weakSelf = self;
+        if (_hostTimeout > 0) {
+            task.deadline = [[SSHKitTimerWheel sharedWheel] scheduleTimerWithDelay:_hostTimeout queue:_runnerQueue block:^{
+                NSString *errorDesc = [NSString stringWithFormat:@"Timeout, command on %@ not finished", task.host];
+                [weakSelf doAbortTask:task error:SSHKitExecRunnerError(SSHKitErrorTimeout, errorDesc)];
+            }];
+        }
+
+        SSHKitSessionPool *sessionPool = _sessionPool;
+        [sessionPool acquireSessionForHost:task.host port:_port user:_user options:_options completion:^(SSHKitSession *session, NSError *error) {
+            __strong SSHKitExecRunner *strongSelf = weakSelf;
+            if (!strongSelf) {
+                if (session) {
+                    [sessionPool releaseSession:session];
+                }
+                return_from_block;
+            }
+
+            dispatch_async(strongSelf->_runnerQueue, ^{
+                [strongSelf doRunTask:task session:session error:error];
+            });
+        }];
+    }
+}
+
+- (void)doRunTask:(SSHKitExecTask *)task session:(SSHKitSession *)session error:(NSError *)error {
+    if (task.abandoned) {
+        if (session) {
+            [_sessionPool releaseSession:session];
+        }
+        [_abandonedTasks removeObject:task];
+        [self doStartTasks];
+        return;
+    }
+
+    if (!session) {
+        [self doCompleteTask:task result:[task resultWithError:error]];
+        return;
+    }
+
+    task.session = session;
+
+    __weak SSHKitExecRunner *weakSelf = self;
+    task.closeHandler = ^(SSHKitExecResult *result) {
+        __strong SSHKitExecRunner *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+
+        dispatch_async(strongSelf->_runnerQueue, ^{
+            [strongSelf doCompleteTask:task result:result];
+        });
+    };
+
+    task.channel = [session openExecChannelWithCommand:_command delegate:task];
+}
+
+/** Close channel of task, or give up waiting for its session */
+- (void)doAbortTask:(SSHKitExecTask *)task error:(NSError *)error {
+    if (![_runningTasks containsObject:task]) {
+        return;
+    }
+
+    if (!task.session) {
+        task.abandoned = YES;
+        [_abandonedTasks addObject:task];
+        [self doCompleteTask:task result:[task resultWithError:error]];
+        return;
+    }
+
+    SSHKitExecChannel *channel = task.channel;
+    [task.session dispatchAsyncOnSessionQueue:^{
+        if (!task.abortError) {
+            task.abortError = error;
+        }
+        [channel doCloseWithError:nil];
+    }];
+}
+
+- (void)doCompleteTask:(SSHKitExecTask *)task result:(SSHKitExecResult *)result {
+    if (![_runningTasks containsObject:task]) {
+        return;
+    }
+
+    [_runningTasks removeObject:task];
+    [task.deadline cancel];
+    task.deadline = nil;
+
+    if (task.session) {
+        [_sessionPool releaseSession:task.session];
+        task.session = nil;
+    }
+
+    [self doReportResult:result];
+    [self doStartTasks];
+    [self doFinishIfNeeded];
+}
+
+- (void)doReportResult:(SSHKitExecResult *)result {
+    [_results addObject:result];
+
+    SSHKitExecRunnerResultBlock resultBlock = _resultBlock;
+    if (resultBlock) {
+        dispatch_async(_callbackQueue, ^{
+            resultBlock(result);
+        });
+    }
+}
+
+- (void)doFinishIfNeeded {
+    if (!_completion || _pendingHosts.count || _runningTasks.count) {
+        return;
+    }
+
+    SSHKitExecRunnerCompletionBlock completion = _completion;
+    NSArray *results = [_results copy];
+    _completion = nil;
+    [_results removeAllObjects];
+
+    dispatch_async(_callbackQueue, ^{
+        completion(results);
+    });
+}
+
+@end
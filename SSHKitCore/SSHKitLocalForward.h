@@ -0,0 +1,58 @@
+//
+//  SSHKitLocalForward.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+
+@class SSHKitSession, SSHKitLocalForwardMetrics;
+
+/** Called on session queue once the forward stopped listening, error is nil if it was closed */
+typedef void(^SSHKitLocalForwardCloseBlock)(NSError *error);
+
+/**
+ Local listener owned by a session, see -startLocalForwardOnAddress:port:targetHost:targetPort:error: and
+ -startSOCKSProxyOnAddress:port:error: of SSHKitSession (Channels).
+
+ Every accepted connection is tunnelled through its own direct channel by a SSHKitChannelPump. Connections
+ are accepted and their channels requested as soon as they arrive, without waiting for channels of others
+ to open, so a burst of connections costs about one channel open round trip instead of one per connection.
+ A SOCKS proxy reads the request of each client first, SOCKS 4, 4a and 5 are served, CONNECT only and
+ without authentication, the reply is sent once the server opened the channel or refused it.
+
+ At most maxConnections are tunnelled at a time, further clients wait in the listen backlog until one
+ finished, as they do while the process is out of descriptors. Everything happens on the session queue.
+ While the session reconnects the forward keeps listening and channels of new connections open once it is
+ back, connections already tunnelled are closed, their target could not continue the stream on a new
+ channel. The forward closes with the session otherwise.
+ */
+@interface SSHKitLocalForward : NSObject
+
+@property (nonatomic, readonly, weak) SSHKitSession *session;
+
+/** SSHKitProxyTypeDirect for a static forward, SSHKitProxyTypeSOCKS5 for a SOCKS proxy, which also serves SOCKS 4 and 4a */
+@property (nonatomic, readonly) SSHKitProxyType proxyType;
+
+@property (nonatomic, readonly, copy) NSString *listenHost;
+/** Port actually bound, when 0 was asked for */
+@property (nonatomic, readonly) uint16_t listenPort;
+
+/** Where a static forward connects to, nil for a SOCKS proxy */
+@property (nonatomic, readonly, copy) NSString *targetHost;
+@property (nonatomic, readonly) NSUInteger targetPort;
+
+/** Connections tunnelled at a time, default 256 */
+@property (nonatomic) NSUInteger maxConnections;
+
+@property (nonatomic, readonly, getter = isListening) BOOL listening;
+
+@property (nonatomic, copy) SSHKitLocalForwardCloseBlock closeHandler;
+
+/** Throughput is measured since the previous call */
+- (SSHKitLocalForwardMetrics *)metrics;
+
+/** Stop listening and close every connection of the forward */
+- (void)close;
+
+@end
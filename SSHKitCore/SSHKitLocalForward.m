@@ -0,0 +1,730 @@
+//
+//  SSHKitLocalForward.m
+//  SSHKitCore
+//
+
+#import "SSHKitLocalForward.h"
+#import "SSHKitSession+Channels.h"
+#import "SSHKitDirectChannel.h"
+#import "SSHKitCore+Protected.h"
+#import <fcntl.h>
+#import <netdb.h>
+#import <unistd.h>
+
+#define SOCKS_HANDSHAKE_TIMEOUT     30      // seconds for a client to send its request
+#define SOCKS_MAX_HANDSHAKE_LENGTH  1024    // SOCKS 4 user id and 4a host name are NUL terminated, bound them
+#define ACCEPT_RETRY_DELAY          0.5     // seconds accepting pauses when out of descriptors
+
+// SOCKS 5 replies, SOCKS 4 knows granted and rejected only
+typedef NS_ENUM(uint8_t, SSHKitSOCKSReply) {
+    SSHKitSOCKSReplySucceeded           = 0x00,
+    SSHKitSOCKSReplyGeneralFailure      = 0x01,
+    SSHKitSOCKSReplyCommandNotSupported = 0x07,
+    SSHKitSOCKSReplyAddressNotSupported = 0x08,
+};
+
+static NSError *SSHKitLocalForwardSocketError(int code, NSString *address, uint16_t port) {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain
+                               code:code
+                           userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Could not listen on %@:%u: %s", address, port, strerror(code)] }];
+}
+
+typedef NS_ENUM(NSInteger, SSHKitForwardConnectionStage) {
+    SSHKitForwardConnectionStageHandshake = 0,  // reading SOCKS request
+    SSHKitForwardConnectionStageOpening,        // channel requested, waiting for server
+    SSHKitForwardConnectionStageTunnelling,     // pump running
+    SSHKitForwardConnectionStageFinished,
+};
+
+@class SSHKitForwardConnection;
+
+@interface SSHKitLocalForward ()
+
+- (void)doConnectionDidOpen:(SSHKitForwardConnection *)connection;
+- (void)doConnection:(SSHKitForwardConnection *)connection didCloseChannelWithError:(NSError *)error;
+
+@end
+
+#pragma mark - Connections
+
+/** One accepted client, lives on session queue */
+@interface SSHKitForwardConnection : NSObject <SSHKitChannelDelegate>
+
+@property (nonatomic, weak) SSHKitLocalForward *forward;
+@property (nonatomic) int fileDescriptor;
+@property (nonatomic) SSHKitForwardConnectionStage stage;
+@property (nonatomic) CFAbsoluteTime acceptedAt;
+
+// SOCKS handshake, version is 0 for static forwards
+@property (nonatomic) uint8_t socksVersion;
+@property (nonatomic) BOOL socksGreeted;
+@property (nonatomic, strong) NSMutableData *handshake;
+@property (nonatomic, strong) dispatch_source_t readSource;
+/** Whether cancel handler of read source closes the socket, it is left to the pump otherwise */
+@property (nonatomic) BOOL closesSocketOnCancel;
+@property (nonatomic, strong) SSHKitWheelTimer *handshakeTimer;
+/** Client data following the SOCKS request */
+@property (nonatomic, strong) NSData *earlyData;
+
+@property (nonatomic, strong) SSHKitDirectChannel *channel;
+@property (nonatomic, strong) SSHKitChannelPump *pump;
+
+@end
+
+@implementation SSHKitForwardConnection
+
+#pragma mark - SSHKitChannelDelegate
+
+// pump takes over as delegate once channel opened
+
+- (void)channelDidOpen:(SSHKitChannel *)channel {
+    [_forward doConnectionDidOpen:self];
+}
+
+- (void)channelDidClose:(SSHKitChannel *)channel withError:(NSError *)error {
+    [_forward doConnection:self didCloseChannelWithError:error];
+}
+
+@end
+
+#pragma mark -
+
+@interface SSHKitLocalForward () {
+    int                 _listenFd;
+    dispatch_source_t   _acceptSource;
+    BOOL                _acceptSuspended;
+    SSHKitWheelTimer    *_acceptRetryTimer;
+    BOOL                _closed;
+
+    NSMutableSet<SSHKitForwardConnection *> *_connections;
+
+    // counters, bytes of connections already finished
+    unsigned long long  _bytesToRemote;
+    unsigned long long  _bytesFromRemote;
+    NSUInteger          _totalConnections;
+    NSUInteger          _failedConnections;
+    NSUInteger          _limitStalls;
+    SSHKitLatencyHistogram *_openLatency;
+
+    // throughput since previous snapshot
+    CFAbsoluteTime      _lastMetricsAt;
+    unsigned long long  _lastMetricsBytes;
+}
+
+@property (nonatomic, readwrite, copy) NSString *listenHost;
+@property (nonatomic, readwrite) uint16_t listenPort;
+@property (nonatomic, readwrite, getter = isListening) BOOL listening;
+
+@end
+
+@implementation SSHKitLocalForward
+
+- (instancetype)initWithSession:(SSHKitSession *)session proxyType:(SSHKitProxyType)proxyType targetHost:(NSString *)targetHost targetPort:(NSUInteger)targetPort {
+    if ((self = [super init])) {
+        _session = session;
+        _proxyType = proxyType;
+        _targetHost = [targetHost copy];
+        _targetPort = targetPort;
+        _maxConnections = 256;
+
+        _listenFd = -1;
+        _connections = [NSMutableSet set];
+        _openLatency = [[SSHKitLatencyHistogram alloc] init];
+    }
+    return self;
+}
+
+- (void)setMaxConnections:(NSUInteger)maxConnections {
+    _maxConnections = maxConnections;
+
+    [_session dispatchAsyncOnSessionQueue:^{
+        [self doResumeAcceptingIfNeeded];
+    }];
+}
+
+- (void)close {
+    [_session dispatchAsyncOnSessionQueue:^{ @autoreleasepool {
+        [self doCloseWithError:nil];
+    }}];
+}
+
+#pragma mark - Listening
+
+- (BOOL)doListenOnAddress:(NSString *)address port:(uint16_t)port error:(NSError **)errorPtr {
+    NSAssert([_session isOnSessionQueue], @"Must be dispatched on session queue");
+
+    address = address.length ? address : @"127.0.0.1";
+
+    struct addrinfo hints, *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+    char portString[8];
+    snprintf(portString, sizeof(portString), "%u", port);
+
+    int rc = getaddrinfo(address.UTF8String, portString, &hints, &result);
+    if (rc != 0 || !result) {
+        if (errorPtr) {
+            *errorPtr = [NSError errorWithDomain:SSHKitCoreErrorDomain
+                                            code:SSHKitErrorConnectFailure
+                                        userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Could not resolve %@: %s", address, gai_strerror(rc)] }];
+        }
+        return NO;
+    }
+
+    int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (fd >= 0) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+
+    if (fd < 0 || bind(fd, result->ai_addr, result->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0) {
+        int code = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        freeaddrinfo(result);
+
+        if (errorPtr) {
+            *errorPtr = SSHKitLocalForwardSocketError(code, address, port);
+        }
+        return NO;
+    }
+    freeaddrinfo(result);
+
+    // port bound for 0
+    struct sockaddr_storage boundAddress;
+    socklen_t boundLength = sizeof(boundAddress);
+    if (getsockname(fd, (struct sockaddr *)&boundAddress, &boundLength) == 0) {
+        if (boundAddress.ss_family == AF_INET6) {
+            port = ntohs(((struct sockaddr_in6 *)&boundAddress)->sin6_port);
+        } else {
+            port = ntohs(((struct sockaddr_in *)&boundAddress)->sin_port);
+        }
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    _acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, fd, 0, _session.sessionQueue);
+    if (!_acceptSource) {
+        close(fd);
+        if (errorPtr) {
+            *errorPtr = SSHKitLocalForwardSocketError(ENOMEM, address, port);
+        }
+        return NO;
+    }
+
+    dispatch_source_set_event_handler(_acceptSource, ^{ @autoreleasepool {
+        [self doAcceptConnections];
+    }});
+    dispatch_source_set_cancel_handler(_acceptSource, ^{
+        close(fd);
+    });
+    dispatch_resume(_acceptSource);
+
+    _listenFd = fd;
+    self.listenHost = address;
+    self.listenPort = port;
+    self.listening = YES;
+    _lastMetricsAt = CFAbsoluteTimeGetCurrent();
+
+    return YES;
+}
+
+- (void)doCloseWithError:(NSError *)error {
+    if (_closed || !_acceptSource) {
+        return;
+    }
+
+    _closed = YES;
+    self.listening = NO;
+
+    [_acceptRetryTimer cancel];
+    _acceptRetryTimer = nil;
+
+    // source must not be released suspended
+    if (_acceptSuspended) {
+        _acceptSuspended = NO;
+        dispatch_resume(_acceptSource);
+    }
+    dispatch_source_cancel(_acceptSource);
+    _acceptSource = nil;
+    _listenFd = -1;
+
+    for (SSHKitForwardConnection *connection in [_connections copy]) {
+        if (connection.pump) {
+            [connection.pump stop];
+        } else {
+            [self doFinishConnection:connection failed:NO];
+        }
+    }
+
+    [_session doRemoveLocalForward:self];
+
+    SSHKitLocalForwardCloseBlock closeHandler = _closeHandler;
+    _closeHandler = nil;
+    if (closeHandler) {
+        closeHandler(error);
+    }
+}
+
+/** Take every connection waiting in the backlog, their channels open side by side */
+- (void)doAcceptConnections {
+    if (_closed) {
+        return;
+    }
+
+    while (_connections.count < MAX(_maxConnections, 1)) {
+        int fd = accept(_listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                [self doPauseAcceptingForResources];
+            }
+            // EAGAIN once backlog is empty
+            return;
+        }
+
+        [self doStartConnectionWithFileDescriptor:fd];
+    }
+
+    // clients wait in the backlog until a connection finished
+    [self doSuspendAccepting];
+}
+
+- (void)doSuspendAccepting {
+    if (!_acceptSuspended) {
+        _acceptSuspended = YES;
+        _limitStalls++;
+        dispatch_suspend(_acceptSource);
+    }
+}
+
+/** Client stays in the backlog and the source would fire again at once, retried after a delay or once a connection finished */
+- (void)doPauseAcceptingForResources {
+    if (!_acceptSuspended) {
+        _acceptSuspended = YES;
+        dispatch_suspend(_acceptSource);
+    }
+
+    [_acceptRetryTimer cancel];
+
+    __weak SSHKitLocalForward *weakSelf = self;
+    _acceptRetryTimer = [[SSHKitTimerWheel sharedWheel] scheduleTimerWithDelay:ACCEPT_RETRY_DELAY queue:_session.sessionQueue block:^{
+        [weakSelf doResumeAcceptingIfNeeded];
+    }];
+}
+
+- (void)doResumeAcceptingIfNeeded {
+    if (_acceptSuspended && !_closed && _connections.count < MAX(_maxConnections, 1)) {
+        [_acceptRetryTimer cancel];
+        _acceptRetryTimer = nil;
+
+        _acceptSuspended = NO;
+        dispatch_resume(_acceptSource);
+    }
+}
+
+#pragma mark - Connections
+
+- (void)doStartConnectionWithFileDescriptor:(int)fd {
+    SSHKitForwardConnection *connection = [[SSHKitForwardConnection alloc] init];
+    connection.forward = self;
+    connection.fileDescriptor = fd;
+    connection.acceptedAt = CFAbsoluteTimeGetCurrent();
+
+    [_connections addObject:connection];
+    _totalConnections++;
+
+    // accepted sockets do not inherit O_NONBLOCK everywhere
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    if (_proxyType == SSHKitProxyTypeDirect) {
+        [self doOpenChannelForConnection:connection host:_targetHost port:_targetPort];
+        return;
+    }
+
+    connection.handshake = [NSMutableData data];
+    connection.readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, fd, 0, _session.sessionQueue);
+    if (!connection.readSource) {
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    __weak SSHKitForwardConnection *weakConnection = connection;
+    dispatch_source_set_event_handler(connection.readSource, ^{ @autoreleasepool {
+        [self doReadHandshakeOfConnection:weakConnection];
+    }});
+    // held until the handler ran, nothing else may keep a finished connection alive by then
+    dispatch_source_set_cancel_handler(connection.readSource, ^{
+        if (connection.closesSocketOnCancel) {
+            close(fd);
+        }
+    });
+    dispatch_resume(connection.readSource);
+
+    __weak SSHKitLocalForward *weakSelf = self;
+    connection.handshakeTimer = [[SSHKitTimerWheel sharedWheel] scheduleTimerWithDelay:SOCKS_HANDSHAKE_TIMEOUT queue:_session.sessionQueue block:^{
+        [weakSelf doFinishConnection:connection failed:YES];
+    }];
+}
+
+- (void)doOpenChannelForConnection:(SSHKitForwardConnection *)connection host:(NSString *)host port:(NSUInteger)port {
+    SSHKitSession *session = _session;
+    if (!session) {
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    // not waiting for the others, server opens them in parallel
+    connection.stage = SSHKitForwardConnectionStageOpening;
+    connection.channel = [session openDirectChannelWithTargetHost:host port:port delegate:connection];
+}
+
+- (void)doConnectionDidOpen:(SSHKitForwardConnection *)connection {
+    if (connection.stage != SSHKitForwardConnectionStageOpening) {
+        return;
+    }
+
+    [_openLatency recordValue:CFAbsoluteTimeGetCurrent() - connection.acceptedAt];
+
+    if (connection.socksVersion) {
+        [self doReplySOCKS:SSHKitSOCKSReplySucceeded toConnection:connection];
+    }
+
+    connection.stage = SSHKitForwardConnectionStageTunnelling;
+
+    if (connection.earlyData.length) {
+        _bytesToRemote += connection.earlyData.length;
+        [connection.channel doEnqueueData:connection.earlyData];
+        connection.earlyData = nil;
+    }
+
+    // pump becomes delegate before anything else arrives on the channel
+    connection.pump = [[SSHKitChannelPump alloc] initWithChannel:connection.channel fileDescriptor:connection.fileDescriptor];
+
+    __weak SSHKitLocalForward *weakSelf = self;
+    [connection.pump doStartWithCompletion:^(NSError *error) {
+        [weakSelf doFinishConnection:connection failed:NO];
+    }];
+}
+
+- (void)doConnection:(SSHKitForwardConnection *)connection didCloseChannelWithError:(NSError *)error {
+    if (connection.stage != SSHKitForwardConnectionStageOpening) {
+        return;
+    }
+
+    // refused by server, or the session went down
+    if (connection.socksVersion) {
+        [self doReplySOCKS:SSHKitSOCKSReplyGeneralFailure toConnection:connection];
+    }
+    [self doFinishConnection:connection failed:YES];
+}
+
+- (void)doFinishConnection:(SSHKitForwardConnection *)connection failed:(BOOL)failed {
+    if (!connection || connection.stage == SSHKitForwardConnectionStageFinished) {
+        return;
+    }
+
+    connection.stage = SSHKitForwardConnectionStageFinished;
+
+    [connection.handshakeTimer cancel];
+    connection.handshakeTimer = nil;
+
+    if (connection.pump) {
+        // pump closed socket and channel
+        _bytesToRemote += connection.pump.bytesToChannel;
+        _bytesFromRemote += connection.pump.bytesFromChannel;
+    } else {
+        if (connection.readSource) {
+            connection.closesSocketOnCancel = YES;
+            dispatch_source_cancel(connection.readSource);
+            connection.readSource = nil;
+        } else {
+            close(connection.fileDescriptor);
+        }
+
+        if (connection.channel.stage != SSHKitChannelStageClosed) {
+            connection.channel.delegate = nil;
+            [connection.channel doCloseWithError:nil];
+        }
+    }
+
+    if (failed) {
+        _failedConnections++;
+    }
+
+    [_connections removeObject:connection];
+    [self doResumeAcceptingIfNeeded];
+}
+
+#pragma mark - SOCKS
+
+- (void)doReadHandshakeOfConnection:(SSHKitForwardConnection *)connection {
+    if (connection.stage != SSHKitForwardConnectionStageHandshake) {
+        return;
+    }
+
+    uint8_t buffer[512];
+    ssize_t length = read(connection.fileDescriptor, buffer, sizeof(buffer));
+
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+
+    if (length <= 0) {
+        // client went away before asking for anything
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    [connection.handshake appendBytes:buffer length:length];
+    if (connection.handshake.length > SOCKS_MAX_HANDSHAKE_LENGTH) {
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    if (connection.socksGreeted) {
+        [self doParseSOCKS5RequestOfConnection:connection];
+        return;
+    }
+
+    switch (((const uint8_t *)connection.handshake.bytes)[0]) {
+        case 4:
+            [self doParseSOCKS4RequestOfConnection:connection];
+            break;
+
+        case 5:
+            [self doParseSOCKS5GreetingOfConnection:connection];
+            break;
+
+        default:
+            [self doFinishConnection:connection failed:YES];
+            break;
+    }
+}
+
+/** VN CD DSTPORT DSTIP USERID NUL, SOCKS 4a puts 0.0.0.x into DSTIP and HOST NUL after USERID */
+- (void)doParseSOCKS4RequestOfConnection:(SSHKitForwardConnection *)connection {
+    const uint8_t *bytes = connection.handshake.bytes;
+    NSUInteger length = connection.handshake.length;
+
+    if (length < 9) {
+        return;
+    }
+
+    const uint8_t *userEnd = memchr(bytes + 8, 0, length - 8);
+    if (!userEnd) {
+        return;
+    }
+
+    NSUInteger consumed = userEnd - bytes + 1;
+    NSString *host = nil;
+
+    if (bytes[4] == 0 && bytes[5] == 0 && bytes[6] == 0 && bytes[7] != 0) {
+        const uint8_t *hostEnd = memchr(bytes + consumed, 0, length - consumed);
+        if (!hostEnd) {
+            return;
+        }
+
+        host = [[NSString alloc] initWithBytes:bytes + consumed length:hostEnd - (bytes + consumed) encoding:NSUTF8StringEncoding];
+        consumed = hostEnd - bytes + 1;
+    } else {
+        char address[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, bytes + 4, address, sizeof(address))) {
+            host = @(address);
+        }
+    }
+
+    connection.socksVersion = 4;
+
+    if (bytes[1] != 1 || !host.length) {
+        [self doReplySOCKS:SSHKitSOCKSReplyCommandNotSupported toConnection:connection];
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    uint16_t port = (bytes[2] << 8) | bytes[3];
+    [self doFinishHandshakeOfConnection:connection host:host port:port consumed:consumed];
+}
+
+/** VER NMETHODS METHODS, only "no authentication required" is offered */
+- (void)doParseSOCKS5GreetingOfConnection:(SSHKitForwardConnection *)connection {
+    const uint8_t *bytes = connection.handshake.bytes;
+    NSUInteger length = connection.handshake.length;
+
+    if (length < 2 || length < 2 + (NSUInteger)bytes[1]) {
+        return;
+    }
+
+    NSUInteger consumed = 2 + bytes[1];
+    BOOL noAuthentication = memchr(bytes + 2, 0x00, bytes[1]) != NULL;
+
+    uint8_t reply[2] = { 5, noAuthentication ? 0x00 : 0xFF };
+    if (write(connection.fileDescriptor, reply, sizeof(reply)) != sizeof(reply) || !noAuthentication) {
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    connection.socksVersion = 5;
+    connection.socksGreeted = YES;
+    [connection.handshake replaceBytesInRange:NSMakeRange(0, consumed) withBytes:NULL length:0];
+
+    // request may have come along
+    if (connection.handshake.length) {
+        [self doParseSOCKS5RequestOfConnection:connection];
+    }
+}
+
+/** VER CMD RSV ATYP DST.ADDR DST.PORT */
+- (void)doParseSOCKS5RequestOfConnection:(SSHKitForwardConnection *)connection {
+    const uint8_t *bytes = connection.handshake.bytes;
+    NSUInteger length = connection.handshake.length;
+
+    if (length < 5) {
+        return;
+    }
+
+    if (bytes[0] != 5) {
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    NSUInteger addressLength = 0;
+    NSUInteger addressOffset = 4;
+    switch (bytes[3]) {
+        case 0x01:
+            addressLength = 4;
+            break;
+
+        case 0x03:
+            addressLength = bytes[4];
+            addressOffset = 5;
+            break;
+
+        case 0x04:
+            addressLength = 16;
+            break;
+
+        default:
+            [self doReplySOCKS:SSHKitSOCKSReplyAddressNotSupported toConnection:connection];
+            [self doFinishConnection:connection failed:YES];
+            return;
+    }
+
+    NSUInteger consumed = addressOffset + addressLength + 2;
+    if (length < consumed) {
+        return;
+    }
+
+    NSString *host = nil;
+    if (bytes[3] == 0x03) {
+        host = [[NSString alloc] initWithBytes:bytes + addressOffset length:addressLength encoding:NSUTF8StringEncoding];
+    } else {
+        char address[INET6_ADDRSTRLEN];
+        if (inet_ntop(bytes[3] == 0x01 ? AF_INET : AF_INET6, bytes + addressOffset, address, sizeof(address))) {
+            host = @(address);
+        }
+    }
+
+    if (bytes[1] != 1) {
+        [self doReplySOCKS:SSHKitSOCKSReplyCommandNotSupported toConnection:connection];
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    if (!host.length) {
+        [self doReplySOCKS:SSHKitSOCKSReplyAddressNotSupported toConnection:connection];
+        [self doFinishConnection:connection failed:YES];
+        return;
+    }
+
+    uint16_t port = (bytes[consumed - 2] << 8) | bytes[consumed - 1];
+    [self doFinishHandshakeOfConnection:connection host:host port:port consumed:consumed];
+}
+
+- (void)doFinishHandshakeOfConnection:(SSHKitForwardConnection *)connection host:(NSString *)host port:(uint16_t)port consumed:(NSUInteger)consumed {
+    [connection.handshakeTimer cancel];
+    connection.handshakeTimer = nil;
+
+    // pump reads the socket from now on
+    dispatch_source_cancel(connection.readSource);
+    connection.readSource = nil;
+
+    NSMutableData *handshake = connection.handshake;
+    if (handshake.length > consumed) {
+        connection.earlyData = [handshake subdataWithRange:NSMakeRange(consumed, handshake.length - consumed)];
+    }
+    connection.handshake = nil;
+
+    [self doOpenChannelForConnection:connection host:host port:port];
+}
+
+/** Bound address is not known locally, zeros are sent, which clients ignore */
+- (void)doReplySOCKS:(SSHKitSOCKSReply)reply toConnection:(SSHKitForwardConnection *)connection {
+    if (connection.socksVersion == 4) {
+        uint8_t response[8] = { 0, reply == SSHKitSOCKSReplySucceeded ? 0x5A : 0x5B, 0, 0, 0, 0, 0, 0 };
+        (void)write(connection.fileDescriptor, response, sizeof(response));
+    } else {
+        uint8_t response[10] = { 5, reply, 0, 0x01, 0, 0, 0, 0, 0, 0 };
+        (void)write(connection.fileDescriptor, response, sizeof(response));
+    }
+}
+
+#pragma mark - Metrics
+
+- (SSHKitLocalForwardMetrics *)metrics {
+    __block SSHKitLocalForwardMetrics *metrics = nil;
+    [_session dispatchSyncOnSessionQueue:^{
+        metrics = [self doCollectMetrics];
+    }];
+
+    return metrics;
+}
+
+- (SSHKitLocalForwardMetrics *)doCollectMetrics {
+    SSHKitLocalForwardMetrics *metrics = [[SSHKitLocalForwardMetrics alloc] init];
+
+    unsigned long long bytesToRemote = _bytesToRemote;
+    unsigned long long bytesFromRemote = _bytesFromRemote;
+    NSUInteger openingConnections = 0;
+
+    for (SSHKitForwardConnection *connection in _connections) {
+        if (connection.pump) {
+            bytesToRemote += connection.pump.bytesToChannel;
+            bytesFromRemote += connection.pump.bytesFromChannel;
+        } else {
+            openingConnections++;
+        }
+    }
+
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    unsigned long long bytes = bytesToRemote + bytesFromRemote;
+    if (now > _lastMetricsAt) {
+        metrics.throughput = (bytes - _lastMetricsBytes) / (now - _lastMetricsAt);
+    }
+    _lastMetricsAt = now;
+    _lastMetricsBytes = bytes;
+
+    metrics.date = [NSDate date];
+    metrics.bytesToRemote = bytesToRemote;
+    metrics.bytesFromRemote = bytesFromRemote;
+    metrics.activeConnections = _connections.count;
+    metrics.openingConnections = openingConnections;
+    metrics.totalConnections = _totalConnections;
+    metrics.failedConnections = _failedConnections;
+    metrics.limitStalls = _limitStalls;
+    metrics.openLatency = [_openLatency copy];
+
+    return metrics;
+}
+
+@end
@@ -0,0 +1,129 @@
+//
+//  SSHKitMetrics.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+
+// handshake phases of SSHKitSessionMetrics
+extern NSString * const SSHKitHandshakePhaseTotalSetup;      // aggregate of resolve, TCP connect, banner and key exchange
+extern NSString * const SSHKitHandshakePhaseHostKey;         // host key verification and querying auth methods
+extern NSString * const SSHKitHandshakePhaseAuthenticate;    // user authentication
+
+// finer phases within SSHKitHandshakePhaseTotalSetup, do not add them to it
+extern NSString * const SSHKitHandshakePhaseResolve;         // DNS lookup, only when racing addresses
+extern NSString * const SSHKitHandshakePhaseTCPConnect;      // TCP connect of winning address, only when racing addresses
+extern NSString * const SSHKitHandshakePhaseBanner;          // until server banner arrived, includes TCP connect done by libssh
+extern NSString * const SSHKitHandshakePhaseKeyExchange;     // from server banner to new keys
+
+/**
+ Latency distribution in power of two microsecond buckets, bucket 0 holds values below 2 µs,
+ bucket i holds values in [2^i, 2^(i+1)) µs.
+ */
+@interface SSHKitLatencyHistogram : NSObject <NSCopying>
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) NSTimeInterval sum;
+@property (nonatomic, readonly) NSTimeInterval min;
+@property (nonatomic, readonly) NSTimeInterval max;
+@property (nonatomic, readonly) NSTimeInterval mean;
+
+@property (nonatomic, readonly) NSArray<NSNumber *> *bucketCounts;
+
+/** Upper bound of the bucket holding the given percentile, 0...100 */
+- (NSTimeInterval)valueAtPercentile:(double)percentile;
+
+- (void)recordValue:(NSTimeInterval)value;
+- (void)reset;
+
+@end
+
+/** Snapshot of channel counters */
+@interface SSHKitChannelMetrics : NSObject
+
+@property (nonatomic, readonly) unsigned long long bytesIn;
+@property (nonatomic, readonly) unsigned long long bytesOut;
+@property (nonatomic, readonly) NSUInteger packetsIn;
+@property (nonatomic, readonly) NSUInteger packetsOut;
+
+@property (nonatomic, readonly) NSUInteger queuedWriteBytes;
+/** Writes found the remote window exhausted */
+@property (nonatomic, readonly) NSUInteger windowStalls;
+@property (nonatomic, readonly) NSUInteger receiveAllocationCount;
+
+/** SFTP requests waiting for their reply, 0 for other channels */
+@property (nonatomic, readonly) NSUInteger outstandingRequests;
+
+@end
+
+/** Snapshot of a SFTP file transfer */
+@interface SSHKitSFTPFileMetrics : NSObject
+
+@property (nonatomic, readonly) NSUInteger requestsSent;
+@property (nonatomic, readonly) NSUInteger outstandingRequests;
+@property (nonatomic, readonly) unsigned long long bytesTransferred;
+@property (nonatomic, readonly) NSTimeInterval transferDuration;
+/** Bytes per second over transferDuration */
+@property (nonatomic, readonly) double throughput;
+/** Most bytes of READ requests in flight at once */
+@property (nonatomic, readonly) unsigned long long peakBytesInFlight;
+
+/** Round trip time of READ and WRITE requests */
+@property (nonatomic, readonly) SSHKitLatencyHistogram *requestLatency;
+
+@end
+
+/** Snapshot of a SSHKitLocalForward, bytes include connections already closed */
+@interface SSHKitLocalForwardMetrics : NSObject
+
+@property (nonatomic, readonly) NSDate *date;
+
+/** Bytes local clients sent to the remote end, and received from it */
+@property (nonatomic, readonly) unsigned long long bytesToRemote;
+@property (nonatomic, readonly) unsigned long long bytesFromRemote;
+/** Bytes per second of both directions since the previous snapshot of the forward, or since it started */
+@property (nonatomic, readonly) double throughput;
+
+/** Connections accepted and not finished, including those still opening their channel */
+@property (nonatomic, readonly) NSUInteger activeConnections;
+/** Reading the SOCKS request or waiting for the channel to open */
+@property (nonatomic, readonly) NSUInteger openingConnections;
+@property (nonatomic, readonly) NSUInteger totalConnections;
+/** Bad SOCKS requests and channels the server refused to open */
+@property (nonatomic, readonly) NSUInteger failedConnections;
+/** Accepting paused because maxConnections were active */
+@property (nonatomic, readonly) NSUInteger limitStalls;
+
+/** From accepting a connection until its channel was open */
+@property (nonatomic, readonly) SSHKitLatencyHistogram *openLatency;
+
+@end
+
+/** Snapshot of session counters, bytes and packets include channels already closed */
+@interface SSHKitSessionMetrics : NSObject
+
+@property (nonatomic, readonly) NSDate *date;
+
+@property (nonatomic, readonly) unsigned long long bytesIn;
+@property (nonatomic, readonly) unsigned long long bytesOut;
+@property (nonatomic, readonly) NSUInteger packetsIn;
+@property (nonatomic, readonly) NSUInteger packetsOut;
+@property (nonatomic, readonly) NSUInteger windowStalls;
+
+/**
+ Seconds spent in each SSHKitHandshakePhase finished so far. SSHKitHandshakePhaseTotalSetup overlaps
+ the finer phases within it, leave it out when summing durations.
+ */
+@property (nonatomic, readonly) NSDictionary<NSString *, NSNumber *> *handshakeDurations;
+
+/** Socket events handled by session queue, and time spent handling them */
+@property (nonatomic, readonly) NSUInteger wakeups;
+@property (nonatomic, readonly) NSTimeInterval wakeupTime;
+@property (nonatomic, readonly) NSTimeInterval maxWakeupTime;
+/** Channels serviced by those socket events, only channels with pending work are */
+@property (nonatomic, readonly) NSUInteger channelServices;
+
+/** Metrics of channels currently open */
+@property (nonatomic, readonly) NSArray<SSHKitChannelMetrics *> *channels;
+
+@end
@@ -0,0 +1,126 @@
+//
+//  SSHKitMetrics.m
+//  SSHKitCore
+//
+
+#import "SSHKitMetrics.h"
+#import "SSHKitCore+Protected.h"
+
+#define HISTOGRAM_BUCKET_COUNT 32
+
+NSString * const SSHKitHandshakePhaseTotalSetup     = @"totalSetup";
+NSString * const SSHKitHandshakePhaseHostKey        = @"hostKey";
+NSString * const SSHKitHandshakePhaseAuthenticate   = @"authenticate";
+NSString * const SSHKitHandshakePhaseResolve        = @"resolve";
+NSString * const SSHKitHandshakePhaseTCPConnect     = @"tcpConnect";
+NSString * const SSHKitHandshakePhaseBanner         = @"banner";
+NSString * const SSHKitHandshakePhaseKeyExchange    = @"keyExchange";
+
+@implementation SSHKitLatencyHistogram {
+    NSUInteger _buckets[HISTOGRAM_BUCKET_COUNT];
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    SSHKitLatencyHistogram *copy = [[SSHKitLatencyHistogram allocWithZone:zone] init];
+    memcpy(copy->_buckets, _buckets, sizeof(_buckets));
+    copy->_count = _count;
+    copy->_sum = _sum;
+    copy->_min = _min;
+    copy->_max = _max;
+    return copy;
+}
+
+- (void)recordValue:(NSTimeInterval)value {
+    uint64_t micros = (uint64_t)MAX(value * 1000000, 0);
+    NSUInteger bucket = micros < 2 ? 0 : MIN(63 - __builtin_clzll(micros), HISTOGRAM_BUCKET_COUNT - 1);
+
+    _buckets[bucket]++;
+    _min = _count ? MIN(_min, value) : value;
+    _max = MAX(_max, value);
+    _sum += value;
+    _count++;
+}
+
+- (void)reset {
+    memset(_buckets, 0, sizeof(_buckets));
+    _count = 0;
+    _sum = 0;
+    _min = 0;
+    _max = 0;
+}
+
+- (NSTimeInterval)mean {
+    return _count ? _sum / _count : 0;
+}
+
+- (NSArray *)bucketCounts {
+    NSMutableArray *counts = [NSMutableArray arrayWithCapacity:HISTOGRAM_BUCKET_COUNT];
+    for (NSUInteger i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+        [counts addObject:@(_buckets[i])];
+    }
+    return counts;
+}
+
+- (NSTimeInterval)valueAtPercentile:(double)percentile {
+    if (!_count) {
+        return 0;
+    }
+
+    NSUInteger rank = (NSUInteger)ceil(MIN(MAX(percentile, 0), 100) / 100 * _count);
+    NSUInteger seen = 0;
+
+    for (NSUInteger i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+        seen += _buckets[i];
+        if (seen >= rank && _buckets[i]) {
+            return MIN((double)(2ull << i) / 1000000, _max);
+        }
+    }
+
+    return _max;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: count %lu, mean %.6f, p50 %.6f, p99 %.6f, max %.6f>",
+            NSStringFromClass(self.class), (unsigned long)_count, self.mean, [self valueAtPercentile:50], [self valueAtPercentile:99], _max];
+}
+
+@end
+
+@implementation SSHKitChannelMetrics
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: in %llu bytes/%lu packets, out %llu bytes/%lu packets, queued %lu, stalls %lu>",
+            NSStringFromClass(self.class), _bytesIn, (unsigned long)_packetsIn, _bytesOut, (unsigned long)_packetsOut,
+            (unsigned long)_queuedWriteBytes, (unsigned long)_windowStalls];
+}
+
+@end
+
+@implementation SSHKitSFTPFileMetrics
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %llu bytes in %.3f sec, %.0f bytes/sec, requests %lu, outstanding %lu, latency %@>",
+            NSStringFromClass(self.class), _bytesTransferred, _transferDuration, _throughput, (unsigned long)_requestsSent,
+            (unsigned long)_outstandingRequests, _requestLatency];
+}
+
+@end
+
+@implementation SSHKitLocalForwardMetrics
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: to remote %llu bytes, from remote %llu bytes, %.0f bytes/sec, active %lu, total %lu, failed %lu, open latency %@>",
+            NSStringFromClass(self.class), _bytesToRemote, _bytesFromRemote, _throughput, (unsigned long)_activeConnections,
+            (unsigned long)_totalConnections, (unsigned long)_failedConnections, _openLatency];
+}
+
+@end
+
+@implementation SSHKitSessionMetrics
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: in %llu bytes, out %llu bytes, wakeups %lu (%.3f sec, max %.6f), handshake %@>",
+            NSStringFromClass(self.class), _bytesIn, _bytesOut, (unsigned long)_wakeups, _wakeupTime, _maxWakeupTime, _handshakeDurations];
+}
+
+@end
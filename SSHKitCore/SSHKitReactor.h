@@ -0,0 +1,47 @@
+//
+//  SSHKitReactor.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+
+/** Snapshot of one worker of a SSHKitReactor */
+@interface SSHKitReactorWorkerStats : NSObject
+
+@property (nonatomic, readonly) NSUInteger index;
+/** Sessions currently living on the worker */
+@property (nonatomic, readonly) NSUInteger sessionCount;
+/** Socket events handled for all its sessions, and time spent handling them */
+@property (nonatomic, readonly) NSUInteger wakeups;
+@property (nonatomic, readonly) NSTimeInterval busyTime;
+@property (nonatomic, readonly) NSTimeInterval maxWakeupTime;
+
+@end
+
+/**
+ Fixed set of serial worker queues shared by many sessions, instead of one queue per session. Socket
+ sources and timers of all sessions on a worker are served by that worker's queue, so at most workerCount
+ threads run session work at once, whatever the number of sessions, and an idle session costs no queue.
+
+ A session is put on the worker with fewest sessions when created with
+ initWithHost:port:user:options:delegate:reactor:, and stays there. Sessions of a worker take turns, a
+ delegate callback blocking the worker delays every other session on it.
+
+ libssh logging is per thread, a logHandler of one session on a shared worker may receive log of others.
+ */
+@interface SSHKitReactor : NSObject
+
+/** One worker per active processor */
++ (instancetype)sharedReactor;
+
+- (instancetype)initWithWorkerCount:(NSUInteger)workerCount;
+
+@property (nonatomic, readonly) NSUInteger workerCount;
+
+/** Sessions on all workers */
+@property (nonatomic, readonly) NSUInteger sessionCount;
+
+/** Stats of every worker, by index */
+- (NSArray<SSHKitReactorWorkerStats *> *)workerStats;
+
+@end
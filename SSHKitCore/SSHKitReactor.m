@@ -0,0 +1,167 @@
+//
+//  SSHKitReactor.m
+//  SSHKitCore
+//
+
+#import "SSHKitReactor.h"
+#import "SSHKitCore+Protected.h"
+#import <pthread.h>
+
+@interface SSHKitReactorWorkerStats ()
+
+@property (nonatomic, readwrite) NSUInteger index;
+@property (nonatomic, readwrite) NSUInteger sessionCount;
+@property (nonatomic, readwrite) NSUInteger wakeups;
+@property (nonatomic, readwrite) NSTimeInterval busyTime;
+@property (nonatomic, readwrite) NSTimeInterval maxWakeupTime;
+
+@end
+
+@implementation SSHKitReactorWorkerStats
+@end
+
+#pragma mark -
+
+@implementation SSHKitReactorWorker {
+    pthread_mutex_t _mutex;
+    
+    NSUInteger _sessionCount;
+    NSUInteger _wakeups;
+    NSTimeInterval _busyTime;
+    NSTimeInterval _maxWakeupTime;
+}
+
+- (instancetype)initWithIndex:(NSUInteger)index {
+    if ((self = [super init])) {
+        _index = index;
+        
+        NSString *label = [NSString stringWithFormat:@"com.codinn.libssh.reactor_worker.%lu", (unsigned long)index];
+        _queue = dispatch_queue_create(label.UTF8String, DISPATCH_QUEUE_SERIAL);
+        
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_mutex);
+}
+
+- (NSUInteger)sessionCount {
+    pthread_mutex_lock(&_mutex);
+    NSUInteger count = _sessionCount;
+    pthread_mutex_unlock(&_mutex);
+    
+    return count;
+}
+
+- (void)doRetainSession {
+    pthread_mutex_lock(&_mutex);
+    _sessionCount++;
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (void)doReleaseSession {
+    pthread_mutex_lock(&_mutex);
+    if (_sessionCount) {
+        _sessionCount--;
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (void)doRecordWakeup:(NSTimeInterval)wakeupTime {
+    pthread_mutex_lock(&_mutex);
+    _wakeups++;
+    _busyTime += wakeupTime;
+    _maxWakeupTime = MAX(_maxWakeupTime, wakeupTime);
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (SSHKitReactorWorkerStats *)stats {
+    SSHKitReactorWorkerStats *stats = [[SSHKitReactorWorkerStats alloc] init];
+    stats.index = _index;
+    
+    pthread_mutex_lock(&_mutex);
+    stats.sessionCount = _sessionCount;
+    stats.wakeups = _wakeups;
+    stats.busyTime = _busyTime;
+    stats.maxWakeupTime = _maxWakeupTime;
+    pthread_mutex_unlock(&_mutex);
+    
+    return stats;
+}
+
+@end
+
+#pragma mark -
+
+@implementation SSHKitReactor {
+    pthread_mutex_t _mutex;
+    NSArray<SSHKitReactorWorker *> *_workers;
+}
+
++ (instancetype)sharedReactor {
+    static SSHKitReactor *sharedReactor = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedReactor = [[SSHKitReactor alloc] initWithWorkerCount:[NSProcessInfo processInfo].activeProcessorCount];
+    });
+    return sharedReactor;
+}
+
+- (instancetype)initWithWorkerCount:(NSUInteger)workerCount {
+    if ((self = [super init])) {
+        _workerCount = MAX(workerCount, 1);
+        
+        NSMutableArray *workers = [NSMutableArray arrayWithCapacity:_workerCount];
+        for (NSUInteger i = 0; i < _workerCount; i++) {
+            [workers addObject:[[SSHKitReactorWorker alloc] initWithIndex:i]];
+        }
+        _workers = [workers copy];
+        
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_mutex);
+}
+
+- (SSHKitReactorWorker *)doTakeWorker {
+    // serialize picking, two sessions created at once must not both see the same least loaded worker
+    pthread_mutex_lock(&_mutex);
+    SSHKitReactorWorker *leastLoaded = nil;
+    NSUInteger leastCount = NSUIntegerMax;
+    for (SSHKitReactorWorker *worker in _workers) {
+        NSUInteger count = worker.sessionCount;
+        if (count < leastCount) {
+            leastLoaded = worker;
+            leastCount = count;
+        }
+    }
+    [leastLoaded doRetainSession];
+    pthread_mutex_unlock(&_mutex);
+    
+    return leastLoaded;
+}
+
+#pragma mark - Stats
+
+- (NSUInteger)sessionCount {
+    NSUInteger count = 0;
+    for (SSHKitReactorWorker *worker in _workers) {
+        count += worker.sessionCount;
+    }
+    return count;
+}
+
+- (NSArray<SSHKitReactorWorkerStats *> *)workerStats {
+    NSMutableArray *stats = [NSMutableArray arrayWithCapacity:_workers.count];
+    for (SSHKitReactorWorker *worker in _workers) {
+        [stats addObject:[worker stats]];
+    }
+    return stats;
+}
+
+@end
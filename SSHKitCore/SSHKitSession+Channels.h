@@ -10,6 +10,8 @@
 #import "SSHKitCoreCommon.h"
 #import "SSHKitSession.h"
 
+@class SSHKitLocalForward;
+
 @interface SSHKitSession (Channels)
 
 // -----------------------------------------------------------------------------
@@ -38,10 +40,44 @@
 
 - (SSHKitSFTPChannel *)openSFTPChannel:(id<SSHKitChannelDelegate>)aDelegate;
 
+/** Run command without pty, see SSHKitExecChannel */
+- (SSHKitExecChannel *)openExecChannelWithCommand:(NSString *)command delegate:(id<SSHKitChannelDelegate>)aDelegate;
+
+// -----------------------------------------------------------------------------
+#pragma mark Local Listeners
+// -----------------------------------------------------------------------------
+
+/**
+ Listen locally and tunnel every connection to host:port through a direct channel, like ssh -L.
+
+ @param address Local address to bind, nil for 127.0.0.1
+ @param port    Local port, 0 for any free one, see listenPort of the forward
+ @return nil if the address could not be bound, or the session is disconnected
+ */
+- (SSHKitLocalForward *)startLocalForwardOnAddress:(NSString *)address port:(uint16_t)port targetHost:(NSString *)host targetPort:(NSUInteger)targetPort error:(NSError **)errorPtr;
+
+/**
+ Listen locally for SOCKS 4, 4a and 5 clients and tunnel each to the address it asks for, like ssh -D.
+ See startLocalForwardOnAddress:port:targetHost:targetPort:error: for parameters.
+ */
+- (SSHKitLocalForward *)startSOCKSProxyOnAddress:(NSString *)address port:(uint16_t)port error:(NSError **)errorPtr;
+
+/** Listeners started and not closed yet */
+- (NSArray<SSHKitLocalForward *> *)localForwards;
+
+// @internal
+- (void)doRemoveLocalForward:(SSHKitLocalForward *)forward;
+
 // @internal
 - (void)doSendForwardRequest;
 
 // @internal
 - (SSHKitForwardChannel *)doTryOpenForwardChannel;
 
+// @internal
+- (void)doOpenChannel:(SSHKitChannel *)channel;
+
+// @internal, reopen suspended channels and listening forwards after reconnecting
+- (void)doRestoreChannels;
+
 @end
@@ -30,23 +30,69 @@
     // We must retain channel to prevent it be released before adding to session channel container
     [self dispatchAsyncOnSessionQueue: ^{ {
         SSHKitSession *strongSelf = weakSelf;
+        if (strongSelf.isReconnecting) {
+            // opened with the others once connection is back
+            [strongSelf->_suspendedChannels addObject:channel];
+            return_from_block;
+        }
+        
         if (!strongSelf.isConnected) {
             [channel close];
             return_from_block;
         }
         
-        if ([channel doInitiateWithRawChannel:NULL]) {
-            // add channel to session list, retain it
-            [strongSelf->_channels addObject:channel];
-            
-            channel.stage = SSHKitChannelStageOpening;
-            [channel doOpen];
-        } else {
-            [channel close];
+        // closed before its turn came
+        if (channel.stage == SSHKitChannelStageClosed) {
+            return_from_block;
         }
+        
+        [strongSelf doOpenChannel:channel];
     }}];
 }
 
+- (void)doOpenChannel:(SSHKitChannel *)channel {
+    NSAssert([self isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    if ([channel doInitiateWithRawChannel:NULL]) {
+        // add channel to session list, retain it
+        [_channels addObject:channel];
+        
+        channel.stage = SSHKitChannelStageOpening;
+        [self doScheduleChannel:channel];
+        [channel doOpen];
+        
+        if (channel.stage == SSHKitChannelStageOpening) {
+            [self doSetupOpenTimerForChannel:channel];
+        }
+    } else {
+        [channel close];
+    }
+}
+
+- (void)doRestoreChannels {
+    NSAssert([self isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    NSArray *channels = [_suspendedChannels copy];
+    [_suspendedChannels removeAllObjects];
+    
+    for (SSHKitChannel *channel in channels) {
+        // skip channels closed while connection was down
+        if (channel.stage == SSHKitChannelStageInitial) {
+            [self doOpenChannel:channel];
+        }
+    }
+    
+    // requests put themselves back into listening forwards once bound again
+    for (SSHKitForwardRequest *request in _listeningForwards) {
+        if (![_forwardRequests containsObject:request]) {
+            [_forwardRequests addObject:request];
+        }
+    }
+    [_listeningForwards removeAllObjects];
+    
+    [self doSendForwardRequest];
+}
+
 - (SSHKitDirectChannel *)openDirectChannelWithTargetHost:(NSString *)host port:(NSUInteger)port delegate:(id<SSHKitChannelDelegate>)aDelegate {
     SSHKitDirectChannel *channel = [[SSHKitDirectChannel alloc] initWithSession:self targetHost:host targetPort:port delegate:aDelegate];
     
@@ -105,6 +151,70 @@
     return channel;
 }
 
+- (SSHKitExecChannel *)openExecChannelWithCommand:(NSString *)command delegate:(id<SSHKitChannelDelegate>)aDelegate {
+    SSHKitExecChannel *channel = [[SSHKitExecChannel alloc] initWithSession:self command:command delegate:aDelegate];
+    
+    [self _scheduleChannelForOpening:channel];
+    return channel;
+}
+
+#pragma mark - Local Listeners
+
+- (SSHKitLocalForward *)startLocalForwardOnAddress:(NSString *)address port:(uint16_t)port targetHost:(NSString *)host targetPort:(NSUInteger)targetPort error:(NSError **)errorPtr {
+    NSParameterAssert(host.length);
+    
+    SSHKitLocalForward *forward = [[SSHKitLocalForward alloc] initWithSession:self proxyType:SSHKitProxyTypeDirect targetHost:host targetPort:targetPort];
+    return [self _startLocalForward:forward onAddress:address port:port error:errorPtr];
+}
+
+- (SSHKitLocalForward *)startSOCKSProxyOnAddress:(NSString *)address port:(uint16_t)port error:(NSError **)errorPtr {
+    SSHKitLocalForward *forward = [[SSHKitLocalForward alloc] initWithSession:self proxyType:SSHKitProxyTypeSOCKS5 targetHost:nil targetPort:0];
+    return [self _startLocalForward:forward onAddress:address port:port error:errorPtr];
+}
+
+- (SSHKitLocalForward *)_startLocalForward:(SSHKitLocalForward *)forward onAddress:(NSString *)address port:(uint16_t)port error:(NSError **)errorPtr {
+    __block BOOL listening = NO;
+    __block NSError *error = nil;
+    
+    [self dispatchSyncOnSessionQueue:^{ @autoreleasepool {
+        if (self.isDisconnected && !self.isReconnecting) {
+            error = [NSError errorWithDomain:SSHKitCoreErrorDomain
+                                        code:SSHKitErrorStop
+                                    userInfo:@{ NSLocalizedDescriptionKey : @"Session is disconnected" }];
+            return_from_block;
+        }
+        
+        listening = [forward doListenOnAddress:address port:port error:&error];
+        if (listening) {
+            [_localForwards addObject:forward];
+        }
+    }}];
+    
+    if (!listening) {
+        if (errorPtr) {
+            *errorPtr = error;
+        }
+        return nil;
+    }
+    
+    return forward;
+}
+
+- (NSArray<SSHKitLocalForward *> *)localForwards {
+    __block NSArray *localForwards = nil;
+    [self dispatchSyncOnSessionQueue:^{
+        localForwards = [_localForwards copy];
+    }];
+    
+    return localForwards;
+}
+
+- (void)doRemoveLocalForward:(SSHKitLocalForward *)forward {
+    NSAssert([self isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    [_localForwards removeObject:forward];
+}
+
 /** !WARNING!
  tcpip-forward is session global request, requests must go one by one serially.
  Otherwise, forward request will be failed
@@ -133,6 +243,9 @@
             boundport = boundport ? boundport : request.listenPort;
             if (request.completionHandler) request.completionHandler(YES, boundport, nil);
             
+            // listen on the same port after reconnecting, remote peers know only that one
+            [_listeningForwards addObject:[[SSHKitForwardRequest alloc] initWithListenHost:request.listenHost port:boundport completion:nil]];
+            
             // try next
             if (_forwardRequests.firstObject) {
                 [self doSendForwardRequest];
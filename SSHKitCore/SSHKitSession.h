@@ -1,8 +1,9 @@
 #import <SSHKitCore/SSHKitCoreCommon.h>
 
 @protocol SSHKitSessionDelegate, SSHKitChannelDelegate, SSHKitShellChannelDelegate;
-@class SSHKitHostKey, SSHKitRemoteForwardRequest, SSHKitKeyPair;
-@class SSHKitChannel, SSHKitDirectChannel, SSHKitForwardChannel, SSHKitShellChannel, SSHKitSFTPChannel;
+@class SSHKitHostKey, SSHKitRemoteForwardRequest, SSHKitKeyPair, SSHKitSessionMetrics;
+@class SSHKitChannel, SSHKitDirectChannel, SSHKitForwardChannel, SSHKitShellChannel, SSHKitSFTPChannel, SSHKitExecChannel;
+@class SSHKitReactor;
 
 // -----------------------------------------------------------------------------
 #pragma mark -
@@ -37,6 +38,12 @@
 - (instancetype)initWithHost:(NSString *)host port:(uint16_t)port user:(NSString *)user options:(NSDictionary *)options delegate:(id<SSHKitSessionDelegate>)aDelegate;
 - (instancetype)initWithHost:(NSString *)host port:(uint16_t)port user:(NSString *)user options:(NSDictionary *)options delegate:(id<SSHKitSessionDelegate>)aDelegate sessionQueue:(dispatch_queue_t)sq;
 
+/**
+ * Session queue is the least loaded worker of reactor, shared with other sessions, see SSHKitReactor.
+ * Own queue is created if reactor is nil.
+ **/
+- (instancetype)initWithHost:(NSString *)host port:(uint16_t)port user:(NSString *)user options:(NSDictionary *)options delegate:(id<SSHKitSessionDelegate>)aDelegate reactor:(SSHKitReactor *)reactor;
+
 // -----------------------------------------------------------------------------
 #pragma mark Configuration
 // -----------------------------------------------------------------------------
@@ -95,6 +102,49 @@
  **/
 - (void)connectWithTimeout:(NSTimeInterval)timeout fileDescriptorBlock:(int (^)(NSError **))block;
 
+/**
+ * Resolves every address of host and races connections to them, IPv6 and IPv4 interleaved with
+ * staggered starts, see SSHKitAddressRacer. The winning socket goes through the fileDescriptorBlock path.
+ * @param timeout Limit of the whole setup from DNS lookup until authentication starts, 0.0 for default
+ *
+ **/
+- (void)connectRacingAddressesWithTimeout:(NSTimeInterval)timeout;
+
+// -----------------------------------------------------------------------------
+#pragma mark Reconnecting
+// -----------------------------------------------------------------------------
+
+/**
+ Bring a lost connection back instead of disconnecting, default NO.
+ 
+ Once authenticated, session remembers how it connected, the host key and the authentications it used. When
+ the connection drops with an error, it connects the same way again, fileDescriptorBlock is called again if
+ one was given. Host key is trusted if unchanged, otherwise delegate is asked. Authentications are replayed
+ without asking delegate, keyboard-interactive calls its block again.
+ 
+ Shell and SFTP channels are opened again. Shells get a new shell, data not yet sent on the old one and data
+ written while reconnecting are dropped and reported through channel:didDiscardUnsentBytes:, the rest of a
+ half sent command must not run in the new shell. Direct channels are opened again only if they were not
+ open yet, an open one is closed with the connection error, its target would see a new TCP stream starting
+ halfway through. Listening forwards are requested again on the port they were bound to. Transfers of
+ SSHKitSFTPTransferScheduler and SSHKitSFTPStripedTransfer continue from the last byte known to have
+ arrived, other SFTP transfers fail with SSHKitSFTPErrorCodeConnectionLost. Channels accepted from server
+ are closed.
+ 
+ session:didDisconnectWithError: is only sent after maxReconnectAttempts failed attempts in a row, when host
+ key is rejected or authentication denied, or on disconnect.
+ */
+@property (nonatomic) BOOL reconnectsAutomatically;
+
+/** Failed attempts in a row before giving up, default 8 */
+@property (nonatomic) NSUInteger maxReconnectAttempts;
+
+/** Wait before first attempt, doubled for each further attempt up to 30 seconds, default 1 second */
+@property (nonatomic) NSTimeInterval reconnectDelay;
+
+/** YES from connection loss until the session is authenticated again or gives up */
+@property (nonatomic, readonly, getter = isReconnecting) BOOL reconnecting;
+
 // -----------------------------------------------------------------------------
 #pragma mark Disconnecting
 // -----------------------------------------------------------------------------
@@ -111,6 +161,21 @@
 - (void)dispatchSyncOnSessionQueue:(dispatch_block_t)block;
 - (void)dispatchAsyncOnSessionQueue:(dispatch_block_t)block;
 
+// -----------------------------------------------------------------------------
+#pragma mark Metrics
+// -----------------------------------------------------------------------------
+
+/** Snapshot of session and channel counters */
+- (SSHKitSessionMetrics *)metrics;
+
+/**
+ Periodically report metrics, replaces the previous reporting
+
+ @param queue Queue handler is called on, main queue if NULL
+ */
+- (void)reportMetricsWithInterval:(NSTimeInterval)interval queue:(dispatch_queue_t)queue handler:(SSHKitSessionMetricsHandler)handler;
+- (void)stopReportingMetrics;
+
 // -----------------------------------------------------------------------------
 #pragma mark Authentication
 // -----------------------------------------------------------------------------
@@ -162,6 +227,19 @@
  */
 - (void)session:(SSHKitSession *)session didDisconnectWithError:(NSError *)error;
 
+/**
+ Called when an authenticated session lost its connection and reconnectsAutomatically is set.
+
+ @param attempt Starts from 1, reset once reconnected
+ @param delay Seconds until the attempt starts
+ */
+- (void)session:(SSHKitSession *)session willReconnectAfterError:(NSError *)error attempt:(NSUInteger)attempt delay:(NSTimeInterval)delay;
+
+/**
+ Called instead of session:didAuthenticateUser: once a lost connection is back, channels are being opened again.
+ */
+- (void)sessionDidReconnect:(SSHKitSession *)session;
+
 - (void)session:(SSHKitSession *)session didReceiveIssueBanner:(NSString *)banner;
 
 /**
@@ -171,6 +249,13 @@
  */
 - (void)session:(SSHKitSession *)session didReceiveServerBanner:(NSString *)serverBanner clientBanner:(NSString *)clientBanner protocolVersion:(int)protocolVersion;
 
+/**
+ Called each time a handshake phase ends, phase is one of SSHKitHandshakePhase constants. A phase
+ entered more than once, like authentication with several methods, is reported every time.
+ SSHKitHandshakePhaseTotalSetup is reported after the finer phases it contains.
+ */
+- (void)session:(SSHKitSession *)session didFinishHandshakePhase:(NSString *)phase duration:(NSTimeInterval)duration;
+
 /**
  Called when a session is connecting to a host, the fingerprint is used
  to verify the authenticity of the host.
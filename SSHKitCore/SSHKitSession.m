@@ -6,6 +6,9 @@
 #import "SSHKitSession+Channels.h"
 #import "SSHKitKeyPair.h"
 #import "SSHKitForwardChannel.h"
+#import "SSHKitAddressRacer.h"
+#import "SSHKitCipherProbe.h"
+#import "SSHKitTimerWheel.h"
 
 #define SOCKET_NULL -1
 
@@ -30,20 +33,51 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
         unsigned int didAuthenticateUser            : 1;
         unsigned int didOpenForwardChannel          : 1;
         unsigned int channelHasRaisedError          : 1;
+        unsigned int didFinishHandshakePhaseDuration : 1;
+        unsigned int willReconnectAfterErrorAttemptDelay : 1;
+        unsigned int didReconnect                   : 1;
 	} _delegateFlags;
     
     dispatch_source_t   _socketReadSource;
     
-    dispatch_source_t   _heartbeatTimer;
+    // timers of the shared timer wheel
+    SSHKitWheelTimer    *_heartbeatTimer;
     NSInteger           _heartbeatCounter;
+    CFAbsoluteTime      _lastReceivedAt;        // keepalive is skipped while server talks
     
-    dispatch_source_t   _connectTimer;
+    SSHKitWheelTimer    *_connectTimer;
+    SSHKitWheelTimer    *_authTimer;
+    SSHKitAddressRacer  *_addressRacer;
     
     dispatch_block_t    _authBlock;
     
+    // reconnecting
+    BOOL                _reconnecting;
+    NSUInteger          _reconnectAttempt;
+    SSHKitWheelTimer    *_reconnectTimer;
+    dispatch_block_t    _connectBlock;          // connects again the way user did
+    NSString            *_trustedHostKey;       // base64 of host key delegate trusted
+    NSArray             *_authReplays;          // authentications that succeeded last, in order
+    NSMutableArray      *_pendingAuthReplays;   // authentications of connection being set up
+    NSUInteger          _authReplayIndex;
+    
     void *_isOnSessionQueueKey;
+    SSHKitReactorWorker *_reactorWorker;    // nil unless session queue is shared
     
     int _verbosity;
+    
+    // metrics
+    CFAbsoluteTime      _stageChangedAt;
+    CFAbsoluteTime      _socketConnectedAt;     // 0 while libssh connects by itself
+    CFAbsoluteTime      _bannerReceivedAt;
+    NSMutableDictionary *_handshakeDurations;
+    NSUInteger          _wakeups;
+    NSTimeInterval      _wakeupTime;
+    NSTimeInterval      _maxWakeupTime;
+    NSUInteger          _channelServices;
+    SSHKitLogHandler    _registeredLogHandler;  // worker queue of a reactor may log for other sessions too
+    SSHKitChannelMetrics *_closedChannelsMetrics;   // totals of channels already removed
+    dispatch_source_t   _metricsTimer;
 }
 
 @property (nonatomic, readwrite)  SSHKitSessionStage stage;
@@ -54,8 +88,6 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
 
 @property (nonatomic, readonly) long          timeout;
 
-@property (nonatomic, readonly) dispatch_queue_t sessionQueue;
-
 @property (nonatomic, readwrite)  int         fd;
 @end
 
@@ -77,8 +109,17 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
         
         self.stage = SSHKitSessionStageNotConnected;
         _channels = [@[] mutableCopy];
+        _pendingChannels = [NSMutableOrderedSet orderedSet];
         _forwardRequests = [@[] mutableCopy];
+        _suspendedChannels = [@[] mutableCopy];
+        _listeningForwards = [@[] mutableCopy];
+        _localForwards = [@[] mutableCopy];
+        _pendingAuthReplays = [@[] mutableCopy];
+        _maxReconnectAttempts = 8;
+        _reconnectDelay = 1;
         _verbosity = SSH_LOG_NOLOG;
+        _handshakeDurations = [@{} mutableCopy];
+        _closedChannelsMetrics = [[SSHKitChannelMetrics alloc] init];
         
 		self.delegate = aDelegate;
 		
@@ -121,11 +162,31 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
     return self;
 }
 
+- (instancetype)initWithHost:(NSString *)host port:(uint16_t)port user:(NSString *)user options:(NSDictionary *)options delegate:(id<SSHKitSessionDelegate>)aDelegate reactor:(SSHKitReactor *)reactor {
+    SSHKitReactorWorker *worker = [reactor doTakeWorker];
+    
+    if ((self = [self initWithHost:host port:port user:user options:options delegate:aDelegate sessionQueue:worker.queue])) {
+        _reactorWorker = worker;
+    } else {
+        [worker doReleaseSession];
+    }
+    
+    return self;
+}
+
 - (void)dealloc {
     // Synchronous disconnection
     [self dispatchSyncOnSessionQueue: ^{ @autoreleasepool {
         [self _doDisconnectWithError:nil];
     }}];
+    
+    // queue may outlive us and serve other sessions, a later session at the same address must not look on it
+    dispatch_queue_set_specific(_sessionQueue, _isOnSessionQueueKey, NULL, NULL);
+    [_reactorWorker doReleaseSession];
+    
+    if (_metricsTimer) {
+        dispatch_source_cancel(_metricsTimer);
+    }
 }
 
 -(NSString *)description {
@@ -146,9 +207,63 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
         _delegateFlags.didOpenForwardChannel = [delegate respondsToSelector:@selector(session:didOpenForwardChannel:)];
         _delegateFlags.didAuthenticateUser = [delegate respondsToSelector:@selector(session:didAuthenticateUser:)];
         _delegateFlags.channelHasRaisedError = [delegate respondsToSelector:@selector(session:channel:hasRaisedError:)];
+        _delegateFlags.didFinishHandshakePhaseDuration = [delegate respondsToSelector:@selector(session:didFinishHandshakePhase:duration:)];
+        _delegateFlags.willReconnectAfterErrorAttemptDelay = [delegate respondsToSelector:@selector(session:willReconnectAfterError:attempt:delay:)];
+        _delegateFlags.didReconnect = [delegate respondsToSelector:@selector(sessionDidReconnect:)];
 	}
 }
 
+- (void)setStage:(SSHKitSessionStage)stage {
+    if (_stage == stage) {
+        return;
+    }
+    
+    // time spent in handshake stages
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSString *phase = nil;
+    switch (_stage) {
+        case SSHKitSessionStageConnecting:
+            phase = SSHKitHandshakePhaseTotalSetup;
+            break;
+        case SSHKitSessionStagePreAuthenticate:
+            phase = SSHKitHandshakePhaseHostKey;
+            break;
+        case SSHKitSessionStageAuthenticating:
+            phase = SSHKitHandshakePhaseAuthenticate;
+            break;
+        default:
+            break;
+    }
+    
+    if (phase) {
+        [self _didFinishHandshakePhase:phase duration:now - _stageChangedAt];
+    }
+    
+    if (stage == SSHKitSessionStageConnecting) {
+        // reconnecting, forget last handshake
+        [_handshakeDurations removeAllObjects];
+        _socketConnectedAt = 0;
+        _bannerReceivedAt = 0;
+        
+        // a reconnect replays authentications of last success, otherwise record them again
+        _authReplayIndex = 0;
+        if (!_reconnecting) {
+            [_pendingAuthReplays removeAllObjects];
+        }
+    }
+    
+    _stage = stage;
+    _stageChangedAt = now;
+}
+
+- (void)_didFinishHandshakePhase:(NSString *)phase duration:(NSTimeInterval)duration {
+    _handshakeDurations[phase] = @([_handshakeDurations[phase] doubleValue] + duration);
+    
+    if (_delegateFlags.didFinishHandshakePhaseDuration) {
+        [self.delegate session:self didFinishHandshakePhase:phase duration:duration];
+    }
+}
+
 - (void) setBlocking:(BOOL)blocking {
     _blocking = blocking;
     
@@ -174,10 +289,18 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
     int result = ssh_connect(_rawSession);
     [self _setupSocketReadSource];
     
+    if (!_bannerReceivedAt && (result == SSH_OK || result == SSH_AGAIN) && ssh_get_serverbanner(_rawSession)) {
+        _bannerReceivedAt = CFAbsoluteTimeGetCurrent();
+        [self _didFinishHandshakePhase:SSHKitHandshakePhaseBanner duration:_bannerReceivedAt - (_socketConnectedAt ?: _stageChangedAt)];
+    }
+    
     switch (result) {
         case SSH_OK: {
             // connection established
             self.fd = ssh_get_fd(_rawSession);
+            [self _didFinishHandshakePhase:SSHKitHandshakePhaseKeyExchange duration:CFAbsoluteTimeGetCurrent() - _bannerReceivedAt];
+            // deadline covers transport only, authentication may wait for user
+            [self _cancelConnectTimer];
             
             NSString *serverBanner = nil;
             NSString *clientBanner = nil;
@@ -212,7 +335,10 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
             NSError *error = nil;
             SSHKitHostKey *hostKey = [SSHKitHostKey hostKeyFromRawSession:self.rawSession error:&error];
             
-            if ( !error && ! (_delegateFlags.shouldTrustHostKey && [self.delegate session:self shouldTrustHostKey:hostKey]) )
+            // same server as before connection was lost, don't ask again
+            BOOL trusted = !error && _reconnecting && [hostKey.base64 isEqualToString:_trustedHostKey];
+            
+            if ( !error && !trusted && ! (_delegateFlags.shouldTrustHostKey && [self.delegate session:self shouldTrustHostKey:hostKey]) )
             {
                 // failed
                 error = [NSError errorWithDomain:SSHKitCoreErrorDomain
@@ -225,7 +351,10 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
                 return;
             }
             
+            _trustedHostKey = hostKey.base64;
+            
             self.stage = SSHKitSessionStagePreAuthenticate;
+            [self _setupAuthTimer];
             [self _preAuthenticate];
         }
             break;
@@ -256,29 +385,95 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
             return_from_block;
         }
         
-        strongSelf.stage = SSHKitSessionStageConnecting;
-        int fd = SSH_INVALID_SOCKET;
+        strongSelf->_connectBlock = ^{
+            __strong SSHKitSession *strongSelf = weakSelf;
+            [strongSelf _doConnectWithFileDescriptorBlock:block timeout:strongSelf->_timeout];
+        };
+        [strongSelf _cancelReconnectTimer];
+        strongSelf->_connectBlock();
+    }}];
+}
+
+- (void)_doConnectWithFileDescriptorBlock:(int (^)(NSError **))block timeout:(NSTimeInterval)timeout {
+    self.stage = SSHKitSessionStageConnecting;
+    int fd = SSH_INVALID_SOCKET;
+    
+    if (block) {
+        NSError *error = nil;
+        fd = block(&error);
         
-        if (block) {
-            NSError *error = nil;
-            fd = block(&error);
-            
-            if (fd==SSH_INVALID_SOCKET || error) {
-                [strongSelf _doDisconnectWithError:error];
-                return_from_block;
-            }
+        if (fd==SSH_INVALID_SOCKET || error) {
+            [self _doDisconnectWithError:error];
+            return;
         }
         
-        BOOL prepared = [strongSelf _doPrepareWithFileDescriptor:fd];
-        if (!prepared) {
+        _socketConnectedAt = CFAbsoluteTimeGetCurrent();
+    }
+    
+    BOOL prepared = [self _doPrepareWithFileDescriptor:fd];
+    if (!prepared) {
+        return;
+    }
+    
+    [self _setupConnectTimer:timeout];
+    [self _doConnect];
+}
+
+- (void)connectRacingAddressesWithTimeout:(NSTimeInterval)timeout {
+    _timeout = timeout > 0 ? timeout : SSHKIT_SESSION_DEFAULT_TIMEOUT;
+    
+    __weak SSHKitSession *weakSelf = self;
+    [self dispatchAsyncOnSessionQueue: ^{ @autoreleasepool {
+        __strong SSHKitSession *strongSelf = weakSelf;
+        if (!strongSelf) {
             return_from_block;
         }
         
-        [strongSelf _doConnect];
-//        [strongSelf _setupConnectTimer];
+        strongSelf->_connectBlock = ^{
+            [weakSelf _doConnectRacingAddresses];
+        };
+        [strongSelf _cancelReconnectTimer];
+        strongSelf->_connectBlock();
     }}];
 }
 
+- (void)_doConnectRacingAddresses {
+    // DNS and TCP count as connect phase, session is no longer disconnected
+    self.stage = SSHKitSessionStageConnecting;
+    CFAbsoluteTime startedAt = CFAbsoluteTimeGetCurrent();
+    
+    SSHKitAddressRacer *racer = [[SSHKitAddressRacer alloc] initWithHost:self.host port:self.port ?: 22];
+    _addressRacer = racer;
+    
+    __weak SSHKitSession *weakSelf = self;
+    [racer connectWithTimeout:_timeout queue:_sessionQueue completion:^(int fd, NSError *error) {
+        __strong SSHKitSession *strongSelf = weakSelf;
+        if (!strongSelf || strongSelf->_addressRacer != racer) {
+            // disconnected meanwhile
+            if (fd >= 0) {
+                close(fd);
+            }
+            return_from_block;
+        }
+        
+        strongSelf->_addressRacer = nil;
+        
+        if (error) {
+            [strongSelf _doDisconnectWithError:error];
+            return_from_block;
+        }
+        
+        [strongSelf _didFinishHandshakePhase:SSHKitHandshakePhaseResolve duration:racer.resolveDuration];
+        [strongSelf _didFinishHandshakePhase:SSHKitHandshakePhaseTCPConnect duration:racer.connectDuration];
+        
+        // rest of the deadline is left for banner and key exchange, the timer is cancelled before authentication
+        NSTimeInterval remaining = strongSelf->_timeout - (CFAbsoluteTimeGetCurrent() - startedAt);
+        [strongSelf _doConnectWithFileDescriptorBlock:^int(NSError **errorPtr) {
+            return fd;
+        } timeout:MAX(remaining, 0.001)];
+    }];
+}
+
 #define SET_SSH_OPTIONS(opt,value) ({\
     int rc = ssh_options_set(_rawSession, (opt), (value)); \
     if (rc < 0) { \
@@ -300,8 +495,9 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
     if (debugLevel) {
         _verbosity = debugLevel.intValue;
         
-        if (_verbosity > SSH_LOG_NOLOG && _logHandler) {
-            SSHKitRegisterLogCallback(_verbosity, _logHandler, self.sessionQueue);
+        if (_verbosity > SSH_LOG_NOLOG && _logHandler && !_registeredLogHandler) {
+            _registeredLogHandler = [_logHandler copy];
+            SSHKitRegisterLogCallback(_verbosity, _registeredLogHandler, self.sessionQueue);
         }
     }
     SET_SSH_OPTIONS(SSH_OPTIONS_LOG_VERBOSITY, &_verbosity);
@@ -335,8 +531,14 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
         SET_SSH_OPTIONS(SSH_OPTIONS_COMPRESSION, "no");
     }
     
+    // ciphers and MACs fastest on this machine first, measured once by first session asking
+    BOOL probesAlgorithms = [self.options[kVTKitProbeAlgorithmsKey] boolValue];
+    
     // encryption ciphers
     NSString *ciphers = self.options[kVTKitEncryptionCiphersKey];
+    if (!ciphers.length && probesAlgorithms) {
+        ciphers = [SSHKitCipherProbe sharedProbe].preferredCiphers;
+    }
     if (ciphers.length) {
         SET_SSH_OPTIONS(SSH_OPTIONS_CIPHERS_C_S, ciphers.UTF8String);
         SET_SSH_OPTIONS(SSH_OPTIONS_CIPHERS_S_C, ciphers.UTF8String);
@@ -344,6 +546,9 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
     
     // HMAC algorithms
     NSString *hmac = self.options[kVTKitMACAlgorithmsKey];
+    if (!hmac.length && probesAlgorithms) {
+        hmac = [SSHKitCipherProbe sharedProbe].preferredMACs;
+    }
     if (hmac.length) {
         SET_SSH_OPTIONS(SSH_OPTIONS_HMAC_C_S, hmac.UTF8String);
         SET_SSH_OPTIONS(SSH_OPTIONS_HMAC_S_C, hmac.UTF8String);
@@ -427,21 +632,52 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
 }
 
 - (void)_doDisconnectWithError:(NSError *)error {
-    if (self.isDisconnected) { // already disconnected
+    // already disconnected, a session waiting to reconnect can still be told to give up
+    if (self.isDisconnected && (!_reconnecting || error)) {
         return;
     }
     
+    BOOL reconnects = [self _shouldReconnectAfterError:error];
+    
     _stage = SSHKitSessionStageDisconnected;
     
     [self _cancelHeartbeatTimer];
-//    [self _cancelConnectTimer];
+    [self _cancelConnectTimer];
+    [self _cancelAuthTimer];
+    
+    [_addressRacer cancel];
+    _addressRacer = nil;
     
     NSArray *channels = [_channels copy];
     for (SSHKitChannel* channel in channels) {
+        if (reconnects && channel.stage != SSHKitChannelStageClosed && channel.isSuspendable) {
+            [channel doSuspend];
+            [_suspendedChannels addObject:channel];
+            continue;
+        }
+        
         [channel doCloseWithError:error];
+        [self doAccumulateMetricsOfChannel:channel];
+    }
+    
+    if (!reconnects) {
+        NSArray *suspendedChannels = [_suspendedChannels copy];
+        [_suspendedChannels removeAllObjects];
+        for (SSHKitChannel* channel in suspendedChannels) {
+            [channel doCloseWithError:error];
+            [self doAccumulateMetricsOfChannel:channel];
+        }
+        
+        [_listeningForwards removeAllObjects];
+        
+        NSArray *localForwards = [_localForwards copy];
+        for (SSHKitLocalForward *forward in localForwards) {
+            [forward doCloseWithError:error];
+        }
     }
     
     [_channels removeAllObjects];
+    [_pendingChannels removeAllObjects];
     
     if (ssh_is_connected(_rawSession)) {
         ssh_disconnect(_rawSession);
@@ -452,13 +688,133 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
     
     [self _cancelSocketReadSource];
     
-    SSHKitUnregisterLogCallback(_sessionQueue);
+    if (_registeredLogHandler) {
+        // only this session's registration, others sharing the queue keep logging
+        SSHKitUnregisterLogHandler(_registeredLogHandler, _sessionQueue);
+        _registeredLogHandler = nil;
+    }
+    
+    if (reconnects) {
+        [self _scheduleReconnectAfterError:error];
+        return;
+    }
+    
+    _reconnecting = NO;
+    _reconnectAttempt = 0;
+    [self _cancelReconnectTimer];
     
     if (_delegateFlags.didDisconnectWithError) {
         [self.delegate session:self didDisconnectWithError:error];
     }
 }
 
+// -----------------------------------------------------------------------------
+#pragma mark Reconnecting
+// -----------------------------------------------------------------------------
+
+- (BOOL)isReconnecting {
+    __block BOOL flag = NO;
+    [self dispatchSyncOnSessionQueue:^{
+        flag = self->_reconnecting;
+    }];
+    
+    return flag;
+}
+
+- (BOOL)_shouldReconnectAfterError:(NSError *)error {
+    if (!error || !_reconnectsAutomatically || !_connectBlock) {
+        return NO;
+    }
+    
+    // only a session which was authenticated once is brought back
+    if (!_reconnecting && _stage != SSHKitSessionStageAuthenticated) {
+        return NO;
+    }
+    
+    // server refused us, trying again won't help
+    if (error.code == SSHKitErrorRequestDenied && [error.domain isEqualToString:SSHKitLibsshErrorDomain]) {
+        return NO;
+    }
+    if ([error.domain isEqualToString:SSHKitCoreErrorDomain]) {
+        switch (error.code) {
+            case SSHKitErrorHostKeyMismatch:
+            case SSHKitErrorAuthFailure:
+            case SSHKitErrorStop:
+                return NO;
+                
+            default:
+                break;
+        }
+    }
+    
+    return _reconnectAttempt < _maxReconnectAttempts;
+}
+
+- (void)_scheduleReconnectAfterError:(NSError *)error {
+    _reconnecting = YES;
+    _reconnectAttempt++;
+    
+    NSTimeInterval delay = MIN(_reconnectDelay * pow(2, _reconnectAttempt - 1), SSHKIT_SESSION_MAX_RECONNECT_DELAY);
+    
+    if (_delegateFlags.willReconnectAfterErrorAttemptDelay) {
+        [self.delegate session:self willReconnectAfterError:error attempt:_reconnectAttempt delay:delay];
+    }
+    
+    [self _cancelReconnectTimer];
+    
+    __weak SSHKitSession *weakSelf = self;
+    _reconnectTimer = [[SSHKitTimerWheel sharedWheel] scheduleTimerWithDelay:delay queue:_sessionQueue block:^{
+        __strong SSHKitSession *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+        
+        strongSelf->_reconnectTimer = nil;
+        strongSelf->_connectBlock();
+    }];
+}
+
+- (void)_cancelReconnectTimer {
+    [_reconnectTimer cancel];
+    _reconnectTimer = nil;
+}
+
+- (void)_didReconnect {
+    _reconnecting = NO;
+    _reconnectAttempt = 0;
+    
+    [self doRestoreChannels];
+    
+    if (_delegateFlags.didReconnect) {
+        [self.delegate sessionDidReconnect:self];
+    }
+}
+
+/** Remember an authentication, replayed in order when session reconnects */
+- (void)_recordAuthentication:(dispatch_block_t)replay {
+    __weak SSHKitSession *weakSelf = self;
+    [self dispatchAsyncOnSessionQueue:^{
+        __strong SSHKitSession *strongSelf = weakSelf;
+        if (!strongSelf || strongSelf->_reconnecting) {
+            return_from_block;
+        }
+        
+        [strongSelf->_pendingAuthReplays addObject:[replay copy]];
+    }];
+}
+
+/** @return NO if not reconnecting or nothing is left to replay, delegate decides then */
+- (BOOL)_replayAuthentication {
+    if (!_reconnecting || _authReplayIndex >= _authReplays.count) {
+        return NO;
+    }
+    
+    dispatch_block_t replay = _authReplays[_authReplayIndex++];
+    replay();
+    
+    return YES;
+}
+
 #pragma mark Diagnostics
 
 - (NSError *)libsshError {
@@ -548,6 +904,10 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
                 if (banner) [self.delegate session:self didReceiveIssueBanner:@(banner)];
             }
             
+            if ([self _replayAuthentication]) {
+                return;
+            }
+            
             NSArray<NSString *> *authMethods = [self _getUserAuthList];
             
             if (_delegateFlags.authenticateWithAllowedMethodsPartialSuccess) {
@@ -567,9 +927,17 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
     self.stage = SSHKitSessionStageAuthenticated;
     
     // stop connect timer and throw to heartbeat timer
-//    [self _cancelConnectTimer];
+    [self _cancelConnectTimer];
+    [self _cancelAuthTimer];
     [self _setupHeartbeatTimer];
     
+    if (_reconnecting) {
+        [self _didReconnect];
+        return;
+    }
+    
+    _authReplays = [_pendingAuthReplays copy];
+    
     if (_delegateFlags.didAuthenticateUser) {
         [self.delegate session:self didAuthenticateUser:nil];
     }
@@ -590,6 +958,10 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
             return;
             
         case SSH_AUTH_PARTIAL: {
+            if ([self _replayAuthentication]) {
+                return;
+            }
+            
             // pre auth success
             NSArray<NSString *> *authMethods = [self _getUserAuthList];
             
@@ -618,6 +990,11 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
     __block int rc = SSH_AUTH_AGAIN;
     
     __weak SSHKitSession *weakSelf = self;
+    // answers may change each time, ask again
+    [self _recordAuthentication:^{
+        [weakSelf authenticateWithAskInteractiveInfo:askInteractiveInfo];
+    }];
+    
     _authBlock = ^{ @autoreleasepool {
         __strong SSHKitSession *strongSelf = weakSelf;
         if (!strongSelf) {
@@ -691,6 +1068,12 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
 //    [self _setupConnectTimer];
     
     __weak SSHKitSession *weakSelf = self;
+    [self _recordAuthentication:^{
+        [weakSelf authenticateWithAskPassword:^NSString *{
+            return password;
+        }];
+    }];
+    
     _authBlock = ^{ @autoreleasepool {
         __strong SSHKitSession *strongSelf = weakSelf;
         if (!strongSelf) {
@@ -718,6 +1101,10 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
     __block BOOL publicKeySuccess = NO;
     __weak SSHKitSession *weakSelf = self;
     
+    [self _recordAuthentication:^{
+        [weakSelf authenticateWithKeyPair:keyPair];
+    }];
+    
     _authBlock = ^{ @autoreleasepool {
         __strong SSHKitSession *strongSelf = weakSelf;
         if (!strongSelf) {
@@ -790,9 +1177,12 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
             return_from_block;
         }
         
+        CFAbsoluteTime wakeupStartedAt = CFAbsoluteTimeGetCurrent();
+        
         // reset keepalive counter
         NSNumber *serverAliveMax = strongSelf.options[kVTKitServerAliveCountMaxKey];
         strongSelf->_heartbeatCounter = serverAliveMax.integerValue;
+        strongSelf->_lastReceivedAt = wakeupStartedAt;
         
         switch (strongSelf->_stage) {
             case SSHKitSessionStageNotConnected:
@@ -825,26 +1215,8 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
                     }
                 }
                 
-                // copy channels here, NSEnumerationReverse still not safe while removing object in array
-                NSArray *channels = [strongSelf->_channels copy];
-                for (SSHKitChannel *channel in channels) {
-                    switch (channel.stage) {
-                        case SSHKitChannelStageOpening:
-                            [channel doOpen];
-                            break;
-                            
-                        case SSHKitChannelStageReady:
-                            [channel doWrite];
-                            break;
-                            
-                        case SSHKitChannelStageClosed:
-                            [strongSelf->_channels removeObject:channel];
-                            break;
-                            
-                        default:
-                            break;
-                    }
-                }
+                // only channels with pending work are serviced, data of idle channels is delivered by libssh callbacks
+                [strongSelf doServicePendingChannels];
                 
                 break;
             }
@@ -854,11 +1226,65 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
                 // should never comes here
                 break;
         }
+        
+        NSTimeInterval wakeupTime = CFAbsoluteTimeGetCurrent() - wakeupStartedAt;
+        strongSelf->_wakeups++;
+        strongSelf->_wakeupTime += wakeupTime;
+        strongSelf->_maxWakeupTime = MAX(strongSelf->_maxWakeupTime, wakeupTime);
+        [strongSelf->_reactorWorker doRecordWakeup:wakeupTime];
     }});
     
     dispatch_resume(_socketReadSource);
 }
 
+- (void)doScheduleChannel:(SSHKitChannel *)channel {
+    NSAssert([self isOnSessionQueue], @"Must be dispatched on session queue");
+    
+    [_pendingChannels addObject:channel];
+}
+
+- (void)doServicePendingChannels {
+    // copy channels here, channels may be scheduled or closed while serviced
+    NSArray *channels = [_pendingChannels array];
+    _channelServices += channels.count;
+    
+    for (SSHKitChannel *channel in channels) {
+        switch (channel.stage) {
+            case SSHKitChannelStageOpening:
+                [channel doOpen];
+                
+                if (channel.stage != SSHKitChannelStageOpening) {
+                    [channel.openTimer cancel];
+                    channel.openTimer = nil;
+                }
+                
+                // flush data written while channel was opening
+                if (channel.stage == SSHKitChannelStageReady) {
+                    [channel doWrite];
+                }
+                break;
+                
+            case SSHKitChannelStageReady:
+                [channel doWrite];
+                break;
+                
+            case SSHKitChannelStageClosed:
+                if ([_channels containsObject:channel]) {
+                    [self doAccumulateMetricsOfChannel:channel];
+                    [_channels removeObject:channel];
+                }
+                break;
+                
+            default:
+                break;
+        }
+        
+        if (!channel.hasPendingWork) {
+            [_pendingChannels removeObject:channel];
+        }
+    }
+}
+
 - (void)_cancelSocketReadSource {
     if (_socketReadSource) {
         dispatch_source_cancel(_socketReadSource);
@@ -878,39 +1304,62 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
 
 #pragma mark - Connection Heartbeat
 
-- (void)_setupConnectTimer {
+/** Disconnect unless key exchange finishes within timeout */
+- (void)_setupConnectTimer:(NSTimeInterval)timeout {
     [self _cancelConnectTimer];
     
-    _connectTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _sessionQueue);
-    if (!_connectTimer) {
-        // TODO: Throw error after migrate to swift
+    if (_stage != SSHKitSessionStageConnecting) {
         return;
     }
     
-    dispatch_source_set_timer(_connectTimer, dispatch_time(DISPATCH_TIME_NOW, _timeout * NSEC_PER_SEC), _timeout * NSEC_PER_SEC, (1ull * NSEC_PER_SEC) / 10);
-    
     __weak SSHKitSession *weakSelf = self;
-    dispatch_source_set_event_handler(_connectTimer, ^{
+    _connectTimer = [[SSHKitTimerWheel sharedWheel] scheduleTimerWithDelay:timeout queue:_sessionQueue block:^{
         __strong SSHKitSession *strongSelf = weakSelf;
         if (!strongSelf) {
             return_from_block;
         }
         
+        strongSelf->_connectTimer = nil;
+        
         NSString *errorDesc = [NSString stringWithFormat:@"Timeout, server %@ not responding", strongSelf.host];
         [strongSelf _doDisconnectWithError:[NSError errorWithDomain:SSHKitCoreErrorDomain
                                                                code:SSHKitErrorTimeout
                                                            userInfo:@{ NSLocalizedDescriptionKey : errorDesc } ]];
-        return_from_block;
-    });
-    
-    dispatch_resume(_connectTimer);
+    }];
 }
 
 - (void)_cancelConnectTimer {
-    if (_connectTimer) {
-        dispatch_source_cancel(_connectTimer);
-        _connectTimer = nil;
+    [_connectTimer cancel];
+    _connectTimer = nil;
+}
+
+/** Disconnect unless authenticated within kVTKitAuthenticationTimeoutKey seconds */
+- (void)_setupAuthTimer {
+    [self _cancelAuthTimer];
+    
+    NSNumber *authTimeout = self.options[kVTKitAuthenticationTimeoutKey];
+    if (authTimeout.doubleValue <= 0) {
+        return;
     }
+    
+    __weak SSHKitSession *weakSelf = self;
+    _authTimer = [[SSHKitTimerWheel sharedWheel] scheduleTimerWithDelay:authTimeout.doubleValue queue:_sessionQueue block:^{
+        __strong SSHKitSession *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+        
+        strongSelf->_authTimer = nil;
+        
+        [strongSelf _doDisconnectWithError:[NSError errorWithDomain:SSHKitCoreErrorDomain
+                                                               code:SSHKitErrorTimeout
+                                                           userInfo:@{ NSLocalizedDescriptionKey : @"Timeout, user not authenticated in time" } ]];
+    }];
+}
+
+- (void)_cancelAuthTimer {
+    [_authTimer cancel];
+    _authTimer = nil;
 }
 
 - (void)_setupHeartbeatTimer {
@@ -919,51 +1368,178 @@ typedef NS_ENUM(NSInteger, SSHKitSessionStage) {
         return;
     }
     
+    _heartbeatCounter = serverAliveMax.integerValue;
+    _lastReceivedAt = CFAbsoluteTimeGetCurrent();
+    
+    [self _scheduleHeartbeatAfter:_timeout];
+}
+
+- (void)_scheduleHeartbeatAfter:(NSTimeInterval)delay {
     [self _cancelHeartbeatTimer];
     
-    _heartbeatTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _sessionQueue);
-    if (!_heartbeatTimer) {
-        // TODO: Throw error after migrate to swift
+    __weak SSHKitSession *weakSelf = self;
+    _heartbeatTimer = [[SSHKitTimerWheel sharedWheel] scheduleTimerWithDelay:delay queue:_sessionQueue block:^{
+        __strong SSHKitSession *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+        
+        strongSelf->_heartbeatTimer = nil;
+        [strongSelf _heartbeat];
+    }];
+}
+
+- (void)_heartbeat {
+    // server talked recently, it is alive without asking
+    NSTimeInterval idle = CFAbsoluteTimeGetCurrent() - _lastReceivedAt;
+    if (idle >= 0 && idle < _timeout) {
+        [self _scheduleHeartbeatAfter:_timeout - idle];
         return;
     }
     
-    _heartbeatCounter = serverAliveMax.integerValue;
+    if (_heartbeatCounter<=0) {
+        NSString *errorDesc = [NSString stringWithFormat:@"Timeout, server %@ not responding", self.host];
+        [self _doDisconnectWithError:[NSError errorWithDomain:SSHKitCoreErrorDomain
+                                                         code:SSHKitErrorTimeout
+                                                     userInfo:@{ NSLocalizedDescriptionKey : errorDesc } ]];
+        return;
+    }
+    
+    int result = ssh_send_keepalive(_rawSession);
+    if (result!=SSH_OK) {
+        [self _doDisconnectWithError:self.libsshError];
+        return;
+    }
+    
+    _heartbeatCounter--;
     
-    dispatch_source_set_timer(_heartbeatTimer, dispatch_time(DISPATCH_TIME_NOW, _timeout * NSEC_PER_SEC), _timeout * NSEC_PER_SEC, (1ull * NSEC_PER_SEC) / 10);
+    [self _scheduleHeartbeatAfter:_timeout];
+    [self disconnectIfNeeded];
+}
+
+- (void)_cancelHeartbeatTimer {
+    [_heartbeatTimer cancel];
+    _heartbeatTimer = nil;
+}
+
+- (void)doSetupOpenTimerForChannel:(SSHKitChannel *)channel {
+    [channel.openTimer cancel];
+    
+    __weak SSHKitChannel *weakChannel = channel;
+    channel.openTimer = [[SSHKitTimerWheel sharedWheel] scheduleTimerWithDelay:_timeout queue:_sessionQueue block:^{
+        __strong SSHKitChannel *strongChannel = weakChannel;
+        if (strongChannel.stage != SSHKitChannelStageOpening) {
+            return_from_block;
+        }
+        
+        strongChannel.openTimer = nil;
+        [strongChannel doCloseWithError:[NSError errorWithDomain:SSHKitCoreErrorDomain
+                                                            code:SSHKitErrorTimeout
+                                                        userInfo:@{ NSLocalizedDescriptionKey : @"Timeout, channel not opened by server" } ]];
+    }];
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark - Metrics
+// -----------------------------------------------------------------------------
+
+- (void)doAccumulateMetricsOfChannel:(SSHKitChannel *)channel {
+    SSHKitChannelMetrics *metrics = [channel doCollectMetrics];
+    
+    _closedChannelsMetrics.bytesIn += metrics.bytesIn;
+    _closedChannelsMetrics.bytesOut += metrics.bytesOut;
+    _closedChannelsMetrics.packetsIn += metrics.packetsIn;
+    _closedChannelsMetrics.packetsOut += metrics.packetsOut;
+    _closedChannelsMetrics.windowStalls += metrics.windowStalls;
+}
+
+- (SSHKitSessionMetrics *)doCollectMetrics {
+    SSHKitSessionMetrics *metrics = [[SSHKitSessionMetrics alloc] init];
+    metrics.date = [NSDate date];
+    metrics.bytesIn = _closedChannelsMetrics.bytesIn;
+    metrics.bytesOut = _closedChannelsMetrics.bytesOut;
+    metrics.packetsIn = _closedChannelsMetrics.packetsIn;
+    metrics.packetsOut = _closedChannelsMetrics.packetsOut;
+    metrics.windowStalls = _closedChannelsMetrics.windowStalls;
+    
+    NSMutableArray *channelsMetrics = [NSMutableArray arrayWithCapacity:_channels.count];
+    for (SSHKitChannel *channel in _channels) {
+        SSHKitChannelMetrics *channelMetrics = [channel doCollectMetrics];
+        [channelsMetrics addObject:channelMetrics];
+        
+        metrics.bytesIn += channelMetrics.bytesIn;
+        metrics.bytesOut += channelMetrics.bytesOut;
+        metrics.packetsIn += channelMetrics.packetsIn;
+        metrics.packetsOut += channelMetrics.packetsOut;
+        metrics.windowStalls += channelMetrics.windowStalls;
+    }
+    metrics.channels = channelsMetrics;
+    
+    metrics.handshakeDurations = [_handshakeDurations copy];
+    metrics.wakeups = _wakeups;
+    metrics.wakeupTime = _wakeupTime;
+    metrics.maxWakeupTime = _maxWakeupTime;
+    metrics.channelServices = _channelServices;
+    
+    return metrics;
+}
+
+- (SSHKitSessionMetrics *)metrics {
+    __block SSHKitSessionMetrics *metrics = nil;
+    [self dispatchSyncOnSessionQueue:^{
+        metrics = [self doCollectMetrics];
+    }];
+    
+    return metrics;
+}
+
+- (void)reportMetricsWithInterval:(NSTimeInterval)interval queue:(dispatch_queue_t)queue handler:(SSHKitSessionMetricsHandler)handler {
+    NSParameterAssert(handler);
+    
+    queue = queue ?: dispatch_get_main_queue();
     
     __weak SSHKitSession *weakSelf = self;
-    dispatch_source_set_event_handler(_heartbeatTimer, ^{
+    [self dispatchAsyncOnSessionQueue:^{
         __strong SSHKitSession *strongSelf = weakSelf;
         if (!strongSelf) {
             return_from_block;
         }
         
-        if (strongSelf->_heartbeatCounter<=0) {
-            NSString *errorDesc = [NSString stringWithFormat:@"Timeout, server %@ not responding", strongSelf.host];
-            [strongSelf _doDisconnectWithError:[NSError errorWithDomain:SSHKitCoreErrorDomain
-                                                                code:SSHKitErrorTimeout
-                                                            userInfo:@{ NSLocalizedDescriptionKey : errorDesc } ]];
-            return_from_block;
-        }
+        [strongSelf _cancelMetricsTimer];
         
-        int result = ssh_send_keepalive(strongSelf->_rawSession);
-        if (result!=SSH_OK) {
-            [strongSelf _doDisconnectWithError:strongSelf.libsshError];
-            return;
+        strongSelf->_metricsTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, strongSelf->_sessionQueue);
+        if (!strongSelf->_metricsTimer) {
+            return_from_block;
         }
         
-        strongSelf->_heartbeatCounter--;
+        dispatch_source_set_timer(strongSelf->_metricsTimer, dispatch_time(DISPATCH_TIME_NOW, interval * NSEC_PER_SEC), interval * NSEC_PER_SEC, (1ull * NSEC_PER_SEC) / 10);
+        dispatch_source_set_event_handler(strongSelf->_metricsTimer, ^{
+            __strong SSHKitSession *strongSelf = weakSelf;
+            if (!strongSelf) {
+                return_from_block;
+            }
+            
+            SSHKitSessionMetrics *metrics = [strongSelf doCollectMetrics];
+            dispatch_async(queue, ^{
+                handler(metrics);
+            });
+        });
         
-        [strongSelf disconnectIfNeeded];
-    });
-    
-    dispatch_resume(_heartbeatTimer);
+        dispatch_resume(strongSelf->_metricsTimer);
+    }];
 }
 
-- (void)_cancelHeartbeatTimer {
-    if (_heartbeatTimer) {
-        dispatch_source_cancel(_heartbeatTimer);
-        _heartbeatTimer = nil;
+- (void)stopReportingMetrics {
+    __weak SSHKitSession *weakSelf = self;
+    [self dispatchAsyncOnSessionQueue:^{
+        [weakSelf _cancelMetricsTimer];
+    }];
+}
+
+- (void)_cancelMetricsTimer {
+    if (_metricsTimer) {
+        dispatch_source_cancel(_metricsTimer);
+        _metricsTimer = nil;
     }
 }
 
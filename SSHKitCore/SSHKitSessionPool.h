@@ -0,0 +1,79 @@
+//
+//  SSHKitSessionPool.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+
+@class SSHKitSession, SSHKitHostKey, SSHKitReactor;
+
+/** Called on session queue, authenticate the session the same way as in SSHKitSessionDelegate */
+typedef void (^ SSHKitSessionPoolAuthenticateBlock)(SSHKitSession *session, NSArray<NSString *> *methods, BOOL partialSuccess);
+/** Called on session queue */
+typedef BOOL (^ SSHKitSessionPoolTrustHostKeyBlock)(SSHKitSession *session, SSHKitHostKey *hostKey);
+/** Called on callbackQueue, session is authenticated and leased to caller until releaseSession: */
+typedef void (^ SSHKitSessionPoolAcquireBlock)(SSHKitSession *session, NSError *error);
+
+/**
+ Keeps authenticated sessions alive for reuse, keyed by host, port, user and options.
+
+ Every acquire leases one slot of a session, up to maxChannelsPerSession leases per session. When all
+ sessions of a key are fully leased a new one is connected, up to maxSessionsPerKey, further requests wait
+ for a release. Sessions without lease are disconnected after idleTimeout, except warm standby sessions
+ requested by warmUpSessionsForHost:port:user:options:count:.
+
+ Dead sessions are detected by the session heartbeat, kVTKitServerAliveCountMaxKey defaults to 3 for
+ pooled sessions, and removed from the pool once disconnected.
+ */
+@interface SSHKitSessionPool : NSObject
+
+/**
+ @param trustHostKeyBlock Host keys are rejected if nil
+ */
+- (instancetype)initWithAuthenticateBlock:(SSHKitSessionPoolAuthenticateBlock)authenticateBlock
+                        trustHostKeyBlock:(SSHKitSessionPoolTrustHostKeyBlock)trustHostKeyBlock;
+
+/** Default 8 */
+@property (nonatomic) NSUInteger maxChannelsPerSession;
+/** Default 4 */
+@property (nonatomic) NSUInteger maxSessionsPerKey;
+/** Seconds a session without lease stays connected, default 60 */
+@property (nonatomic) NSTimeInterval idleTimeout;
+/** Default 10 */
+@property (nonatomic) NSTimeInterval connectTimeout;
+/**
+ Failed connects to a key in a row before its waiting requests fail and its standby count is cleared,
+ default 5. Connects after a failure back off from 1 up to 30 seconds, waiting requests stay queued meanwhile.
+ */
+@property (nonatomic) NSUInteger maxConnectFailures;
+
+/** Sessions connected from now on share the worker queues of reactor instead of owning a queue each, default nil */
+@property (nonatomic, strong) SSHKitReactor *reactor;
+
+/** Queue for acquire blocks, default main queue */
+@property (nonatomic, strong) dispatch_queue_t callbackQueue;
+
+/** Sessions connected or connecting */
+@property (nonatomic, readonly) NSUInteger sessionCount;
+
+- (void)acquireSessionForHost:(NSString *)host
+                         port:(uint16_t)port
+                         user:(NSString *)user
+                      options:(NSDictionary *)options
+                   completion:(SSHKitSessionPoolAcquireBlock)completion;
+
+/** Return a lease taken by acquireSessionForHost:port:user:options:completion: */
+- (void)releaseSession:(SSHKitSession *)session;
+
+/** Keep count authenticated sessions ready for the key even when idle, pass 0 to stop */
+- (void)warmUpSessionsForHost:(NSString *)host
+                         port:(uint16_t)port
+                         user:(NSString *)user
+                      options:(NSDictionary *)options
+                        count:(NSUInteger)count;
+
+/** Disconnect all sessions and fail requests still waiting */
+- (void)drain;
+
+@end
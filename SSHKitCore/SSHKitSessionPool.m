@@ -0,0 +1,459 @@
+//
+//  SSHKitSessionPool.m
+//  SSHKitCore
+//
+
+#import "SSHKitSessionPool.h"
+#import "SSHKitCore+Protected.h"
+
+#define SESSION_POOL_DEFAULT_ALIVE_COUNT_MAX 3
+#define SESSION_POOL_RETRY_DELAY            1   // seconds before connecting again after a failure, doubled per failure
+#define SESSION_POOL_MAX_RETRY_DELAY        30
+
+static NSError *SSHKitSessionPoolError(NSString *description) {
+    return [NSError errorWithDomain:SSHKitCoreErrorDomain
+                               code:SSHKitErrorStop
+                           userInfo:@{ NSLocalizedDescriptionKey : description }];
+}
+
+#pragma mark - Pool entries
+
+@interface SSHKitPooledSession : NSObject
+
+@property (nonatomic, strong) SSHKitSession *session;
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic) BOOL authenticated;
+@property (nonatomic) NSUInteger leases;
+@property (nonatomic) CFAbsoluteTime idleSince;
+
+@end
+
+@implementation SSHKitPooledSession
+@end
+
+/** Sessions, waiting requests and standby count of one host/port/user/options key */
+@interface SSHKitPooledEndpoint : NSObject
+
+@property (nonatomic, copy) NSString *host;
+@property (nonatomic) uint16_t port;
+@property (nonatomic, copy) NSString *user;
+@property (nonatomic, copy) NSDictionary *options;
+
+@property (nonatomic, strong) NSMutableArray<SSHKitPooledSession *> *sessions;
+@property (nonatomic, strong) NSMutableArray<SSHKitSessionPoolAcquireBlock> *waiters;
+@property (nonatomic) NSUInteger standbyCount;
+
+/** Connects failed in a row, no new connect before retryAt */
+@property (nonatomic) NSUInteger consecutiveFailures;
+@property (nonatomic) CFAbsoluteTime retryAt;
+
+@end
+
+@implementation SSHKitPooledEndpoint
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _sessions = [@[] mutableCopy];
+        _waiters = [@[] mutableCopy];
+    }
+    return self;
+}
+
+- (NSUInteger)connectingCount {
+    NSUInteger count = 0;
+    for (SSHKitPooledSession *entry in _sessions) {
+        count += entry.authenticated ? 0 : 1;
+    }
+    return count;
+}
+
+- (NSUInteger)idleCount {
+    NSUInteger count = 0;
+    for (SSHKitPooledSession *entry in _sessions) {
+        count += (entry.authenticated && !entry.leases) ? 1 : 0;
+    }
+    return count;
+}
+
+@end
+
+#pragma mark -
+
+@interface SSHKitSessionPool () <SSHKitSessionDelegate> {
+    dispatch_queue_t _poolQueue;
+    dispatch_source_t _evictTimer;
+
+    NSMutableDictionary<NSString *, SSHKitPooledEndpoint *> *_endpoints;
+}
+
+@property (nonatomic, copy) SSHKitSessionPoolAuthenticateBlock authenticateBlock;
+@property (nonatomic, copy) SSHKitSessionPoolTrustHostKeyBlock trustHostKeyBlock;
+
+@end
+
+@implementation SSHKitSessionPool
+
+- (instancetype)initWithAuthenticateBlock:(SSHKitSessionPoolAuthenticateBlock)authenticateBlock
+                        trustHostKeyBlock:(SSHKitSessionPoolTrustHostKeyBlock)trustHostKeyBlock {
+    NSParameterAssert(authenticateBlock);
+
+    if ((self = [super init])) {
+        _authenticateBlock = [authenticateBlock copy];
+        _trustHostKeyBlock = [trustHostKeyBlock copy];
+
+        _maxChannelsPerSession = 8;
+        _maxSessionsPerKey = 4;
+        _idleTimeout = 60;
+        _connectTimeout = 10;
+        _maxConnectFailures = 5;
+        _callbackQueue = dispatch_get_main_queue();
+
+        _poolQueue = dispatch_queue_create("com.codinn.libssh.session_pool", DISPATCH_QUEUE_SERIAL);
+        _endpoints = [@{} mutableCopy];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_evictTimer) {
+        dispatch_source_cancel(_evictTimer);
+    }
+
+    for (SSHKitPooledEndpoint *endpoint in _endpoints.allValues) {
+        for (SSHKitPooledSession *entry in endpoint.sessions) {
+            entry.session.delegate = nil;
+            [entry.session disconnect];
+        }
+    }
+}
+
+- (NSUInteger)sessionCount {
+    __block NSUInteger count = 0;
+    dispatch_sync(_poolQueue, ^{
+        for (SSHKitPooledEndpoint *endpoint in _endpoints.allValues) {
+            count += endpoint.sessions.count;
+        }
+    });
+    return count;
+}
+
+#pragma mark - Leases
+
+- (void)acquireSessionForHost:(NSString *)host
+                         port:(uint16_t)port
+                         user:(NSString *)user
+                      options:(NSDictionary *)options
+                   completion:(SSHKitSessionPoolAcquireBlock)completion {
+    NSParameterAssert(completion);
+
+    dispatch_async(_poolQueue, ^{
+        SSHKitPooledEndpoint *endpoint = [self doEndpointForHost:host port:port user:user options:options];
+        [endpoint.waiters addObject:[completion copy]];
+        [self doServeEndpoint:endpoint];
+    });
+}
+
+- (void)releaseSession:(SSHKitSession *)session {
+    dispatch_async(_poolQueue, ^{
+        SSHKitPooledEndpoint *endpoint = nil;
+        SSHKitPooledSession *entry = [self doEntryForSession:session endpoint:&endpoint];
+        if (!entry || !entry.leases) {
+            // already disconnected and removed
+            return;
+        }
+
+        entry.leases--;
+        if (!entry.leases) {
+            entry.idleSince = CFAbsoluteTimeGetCurrent();
+        }
+
+        [self doServeEndpoint:endpoint];
+    });
+}
+
+- (void)warmUpSessionsForHost:(NSString *)host
+                         port:(uint16_t)port
+                         user:(NSString *)user
+                      options:(NSDictionary *)options
+                        count:(NSUInteger)count {
+    dispatch_async(_poolQueue, ^{
+        SSHKitPooledEndpoint *endpoint = [self doEndpointForHost:host port:port user:user options:options];
+        endpoint.standbyCount = MIN(count, _maxSessionsPerKey);
+        [self doServeEndpoint:endpoint];
+    });
+}
+
+- (void)drain {
+    dispatch_async(_poolQueue, ^{
+        NSError *error = SSHKitSessionPoolError(@"Session pool drained");
+
+        for (SSHKitPooledEndpoint *endpoint in _endpoints.allValues) {
+            [self doFailWaitersOfEndpoint:endpoint error:error];
+
+            for (SSHKitPooledSession *entry in endpoint.sessions) {
+                entry.session.delegate = nil;
+                [entry.session disconnect];
+            }
+        }
+
+        [_endpoints removeAllObjects];
+    });
+}
+
+#pragma mark - Internal
+
++ (NSString *)keyForHost:(NSString *)host port:(uint16_t)port user:(NSString *)user options:(NSDictionary *)options {
+    NSMutableString *key = [NSMutableString stringWithFormat:@"%@@%@:%u", user, host, port];
+
+    // options dictionary has no stable ordering
+    for (NSString *option in [options.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        [key appendFormat:@";%@=%@", option, options[option]];
+    }
+
+    return key;
+}
+
+- (SSHKitPooledEndpoint *)doEndpointForHost:(NSString *)host port:(uint16_t)port user:(NSString *)user options:(NSDictionary *)options {
+    NSString *key = [SSHKitSessionPool keyForHost:host port:port user:user options:options];
+
+    SSHKitPooledEndpoint *endpoint = _endpoints[key];
+    if (!endpoint) {
+        endpoint = [[SSHKitPooledEndpoint alloc] init];
+        endpoint.host = host;
+        endpoint.port = port;
+        endpoint.user = user;
+
+        // pooled sessions stay around, heartbeat tells when they are dead
+        NSMutableDictionary *sessionOptions = [options ?: @{} mutableCopy];
+        if (!sessionOptions[kVTKitServerAliveCountMaxKey]) {
+            sessionOptions[kVTKitServerAliveCountMaxKey] = @(SESSION_POOL_DEFAULT_ALIVE_COUNT_MAX);
+        }
+        endpoint.options = sessionOptions;
+
+        _endpoints[key] = endpoint;
+    }
+
+    [self doSetupEvictTimer];
+
+    return endpoint;
+}
+
+- (SSHKitPooledSession *)doEntryForSession:(SSHKitSession *)session endpoint:(SSHKitPooledEndpoint **)endpointPtr {
+    for (SSHKitPooledEndpoint *endpoint in _endpoints.allValues) {
+        for (SSHKitPooledSession *entry in endpoint.sessions) {
+            if (entry.session == session) {
+                if (endpointPtr) {
+                    *endpointPtr = endpoint;
+                }
+                return entry;
+            }
+        }
+    }
+
+    return nil;
+}
+
+/** Hand out leases to waiting requests, connect more sessions for load or standby */
+- (void)doServeEndpoint:(SSHKitPooledEndpoint *)endpoint {
+    while (endpoint.waiters.count) {
+        // least leased first, spreads channels over sessions
+        SSHKitPooledSession *best = nil;
+        for (SSHKitPooledSession *entry in endpoint.sessions) {
+            if (!entry.authenticated || entry.leases >= _maxChannelsPerSession) {
+                continue;
+            }
+            if (!best || entry.leases < best.leases) {
+                best = entry;
+            }
+        }
+
+        if (!best) {
+            break;
+        }
+
+        best.leases++;
+
+        SSHKitSessionPoolAcquireBlock completion = endpoint.waiters.firstObject;
+        [endpoint.waiters removeObjectAtIndex:0];
+
+        SSHKitSession *session = best.session;
+        dispatch_async(_callbackQueue, ^{
+            completion(session, nil);
+        });
+    }
+
+    // each connecting session will serve up to maxChannelsPerSession waiters
+    NSUInteger connecting = endpoint.connectingCount;
+    NSUInteger needed = (endpoint.waiters.count + _maxChannelsPerSession - 1) / _maxChannelsPerSession;
+    NSUInteger standby = endpoint.standbyCount > endpoint.idleCount ? endpoint.standbyCount - endpoint.idleCount : 0;
+    needed = MAX(needed, standby);
+
+    if (CFAbsoluteTimeGetCurrent() < endpoint.retryAt) {
+        // backing off, served again once the delay passed
+        return;
+    }
+
+    while (connecting < needed && endpoint.sessions.count < _maxSessionsPerKey) {
+        [self doConnectSessionForEndpoint:endpoint];
+        connecting++;
+    }
+}
+
+- (void)doConnectSessionForEndpoint:(SSHKitPooledEndpoint *)endpoint {
+    SSHKitSession *session = [[SSHKitSession alloc] initWithHost:endpoint.host port:endpoint.port user:endpoint.user options:endpoint.options delegate:self reactor:_reactor];
+
+    SSHKitPooledSession *entry = [[SSHKitPooledSession alloc] init];
+    entry.session = session;
+    entry.idleSince = CFAbsoluteTimeGetCurrent();
+    [endpoint.sessions addObject:entry];
+
+    [session connectWithTimeout:_connectTimeout];
+}
+
+- (void)doFailWaitersOfEndpoint:(SSHKitPooledEndpoint *)endpoint error:(NSError *)error {
+    NSArray *waiters = [endpoint.waiters copy];
+    [endpoint.waiters removeAllObjects];
+
+    for (SSHKitSessionPoolAcquireBlock completion in waiters) {
+        dispatch_async(_callbackQueue, ^{
+            completion(nil, error);
+        });
+    }
+}
+
+#pragma mark - Eviction
+
+- (void)doSetupEvictTimer {
+    if (_evictTimer) {
+        return;
+    }
+
+    _evictTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _poolQueue);
+    if (!_evictTimer) {
+        return;
+    }
+
+    NSTimeInterval interval = MAX(_idleTimeout / 2, 1);
+    dispatch_source_set_timer(_evictTimer, dispatch_time(DISPATCH_TIME_NOW, interval * NSEC_PER_SEC), interval * NSEC_PER_SEC, (1ull * NSEC_PER_SEC) / 10);
+
+    __weak SSHKitSessionPool *weakSelf = self;
+    dispatch_source_set_event_handler(_evictTimer, ^{
+        __strong SSHKitSessionPool *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return_from_block;
+        }
+
+        [strongSelf doEvictIdleSessions];
+    });
+
+    dispatch_resume(_evictTimer);
+}
+
+- (void)doEvictIdleSessions {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    for (SSHKitPooledEndpoint *endpoint in _endpoints.allValues) {
+        NSUInteger idleCount = endpoint.idleCount;
+
+        for (SSHKitPooledSession *entry in [endpoint.sessions copy]) {
+            if (!entry.authenticated || entry.leases) {
+                continue;
+            }
+
+            if (!entry.session.isConnected) {
+                // missed disconnect callback
+                [endpoint.sessions removeObject:entry];
+                idleCount--;
+                continue;
+            }
+
+            if (idleCount > endpoint.standbyCount && now - entry.idleSince >= _idleTimeout) {
+                [endpoint.sessions removeObject:entry];
+                idleCount--;
+
+                entry.session.delegate = nil;
+                [entry.session disconnect];
+            }
+        }
+
+        [self doServeEndpoint:endpoint];
+    }
+}
+
+#pragma mark - SSHKitSessionDelegate
+
+- (BOOL)session:(SSHKitSession *)session shouldTrustHostKey:(SSHKitHostKey *)hostKey {
+    return self.trustHostKeyBlock ? self.trustHostKeyBlock(session, hostKey) : NO;
+}
+
+- (void)session:(SSHKitSession *)session authenticateWithAllowedMethods:(NSArray<NSString *> *)methods partialSuccess:(BOOL)partialSuccess {
+    self.authenticateBlock(session, methods, partialSuccess);
+}
+
+- (void)session:(SSHKitSession *)session didAuthenticateUser:(NSString *)username {
+    dispatch_async(_poolQueue, ^{
+        SSHKitPooledEndpoint *endpoint = nil;
+        SSHKitPooledSession *entry = [self doEntryForSession:session endpoint:&endpoint];
+        if (!entry) {
+            return;
+        }
+
+        entry.authenticated = YES;
+        entry.idleSince = CFAbsoluteTimeGetCurrent();
+        endpoint.consecutiveFailures = 0;
+        endpoint.retryAt = 0;
+        [self doServeEndpoint:endpoint];
+    });
+}
+
+- (void)session:(SSHKitSession *)session didDisconnectWithError:(NSError *)error {
+    dispatch_async(_poolQueue, ^{
+        SSHKitPooledEndpoint *endpoint = nil;
+        SSHKitPooledSession *entry = [self doEntryForSession:session endpoint:&endpoint];
+        if (!entry) {
+            return;
+        }
+
+        [endpoint.sessions removeObject:entry];
+
+        if (!entry.authenticated) {
+            [self doHandleConnectFailureOfEndpoint:endpoint error:error ?: SSHKitSessionPoolError(@"Session disconnected")];
+            return;
+        }
+
+        [self doServeEndpoint:endpoint];
+    });
+}
+
+#pragma mark - Connect Failures
+
+- (void)doHandleConnectFailureOfEndpoint:(SSHKitPooledEndpoint *)endpoint error:(NSError *)error {
+    endpoint.consecutiveFailures++;
+
+    if (endpoint.consecutiveFailures >= MAX(_maxConnectFailures, 1)) {
+        // host keeps refusing or timing out, don't retry forever
+        [self doFailWaitersOfEndpoint:endpoint error:error];
+        endpoint.standbyCount = 0;
+        endpoint.consecutiveFailures = 0;
+        endpoint.retryAt = 0;
+        return;
+    }
+
+    // waiters stay queued, the connect after backing off may still serve them
+    NSUInteger exponent = MIN(endpoint.consecutiveFailures - 1, 5);
+    NSTimeInterval delay = MIN(SESSION_POOL_RETRY_DELAY * (double)(1 << exponent), SESSION_POOL_MAX_RETRY_DELAY);
+    endpoint.retryAt = CFAbsoluteTimeGetCurrent() + delay;
+
+    __weak SSHKitSessionPool *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), _poolQueue, ^{
+        __strong SSHKitSessionPool *strongSelf = weakSelf;
+        // pool drained meanwhile
+        if (!strongSelf || [strongSelf->_endpoints.allValues indexOfObjectIdenticalTo:endpoint] == NSNotFound) {
+            return_from_block;
+        }
+
+        [strongSelf doServeEndpoint:endpoint];
+    });
+}
+
+@end
@@ -0,0 +1,44 @@
+//
+//  SSHKitAddressRacer.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+
+/** fd of the connected socket, or -1 with error */
+typedef void(^SSHKitAddressRacerCompletionBlock)(int fd, NSError *error);
+
+/**
+ Resolves every address of a host and races TCP connections to them, in the manner of Happy Eyeballs
+ (RFC 8305). Address families are interleaved starting with the first one resolved, a new attempt starts
+ every connectionAttemptDelay or as soon as the previous one fails, and the first connection established
+ wins while the others are closed. A dead route to one family costs a delay, not a full TCP timeout.
+ */
+@interface SSHKitAddressRacer : NSObject
+
+- (instancetype)initWithHost:(NSString *)host port:(uint16_t)port;
+
+@property (nonatomic, readonly) NSString *host;
+@property (nonatomic, readonly) uint16_t port;
+
+/** Head start of each attempt over the next one, default 0.25 seconds */
+@property (nonatomic) NSTimeInterval connectionAttemptDelay;
+
+/** Valid once completion is called */
+@property (nonatomic, readonly) NSTimeInterval resolveDuration;
+@property (nonatomic, readonly) NSTimeInterval connectDuration;
+/** Numeric address of winning connection */
+@property (nonatomic, readonly) NSString *connectedAddress;
+
+/**
+ Start racing, can only be called once.
+
+ @param timeout Overall limit of resolving and connecting, fails with SSHKitErrorTimeout
+ @param queue Queue completion is called on
+ */
+- (void)connectWithTimeout:(NSTimeInterval)timeout queue:(dispatch_queue_t)queue completion:(SSHKitAddressRacerCompletionBlock)completion;
+
+/** Close every attempt, completion is called with SSHKitErrorStop */
+- (void)cancel;
+
+@end
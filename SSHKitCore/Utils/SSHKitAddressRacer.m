@@ -0,0 +1,340 @@
+//
+//  SSHKitAddressRacer.m
+//  SSHKitCore
+//
+
+#import "SSHKitAddressRacer.h"
+#import "SSHKitCoreCommon.h"
+#import <netdb.h>
+#import <fcntl.h>
+#import <sys/socket.h>
+#import <netinet/in.h>
+
+static NSError *SSHKitConnectError(int code, NSString *address) {
+    return [NSError errorWithDomain:SSHKitCoreErrorDomain
+                               code:SSHKitErrorConnectFailure
+                           userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Could not connect to %@: %s", address, strerror(code)],
+                                       NSUnderlyingErrorKey : [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil] }];
+}
+
+static NSString *SSHKitNumericAddress(const struct sockaddr *address, socklen_t length) {
+    char host[NI_MAXHOST];
+    if (getnameinfo(address, length, host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0) {
+        return @"?";
+    }
+    return @(host);
+}
+
+/** Addresses as sockaddr data, families alternate starting with the first one resolved, RFC 8305 section 4 */
+static NSArray<NSData *> *SSHKitResolveAddresses(NSString *host, uint16_t port, NSError **errorPtr) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    struct addrinfo *result = NULL;
+    NSString *service = [NSString stringWithFormat:@"%u", port];
+    int rc = getaddrinfo(host.UTF8String, service.UTF8String, &hints, &result);
+    if (rc != 0 || !result) {
+        *errorPtr = [NSError errorWithDomain:SSHKitCoreErrorDomain
+                                        code:SSHKitErrorConnectFailure
+                                    userInfo:@{ NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Could not resolve %@: %s", host, gai_strerror(rc)] }];
+        return nil;
+    }
+
+    NSMutableArray *preferred = [@[] mutableCopy];
+    NSMutableArray *others = [@[] mutableCopy];
+    for (struct addrinfo *info = result; info; info = info->ai_next) {
+        NSData *address = [NSData dataWithBytes:info->ai_addr length:info->ai_addrlen];
+        [(info->ai_family == result->ai_family ? preferred : others) addObject:address];
+    }
+    freeaddrinfo(result);
+
+    NSMutableArray *addresses = [NSMutableArray arrayWithCapacity:preferred.count + others.count];
+    for (NSUInteger i = 0; i < MAX(preferred.count, others.count); i++) {
+        if (i < preferred.count) {
+            [addresses addObject:preferred[i]];
+        }
+        if (i < others.count) {
+            [addresses addObject:others[i]];
+        }
+    }
+
+    return addresses;
+}
+
+/** A socket connecting in background, owned by its write source, which closes it once cancelled */
+@interface SSHKitConnectionAttempt : NSObject
+
+@property (nonatomic) int fd;
+@property (nonatomic, copy) NSString *address;
+@property (nonatomic, strong) dispatch_source_t source;
+
+@end
+
+@implementation SSHKitConnectionAttempt
+@end
+
+@implementation SSHKitAddressRacer {
+    dispatch_queue_t _racerQueue;
+    dispatch_source_t _attemptTimer;
+    dispatch_source_t _deadlineTimer;
+
+    NSArray<NSData *> *_addresses;
+    NSUInteger _nextAddress;
+    NSMutableArray<SSHKitConnectionAttempt *> *_attempts;
+    NSError *_lastError;
+
+    CFAbsoluteTime _startedAt;
+    CFAbsoluteTime _resolvedAt;
+    BOOL _started;
+
+    dispatch_queue_t _callbackQueue;
+    SSHKitAddressRacerCompletionBlock _completion;
+}
+
+- (instancetype)initWithHost:(NSString *)host port:(uint16_t)port {
+    if ((self = [super init])) {
+        _host = [host copy];
+        _port = port;
+        _connectionAttemptDelay = 0.25;
+
+        _racerQueue = dispatch_queue_create("com.codinn.address_racer", DISPATCH_QUEUE_SERIAL);
+        _attempts = [@[] mutableCopy];
+    }
+    return self;
+}
+
+#pragma mark - Racing
+
+- (void)connectWithTimeout:(NSTimeInterval)timeout queue:(dispatch_queue_t)queue completion:(SSHKitAddressRacerCompletionBlock)completion {
+    NSParameterAssert(completion);
+
+    dispatch_async(_racerQueue, ^{
+        if (_started) {
+            return_from_block;
+        }
+
+        _started = YES;
+        _completion = [completion copy];
+        _callbackQueue = queue ?: dispatch_get_main_queue();
+        _startedAt = CFAbsoluteTimeGetCurrent();
+
+        [self doSetupDeadlineTimer:timeout];
+
+        // getaddrinfo blocks, a late answer after the deadline is dropped
+        NSString *host = _host;
+        uint16_t port = _port;
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            NSError *error = nil;
+            NSArray *addresses = SSHKitResolveAddresses(host, port, &error);
+
+            dispatch_async(_racerQueue, ^{
+                if (!_completion) {
+                    return_from_block;
+                }
+
+                _resolvedAt = CFAbsoluteTimeGetCurrent();
+                _resolveDuration = _resolvedAt - _startedAt;
+
+                if (!addresses.count) {
+                    [self doFinishWithFileDescriptor:-1 error:error];
+                    return_from_block;
+                }
+
+                _addresses = addresses;
+                [self doStartNextAttempt];
+            });
+        });
+    });
+}
+
+- (void)cancel {
+    dispatch_async(_racerQueue, ^{
+        [self doFinishWithFileDescriptor:-1 error:[NSError errorWithDomain:SSHKitCoreErrorDomain
+                                                                      code:SSHKitErrorStop
+                                                                  userInfo:@{ NSLocalizedDescriptionKey : @"Connection cancelled" }]];
+    });
+}
+
+- (void)doStartNextAttempt {
+    [self doCancelAttemptTimer];
+
+    while (_completion && _nextAddress < _addresses.count) {
+        if ([self doStartAttempt:_addresses[_nextAddress++]]) {
+            break;
+        }
+    }
+
+    if (!_completion) {
+        // won right away
+        return;
+    }
+
+    if (_nextAddress < _addresses.count) {
+        [self doSetupAttemptTimer];
+    } else if (!_attempts.count) {
+        [self doFinishWithFileDescriptor:-1 error:_lastError];
+    }
+}
+
+/** @return YES if the attempt is in progress or already won */
+- (BOOL)doStartAttempt:(NSData *)addressData {
+    const struct sockaddr *address = addressData.bytes;
+    socklen_t length = (socklen_t)addressData.length;
+
+    SSHKitConnectionAttempt *attempt = [[SSHKitConnectionAttempt alloc] init];
+    attempt.address = SSHKitNumericAddress(address, length);
+    attempt.fd = socket(address->sa_family, SOCK_STREAM, IPPROTO_TCP);
+
+    if (attempt.fd < 0) {
+        _lastError = SSHKitConnectError(errno, attempt.address);
+        return NO;
+    }
+
+    fcntl(attempt.fd, F_SETFL, fcntl(attempt.fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(attempt.fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    if (connect(attempt.fd, address, length) == 0) {
+        [self doWinAttempt:attempt];
+        return YES;
+    }
+
+    if (errno != EINPROGRESS) {
+        _lastError = SSHKitConnectError(errno, attempt.address);
+        close(attempt.fd);
+        return NO;
+    }
+
+    attempt.source = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, attempt.fd, 0, _racerQueue);
+    if (!attempt.source) {
+        _lastError = SSHKitConnectError(ENOMEM, attempt.address);
+        close(attempt.fd);
+        return NO;
+    }
+
+    // attempt and its source reference each other until the source is cancelled
+    dispatch_source_set_event_handler(attempt.source, ^{
+        [self doCheckAttempt:attempt];
+    });
+    dispatch_source_set_cancel_handler(attempt.source, ^{
+        if (attempt.fd >= 0) {
+            close(attempt.fd);
+        }
+        attempt.source = nil;
+    });
+
+    [_attempts addObject:attempt];
+    dispatch_resume(attempt.source);
+
+    return YES;
+}
+
+- (void)doCheckAttempt:(SSHKitConnectionAttempt *)attempt {
+    if (![_attempts containsObject:attempt]) {
+        return;
+    }
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(attempt.fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+        error = errno;
+    }
+
+    if (!error) {
+        [_attempts removeObject:attempt];
+        dispatch_source_cancel(attempt.source);
+        [self doWinAttempt:attempt];
+        return;
+    }
+
+    _lastError = SSHKitConnectError(error, attempt.address);
+    [_attempts removeObject:attempt];
+    dispatch_source_cancel(attempt.source);
+
+    // a failed attempt makes way for the next one without waiting for the delay
+    [self doStartNextAttempt];
+}
+
+- (void)doWinAttempt:(SSHKitConnectionAttempt *)attempt {
+    int fd = attempt.fd;
+    // fd is handed over, cancel handler must not close it
+    attempt.fd = -1;
+
+    _connectedAddress = attempt.address;
+    _connectDuration = CFAbsoluteTimeGetCurrent() - _resolvedAt;
+
+    [self doFinishWithFileDescriptor:fd error:nil];
+}
+
+- (void)doFinishWithFileDescriptor:(int)fd error:(NSError *)error {
+    if (!_completion) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    [self doCancelAttemptTimer];
+    if (_deadlineTimer) {
+        dispatch_source_cancel(_deadlineTimer);
+        _deadlineTimer = nil;
+    }
+
+    for (SSHKitConnectionAttempt *attempt in _attempts) {
+        dispatch_source_cancel(attempt.source);
+    }
+    [_attempts removeAllObjects];
+
+    SSHKitAddressRacerCompletionBlock completion = _completion;
+    _completion = nil;
+
+    dispatch_async(_callbackQueue, ^{
+        completion(fd, error);
+    });
+}
+
+#pragma mark - Timers
+
+- (void)doSetupAttemptTimer {
+    _attemptTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _racerQueue);
+    if (!_attemptTimer) {
+        return;
+    }
+
+    dispatch_source_set_timer(_attemptTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_connectionAttemptDelay * NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, NSEC_PER_SEC / 100);
+    dispatch_source_set_event_handler(_attemptTimer, ^{
+        [self doStartNextAttempt];
+    });
+    dispatch_resume(_attemptTimer);
+}
+
+- (void)doCancelAttemptTimer {
+    if (_attemptTimer) {
+        dispatch_source_cancel(_attemptTimer);
+        _attemptTimer = nil;
+    }
+}
+
+- (void)doSetupDeadlineTimer:(NSTimeInterval)timeout {
+    _deadlineTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _racerQueue);
+    if (!_deadlineTimer) {
+        return;
+    }
+
+    dispatch_source_set_timer(_deadlineTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, NSEC_PER_SEC / 10);
+    dispatch_source_set_event_handler(_deadlineTimer, ^{
+        NSString *errorDesc = [NSString stringWithFormat:@"Timeout, server %@ not responding", _host];
+        [self doFinishWithFileDescriptor:-1 error:[NSError errorWithDomain:SSHKitCoreErrorDomain
+                                                                      code:SSHKitErrorTimeout
+                                                                  userInfo:@{ NSLocalizedDescriptionKey : errorDesc }]];
+    });
+    dispatch_resume(_deadlineTimer);
+}
+
+@end
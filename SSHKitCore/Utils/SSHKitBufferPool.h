@@ -0,0 +1,38 @@
+//
+//  SSHKitBufferPool.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Thread safe pool of fixed size malloc buffers, reused by channels to deliver received data
+ without allocating a buffer for every packet.
+ */
+@interface SSHKitBufferPool : NSObject
+
+/** Pool of 256 KB buffers shared by every channel unless another pool is set */
++ (instancetype)sharedPool;
+
+- (instancetype)initWithBufferSize:(NSUInteger)bufferSize maxFreeBuffers:(NSUInteger)maxFreeBuffers;
+
+@property (nonatomic, readonly) NSUInteger bufferSize;
+@property (nonatomic, readonly) NSUInteger maxFreeBuffers;
+
+/** Buffers malloc'ed because the pool was empty */
+@property (nonatomic, readonly) NSUInteger allocationCount;
+/** Buffers handed out from the pool without allocating */
+@property (nonatomic, readonly) NSUInteger reuseCount;
+
+/** Returns a buffer of bufferSize bytes, never NULL unless out of memory */
+- (void *)takeBuffer;
+/** Give a buffer taken from this pool back, it is freed if the pool is full */
+- (void)recycleBuffer:(void *)buffer;
+
+/**
+ Wrap length bytes of a pooled buffer without copying, buffer goes back to the pool
+ once the returned data is released.
+ */
+- (NSData *)dataWithBuffer:(void *)buffer length:(NSUInteger)length;
+
+@end
@@ -0,0 +1,79 @@
+//
+//  SSHKitBufferPool.m
+//  SSHKitCore
+//
+
+#import "SSHKitBufferPool.h"
+#import <pthread.h>
+
+@implementation SSHKitBufferPool {
+    pthread_mutex_t _mutex;
+    void **_freeBuffers;
+    NSUInteger _freeCount;
+}
+
++ (instancetype)sharedPool {
+    static SSHKitBufferPool *sharedPool = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedPool = [[SSHKitBufferPool alloc] initWithBufferSize:256 * 1024 maxFreeBuffers:16];
+    });
+    return sharedPool;
+}
+
+- (instancetype)initWithBufferSize:(NSUInteger)bufferSize maxFreeBuffers:(NSUInteger)maxFreeBuffers {
+    if ((self = [super init])) {
+        _bufferSize = bufferSize;
+        _maxFreeBuffers = maxFreeBuffers;
+        _freeBuffers = calloc(MAX(maxFreeBuffers, 1), sizeof(void *));
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (NSUInteger i = 0; i < _freeCount; i++) {
+        free(_freeBuffers[i]);
+    }
+    free(_freeBuffers);
+    pthread_mutex_destroy(&_mutex);
+}
+
+- (void *)takeBuffer {
+    void *buffer = NULL;
+    
+    pthread_mutex_lock(&_mutex);
+    if (_freeCount) {
+        buffer = _freeBuffers[--_freeCount];
+        _reuseCount++;
+    } else {
+        _allocationCount++;
+    }
+    pthread_mutex_unlock(&_mutex);
+    
+    return buffer ?: malloc(_bufferSize);
+}
+
+- (void)recycleBuffer:(void *)buffer {
+    if (!buffer) {
+        return;
+    }
+    
+    pthread_mutex_lock(&_mutex);
+    if (_freeCount < _maxFreeBuffers) {
+        _freeBuffers[_freeCount++] = buffer;
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&_mutex);
+    
+    free(buffer);
+}
+
+- (NSData *)dataWithBuffer:(void *)buffer length:(NSUInteger)length {
+    // pool is retained by the deallocator, so it outlives every buffer handed out
+    return [[NSData alloc] initWithBytesNoCopy:buffer length:length deallocator:^(void *bytes, NSUInteger length) {
+        [self recycleBuffer:bytes];
+    }];
+}
+
+@end
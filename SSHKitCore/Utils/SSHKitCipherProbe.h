@@ -0,0 +1,55 @@
+//
+//  SSHKitCipherProbe.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSInteger, SSHKitAlgorithmKind) {
+    SSHKitAlgorithmKindCipher = 0,
+    SSHKitAlgorithmKindMAC,
+};
+
+/** Single core throughput of one algorithm */
+@interface SSHKitAlgorithmThroughput : NSObject
+
+@property (nonatomic, readonly) NSString *name;     // as negotiated by SSH, e.g. aes128-ctr
+@property (nonatomic, readonly) SSHKitAlgorithmKind kind;
+/** Weaker or legacy algorithm, ranked after every recommended one whatever its speed */
+@property (nonatomic, readonly, getter = isLegacy) BOOL legacy;
+/** Megabytes, 2^20 bytes, encrypted or authenticated per second */
+@property (nonatomic, readonly) double megabytesPerSecond;
+
+@end
+
+/**
+ Measures ciphers and MACs libssh supports with the same OpenSSL primitives libssh calls, on one core and
+ in packet sized chunks, and orders them fastest first. Which AES mode or SHA-2 wins depends on the CPU,
+ e.g. SHA-512 beats SHA-256 on most 64 bit CPUs without SHA extensions.
+
+ Measured once per process on first use, sessions created with kVTKitProbeAlgorithmsKey use the lists
+ unless ciphers or MACs are given explicitly. Probing takes some 100 ms, call probe early to keep it off the
+ first session.
+ */
+@interface SSHKitCipherProbe : NSObject
+
++ (instancetype)sharedProbe;
+
+/** Bytes run through each algorithm, default 4 MB */
+@property (nonatomic) NSUInteger sampleSize;
+
+/** Measure now unless already measured */
+- (void)probe;
+
+/** Measure again, e.g. after changing sampleSize */
+- (void)reprobe;
+
+/** Results, fastest first, probes if needed */
+@property (nonatomic, readonly) NSArray<SSHKitAlgorithmThroughput *> *cipherThroughputs;
+@property (nonatomic, readonly) NSArray<SSHKitAlgorithmThroughput *> *macThroughputs;
+
+/** Comma separated preference lists for kVTKitEncryptionCiphersKey and kVTKitMACAlgorithmsKey, legacy ones last */
+@property (nonatomic, readonly) NSString *preferredCiphers;
+@property (nonatomic, readonly) NSString *preferredMACs;
+
+@end
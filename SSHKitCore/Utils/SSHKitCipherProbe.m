@@ -0,0 +1,279 @@
+//
+//  SSHKitCipherProbe.m
+//  SSHKitCore
+//
+
+#import "SSHKitCipherProbe.h"
+#import <openssl/aes.h>
+#import <openssl/blowfish.h>
+#import <openssl/des.h>
+#import <openssl/evp.h>
+#import <openssl/hmac.h>
+#import <pthread.h>
+
+// largest packet libssh sends, channel data is chunked the same way
+#define PROBE_CHUNK_SIZE    (32 * 1024)
+
+typedef NS_ENUM(NSInteger, SSHKitProbeCipher) {
+    SSHKitProbeCipherAESCTR,
+    SSHKitProbeCipherAESCBC,
+    SSHKitProbeCipherBlowfishCBC,
+    SSHKitProbeCipher3DESCBC,
+};
+
+// ciphers libssh 0.7 offers, des-cbc-ssh1 is SSH-1 only and left out
+static const struct {
+    const char *name;
+    SSHKitProbeCipher cipher;
+    int keyBits;
+    BOOL legacy;
+} s_probe_ciphers[] = {
+    { "aes256-ctr",     SSHKitProbeCipherAESCTR,        256, NO  },
+    { "aes192-ctr",     SSHKitProbeCipherAESCTR,        192, NO  },
+    { "aes128-ctr",     SSHKitProbeCipherAESCTR,        128, NO  },
+    { "aes256-cbc",     SSHKitProbeCipherAESCBC,        256, YES },
+    { "aes192-cbc",     SSHKitProbeCipherAESCBC,        192, YES },
+    { "aes128-cbc",     SSHKitProbeCipherAESCBC,        128, YES },
+    { "blowfish-cbc",   SSHKitProbeCipherBlowfishCBC,   128, YES },
+    { "3des-cbc",       SSHKitProbeCipher3DESCBC,       192, YES },
+};
+
+static const struct {
+    const char *name;
+    const EVP_MD *(*md)(void);
+    BOOL legacy;
+} s_probe_macs[] = {
+    { "hmac-sha2-256",  EVP_sha256,  NO  },
+    { "hmac-sha2-512",  EVP_sha512,  NO  },
+    { "hmac-sha1",      EVP_sha1,    YES },
+};
+
+@interface SSHKitAlgorithmThroughput ()
+
+@property (nonatomic, readwrite) NSString *name;
+@property (nonatomic, readwrite) SSHKitAlgorithmKind kind;
+@property (nonatomic, readwrite, getter = isLegacy) BOOL legacy;
+@property (nonatomic, readwrite) double megabytesPerSecond;
+
+@end
+
+@implementation SSHKitAlgorithmThroughput
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"%@ %.1f MB/s%@", _name, _megabytesPerSecond, _legacy ? @" (legacy)" : @""];
+}
+
+@end
+
+#pragma mark -
+
+// encrypt in place, chunk by chunk, the way libssh encrypts packets
+static NSTimeInterval SSHKitTimeCipher(SSHKitProbeCipher cipher, int keyBits, unsigned char *buffer, NSUInteger size) {
+    unsigned char key[32] = {0};
+    unsigned char iv[16] = {0};
+    unsigned char ecount[16] = {0};
+    unsigned int num = 0;
+    
+    AES_KEY aesKey;
+    BF_KEY bfKey;
+    DES_key_schedule ks1, ks2, ks3;
+    DES_cblock desIV = {0};
+    
+    switch (cipher) {
+        case SSHKitProbeCipherAESCTR:
+        case SSHKitProbeCipherAESCBC:
+            AES_set_encrypt_key(key, keyBits, &aesKey);
+            break;
+            
+        case SSHKitProbeCipherBlowfishCBC:
+            BF_set_key(&bfKey, keyBits / 8, key);
+            break;
+            
+        case SSHKitProbeCipher3DESCBC:
+            DES_set_key_unchecked((const_DES_cblock *)key, &ks1);
+            DES_set_key_unchecked((const_DES_cblock *)(key + 8), &ks2);
+            DES_set_key_unchecked((const_DES_cblock *)(key + 16), &ks3);
+            break;
+    }
+    
+    CFAbsoluteTime startedAt = CFAbsoluteTimeGetCurrent();
+    
+    for (NSUInteger offset = 0; offset < size; offset += PROBE_CHUNK_SIZE) {
+        unsigned char *chunk = buffer + offset;
+        size_t length = MIN(PROBE_CHUNK_SIZE, size - offset);
+        
+        switch (cipher) {
+            case SSHKitProbeCipherAESCTR:
+                AES_ctr128_encrypt(chunk, chunk, length, &aesKey, iv, ecount, &num);
+                break;
+                
+            case SSHKitProbeCipherAESCBC:
+                AES_cbc_encrypt(chunk, chunk, length, &aesKey, iv, AES_ENCRYPT);
+                break;
+                
+            case SSHKitProbeCipherBlowfishCBC:
+                BF_cbc_encrypt(chunk, chunk, (long)length, &bfKey, iv, BF_ENCRYPT);
+                break;
+                
+            case SSHKitProbeCipher3DESCBC:
+                DES_ede3_cbc_encrypt(chunk, chunk, (long)length, &ks1, &ks2, &ks3, &desIV, DES_ENCRYPT);
+                break;
+        }
+    }
+    
+    return CFAbsoluteTimeGetCurrent() - startedAt;
+}
+
+// one HMAC per chunk, as per packet
+static NSTimeInterval SSHKitTimeMAC(const EVP_MD *md, const unsigned char *buffer, NSUInteger size) {
+    unsigned char key[64] = {0};
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    
+    HMAC_CTX ctx;
+    HMAC_CTX_init(&ctx);
+    
+    CFAbsoluteTime startedAt = CFAbsoluteTimeGetCurrent();
+    
+    for (NSUInteger offset = 0; offset < size; offset += PROBE_CHUNK_SIZE) {
+        HMAC_Init_ex(&ctx, key, EVP_MD_size(md), md, NULL);
+        HMAC_Update(&ctx, buffer + offset, MIN(PROBE_CHUNK_SIZE, size - offset));
+        HMAC_Final(&ctx, digest, &digestLength);
+    }
+    
+    NSTimeInterval elapsed = CFAbsoluteTimeGetCurrent() - startedAt;
+    HMAC_CTX_cleanup(&ctx);
+    
+    return elapsed;
+}
+
+static double SSHKitMegabytesPerSecond(NSUInteger size, NSTimeInterval elapsed) {
+    return size / (1024.0 * 1024.0) / MAX(elapsed, 1e-6);
+}
+
+// recommended first, fastest first within each group
+static NSArray *SSHKitSortThroughputs(NSArray *throughputs) {
+    return [throughputs sortedArrayUsingComparator:^NSComparisonResult(SSHKitAlgorithmThroughput *a, SSHKitAlgorithmThroughput *b) {
+        if (a.legacy != b.legacy) {
+            return a.legacy ? NSOrderedDescending : NSOrderedAscending;
+        }
+        if (a.megabytesPerSecond != b.megabytesPerSecond) {
+            return a.megabytesPerSecond > b.megabytesPerSecond ? NSOrderedAscending : NSOrderedDescending;
+        }
+        return NSOrderedSame;
+    }];
+}
+
+@implementation SSHKitCipherProbe {
+    pthread_mutex_t _mutex;
+    
+    NSArray<SSHKitAlgorithmThroughput *> *_cipherThroughputs;
+    NSArray<SSHKitAlgorithmThroughput *> *_macThroughputs;
+}
+
++ (instancetype)sharedProbe {
+    static SSHKitCipherProbe *sharedProbe = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedProbe = [[SSHKitCipherProbe alloc] init];
+    });
+    return sharedProbe;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _sampleSize = 4 * 1024 * 1024;
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_mutex);
+}
+
+#pragma mark - Probing
+
+- (void)probe {
+    pthread_mutex_lock(&_mutex);
+    if (!_cipherThroughputs) {
+        [self doProbe];
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (void)reprobe {
+    pthread_mutex_lock(&_mutex);
+    [self doProbe];
+    pthread_mutex_unlock(&_mutex);
+}
+
+// must hold mutex, callers of other sessions wait instead of probing twice
+- (void)doProbe {
+    // whole chunks, CBC modes only take whole blocks
+    NSUInteger size = MAX(_sampleSize / PROBE_CHUNK_SIZE, 1) * PROBE_CHUNK_SIZE;
+    unsigned char *buffer = calloc(1, size);
+    if (!buffer) {
+        return;
+    }
+    
+    // page in buffer and warm up caches before the first measurement
+    SSHKitTimeCipher(SSHKitProbeCipherAESCTR, 128, buffer, PROBE_CHUNK_SIZE);
+    
+    NSMutableArray *ciphers = [@[] mutableCopy];
+    for (size_t i = 0; i < sizeof(s_probe_ciphers) / sizeof(s_probe_ciphers[0]); i++) {
+        SSHKitAlgorithmThroughput *throughput = [[SSHKitAlgorithmThroughput alloc] init];
+        throughput.name = @(s_probe_ciphers[i].name);
+        throughput.kind = SSHKitAlgorithmKindCipher;
+        throughput.legacy = s_probe_ciphers[i].legacy;
+        throughput.megabytesPerSecond = SSHKitMegabytesPerSecond(size, SSHKitTimeCipher(s_probe_ciphers[i].cipher, s_probe_ciphers[i].keyBits, buffer, size));
+        [ciphers addObject:throughput];
+    }
+    
+    NSMutableArray *macs = [@[] mutableCopy];
+    for (size_t i = 0; i < sizeof(s_probe_macs) / sizeof(s_probe_macs[0]); i++) {
+        SSHKitAlgorithmThroughput *throughput = [[SSHKitAlgorithmThroughput alloc] init];
+        throughput.name = @(s_probe_macs[i].name);
+        throughput.kind = SSHKitAlgorithmKindMAC;
+        throughput.legacy = s_probe_macs[i].legacy;
+        throughput.megabytesPerSecond = SSHKitMegabytesPerSecond(size, SSHKitTimeMAC(s_probe_macs[i].md(), buffer, size));
+        [macs addObject:throughput];
+    }
+    
+    free(buffer);
+    
+    _cipherThroughputs = SSHKitSortThroughputs(ciphers);
+    _macThroughputs = SSHKitSortThroughputs(macs);
+}
+
+#pragma mark - Results
+
+- (NSArray<SSHKitAlgorithmThroughput *> *)cipherThroughputs {
+    [self probe];
+    
+    pthread_mutex_lock(&_mutex);
+    NSArray *throughputs = _cipherThroughputs;
+    pthread_mutex_unlock(&_mutex);
+    
+    return throughputs;
+}
+
+- (NSArray<SSHKitAlgorithmThroughput *> *)macThroughputs {
+    [self probe];
+    
+    pthread_mutex_lock(&_mutex);
+    NSArray *throughputs = _macThroughputs;
+    pthread_mutex_unlock(&_mutex);
+    
+    return throughputs;
+}
+
+- (NSString *)preferredCiphers {
+    return [[self.cipherThroughputs valueForKey:@"name"] componentsJoinedByString:@","];
+}
+
+- (NSString *)preferredMACs {
+    return [[self.macThroughputs valueForKey:@"name"] componentsJoinedByString:@","];
+}
+
+@end
@@ -0,0 +1,48 @@
+//
+//  SSHKitIdentityCache.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+#import "SSHKitCoreCommon.h"
+
+@class SSHKitKeyPair;
+
+/**
+ Thread safe cache of parsed key pairs, an identity shared by many sessions is read, decrypted and has its
+ public key derived only once.
+
+ Key files are cached by path, and parsed again once their inode, size or modification time changes. Base64
+ keys are cached by SHA-256 of their content, the key text itself is not kept. A cached key pair is returned
+ without calling askPass, failed parses are not cached.
+
+ Evicted key pairs are freed once the last session using them releases them, libssh wipes private key
+ material when freeing. Factories of SSHKitKeyPair don't go through any cache.
+ */
+@interface SSHKitIdentityCache : NSObject
+
+/** Cache shared by the process, keeps 64 key pairs */
++ (instancetype)sharedCache;
+
+- (instancetype)initWithCountLimit:(NSUInteger)countLimit;
+
+/** Key pairs kept, least recently used one is evicted first */
+@property (nonatomic, readonly) NSUInteger countLimit;
+
+/** Lookups answered without parsing */
+@property (nonatomic, readonly) NSUInteger hitCount;
+/** Lookups that parsed the key */
+@property (nonatomic, readonly) NSUInteger missCount;
+/** Key pairs currently cached */
+@property (nonatomic, readonly) NSUInteger count;
+
+- (SSHKitKeyPair *)keyPairFromFilePath:(NSString *)path withAskPass:(SSHKitAskPassBlock)askPass error:(NSError **)errPtr;
+
+- (SSHKitKeyPair *)keyPairFromBase64:(NSString *)base64 withAskPass:(SSHKitAskPassBlock)askPass error:(NSError **)errPtr;
+
+/** Forget key pair of a file, e.g. once the identity is removed by user */
+- (void)evictFilePath:(NSString *)path;
+- (void)evictBase64:(NSString *)base64;
+- (void)removeAllKeyPairs;
+
+@end
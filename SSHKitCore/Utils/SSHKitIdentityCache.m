@@ -0,0 +1,191 @@
+//
+//  SSHKitIdentityCache.m
+//  SSHKitCore
+//
+
+#import "SSHKitIdentityCache.h"
+#import "SSHKitKeyPair.h"
+#import <CommonCrypto/CommonDigest.h>
+#import <pthread.h>
+#import <sys/stat.h>
+
+// a key file replaced or edited in place gets a new key
+static NSString *SSHKitFileIdentityKey(NSString *path) {
+    struct stat st;
+    if (stat(path.fileSystemRepresentation, &st) != 0) {
+        return nil;
+    }
+    
+    return [NSString stringWithFormat:@"file:%llu:%lld:%ld.%09ld:%@", (unsigned long long)st.st_ino, (long long)st.st_size,
+            (long)st.st_mtimespec.tv_sec, (long)st.st_mtimespec.tv_nsec, path];
+}
+
+static NSString *SSHKitBase64IdentityKey(NSString *base64) {
+    NSData *content = [base64 dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(content.bytes, (CC_LONG)content.length, digest);
+    
+    NSMutableString *key = [NSMutableString stringWithString:@"base64:"];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [key appendFormat:@"%02x", digest[i]];
+    }
+    return key;
+}
+
+@implementation SSHKitIdentityCache {
+    pthread_mutex_t _mutex;
+    
+    NSMutableDictionary<NSString *, SSHKitKeyPair *> *_keyPairs;
+    NSMutableOrderedSet<NSString *> *_recentKeys;               // least recently used first
+    NSMutableDictionary<NSString *, NSString *> *_fileKeys;     // path -> key of its current version
+}
+
++ (instancetype)sharedCache {
+    static SSHKitIdentityCache *sharedCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedCache = [[SSHKitIdentityCache alloc] initWithCountLimit:64];
+    });
+    return sharedCache;
+}
+
+- (instancetype)initWithCountLimit:(NSUInteger)countLimit {
+    if ((self = [super init])) {
+        _countLimit = MAX(countLimit, 1);
+        
+        _keyPairs = [@{} mutableCopy];
+        _recentKeys = [NSMutableOrderedSet orderedSet];
+        _fileKeys = [@{} mutableCopy];
+        
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_mutex);
+}
+
+- (NSUInteger)count {
+    pthread_mutex_lock(&_mutex);
+    NSUInteger count = _keyPairs.count;
+    pthread_mutex_unlock(&_mutex);
+    
+    return count;
+}
+
+#pragma mark - Lookup
+
+- (SSHKitKeyPair *)keyPairFromFilePath:(NSString *)path withAskPass:(SSHKitAskPassBlock)askPass error:(NSError **)errPtr {
+    NSString *key = SSHKitFileIdentityKey(path);
+    if (!key) {
+        // let parser report a missing file
+        return [SSHKitKeyPair keyPairFromFilePath:path withAskPass:askPass error:errPtr];
+    }
+    
+    SSHKitKeyPair *keyPair = [self lookupKeyPairForKey:key];
+    if (keyPair) {
+        return keyPair;
+    }
+    
+    keyPair = [SSHKitKeyPair keyPairFromFilePath:path withAskPass:askPass error:errPtr];
+    return keyPair ? [self storeKeyPair:keyPair forKey:key path:path] : nil;
+}
+
+- (SSHKitKeyPair *)keyPairFromBase64:(NSString *)base64 withAskPass:(SSHKitAskPassBlock)askPass error:(NSError **)errPtr {
+    if (!base64.length) {
+        return [SSHKitKeyPair keyPairFromBase64:base64 withAskPass:askPass error:errPtr];
+    }
+    
+    NSString *key = SSHKitBase64IdentityKey(base64);
+    
+    SSHKitKeyPair *keyPair = [self lookupKeyPairForKey:key];
+    if (keyPair) {
+        return keyPair;
+    }
+    
+    keyPair = [SSHKitKeyPair keyPairFromBase64:base64 withAskPass:askPass error:errPtr];
+    return keyPair ? [self storeKeyPair:keyPair forKey:key path:nil] : nil;
+}
+
+- (SSHKitKeyPair *)lookupKeyPairForKey:(NSString *)key {
+    pthread_mutex_lock(&_mutex);
+    SSHKitKeyPair *keyPair = _keyPairs[key];
+    if (keyPair) {
+        [_recentKeys removeObject:key];
+        [_recentKeys addObject:key];
+        _hitCount++;
+    } else {
+        _missCount++;
+    }
+    pthread_mutex_unlock(&_mutex);
+    
+    return keyPair;
+}
+
+/** @return key pair to use, one parsed meanwhile by another thread wins so every session shares it */
+- (SSHKitKeyPair *)storeKeyPair:(SSHKitKeyPair *)keyPair forKey:(NSString *)key path:(NSString *)path {
+    pthread_mutex_lock(&_mutex);
+    SSHKitKeyPair *existing = _keyPairs[key];
+    if (existing) {
+        keyPair = existing;
+    } else {
+        // older version of the same file is never asked for again
+        NSString *staleKey = path ? _fileKeys[path] : nil;
+        if (staleKey) {
+            [self removeKey:staleKey];
+        }
+        
+        _keyPairs[key] = keyPair;
+        [_recentKeys addObject:key];
+        if (path) {
+            _fileKeys[path] = key;
+        }
+        
+        while (_keyPairs.count > _countLimit) {
+            [self removeKey:_recentKeys.firstObject];
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+    
+    return keyPair;
+}
+
+#pragma mark - Eviction
+
+// must hold mutex
+- (void)removeKey:(NSString *)key {
+    [_keyPairs removeObjectForKey:key];
+    [_recentKeys removeObject:key];
+    
+    for (NSString *path in [_fileKeys allKeysForObject:key]) {
+        [_fileKeys removeObjectForKey:path];
+    }
+}
+
+- (void)evictFilePath:(NSString *)path {
+    pthread_mutex_lock(&_mutex);
+    NSString *key = _fileKeys[path];
+    if (key) {
+        [self removeKey:key];
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (void)evictBase64:(NSString *)base64 {
+    NSString *key = SSHKitBase64IdentityKey(base64);
+    
+    pthread_mutex_lock(&_mutex);
+    [self removeKey:key];
+    pthread_mutex_unlock(&_mutex);
+}
+
+- (void)removeAllKeyPairs {
+    pthread_mutex_lock(&_mutex);
+    [_keyPairs removeAllObjects];
+    [_recentKeys removeAllObjects];
+    [_fileKeys removeAllObjects];
+    pthread_mutex_unlock(&_mutex);
+}
+
+@end
@@ -0,0 +1,49 @@
+//
+//  SSHKitTimerWheel.h
+//  SSHKitCore
+//
+
+#import <Foundation/Foundation.h>
+
+@class SSHKitTimerWheel;
+
+/** A pending expiration of a SSHKitTimerWheel */
+@interface SSHKitWheelTimer : NSObject
+
+/** Block won't be called once this returns, even if already due; call it on the timer queue to be sure */
+- (void)cancel;
+
+@property (nonatomic, readonly, getter = isCancelled) BOOL cancelled;
+
+@end
+
+/**
+ Hierarchical timing wheel serving one-shot timers of many owners with a single dispatch timer, for
+ keepalives and deadlines of thousands of sessions.
+
+ Timers are rounded up to tickInterval, all timers due at the same tick for the same queue are fired by one
+ block on that queue. The dispatch timer only wakes at ticks with expirations and once every 256 ticks to
+ move far timers closer, an idle process with long keepalive intervals barely wakes up.
+
+ Four levels of 256, 64, 64 and 64 slots cover 2^26 ticks, later timers fire at that limit.
+ */
+@interface SSHKitTimerWheel : NSObject
+
+/** Wheel of 0.1 second ticks used by sessions */
++ (instancetype)sharedWheel;
+
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval;
+
+@property (nonatomic, readonly) NSTimeInterval tickInterval;
+
+/** Timers scheduled and not yet fired or cancelled */
+@property (nonatomic, readonly) NSUInteger timerCount;
+/** Times the dispatch timer woke up */
+@property (nonatomic, readonly) NSUInteger wakeups;
+/** Timers fired */
+@property (nonatomic, readonly) NSUInteger firedCount;
+
+/** Call block on queue after at least delay seconds */
+- (SSHKitWheelTimer *)scheduleTimerWithDelay:(NSTimeInterval)delay queue:(dispatch_queue_t)queue block:(dispatch_block_t)block;
+
+@end
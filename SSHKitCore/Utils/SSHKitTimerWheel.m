@@ -0,0 +1,298 @@
+//
+//  SSHKitTimerWheel.m
+//  SSHKitCore
+//
+
+#import "SSHKitTimerWheel.h"
+#import <mach/mach_time.h>
+#import <pthread.h>
+
+#define WHEEL_LEVELS        4
+#define WHEEL_ROOT_BITS     8   // 256 slots of one tick
+#define WHEEL_LEVEL_BITS    6   // 64 slots of the whole level below
+#define WHEEL_MAX_DELTA     ((1ull << (WHEEL_ROOT_BITS + WHEEL_LEVEL_BITS * (WHEEL_LEVELS - 1))) - 1)
+
+static NSTimeInterval SSHKitMonotonicTime(void) {
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebase);
+    });
+    
+    return (double)mach_absolute_time() * timebase.numer / timebase.denom / NSEC_PER_SEC;
+}
+
+// first tick covered by level, slots of level below it repeat within one of its slots
+static int SSHKitWheelShift(int level) {
+    return level ? WHEEL_ROOT_BITS + WHEEL_LEVEL_BITS * (level - 1) : 0;
+}
+
+static NSUInteger SSHKitWheelSlot(int level, uint64_t tick) {
+    uint64_t mask = level ? (1 << WHEEL_LEVEL_BITS) - 1 : (1 << WHEEL_ROOT_BITS) - 1;
+    return (NSUInteger)((tick >> SSHKitWheelShift(level)) & mask);
+}
+
+@interface SSHKitWheelTimer () {
+@public
+    uint64_t _expiresAt;            // tick
+    int _level;
+    NSUInteger _slot;
+    BOOL _scheduled;                // in a slot of the wheel
+    BOOL _cancelled;
+    dispatch_queue_t _queue;
+    dispatch_block_t _block;
+    pthread_mutex_t *_mutex;        // of wheel, guards the fields above
+    __weak SSHKitTimerWheel *_wheel;
+}
+
+@end
+
+@interface SSHKitTimerWheel ()
+
+- (void)doUnscheduleTimer:(SSHKitWheelTimer *)timer;
+
+@end
+
+@implementation SSHKitWheelTimer
+
+- (void)cancel {
+    SSHKitTimerWheel *wheel = _wheel;
+    if (!wheel) {
+        return;
+    }
+    
+    pthread_mutex_lock(_mutex);
+    _cancelled = YES;
+    _block = nil;
+    if (_scheduled) {
+        [wheel doUnscheduleTimer:self];
+    }
+    pthread_mutex_unlock(_mutex);
+}
+
+- (BOOL)isCancelled {
+    SSHKitTimerWheel *wheel = _wheel;
+    if (!wheel) {
+        return _cancelled;
+    }
+    
+    pthread_mutex_lock(_mutex);
+    BOOL cancelled = _cancelled;
+    pthread_mutex_unlock(_mutex);
+    
+    return cancelled;
+}
+
+@end
+
+#pragma mark -
+
+@implementation SSHKitTimerWheel {
+    pthread_mutex_t _mutex;
+    
+    dispatch_queue_t _wheelQueue;
+    dispatch_source_t _tickTimer;
+    uint64_t _armedTick;                            // 0 while disarmed
+    
+    NSTimeInterval _startedAt;
+    uint64_t _now;                                  // last tick processed
+    NSArray<NSArray<NSMutableSet *> *> *_levels;
+}
+
++ (instancetype)sharedWheel {
+    static SSHKitTimerWheel *sharedWheel = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedWheel = [[SSHKitTimerWheel alloc] initWithTickInterval:0.1];
+    });
+    return sharedWheel;
+}
+
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval {
+    if ((self = [super init])) {
+        _tickInterval = MAX(tickInterval, 0.001);
+        _startedAt = SSHKitMonotonicTime();
+        
+        NSMutableArray *levels = [NSMutableArray arrayWithCapacity:WHEEL_LEVELS];
+        for (int level = 0; level < WHEEL_LEVELS; level++) {
+            NSUInteger slotCount = 1 << (level ? WHEEL_LEVEL_BITS : WHEEL_ROOT_BITS);
+            NSMutableArray *slots = [NSMutableArray arrayWithCapacity:slotCount];
+            for (NSUInteger i = 0; i < slotCount; i++) {
+                [slots addObject:[NSMutableSet set]];
+            }
+            [levels addObject:slots];
+        }
+        _levels = levels;
+        
+        _wheelQueue = dispatch_queue_create("com.codinn.libssh.timer_wheel", DISPATCH_QUEUE_SERIAL);
+        _tickTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _wheelQueue);
+        
+        __weak SSHKitTimerWheel *weakSelf = self;
+        dispatch_source_set_event_handler(_tickTimer, ^{
+            [weakSelf doTick];
+        });
+        dispatch_source_set_timer(_tickTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(_tickTimer);
+        
+        pthread_mutex_init(&_mutex, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(_tickTimer);
+    pthread_mutex_destroy(&_mutex);
+}
+
+#pragma mark - Scheduling
+
+- (SSHKitWheelTimer *)scheduleTimerWithDelay:(NSTimeInterval)delay queue:(dispatch_queue_t)queue block:(dispatch_block_t)block {
+    NSParameterAssert(queue && block);
+    
+    SSHKitWheelTimer *timer = [[SSHKitWheelTimer alloc] init];
+    timer->_queue = queue;
+    timer->_block = [block copy];
+    timer->_mutex = &_mutex;
+    timer->_wheel = self;
+    
+    pthread_mutex_lock(&_mutex);
+    // round up, a timer never fires early
+    NSTimeInterval due = SSHKitMonotonicTime() - _startedAt + MAX(delay, 0);
+    timer->_expiresAt = (uint64_t)ceil(due / _tickInterval);
+    [self doScheduleTimer:timer earliest:_now + 1];
+    [self doArm];
+    pthread_mutex_unlock(&_mutex);
+    
+    return timer;
+}
+
+// must hold mutex
+- (void)doScheduleTimer:(SSHKitWheelTimer *)timer earliest:(uint64_t)earliest {
+    uint64_t expiresAt = MAX(timer->_expiresAt, earliest);
+    uint64_t delta = MIN(expiresAt - _now, WHEEL_MAX_DELTA);
+    expiresAt = _now + delta;
+    
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ull << SSHKitWheelShift(level + 1))) {
+        level++;
+    }
+    
+    timer->_expiresAt = expiresAt;
+    timer->_level = level;
+    timer->_slot = SSHKitWheelSlot(level, expiresAt);
+    timer->_scheduled = YES;
+    [_levels[level][timer->_slot] addObject:timer];
+    _timerCount++;
+}
+
+// must hold mutex
+- (void)doUnscheduleTimer:(SSHKitWheelTimer *)timer {
+    [_levels[timer->_level][timer->_slot] removeObject:timer];
+    timer->_scheduled = NO;
+    _timerCount--;
+}
+
+#pragma mark - Ticking
+
+// must hold mutex, sleep until the next tick with work: an expiration, or moving a higher level down
+- (void)doArm {
+    uint64_t next = 0;
+    
+    if (_timerCount) {
+        uint64_t boundary = ((_now >> WHEEL_ROOT_BITS) + 1) << WHEEL_ROOT_BITS;
+        for (uint64_t tick = _now + 1; tick <= boundary; tick++) {
+            if (tick == boundary || [_levels[0][SSHKitWheelSlot(0, tick)] count]) {
+                next = tick;
+                break;
+            }
+        }
+    }
+    
+    if (next == _armedTick) {
+        return;
+    }
+    
+    _armedTick = next;
+    if (!next) {
+        dispatch_source_set_timer(_tickTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
+    
+    NSTimeInterval delay = MAX(next * _tickInterval - (SSHKitMonotonicTime() - _startedAt), 0);
+    // leeway of half a tick lets the system batch us with other wakeups
+    dispatch_source_set_timer(_tickTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, (uint64_t)(_tickInterval * NSEC_PER_SEC / 2));
+}
+
+- (void)doTick {
+    NSMapTable<dispatch_queue_t, NSMutableArray *> *due = [NSMapTable strongToStrongObjectsMapTable];
+    
+    pthread_mutex_lock(&_mutex);
+    _wakeups++;
+    _armedTick = 0;
+    
+    uint64_t target = (uint64_t)floor((SSHKitMonotonicTime() - _startedAt) / _tickInterval);
+    while (_now < target) {
+        _now++;
+        [self doCascade];
+        
+        NSMutableSet *slot = _levels[0][SSHKitWheelSlot(0, _now)];
+        for (SSHKitWheelTimer *timer in slot) {
+            timer->_scheduled = NO;
+            
+            NSMutableArray *timers = [due objectForKey:timer->_queue];
+            if (!timers) {
+                timers = [@[] mutableCopy];
+                [due setObject:timers forKey:timer->_queue];
+            }
+            [timers addObject:timer];
+        }
+        _timerCount -= slot.count;
+        _firedCount += slot.count;
+        [slot removeAllObjects];
+    }
+    
+    [self doArm];
+    pthread_mutex_unlock(&_mutex);
+    
+    // one block per queue for everything due at once, wheel is kept alive for the mutex of its timers
+    SSHKitTimerWheel *wheel = self;
+    for (dispatch_queue_t queue in due) {
+        NSArray *timers = [due objectForKey:queue];
+        dispatch_async(queue, ^{ @autoreleasepool {
+            (void)wheel;
+            for (SSHKitWheelTimer *timer in timers) {
+                pthread_mutex_lock(timer->_mutex);
+                dispatch_block_t block = timer->_cancelled ? nil : timer->_block;
+                timer->_block = nil;
+                pthread_mutex_unlock(timer->_mutex);
+                
+                if (block) {
+                    block();
+                }
+            }
+        }});
+    }
+}
+
+// must hold mutex, _now just advanced, move timers of higher levels whose slot starts now down
+- (void)doCascade {
+    int top = 0;
+    while (top < WHEEL_LEVELS - 1 && !(_now & ((1ull << SSHKitWheelShift(top + 1)) - 1))) {
+        top++;
+    }
+    
+    // highest first, its timers may land in a slot of the level below that starts now too
+    for (int level = top; level > 0; level--) {
+        NSMutableSet *slot = _levels[level][SSHKitWheelSlot(level, _now)];
+        NSArray *timers = [slot allObjects];
+        [slot removeAllObjects];
+        _timerCount -= timers.count;
+        
+        // timers due right now land in the root slot processed next
+        for (SSHKitWheelTimer *timer in timers) {
+            [self doScheduleTimer:timer earliest:_now];
+        }
+    }
+}
+
+@end
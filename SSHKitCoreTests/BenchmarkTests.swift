@@ -0,0 +1,486 @@
+//
+//  BenchmarkTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+private let benchmarkEnvironment = NSProcessInfo.processInfo().environment
+
+/// Appends one JSON object per measurement to $SSHKIT_BENCHMARK_OUTPUT, see ssh/runBenchmark.sh
+class BenchmarkRecorder {
+    let outputPath = benchmarkEnvironment["SSHKIT_BENCHMARK_OUTPUT"]
+
+    func record(name: String, value: Double, unit: String) {
+        print(String(format: "benchmark %@: %.3f %@", name, value, unit))
+
+        guard let path = outputPath else {
+            return
+        }
+
+        let result: [String: AnyObject] = ["name": name, "value": value, "unit": unit]
+        guard let data = try? NSJSONSerialization.dataWithJSONObject(result, options: []) else {
+            return
+        }
+
+        let fileManager = NSFileManager.defaultManager()
+        if !fileManager.fileExistsAtPath(path) {
+            fileManager.createFileAtPath(path, contents: nil, attributes: nil)
+        }
+
+        if let handle = NSFileHandle(forWritingAtPath: path) {
+            handle.seekToEndOfFile()
+            handle.writeData(data)
+            handle.writeData("\n".dataUsingEncoding(NSUTF8StringEncoding)!)
+            handle.closeFile()
+        }
+    }
+}
+
+/// Throughput and latency benchmarks, only run when $SSHKIT_BENCHMARK is set
+class BenchmarkTests: SessionTestCase, SSHKitShellChannelDelegate {
+    private let enabled = benchmarkEnvironment["SSHKIT_BENCHMARK"] != nil
+    private let recorder = BenchmarkRecorder()
+
+    private let echoHost = "127.0.0.1"
+    private let echoPort = 6010
+    let echoServer = EchoServer(port: 6010)
+
+    private var openExpectation: XCTestExpectation?
+    private var channelsToOpen = 0
+
+    // channel callbacks arrive on session queues
+    private let handlerLock = NSLock()
+    private var dataHandlers = [ObjectIdentifier: (NSData) -> Void]()
+    private var closeHandlers = [ObjectIdentifier: () -> Void]()
+
+    override func setUp() {
+        super.setUp()
+        if enabled {
+            echoServer.start()
+        }
+    }
+
+    override func tearDown() {
+        if enabled {
+            echoServer.stop()
+        }
+        super.tearDown()
+    }
+
+    // MARK: - helper function
+    func megabytesPerSecond(bytes: Int, seconds: NSTimeInterval) -> Double {
+        return Double(bytes) / 1048576.0 / max(seconds, 0.000001)
+    }
+
+    func waitForGroup(group: dispatch_group_t, timeout: NSTimeInterval) {
+        let result = dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, Int64(timeout * Double(NSEC_PER_SEC))))
+        XCTAssertEqual(result, 0, "Timed out")
+    }
+
+    func waitForOpen(count: Int, open: () -> Void) {
+        openExpectation = expectationWithDescription("Open \(count) channels")
+        channelsToOpen = count
+        open()
+
+        waitForExpectationsWithTimeout(30) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+    }
+
+    func setDataHandler(channel: SSHKitChannel, handler: ((NSData) -> Void)?) {
+        handlerLock.lock()
+        dataHandlers[ObjectIdentifier(channel)] = handler
+        handlerLock.unlock()
+    }
+
+    func setCloseHandler(channel: SSHKitChannel, handler: (() -> Void)?) {
+        handlerLock.lock()
+        closeHandlers[ObjectIdentifier(channel)] = handler
+        handlerLock.unlock()
+    }
+
+    func openDirectChannel(session: SSHKitSession) -> SSHKitDirectChannel {
+        var channel: SSHKitDirectChannel?
+        waitForOpen(1) {
+            channel = session.openDirectChannelWithTargetHost(self.echoHost, port: UInt(self.echoPort), delegate: self)
+        }
+        return channel!
+    }
+
+    func openSFTPChannel(session: SSHKitSession) -> SSHKitSFTPChannel {
+        var channel: SSHKitSFTPChannel?
+        waitForOpen(1) {
+            channel = session.openSFTPChannel(self)
+        }
+        return channel!
+    }
+
+    /// Write bytes to echo server and wait for them to come back
+    func startBulkEcho(channel: SSHKitChannel, bytes: Int, group: dispatch_group_t) {
+        let chunk = NSMutableData(length: 1024 * 1024)!
+        var received = 0
+
+        dispatch_group_enter(group)
+        setDataHandler(channel) { data in
+            received += data.length
+            if received >= bytes {
+                self.setDataHandler(channel, handler: nil)
+                dispatch_group_leave(group)
+            }
+        }
+
+        var written = 0
+        while written < bytes {
+            let length = min(chunk.length, bytes - written)
+            channel.writeData(length == chunk.length ? chunk : chunk.subdataWithRange(NSMakeRange(0, length)))
+            written += length
+        }
+    }
+
+    func uploadFile(channel: SSHKitSFTPChannel, path: String, length: Int) throws -> NSTimeInterval {
+        let file = try SSHKitSFTPFile.openFileForWrite(channel, path: path, shouldResume: false, mode: 0o644)
+        let group = dispatch_group_create()
+        var position = 0
+
+        dispatch_group_enter(group)
+        let start = CFAbsoluteTimeGetCurrent()
+        file.asyncWriteFile(0, length: UInt64(length), writeFileBlock: { (buffer, bufferLength) -> Int32 in
+            let chunkLength = min(Int(bufferLength), length - position)
+            memset(buffer, 0x5a, chunkLength)
+            position += chunkLength
+            return Int32(chunkLength)
+            }, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+            }, fileTransferSuccessBlock: {
+                dispatch_group_leave(group)
+            }, fileTransferFailBlock: { (error) in
+                XCTFail(error.description)
+                dispatch_group_leave(group)
+        })
+
+        waitForGroup(group, timeout: 300)
+        let elapsed = CFAbsoluteTimeGetCurrent() - start
+        file.close()
+
+        return elapsed
+    }
+
+    func downloadFile(channel: SSHKitSFTPChannel, path: String) throws -> NSTimeInterval {
+        let file = try SSHKitSFTPFile.openFile(channel, path: path)
+        let group = dispatch_group_create()
+
+        dispatch_group_enter(group)
+        let start = CFAbsoluteTimeGetCurrent()
+        file.asyncReadFile(0, readFileBlock: { (buffer, bufferLength) in
+            }, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+            }, fileTransferSuccessBlock: {
+                dispatch_group_leave(group)
+            }, fileTransferFailBlock: { (error) in
+                XCTFail(error.description)
+                dispatch_group_leave(group)
+        })
+
+        waitForGroup(group, timeout: 300)
+        let elapsed = CFAbsoluteTimeGetCurrent() - start
+        file.close()
+
+        return elapsed
+    }
+
+    func runJob(start: (SSHKitSFTPTransferJobCompletionBlock) -> SSHKitSFTPTransferJob) -> SSHKitSFTPTransferJob {
+        let expectation = expectationWithDescription("Transfer Job Finished")
+        let job = start({ (job) in
+            expectation.fulfill()
+        })
+
+        waitForExpectationsWithTimeout(300) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+
+        return job
+    }
+
+    // MARK: - test
+    func testConnectAndAuthenticate() {
+        guard enabled else {
+            return
+        }
+
+        let iterations = 10
+        let total = SSHKitLatencyHistogram()
+        var phases = [String: Double]()
+
+        do {
+            for _ in 0..<iterations {
+                let start = CFAbsoluteTimeGetCurrent()
+                let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+                total.recordValue(CFAbsoluteTimeGetCurrent() - start)
+
+                for (phase, duration) in session.metrics().handshakeDurations {
+                    phases[phase] = (phases[phase] ?? 0) + duration.doubleValue
+                }
+                session.disconnect()
+            }
+        } catch let error as NSError {
+            XCTFail(error.description)
+            return
+        }
+
+        recorder.record("connect.total.mean", value: total.mean * 1000, unit: "ms")
+        recorder.record("connect.total.p99", value: total.valueAtPercentile(99) * 1000, unit: "ms")
+        for (phase, duration) in phases {
+            recorder.record("connect.\(phase).mean", value: duration / Double(iterations) * 1000, unit: "ms")
+        }
+    }
+
+    func testDirectChannelEchoLatency() {
+        guard enabled else {
+            return
+        }
+
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let channel = openDirectChannel(session)
+            let packet = NSMutableData(length: 64)!
+            let roundTrips = 1000
+            let latency = SSHKitLatencyHistogram()
+            let group = dispatch_group_create()
+
+            var received = 0
+            var sentAt = CFAbsoluteTimeGetCurrent()
+
+            dispatch_group_enter(group)
+            setDataHandler(channel) { data in
+                received += data.length
+                if received < packet.length {
+                    return
+                }
+
+                received -= packet.length
+                latency.recordValue(CFAbsoluteTimeGetCurrent() - sentAt)
+
+                if latency.count == UInt(roundTrips) {
+                    dispatch_group_leave(group)
+                } else {
+                    sentAt = CFAbsoluteTimeGetCurrent()
+                    channel.writeData(packet)
+                }
+            }
+
+            channel.writeData(packet)
+            waitForGroup(group, timeout: 60)
+
+            recorder.record("echo.latency.p50", value: latency.valueAtPercentile(50) * 1000000, unit: "us")
+            recorder.record("echo.latency.p99", value: latency.valueAtPercentile(99) * 1000000, unit: "us")
+            recorder.record("echo.latency.mean", value: latency.mean * 1000000, unit: "us")
+
+            session.disconnect()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testDirectChannelThroughput() {
+        guard enabled else {
+            return
+        }
+
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let channel = openDirectChannel(session)
+            let bytes = 64 * 1024 * 1024
+            let group = dispatch_group_create()
+
+            let start = CFAbsoluteTimeGetCurrent()
+            startBulkEcho(channel, bytes: bytes, group: group)
+            waitForGroup(group, timeout: 300)
+
+            recorder.record("echo.throughput", value: megabytesPerSecond(bytes, seconds: CFAbsoluteTimeGetCurrent() - start), unit: "MB/s")
+
+            session.disconnect()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testShellOutputThroughput() {
+        guard enabled else {
+            return
+        }
+
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            var shellChannel: SSHKitShellChannel?
+            waitForOpen(1) {
+                shellChannel = session.openShellChannelWithTerminalType("xterm", columns: 80, rows: 24, delegate: self)
+            }
+
+            let channel = shellChannel!
+            let bytes = 32 * 1024 * 1024
+            let group = dispatch_group_create()
+            var received = 0
+
+            dispatch_group_enter(group)
+            setDataHandler(channel) { data in
+                received += data.length
+            }
+            setCloseHandler(channel) {
+                dispatch_group_leave(group)
+            }
+
+            // shell exits when output is done, which closes the channel
+            let start = CFAbsoluteTimeGetCurrent()
+            channel.writeData("yes 0123456789abcdef | head -c \(bytes); exit\n".dataUsingEncoding(NSUTF8StringEncoding)!)
+            waitForGroup(group, timeout: 300)
+
+            XCTAssertGreaterThanOrEqual(received, bytes)
+            recorder.record("shell.output.throughput", value: megabytesPerSecond(received, seconds: CFAbsoluteTimeGetCurrent() - start), unit: "MB/s")
+
+            session.disconnect()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testSFTPFileSizes() {
+        guard enabled else {
+            return
+        }
+
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let channel = openSFTPChannel(session)
+            let path = "./benchmark.bin"
+
+            for (label, length) in [("64KB", 64 * 1024), ("1MB", 1024 * 1024), ("16MB", 16 * 1024 * 1024), ("128MB", 128 * 1024 * 1024)] {
+                let uploadTime = try uploadFile(channel, path: path, length: length)
+                recorder.record("sftp.upload.\(label)", value: megabytesPerSecond(length, seconds: uploadTime), unit: "MB/s")
+
+                let downloadTime = try downloadFile(channel, path: path)
+                recorder.record("sftp.download.\(label)", value: megabytesPerSecond(length, seconds: downloadTime), unit: "MB/s")
+            }
+
+            channel.unlink(path)
+            session.disconnect()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testSFTPManySmallFiles() {
+        guard enabled else {
+            return
+        }
+
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let channel = openSFTPChannel(session)
+            let scheduler = SSHKitSFTPTransferScheduler(channels: [channel])
+
+            let fileCount = 500
+            let fileLength = 4096
+            let remotePath = "./benchmark_small"
+            let localPath = (NSTemporaryDirectory() as NSString).stringByAppendingPathComponent(NSUUID().UUIDString)
+            let downloadPath = (localPath as NSString).stringByAppendingPathComponent("download")
+
+            let fileManager = NSFileManager.defaultManager()
+            try fileManager.createDirectoryAtPath(localPath, withIntermediateDirectories: true, attributes: nil)
+            let content = NSMutableData(length: fileLength)!
+            for index in 0..<fileCount {
+                content.writeToFile((localPath as NSString).stringByAppendingPathComponent("\(index)"), atomically: false)
+            }
+
+            var start = CFAbsoluteTimeGetCurrent()
+            var job = runJob { (completionBlock) in
+                scheduler.uploadDirectory(localPath, toPath: remotePath, progressBlock: nil, completionBlock: completionBlock)
+            }
+            XCTAssertEqual(job.failedItems.count, 0)
+            recorder.record("sftp.small.upload", value: Double(fileCount) / (CFAbsoluteTimeGetCurrent() - start), unit: "files/s")
+
+            start = CFAbsoluteTimeGetCurrent()
+            job = runJob { (completionBlock) in
+                scheduler.downloadDirectory(remotePath, toPath: downloadPath, progressBlock: nil, completionBlock: completionBlock)
+            }
+            XCTAssertEqual(job.failedItems.count, 0)
+            recorder.record("sftp.small.download", value: Double(fileCount) / (CFAbsoluteTimeGetCurrent() - start), unit: "files/s")
+
+            for index in 0..<fileCount {
+                channel.unlink("\(remotePath)/\(index)")
+            }
+            channel.rmdir(remotePath)
+            _ = try? fileManager.removeItemAtPath(localPath)
+
+            session.disconnect()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testConcurrentSessionScaling() {
+        guard enabled else {
+            return
+        }
+
+        let bytesPerSession = 16 * 1024 * 1024
+
+        do {
+            for count in [1, 2, 4, 8] {
+                var sessions = [SSHKitSession]()
+                var channels = [SSHKitDirectChannel]()
+                for _ in 0..<count {
+                    let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+                    sessions.append(session)
+                    channels.append(openDirectChannel(session))
+                }
+
+                let group = dispatch_group_create()
+                let start = CFAbsoluteTimeGetCurrent()
+                for channel in channels {
+                    startBulkEcho(channel, bytes: bytesPerSession, group: group)
+                }
+                waitForGroup(group, timeout: 300)
+
+                recorder.record("scaling.sessions.\(count)", value: megabytesPerSecond(bytesPerSession * count, seconds: CFAbsoluteTimeGetCurrent() - start), unit: "MB/s")
+
+                for session in sessions {
+                    session.disconnect()
+                }
+            }
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    // MARK: - SSHKitChannelDelegate
+
+    func channelDidOpen(channel: SSHKitChannel) {
+        channelsToOpen -= 1
+        if channelsToOpen == 0 {
+            openExpectation?.fulfill()
+            openExpectation = nil
+        }
+    }
+
+    func channel(channel: SSHKitChannel, didReadStdoutData data: NSData) {
+        handlerLock.lock()
+        let handler = dataHandlers[ObjectIdentifier(channel)]
+        handlerLock.unlock()
+
+        handler?(data)
+    }
+
+    func channel(channel: SSHKitChannel, didReadStderrData data: NSData) {
+    }
+
+    func channelDidClose(channel: SSHKitChannel, withError error: NSError) {
+        handlerLock.lock()
+        let handler = closeHandlers.removeValueForKey(ObjectIdentifier(channel))
+        handlerLock.unlock()
+
+        handler?()
+    }
+}
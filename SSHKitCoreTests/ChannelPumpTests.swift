@@ -0,0 +1,163 @@
+//
+//  ChannelPumpTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class ChannelPumpTests: SessionTestCase {
+    private let echoHost = "127.0.0.1"
+    private let echoPort = 6007
+    let echoServer = EchoServer(port: 6007)
+
+    override func setUp() {
+        super.setUp()
+        echoServer.start()
+    }
+
+    override func tearDown() {
+        echoServer.stop()
+        super.tearDown()
+    }
+
+    // MARK: - helper function
+    func socketPair() -> (Int32, Int32) {
+        var fds: [Int32] = [-1, -1]
+        XCTAssertEqual(socketpair(AF_UNIX, SOCK_STREAM, 0, &fds), 0)
+        return (fds[0], fds[1])
+    }
+
+    // MARK: - test
+    func testPumpEchoesDataAndPassesEOF() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let channel = session.openDirectChannelWithTargetHost(echoHost, port: UInt(echoPort), delegate: nil)
+            let (tunnelFd, appFd) = socketPair()
+
+            let pump = SSHKitChannelPump(channel: channel, fileDescriptor: tunnelFd)
+            let finishExpectation = expectationWithDescription("Pump finished")
+            pump.startWithCompletion { error in
+                XCTAssertNil(error)
+                finishExpectation.fulfill()
+            }
+
+            // more than socket buffers and channel watermarks hold, both directions have to throttle
+            let length = 8 * 1024 * 1024
+            var sent = [UInt8](count: length, repeatedValue: 0)
+            for i in 0..<length {
+                sent[i] = UInt8(truncatingBitPattern: i &* 31)
+            }
+
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)) {
+                var offset = 0
+                while offset < length {
+                    let wrote = sent.withUnsafeBufferPointer { write(appFd, $0.baseAddress + offset, min(64 * 1024, length - offset)) }
+                    if wrote <= 0 {
+                        break
+                    }
+                    offset += wrote
+                }
+                shutdown(appFd, SHUT_WR)
+            }
+
+            let readExpectation = expectationWithDescription("Read echo until EOF")
+            var received = [UInt8]()
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)) {
+                var buffer = [UInt8](count: 64 * 1024, repeatedValue: 0)
+                while true {
+                    let count = read(appFd, &buffer, buffer.count)
+                    if count <= 0 {
+                        break
+                    }
+                    received.appendContentsOf(buffer[0..<count])
+                }
+                readExpectation.fulfill()
+            }
+
+            waitForExpectationsWithTimeout(30) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+            close(appFd)
+
+            XCTAssertEqual(received.count, length)
+            XCTAssert(received == sent)
+            XCTAssertEqual(pump.bytesToChannel, UInt64(length))
+            XCTAssertEqual(pump.bytesFromChannel, UInt64(length))
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testRemoteCloseWhileSocketStalledKeepsData() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            // less than the initial window, remote sends it all, then EOF and close, while nobody reads
+            let channel = session.openExecChannelWithCommand("seq 1 80000", delegate: nil)
+            let (tunnelFd, appFd) = socketPair()
+
+            let pump = SSHKitChannelPump(channel: channel, fileDescriptor: tunnelFd)
+            pump.maxPendingBytes = 64 * 1024
+            let finishExpectation = expectationWithDescription("Pump finished")
+            pump.startWithCompletion { error in
+                XCTAssertNil(error)
+                finishExpectation.fulfill()
+            }
+
+            NSThread.sleepForTimeInterval(3)
+
+            var received = [UInt8]()
+            var buffer = [UInt8](count: 64 * 1024, repeatedValue: 0)
+            while true {
+                let count = read(appFd, &buffer, buffer.count)
+                if count <= 0 {
+                    break
+                }
+                received.appendContentsOf(buffer[0..<count])
+            }
+            close(appFd)
+
+            waitForExpectationsWithTimeout(10) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+
+            let expected = Array((1...80000).map { "\($0)\n" }.joinWithSeparator("").utf8)
+            XCTAssertEqual(received.count, expected.count)
+            XCTAssert(received == expected)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testStopClosesSocket() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let channel = session.openDirectChannelWithTargetHost(echoHost, port: UInt(echoPort), delegate: nil)
+            let (tunnelFd, appFd) = socketPair()
+
+            let pump = SSHKitChannelPump(channel: channel, fileDescriptor: tunnelFd)
+            let finishExpectation = expectationWithDescription("Pump stopped")
+            pump.startWithCompletion { error in
+                XCTAssertEqual(error?.code, SSHKitErrorCode.Stop.rawValue)
+                finishExpectation.fulfill()
+            }
+            pump.stop()
+
+            waitForExpectationsWithTimeout(5) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+
+            // peer of the tunnel sees EOF
+            var byte: UInt8 = 0
+            XCTAssertEqual(read(appFd, &byte, 1), 0)
+            close(appFd)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+}
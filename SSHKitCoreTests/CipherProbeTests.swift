@@ -0,0 +1,46 @@
+//
+//  CipherProbeTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class CipherProbeTests: SessionTestCase {
+    
+    func testProbeOrdersRecommendedAlgorithmsFirst() {
+        let probe = SSHKitCipherProbe()
+        probe.sampleSize = 256 * 1024
+        
+        let ciphers = probe.cipherThroughputs
+        XCTAssertEqual(ciphers.count, 8)
+        XCTAssertEqual(ciphers.filter { !$0.legacy }.count, 3)
+        
+        for (index, throughput) in ciphers.enumerate() {
+            XCTAssertGreaterThan(throughput.megabytesPerSecond, 0, throughput.name)
+            
+            if index > 0 {
+                let previous = ciphers[index - 1]
+                XCTAssert(previous.legacy == throughput.legacy ? previous.megabytesPerSecond >= throughput.megabytesPerSecond : !previous.legacy)
+            }
+        }
+        
+        let macs = probe.macThroughputs
+        XCTAssertEqual(macs.count, 3)
+        XCTAssertEqual(macs.last?.name, "hmac-sha1")
+        
+        XCTAssertEqual(probe.preferredCiphers.componentsSeparatedByString(",").count, 8)
+        XCTAssertEqual(probe.preferredMACs.componentsSeparatedByString(",").count, 3)
+    }
+    
+    func testSessionNegotiatesProbedAlgorithms() {
+        do {
+            let probe = SSHKitCipherProbe.sharedProbe()
+            let _ = try self.launchSessionWithAuthMethod(.Password, user: userForSFA, options: [kVTKitProbeAlgorithmsKey:true])
+            
+            XCTAssertEqual(currentCipher, probe.cipherThroughputs.first?.name)
+            XCTAssertEqual(currentHMAC, probe.macThroughputs.first?.name)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+}
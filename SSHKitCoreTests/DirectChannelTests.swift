@@ -15,8 +15,12 @@ class DirectChannelTests: SessionTestCase, SSHKitChannelDelegate {
     
     private var writeDataCount: Int = 0
     private let writeDataMaxTimes = 100
+    private var highWatermarkCount = 0
+    private var lowWatermarkCount = 0
     private var totoalWroteDataLength: Int = -1
     
+    private var closeError: NSError?
+    
     private let dataWrote = NSMutableData()
     private let dataRead = NSMutableData()
     
@@ -104,6 +108,116 @@ class DirectChannelTests: SessionTestCase, SSHKitChannelDelegate {
         }
     }
     
+    func testCoalescedReadWrite() {
+        do {
+            let channel = try self.openDirectChannelWithTargetHost(echoHost, port: echoPort)
+            XCTAssert(channel.isOpen)
+            
+            // private pool, buffers allocated by other channels do not count
+            let pool = SSHKitBufferPool(bufferSize: 256 * 1024, maxFreeBuffers: 4)
+            channel.receiveBufferPool = pool
+            channel.coalescesReceivedData = true
+            
+            writeExpectation = expectationWithDescription("Channel write data")
+            let data = NSMutableData(length: 1024 * 1024)!
+            for i in 0..<data.length / 4 {
+                var value = UInt32(i)
+                data.replaceBytesInRange(NSMakeRange(i * 4, 4), withBytes: &value)
+            }
+            
+            totoalWroteDataLength = data.length
+            channel.writeData(data)
+            dataWrote.appendData(data)
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            XCTAssertEqual(dataRead, dataWrote)
+            XCTAssertEqual(channel.receivedBytes, UInt64(data.length))
+            
+            // one allocation per packet without coalescing, a packet carries at most 32 KB
+            let megabytes = Double(channel.receivedBytes) / 1048576.0
+            XCTAssertLessThan(Double(channel.receiveAllocationCount) / megabytes, 32.0)
+            
+            // delivered buffers come back to the pool, a few 256 KB buffers carry the whole stream
+            XCTAssertLessThanOrEqual(Double(pool.allocationCount) / megabytes, 3.0)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testMetrics() {
+        do {
+            let channel = try self.openDirectChannelWithTargetHost(echoHost, port: echoPort)
+            XCTAssert(channel.isOpen)
+            
+            writeExpectation = expectationWithDescription("Channel write data")
+            let data = NSMutableData(length: 256 * 1024)!
+            totoalWroteDataLength = data.length
+            channel.writeData(data)
+            dataWrote.appendData(data)
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            let metrics = channel.metrics()
+            XCTAssertEqual(metrics.bytesOut, UInt64(data.length))
+            XCTAssertEqual(metrics.bytesIn, UInt64(data.length))
+            XCTAssertGreaterThanOrEqual(metrics.packetsOut, data.length / 32768)
+            XCTAssertGreaterThan(metrics.packetsIn, 0)
+            XCTAssertEqual(metrics.queuedWriteBytes, 0)
+            
+            let sessionMetrics = channel.session!.metrics()
+            XCTAssertGreaterThanOrEqual(sessionMetrics.bytesOut, metrics.bytesOut)
+            XCTAssertGreaterThan(sessionMetrics.wakeups, 0)
+            XCTAssertNotNil(sessionMetrics.handshakeDurations[SSHKitHandshakePhaseTotalSetup])
+            XCTAssertNotNil(sessionMetrics.handshakeDurations[SSHKitHandshakePhaseAuthenticate])
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testWriteQueueWatermarks() {
+        do {
+            let channel = try self.openDirectChannelWithTargetHost(echoHost, port: echoPort)
+            XCTAssert(channel.isOpen)
+            
+            channel.writeQueueHighWatermark = 64 * 1024
+            channel.writeQueueLowWatermark = 16 * 1024
+            
+            writeExpectation = expectationWithDescription("Channel write data")
+            
+            // back-to-back writes must all be sent, in order
+            let chunkCount = 64
+            totoalWroteDataLength = 16 * 1024 * chunkCount
+            for i in 0..<chunkCount {
+                let chunk = NSMutableData(length: 16 * 1024)!
+                memset(chunk.mutableBytes, Int32(i), chunk.length)
+                channel.writeData(chunk)
+                dataWrote.appendData(chunk)
+            }
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            XCTAssertEqual(dataRead, dataWrote)
+            XCTAssertEqual(channel.queuedWriteBytes, 0)
+            XCTAssertGreaterThan(highWatermarkCount, 0)
+            XCTAssertEqual(highWatermarkCount, lowWatermarkCount)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
     func testClose() {
         do {
             let channel = try self.openDirectChannelWithTargetHost(echoHost, port: echoPort)
@@ -124,6 +238,27 @@ class DirectChannelTests: SessionTestCase, SSHKitChannelDelegate {
         }
     }
     
+    func testOpenChannelClosedOnReconnect() {
+        reconnectsAutomatically = true
+        defer {
+            reconnectsAutomatically = false
+        }
+        
+        do {
+            let channel = try self.openDirectChannelWithTargetHost(echoHost, port: echoPort)
+            XCTAssert(channel.isOpen)
+            
+            // target must not see the rest of a stream on a new TCP connection
+            closeExpectation = expectationWithDescription("Close direct channel")
+            try dropConnectionAndWaitForReconnect(channel.session)
+            
+            XCTAssertFalse(channel.isOpen)
+            XCTAssertNotNil(closeError)
+        } catch let error as NSError {
+            XCTFail(error.localizedDescription)
+        }
+    }
+    
     // MARK: - SSHKitChannelDelegate
     
     func channelDidOpen(channel: SSHKitChannel) {
@@ -134,10 +269,18 @@ class DirectChannelTests: SessionTestCase, SSHKitChannelDelegate {
         writeDataCount += 1
     }
     
+    func channelWriteQueueDidReachHighWatermark(channel: SSHKitChannel) {
+        highWatermarkCount += 1
+    }
+    
+    func channelWriteQueueDidDrainToLowWatermark(channel: SSHKitChannel) {
+        lowWatermarkCount += 1
+    }
+    
     func channel(channel: SSHKitChannel, didReadStdoutData data: NSData) {
         dataRead.appendData(data)
         
-        if writeDataCount == writeDataMaxTimes && dataRead.length >= totoalWroteDataLength {
+        if writeDataCount > 0 && dataRead.length >= totoalWroteDataLength {
             writeExpectation!.fulfill()
         }
     }
@@ -147,6 +290,7 @@ class DirectChannelTests: SessionTestCase, SSHKitChannelDelegate {
     }
 
     func channelDidClose(channel: SSHKitChannel!, withError error: NSError!) {
+        closeError = error
         if let expectation = closeExpectation {
             expectation.fulfill()
         }
@@ -0,0 +1,177 @@
+//
+//  ExecTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class ExecTests: SessionTestCase, SSHKitChannelDelegate {
+    private var closeExpectation: XCTestExpectation?
+
+    private let stdoutData = NSMutableData()
+    private let stderrData = NSMutableData()
+    private var exitStatus = -1
+
+    var pool: SSHKitSessionPool!
+
+    override func setUp() {
+        super.setUp()
+
+        let keyPath = NSBundle(forClass: self.dynamicType).pathForResource(identity, ofType: "")!
+        let keyBase64 = try! String(contentsOfFile: keyPath, encoding: NSUTF8StringEncoding)
+
+        pool = SSHKitSessionPool(authenticateBlock: { (session, methods, partialSuccess) in
+            let keyPair = try! SSHKitKeyPair(fromBase64: keyBase64, withAskPass: nil)
+            session.authenticateWithKeyPair(keyPair)
+        }, trustHostKeyBlock: { (session, hostKey) in
+            return true
+        })
+    }
+
+    override func tearDown() {
+        pool.drain()
+        super.tearDown()
+    }
+
+    // MARK: - helper function
+    func run(runner: SSHKitExecRunner, hosts: [String], command: String) -> (streamed: [SSHKitExecResult], results: [SSHKitExecResult]) {
+        let expectation = expectationWithDescription("Run \(command)")
+        var streamed = [SSHKitExecResult]()
+        var results = [SSHKitExecResult]()
+
+        runner.resultBlock = { result in
+            streamed.append(result)
+        }
+        runner.runCommand(command, onHosts: hosts, port: sshPort, user: userForSFA, options: [:]) { allResults in
+            results = allResults
+            expectation.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(20) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+
+        return (streamed, results)
+    }
+
+    // MARK: - test
+    func testExecChannelSeparatesStreamsAndExitStatus() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+
+            closeExpectation = expectationWithDescription("Command exits")
+            let channel = session.openExecChannelWithCommand("echo out; echo err >&2; exit 3", delegate: self)
+
+            waitForExpectationsWithTimeout(5) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+
+            XCTAssertEqual(String(data: stdoutData, encoding: NSUTF8StringEncoding), "out\n")
+            XCTAssertEqual(String(data: stderrData, encoding: NSUTF8StringEncoding), "err\n")
+            XCTAssertEqual(exitStatus, 3)
+            XCTAssertEqual(channel.exitStatus, 3)
+
+            try disconnectSessionAndWait(session)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testRunnerStreamsEveryResult() {
+        let runner = SSHKitExecRunner(sessionPool: pool)
+        runner.maxConcurrentHosts = 2
+
+        let (streamed, results) = run(runner, hosts: [sshHost, sshHost, sshHost], command: "echo hello")
+
+        XCTAssertEqual(results.count, 3)
+        XCTAssertEqual(streamed.map { ObjectIdentifier($0) }, results.map { ObjectIdentifier($0) })
+
+        for result in results {
+            XCTAssertNil(result.error)
+            XCTAssertEqual(result.exitStatus, 0)
+            XCTAssertEqual(String(data: result.stdoutData, encoding: NSUTF8StringEncoding), "hello\n")
+        }
+
+        XCTAssertEqual(runner.runningCount, 0)
+    }
+
+    func testRunnerCapsOutput() {
+        let runner = SSHKitExecRunner(sessionPool: pool)
+        runner.maxOutputLength = 4
+
+        let (_, results) = run(runner, hosts: [sshHost], command: "echo 0123456789; echo 0123456789 >&2")
+
+        XCTAssertEqual(results.count, 1)
+        XCTAssertEqual(String(data: results[0].stdoutData, encoding: NSUTF8StringEncoding), "0123")
+        XCTAssertEqual(String(data: results[0].stderrData, encoding: NSUTF8StringEncoding), "0123")
+        XCTAssert(results[0].stdoutTruncated)
+        XCTAssert(results[0].stderrTruncated)
+        XCTAssertEqual(results[0].exitStatus, 0)
+    }
+
+    func testRunnerHostTimeout() {
+        let runner = SSHKitExecRunner(sessionPool: pool)
+        runner.hostTimeout = 1
+
+        // slow host finishes last
+        let (_, results) = run(runner, hosts: [nonRoutableIP, sshHost], command: "echo hello")
+
+        XCTAssertEqual(results.count, 2)
+        XCTAssertEqual(results[0].host, sshHost)
+        XCTAssertNil(results[0].error)
+        XCTAssertEqual(results[1].host, nonRoutableIP)
+        XCTAssertEqual(results[1].error?.code, SSHKitErrorCode.Timeout.rawValue)
+        XCTAssertEqual(results[1].exitStatus, -1)
+    }
+
+    func testRunnerHostTimeoutKeepsSlotUntilConnectEnds() {
+        let runner = SSHKitExecRunner(sessionPool: pool)
+        runner.maxConcurrentHosts = 1
+        runner.hostTimeout = 1
+        pool.connectTimeout = 3
+        pool.maxConnectFailures = 1
+
+        // next host waits for the pool to give up on the slow one, not for hostTimeout only
+        let startedAt = NSDate()
+        let (_, results) = run(runner, hosts: [nonRoutableIP, sshHost], command: "echo hello")
+
+        XCTAssertEqual(results.count, 2)
+        XCTAssertEqual(results[0].host, nonRoutableIP)
+        XCTAssertEqual(results[0].error?.code, SSHKitErrorCode.Timeout.rawValue)
+        XCTAssertEqual(results[1].host, sshHost)
+        XCTAssertNil(results[1].error)
+        XCTAssertGreaterThanOrEqual(NSDate().timeIntervalSinceDate(startedAt), 3)
+    }
+
+    func testRunnerTimeoutKeepsOutputOfRunningCommand() {
+        let runner = SSHKitExecRunner(sessionPool: pool)
+        runner.hostTimeout = 2
+
+        let (_, results) = run(runner, hosts: [sshHost], command: "echo started; sleep 10")
+
+        XCTAssertEqual(results.count, 1)
+        XCTAssertEqual(results[0].error?.code, SSHKitErrorCode.Timeout.rawValue)
+        XCTAssertEqual(String(data: results[0].stdoutData, encoding: NSUTF8StringEncoding), "started\n")
+    }
+
+    // MARK: - SSHKitChannelDelegate
+    func channel(channel: SSHKitChannel, didReadStdoutData data: NSData) {
+        stdoutData.appendData(data)
+    }
+
+    func channel(channel: SSHKitChannel, didReadStderrData data: NSData) {
+        stderrData.appendData(data)
+    }
+
+    func channel(channel: SSHKitChannel, didExitWithStatus status: Int) {
+        exitStatus = status
+    }
+
+    func channelDidClose(channel: SSHKitChannel, withError error: NSError) {
+        closeExpectation?.fulfill()
+    }
+}
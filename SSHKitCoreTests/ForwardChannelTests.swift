@@ -173,7 +173,7 @@ class ForwardChannelTests: SessionTestCase, SSHKitChannelDelegate {
     func channel(channel: SSHKitChannel, didReadStdoutData data: NSData) {
         dataRead.appendData(data)
         
-        if writeDataCount == writeDataMaxTimes && dataRead.length == totoalWroteDataLength {
+        if writeDataCount > 0 && dataRead.length == totoalWroteDataLength {
             writeExpectation!.fulfill()
         }
     }
@@ -146,4 +146,97 @@ class KeyPairTests: XCTestCase {
     }
     
     // TODO: Add tests for base64 api
+    
+    // MARK: - Identity Cache
+    
+    func testIdentityCacheSharesParsedKeyPair() {
+        let path = NSBundle(forClass: self.dynamicType).pathForResource("id_ed25519_password", ofType: "");
+        let cache = SSHKitIdentityCache(countLimit: 4)
+        var asked = 0
+        let block :SSHKitAskPassBlock = {
+            asked += 1
+            return "lollipop"
+        }
+        
+        do {
+            let first = try cache.keyPairFromFilePath(path, withAskPass: block)
+            let second = try cache.keyPairFromFilePath(path, withAskPass: block)
+            XCTAssert(first === second)
+            XCTAssertEqual(asked, 1)
+            XCTAssertEqual(cache.hitCount, 1)
+            XCTAssertEqual(cache.missCount, 1)
+            
+            cache.evictFilePath(path)
+            XCTAssertEqual(cache.count, 0)
+            
+            let third = try cache.keyPairFromFilePath(path, withAskPass: block)
+            XCTAssert(first !== third)
+            XCTAssertEqual(asked, 2)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testIdentityCacheParsesChangedFileAgain() {
+        let source = NSBundle(forClass: self.dynamicType).pathForResource("id_rsa", ofType: "")!
+        let path = (NSTemporaryDirectory() as NSString).stringByAppendingPathComponent("identity-cache-\(NSUUID().UUIDString)")
+        let cache = SSHKitIdentityCache(countLimit: 4)
+        
+        defer {
+            let _ = try? NSFileManager.defaultManager().removeItemAtPath(path)
+        }
+        
+        do {
+            try NSFileManager.defaultManager().copyItemAtPath(source, toPath: path)
+            let first = try cache.keyPairFromFilePath(path, withAskPass: nil)
+            
+            try NSFileManager.defaultManager().setAttributes([NSFileModificationDate : NSDate(timeIntervalSinceNow: 60)], ofItemAtPath: path)
+            let second = try cache.keyPairFromFilePath(path, withAskPass: nil)
+            XCTAssert(first !== second)
+            XCTAssertEqual(cache.count, 1)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testIdentityCacheSkipsFailedParse() {
+        let path = NSBundle(forClass: self.dynamicType).pathForResource("id_rsa_password", ofType: "")!
+        let base64 = try! String(contentsOfFile: path, encoding: NSUTF8StringEncoding)
+        let cache = SSHKitIdentityCache(countLimit: 4)
+        
+        do {
+            let _ = try cache.keyPairFromBase64(base64, withAskPass: { return "incorrect-passphrase" })
+            XCTFail("Key pair initialization should fail!")
+        } catch let error as NSError {
+            XCTAssertEqual(SSHKitErrorCode.IdentityParseFailure.rawValue, error.code, error.description)
+        }
+        XCTAssertEqual(cache.count, 0)
+        
+        do {
+            let first = try cache.keyPairFromBase64(base64, withAskPass: { return "lollipop" })
+            let second = try cache.keyPairFromBase64(base64, withAskPass: nil)
+            XCTAssert(first === second)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testIdentityCacheEvictsLeastRecentlyUsed() {
+        let bundle = NSBundle(forClass: self.dynamicType)
+        let cache = SSHKitIdentityCache(countLimit: 2)
+        
+        do {
+            let rsa = try cache.keyPairFromFilePath(bundle.pathForResource("id_rsa", ofType: ""), withAskPass: nil)
+            let _ = try cache.keyPairFromFilePath(bundle.pathForResource("id_ecdsa", ofType: ""), withAskPass: nil)
+            let _ = try cache.keyPairFromFilePath(bundle.pathForResource("id_rsa", ofType: ""), withAskPass: nil)
+            let _ = try cache.keyPairFromFilePath(bundle.pathForResource("id_ed25519", ofType: ""), withAskPass: nil)
+            
+            // ecdsa was least recently used
+            XCTAssertEqual(cache.count, 2)
+            let again = try cache.keyPairFromFilePath(bundle.pathForResource("id_rsa", ofType: ""), withAskPass: nil)
+            XCTAssert(rsa === again)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
 }
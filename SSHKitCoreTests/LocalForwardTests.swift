@@ -0,0 +1,243 @@
+//
+//  LocalForwardTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class LocalForwardTests: SessionTestCase {
+    private let echoHost = "127.0.0.1"
+    private let echoPort = 6007
+    let echoServer = EchoServer(port: 6007)
+
+    override func setUp() {
+        super.setUp()
+        echoServer.start()
+    }
+
+    override func tearDown() {
+        echoServer.stop()
+        super.tearDown()
+    }
+
+    // MARK: - helper function
+    func connectToPort(port: UInt16) -> Int32 {
+        let fd = socket(AF_INET, SOCK_STREAM, 0)
+        var address = sockaddr_in()
+        address.sin_family = sa_family_t(AF_INET)
+        address.sin_port = port.bigEndian
+        address.sin_addr.s_addr = inet_addr("127.0.0.1")
+
+        let rc = withUnsafePointer(&address) { connect(fd, UnsafePointer($0), socklen_t(sizeof(sockaddr_in))) }
+        XCTAssertEqual(rc, 0)
+
+        // a stalled tunnel fails the test instead of hanging it
+        var timeout = timeval(tv_sec: 5, tv_usec: 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, socklen_t(sizeof(timeval)))
+        return fd
+    }
+
+    func sendBytes(fd: Int32, _ bytes: [UInt8]) {
+        XCTAssertEqual(write(fd, bytes, bytes.count), bytes.count)
+    }
+
+    func receiveBytes(fd: Int32, count: Int) -> [UInt8] {
+        var received = [UInt8]()
+        var buffer = [UInt8](count: count, repeatedValue: 0)
+        while received.count < count {
+            let length = read(fd, &buffer, count - received.count)
+            if length <= 0 {
+                break
+            }
+            received.appendContentsOf(buffer[0..<length])
+        }
+        return received
+    }
+
+    func assertClosedByForward(fd: Int32) {
+        // end of stream, not the receive timeout
+        var buffer = [UInt8](count: 64, repeatedValue: 0)
+        var length = read(fd, &buffer, buffer.count)
+        while length > 0 {
+            length = read(fd, &buffer, buffer.count)
+        }
+        XCTAssertEqual(length, 0)
+    }
+
+    func assertEchoes(fd: Int32) {
+        let message = Array("hello".utf8)
+        sendBytes(fd, message)
+        XCTAssertEqual(receiveBytes(fd, count: message.count), message)
+    }
+
+    // MARK: - test
+    func testStaticForwardEchoes() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let forward = try session.startLocalForwardOnAddress(nil, port: 0, targetHost: echoHost, targetPort: UInt(echoPort))
+            XCTAssert(forward.listening)
+            XCTAssertNotEqual(forward.listenPort, 0)
+
+            // channels of all connections open side by side
+            let fds = (0..<8).map { _ in connectToPort(forward.listenPort) }
+            for fd in fds {
+                assertEchoes(fd)
+                close(fd)
+            }
+
+            let metrics = forward.metrics()
+            XCTAssertEqual(metrics.totalConnections, 8)
+            XCTAssertEqual(metrics.failedConnections, 0)
+            XCTAssertEqual(metrics.bytesToRemote, 40)
+            XCTAssertEqual(metrics.bytesFromRemote, 40)
+            XCTAssertEqual(metrics.openLatency.count, 8)
+
+            forward.close()
+            try disconnectSessionAndWait(session)
+            XCTAssertFalse(forward.listening)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testSOCKS5Connect() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let forward = try session.startSOCKSProxyOnAddress(nil, port: 0)
+            let fd = connectToPort(forward.listenPort)
+
+            sendBytes(fd, [5, 1, 0])
+            XCTAssertEqual(receiveBytes(fd, count: 2), [5, 0])
+
+            let port = UInt16(echoPort)
+            sendBytes(fd, [5, 1, 0, 1, 127, 0, 0, 1, UInt8(port >> 8), UInt8(port & 0xff)])
+            let reply = receiveBytes(fd, count: 10)
+            XCTAssertEqual(reply.count, 10)
+            XCTAssertEqual(reply[1], 0)
+
+            assertEchoes(fd)
+            close(fd)
+
+            try disconnectSessionAndWait(session)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testSOCKS4aConnectAndUnsupportedCommand() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let forward = try session.startSOCKSProxyOnAddress(nil, port: 0)
+            let port = UInt16(echoPort)
+
+            // host name after the empty user id, request and data in one write
+            let fd = connectToPort(forward.listenPort)
+            sendBytes(fd, [4, 1, UInt8(port >> 8), UInt8(port & 0xff), 0, 0, 0, 1, 0] + Array(echoHost.utf8) + [0] + Array("hi".utf8))
+            XCTAssertEqual(receiveBytes(fd, count: 8)[1], 0x5A)
+            XCTAssertEqual(receiveBytes(fd, count: 2), Array("hi".utf8))
+            close(fd)
+
+            // BIND is refused
+            let bindFd = connectToPort(forward.listenPort)
+            sendBytes(bindFd, [4, 2, UInt8(port >> 8), UInt8(port & 0xff), 127, 0, 0, 1, 0])
+            XCTAssertEqual(receiveBytes(bindFd, count: 8)[1], 0x5B)
+            close(bindFd)
+
+            XCTAssertEqual(forward.metrics().failedConnections, 1)
+
+            try disconnectSessionAndWait(session)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testFailedHandshakeClosesSocket() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let forward = try session.startSOCKSProxyOnAddress(nil, port: 0)
+
+            // unknown version
+            let badVersion = connectToPort(forward.listenPort)
+            sendBytes(badVersion, [9, 1, 0])
+            assertClosedByForward(badVersion)
+            close(badVersion)
+
+            // client gone halfway through the request
+            let halfRequest = connectToPort(forward.listenPort)
+            sendBytes(halfRequest, [5, 1])
+            shutdown(halfRequest, SHUT_WR)
+            assertClosedByForward(halfRequest)
+            close(halfRequest)
+
+            XCTAssertEqual(forward.metrics().failedConnections, 2)
+            XCTAssertEqual(forward.metrics().activeConnections, 0)
+
+            try disconnectSessionAndWait(session)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testConnectionLimit() {
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let forward = try session.startLocalForwardOnAddress(nil, port: 0, targetHost: echoHost, targetPort: UInt(echoPort))
+            forward.maxConnections = 1
+
+            let first = connectToPort(forward.listenPort)
+            assertEchoes(first)
+
+            // waits in the backlog
+            let second = connectToPort(forward.listenPort)
+            sendBytes(second, Array("hello".utf8))
+            var timeout = timeval(tv_sec: 1, tv_usec: 0)
+            setsockopt(second, SOL_SOCKET, SO_RCVTIMEO, &timeout, socklen_t(sizeof(timeval)))
+            XCTAssertEqual(receiveBytes(second, count: 5).count, 0)
+            XCTAssertEqual(forward.metrics().activeConnections, 1)
+
+            close(first)
+            timeout = timeval(tv_sec: 5, tv_usec: 0)
+            setsockopt(second, SOL_SOCKET, SO_RCVTIMEO, &timeout, socklen_t(sizeof(timeval)))
+            XCTAssertEqual(receiveBytes(second, count: 5), Array("hello".utf8))
+            close(second)
+
+            let metrics = forward.metrics()
+            XCTAssertEqual(metrics.totalConnections, 2)
+            XCTAssertGreaterThanOrEqual(metrics.limitStalls, 1)
+
+            try disconnectSessionAndWait(session)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testReconnectClosesTunnelledConnections() {
+        reconnectsAutomatically = true
+        defer {
+            reconnectsAutomatically = false
+        }
+
+        do {
+            let session = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let forward = try session.startLocalForwardOnAddress(nil, port: 0, targetHost: echoHost, targetPort: UInt(echoPort))
+
+            let fd = connectToPort(forward.listenPort)
+            assertEchoes(fd)
+
+            // stream is not spliced onto a new connection to the target, client sees end of stream
+            try dropConnectionAndWaitForReconnect(session)
+            XCTAssertEqual(receiveBytes(fd, count: 1).count, 0)
+            close(fd)
+
+            // forward kept listening
+            XCTAssert(forward.listening)
+            let other = connectToPort(forward.listenPort)
+            assertEchoes(other)
+            close(other)
+
+            try disconnectSessionAndWait(session)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+}
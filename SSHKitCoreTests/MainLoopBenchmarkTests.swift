@@ -0,0 +1,152 @@
+//
+//  MainLoopBenchmarkTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+/// Cost of a busy channel next to idle ones, only runs when $SSHKIT_BENCHMARK is set, see BenchmarkTests
+class MainLoopBenchmarkTests: SessionTestCase, SSHKitChannelDelegate {
+    private let enabled = NSProcessInfo.processInfo().environment["SSHKIT_BENCHMARK"] != nil
+    private let recorder = BenchmarkRecorder()
+
+    private var openExpectation: XCTestExpectation?
+    private var echoExpectation: XCTestExpectation?
+
+    private var channelsToOpen = 0
+    private var echoChannel: SSHKitChannel?
+    private var echoLength = 0
+    private var roundTrips = 0
+
+    private let echoHost = "127.0.0.1"
+    private let echoPort = 6008
+    private let roundTripCount = 200
+    private let packet = NSMutableData(length: 64)!
+    let echoServer = EchoServer(port: 6008)
+
+    override func setUp() {
+        super.setUp()
+        if enabled {
+            echoServer.start()
+        }
+    }
+
+    override func tearDown() {
+        if enabled {
+            echoServer.stop()
+        }
+        super.tearDown()
+    }
+
+    // MARK: - helper function
+    func openChannels(session: SSHKitSession, count: Int) -> [SSHKitDirectChannel] {
+        if count == 0 {
+            return []
+        }
+
+        openExpectation = expectationWithDescription("Open \(count) channels")
+        channelsToOpen = count
+
+        let channels = (0..<count).map { _ in
+            session.openDirectChannelWithTargetHost(echoHost, port: UInt(echoPort), delegate: self)
+        }
+
+        waitForExpectationsWithTimeout(60) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+
+        return channels
+    }
+
+    /// seconds per echoed packet on one channel, while the other channels stay idle
+    func measurePerPacketCost(channel: SSHKitChannel) -> Double {
+        echoExpectation = expectationWithDescription("Echo packets")
+        echoChannel = channel
+        echoLength = 0
+        roundTrips = 0
+
+        let start = CFAbsoluteTimeGetCurrent()
+        channel.writeData(packet)
+
+        waitForExpectationsWithTimeout(60) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+
+        return (CFAbsoluteTimeGetCurrent() - start) / Double(roundTripCount)
+    }
+
+    // MARK: - test
+    func testPerPacketCostWithIdleChannels() {
+        guard enabled else {
+            return
+        }
+
+        do {
+            let session = try self.launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let activeChannel = openChannels(session, count: 1)[0]
+
+            // warm up
+            _ = measurePerPacketCost(activeChannel)
+
+            var costs = [Int: Double]()
+            var idleChannels = [SSHKitDirectChannel]()
+
+            for total in [1, 10, 100, 1000] {
+                idleChannels += openChannels(session, count: total - 1 - idleChannels.count)
+
+                let before = session.metrics()
+                costs[total] = measurePerPacketCost(activeChannel)
+                let after = session.metrics()
+                recorder.record("mainloop.packet.\(total)channels", value: costs[total]! * 1000000, unit: "us")
+
+                // idle channels are not serviced on socket events, at most the busy one is per wakeup
+                let wakeups = after.wakeups - before.wakeups
+                let services = after.channelServices - before.channelServices
+                XCTAssertGreaterThan(wakeups, 0)
+                XCTAssertLessThanOrEqual(services, wakeups)
+            }
+
+            for channel in idleChannels {
+                channel.close()
+            }
+            session.disconnect()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    // MARK: - SSHKitChannelDelegate
+
+    func channelDidOpen(channel: SSHKitChannel) {
+        channelsToOpen -= 1
+        if channelsToOpen == 0 {
+            openExpectation!.fulfill()
+        }
+    }
+
+    func channel(channel: SSHKitChannel, didReadStdoutData data: NSData) {
+        guard channel === echoChannel else {
+            return
+        }
+
+        echoLength += data.length
+        if echoLength < packet.length {
+            return
+        }
+
+        echoLength -= packet.length
+        roundTrips += 1
+        if roundTrips == roundTripCount {
+            echoExpectation!.fulfill()
+        } else {
+            channel.writeData(packet)
+        }
+    }
+
+    func channelDidClose(channel: SSHKitChannel!, withError error: NSError!) {
+    }
+}
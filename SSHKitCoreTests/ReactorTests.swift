@@ -0,0 +1,92 @@
+//
+//  ReactorTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class ReactorTests: SessionTestCase {
+    
+    override func tearDown() {
+        reactor = nil
+        super.tearDown()
+    }
+    
+    func testSessionsAreSpreadOverWorkers() {
+        let sharedReactor = SSHKitReactor(workerCount: 2)
+        reactor = sharedReactor
+        
+        do {
+            var sessions = [SSHKitSession]()
+            for _ in 0..<3 {
+                sessions.append(try launchSessionWithAuthMethod(.PublicKey, user: userForSFA))
+            }
+            
+            XCTAssertEqual(sharedReactor.sessionCount, 3)
+            
+            let stats = sharedReactor.workerStats()
+            XCTAssertEqual(stats.count, 2)
+            XCTAssertEqual(stats.map { $0.sessionCount }.sort(), [1, 2])
+            
+            for workerStats in stats {
+                XCTAssertGreaterThan(workerStats.wakeups, 0)
+                XCTAssertGreaterThanOrEqual(workerStats.busyTime, workerStats.maxWakeupTime)
+            }
+            
+            for session in sessions {
+                try disconnectSessionAndWait(session)
+            }
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testSessionsSharingOneWorker() {
+        reactor = SSHKitReactor(workerCount: 1)
+        
+        do {
+            let first = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            let second = try launchSessionWithAuthMethod(.Password, user: userForSFA)
+            
+            // sessions sharing a queue still answer synchronous calls of each other
+            XCTAssert(first.connected)
+            XCTAssert(second.connected)
+            
+            try disconnectSessionAndWait(first)
+            XCTAssert(second.connected)
+            try disconnectSessionAndWait(second)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testLogHandlerSurvivesOtherSessionOnWorker() {
+        reactor = SSHKitReactor(workerCount: 1)
+        let lock = NSLock()
+        var firstLogs = 0
+        
+        do {
+            logHandler = { _, _, _ in
+                lock.lock(); firstLogs += 1; lock.unlock()
+            }
+            let first = try launchSessionWithAuthMethod(.PublicKey, user: userForSFA, options: [kVTKitDebugLevelKey: 4])
+            logHandler = { _, _, _ in }
+            let second = try launchSessionWithAuthMethod(.Password, user: userForSFA, options: [kVTKitDebugLevelKey: 4])
+            logHandler = nil
+            
+            // the second session unregisters only its own handler from the shared queue
+            try disconnectSessionAndWait(second)
+            lock.lock(); let before = firstLogs; lock.unlock()
+            
+            first.openExecChannelWithCommand("true", delegate: nil)
+            NSRunLoop.currentRunLoop().runUntilDate(NSDate(timeIntervalSinceNow: 1))
+            
+            lock.lock(); let after = firstLogs; lock.unlock()
+            XCTAssertGreaterThan(after, before)
+            
+            try disconnectSessionAndWait(first)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+}
@@ -217,5 +217,88 @@ class SFTPChannelTests: SFTPTests {
             XCTAssertEqual(error.code, SSHKitSFTPErrorCode.GenericFailure.rawValue)
         }
     }
+    
+    func testAttributeCache() {
+        let cache = SSHKitSFTPAttributeCache(timeToLive: 60)
+        channel!.attributeCache = cache
+        defer {
+            channel!.attributeCache = nil
+        }
+        
+        XCTAssertEqual(channel!.isFileExist(filePathForTest), SSHKitSFTPIsFileExist.File)
+        XCTAssertEqual(cache.missCount, 1)
+        XCTAssertEqual(channel!.isFileExist(filePathForTest), SSHKitSFTPIsFileExist.File)
+        XCTAssertEqual(cache.hitCount, 1)
+        
+        // own changes are never served stale
+        if let error = channel!.unlink(filePathForTest) {
+            XCTFail(error.description)
+        }
+        XCTAssertEqual(channel!.isFileExist(filePathForTest), SSHKitSFTPIsFileExist.No)
+        XCTAssertEqual(cache.missCount, 2)
+        XCTAssertEqual(channel!.isFileExist(filePathForTest), SSHKitSFTPIsFileExist.No)
+        XCTAssertEqual(cache.hitCount, 2)
+        
+        cache.removeAllEntries()
+        XCTAssertEqual(cache.count, 0)
+    }
+    
+    func testBatchRequests() {
+        let missingPath = "./no_this_file"
+        let expectation = expectationWithDescription("Batch Finished")
+        
+        channel!.unlinkPaths([filePathForTest, missingPath]) { (errors) in
+            XCTAssertEqual(errors.count, 1)
+            XCTAssertEqual(errors[missingPath]?.code, SSHKitSFTPErrorCode.NoSuchFile.rawValue)
+            expectation.fulfill()
+        }
+        
+        waitForExpectationsWithTimeout(5) { error in
+            if let error=error {
+                XCTFail(error.description)
+            }
+        }
+        
+        XCTAssertEqual(channel!.isFileExist(filePathForTest), SSHKitSFTPIsFileExist.No)
+    }
+    
+    func testRecursiveOperations() {
+        let root = "./batchTree"
+        let deepPath = root + "/a/b/c"
+        
+        var expectation = expectationWithDescription("mkdir -p Finished")
+        channel!.createDirectoriesAtPaths([deepPath, root + "/a/d"], mode: 0o755) { (errors) in
+            XCTAssertEqual(errors.count, 0)
+            expectation.fulfill()
+        }
+        waitForExpectationsWithTimeout(10, handler: nil)
+        XCTAssertEqual(channel!.isFileExist(deepPath), SSHKitSFTPIsFileExist.Directory)
+        
+        createEmptyFile(deepPath + "/file")
+        channel!.symlink(deepPath, destination: root + "/link")
+        
+        expectation = expectationWithDescription("chmod -R Finished")
+        channel!.chmodRecursivelyAtPath(root, mode: 0o700) { (errors) in
+            XCTAssertEqual(errors.count, 0)
+            expectation.fulfill()
+        }
+        waitForExpectationsWithTimeout(10, handler: nil)
+        
+        do {
+            let file = try SSHKitSFTPFile.openFile(channel, path: deepPath + "/file")
+            XCTAssertEqual(file.posixPermissions & 0o777, 0o700)
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+        
+        expectation = expectationWithDescription("rm -rf Finished")
+        channel!.removeItemRecursivelyAtPath(root) { (errors) in
+            XCTAssertEqual(errors.count, 0)
+            expectation.fulfill()
+        }
+        waitForExpectationsWithTimeout(10, handler: nil)
+        XCTAssertEqual(channel!.isFileExist(root), SSHKitSFTPIsFileExist.No)
+    }
 
 }
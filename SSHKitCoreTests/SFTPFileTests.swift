@@ -11,6 +11,7 @@ import XCTest
 class SFTPFileTests: SFTPTests {
     
     private var readFileExpectation: XCTestExpectation?
+    private var writeFileExpectation: XCTestExpectation?
 
     let lsFolderPathForTest = "./ls"
     let lnFolderPathForTest = "./ln"
@@ -123,6 +124,170 @@ class SFTPFileTests: SFTPTests {
         createFile(filename, content: content)
     }
     
+    func testWriteLargeFile() {
+        let filename = filePathForWriteTest
+        
+        // spans multiple pipelined WRITE requests
+        var i = 0
+        var content = "0123456789abcd"
+        while i < 15 {
+            content = content.stringByAppendingString(content)
+            i += 1
+        }
+        
+        createFile(filename, content: content)
+        
+        do {
+            let file = try SSHKitSFTPFile.openFile(channel, path: filename)
+            XCTAssertEqual(file.fileSize.longLongValue, Int64(content.lengthOfBytesUsingEncoding(NSUTF8StringEncoding)))
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testListDirectoryInBatches() {
+        do {
+            let dir = try SSHKitSFTPFile.openDirectory(channel, path: lsFolderPathForTest)
+            var names = [String]()
+            let expectation = expectationWithDescription("List Directory Finished")
+            
+            dir.listDirectoryInBatches({ (entries) -> SSHKitSFTPListDirFilterCode in
+                for index in 0..<entries.count {
+                    names.append(entries.nameAtIndex(index))
+                    if entries.nameAtIndex(index) == "1" {
+                        let file = entries.fileAtIndex(index)
+                        XCTAssertEqual(file.filename, "1")
+                        XCTAssertFalse(file.isDirectory)
+                        XCTAssertEqual(file.fileSize.integerValue, 0)
+                    }
+                    if entries.nameAtIndex(index) == "." {
+                        XCTAssert(entries.isDirectoryAtIndex(index))
+                    }
+                }
+                return .Add
+                }, completion: { (error) in
+                    XCTAssertNil(error)
+                    expectation.fulfill()
+            })
+            
+            waitForExpectationsWithTimeout(5) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            XCTAssertEqual(Set(names), Set([".", "..", "1", "2"]))
+            XCTAssert(dir.directoryEof)
+            dir.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testAsyncWrite() {
+        let filename = filePathForWriteTest
+        let data = NSMutableData(length: 1024 * 1024)!
+        var position = 0
+        
+        do {
+            writeFileExpectation = expectationWithDescription("Write File Success")
+            let file = try SSHKitSFTPFile.openFileForWrite(channel, path: filename, shouldResume: false, mode: 0o644)
+            
+            file.asyncWriteFile(0, length: UInt64(data.length), writeFileBlock: { (buffer, bufferLength) -> Int32 in
+                let length = min(Int(bufferLength), data.length - position)
+                memcpy(buffer, data.bytes + position, length)
+                position += length
+                return Int32(length)
+                }, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+                }, fileTransferSuccessBlock: {
+                    self.writeFileExpectation?.fulfill()
+                }, fileTransferFailBlock: { (error) in
+                    XCTFail(error.description)
+            })
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            file.close()
+            
+            readFileExpectation = expectationWithDescription("Read Uploaded File Success")
+            let uploaded = try SSHKitSFTPFile.openFile(channel, path: filename)
+            XCTAssertEqual(uploaded.fileSize.integerValue, data.length)
+            
+            let received = NSMutableData()
+            uploaded.asyncReadFile(0, readFileBlock: { (buffer, bufferLength) in
+                received.appendBytes(buffer, length: Int(bufferLength))
+                }, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+                }, fileTransferSuccessBlock: {
+                    self.readFileExpectation?.fulfill()
+                }, fileTransferFailBlock: { (error) in
+                    XCTFail(error.description)
+            })
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            // second half continues right after the first
+            XCTAssertEqual(received, data)
+            uploaded.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testResumeUploadFromPath() {
+        let filename = filePathForWriteTest
+        let localPath = (NSTemporaryDirectory() as NSString).stringByAppendingPathComponent(NSUUID().UUIDString)
+        // every word differs, a misplaced range does not compare equal
+        let data = NSMutableData(length: 1024 * 1024)!
+        for i in 0..<data.length / 4 {
+            var value = UInt32(i)
+            data.replaceBytesInRange(NSMakeRange(i * 4, 4), withBytes: &value)
+        }
+        data.writeToFile(localPath, atomically: false)
+        
+        do {
+            // first half is already there
+            let partial = try SSHKitSFTPFile.openFileForWrite(channel, path: filename, shouldResume: false, mode: 0o644)
+            XCTAssertEqual(partial.write(data.bytes, size: data.length / 2, errorPtr: nil), data.length / 2)
+            partial.close()
+            
+            writeFileExpectation = expectationWithDescription("Upload File Success")
+            let file = try SSHKitSFTPFile.openFileForWrite(channel, path: filename, shouldResume: true, mode: 0o644)
+            XCTAssertEqual(file.fileSize.integerValue, data.length / 2)
+            
+            file.asyncUploadFromPath(localPath, offset: file.fileSize.unsignedLongLongValue, options: .MapLocalFile, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+                }, fileTransferSuccessBlock: {
+                    self.writeFileExpectation?.fulfill()
+                }, fileTransferFailBlock: { (error) in
+                    XCTFail(error.description)
+            })
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            file.close()
+            
+            let uploaded = try SSHKitSFTPFile.openFile(channel, path: filename)
+            XCTAssertEqual(uploaded.fileSize.integerValue, data.length)
+            uploaded.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+        
+        _ = try? NSFileManager.defaultManager().removeItemAtPath(localPath)
+    }
+    
     func testRead() {
         let filename = filePathForReadTest
         
@@ -161,4 +326,227 @@ class SFTPFileTests: SFTPTests {
         }
     }
 
+    func testAdaptiveRead() {
+        let filename = filePathForReadTest
+        
+        var i = 0
+        var content = "0123456789abcd"
+        while i < 15 {
+            content = content.stringByAppendingString(content)
+            i += 1
+        }
+        
+        createFile(filename, content: content)
+        
+        do {
+            readFileExpectation = expectationWithDescription("Read File Success")
+            let file = try SSHKitSFTPFile.openFile(channel, path: filename)
+            let received = NSMutableData()
+            
+            file.adaptiveTransfer = true
+            file.minConcurrentRequests = 2
+            file.maxConcurrentRequests = 64
+            
+            file.asyncReadFile(0, readFileBlock: { (buffer, bufferLength) in
+                received.appendBytes(buffer, length: Int(bufferLength))
+                }, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+                }, fileTransferSuccessBlock: {
+                    self.readFileExpectation?.fulfill()
+                }, fileTransferFailBlock: { (error) in
+                    XCTFail(error.description)
+            })
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            // data must be handed out in file order, even when requests are resized
+            XCTAssertEqual(received, content.dataUsingEncoding(NSUTF8StringEncoding)!)
+            
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testMaxBytesInFlightCapsAdaptiveRead() {
+        let filename = filePathForReadTest
+        
+        var i = 0
+        var content = "0123456789abcd"
+        while i < 17 {
+            content = content.stringByAppendingString(content)
+            i += 1
+        }
+        
+        createFile(filename, content: content)
+        
+        do {
+            readFileExpectation = expectationWithDescription("Read File Success")
+            let file = try SSHKitSFTPFile.openFile(channel, path: filename)
+            let received = NSMutableData()
+            
+            // tuner alone would grow to 256 requests of 64 KB
+            file.adaptiveTransfer = true
+            file.maxBytesInFlight = 256 * 1024
+            
+            file.asyncReadFile(0, readFileBlock: { (buffer, bufferLength) in
+                received.appendBytes(buffer, length: Int(bufferLength))
+                }, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+                }, fileTransferSuccessBlock: {
+                    self.readFileExpectation?.fulfill()
+                }, fileTransferFailBlock: { (error) in
+                    XCTFail(error.description)
+            })
+            
+            waitForExpectationsWithTimeout(20) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            XCTAssertEqual(received, content.dataUsingEncoding(NSUTF8StringEncoding)!)
+            
+            let metrics = file.metrics()
+            XCTAssertGreaterThan(metrics.peakBytesInFlight, 0)
+            XCTAssertLessThanOrEqual(metrics.peakBytesInFlight, file.maxBytesInFlight)
+            
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testDownloadToPath() {
+        let filename = filePathForReadTest
+        let localPath = (NSTemporaryDirectory() as NSString).stringByAppendingPathComponent(NSUUID().UUIDString)
+        
+        var i = 0
+        var content = "0123456789abcd"
+        while i < 15 {
+            content = content.stringByAppendingString(content)
+            i += 1
+        }
+        
+        createFile(filename, content: content)
+        
+        do {
+            readFileExpectation = expectationWithDescription("Download File Success")
+            let file = try SSHKitSFTPFile.openFile(channel, path: filename)
+            
+            file.adaptiveTransfer = true
+            file.asyncDownloadToPath(localPath, offset: 0, options: [.Preallocate, .SyncOnCompletion], progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+                }, fileTransferSuccessBlock: {
+                    self.readFileExpectation?.fulfill()
+                }, fileTransferFailBlock: { (error) in
+                    XCTFail(error.description)
+            })
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            // replies are written at their offsets, whatever order they came in
+            XCTAssertEqual(NSData(contentsOfFile: localPath), content.dataUsingEncoding(NSUTF8StringEncoding)!)
+            
+            let metrics = file.metrics()
+            XCTAssertEqual(metrics.bytesTransferred, UInt64(content.utf8.count))
+            XCTAssertEqual(metrics.outstandingRequests, 0)
+            XCTAssertGreaterThan(metrics.throughput, 0)
+            
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+        
+        _ = try? NSFileManager.defaultManager().removeItemAtPath(localPath)
+    }
+
+    func testDownloadOverLongerFile() {
+        let filename = filePathForReadTest
+        let localPath = (NSTemporaryDirectory() as NSString).stringByAppendingPathComponent(NSUUID().UUIDString)
+        
+        let content = "0123456789abcd"
+        createFile(filename, content: content)
+        
+        // older local copy is longer than the remote file
+        NSMutableData(length: 64 * 1024)!.writeToFile(localPath, atomically: false)
+        
+        do {
+            readFileExpectation = expectationWithDescription("Download File Success")
+            let file = try SSHKitSFTPFile.openFile(channel, path: filename)
+            
+            file.asyncDownloadToPath(localPath, offset: 0, options: .Preallocate, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+                }, fileTransferSuccessBlock: {
+                    self.readFileExpectation?.fulfill()
+                }, fileTransferFailBlock: { (error) in
+                    XCTFail(error.description)
+            })
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            XCTAssertEqual(NSData(contentsOfFile: localPath), content.dataUsingEncoding(NSUTF8StringEncoding)!)
+            
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+        
+        _ = try? NSFileManager.defaultManager().removeItemAtPath(localPath)
+    }
+    
+    func testReadWhileRunningOtherRequests() {
+        let filename = filePathForReadTest
+        
+        var i = 0
+        var content = "0123456789abcd"
+        while i < 15 {
+            content = content.stringByAppendingString(content)
+            i += 1
+        }
+        
+        createFile(filename, content: content)
+        
+        do {
+            readFileExpectation = expectationWithDescription("Read File Success")
+            let file = try SSHKitSFTPFile.openFile(channel, path: filename)
+            var receivedLength = 0
+            
+            file.asyncReadFile(0, readFileBlock: { (buffer, bufferLength) in
+                receivedLength += Int(bufferLength)
+                }, progressBlock: { (bytesNewReceived, bytesReceived, bytesTotal) in
+                }, fileTransferSuccessBlock: {
+                    self.readFileExpectation?.fulfill()
+                }, fileTransferFailBlock: { (error) in
+                    XCTFail(error.description)
+            })
+            
+            // replies of the download may be queued by these requests, the download must still finish
+            for _ in 0..<10 {
+                let path = try channel!.canonicalizePath(".")
+                XCTAssertNotNil(path)
+            }
+            
+            waitForExpectationsWithTimeout(10) { error in
+                if let error=error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            XCTAssertEqual(receivedLength, content.lengthOfBytesUsingEncoding(NSUTF8StringEncoding))
+            
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
 }
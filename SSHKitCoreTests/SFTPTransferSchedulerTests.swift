@@ -0,0 +1,132 @@
+//
+//  SFTPTransferSchedulerTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class SFTPTransferSchedulerTests: SFTPTests {
+
+    let remoteFolderPathForTest = "./scheduler"
+    let remoteUploadFolderPathForTest = "./scheduler_upload"
+    let fileCount = 20
+    var localFolderPathForTest = ""
+
+    // MARK: - setUp
+    override func setUp() {
+        super.setUp()
+
+        localFolderPathForTest = (NSTemporaryDirectory() as NSString).stringByAppendingPathComponent(NSUUID().UUIDString)
+
+        mkdir(remoteFolderPathForTest)
+        for index in 0..<fileCount {
+            writeFile(remoteFolderPathForTest.stringByAppendingString("/\(index)"), content: contentOfFile(index))
+        }
+    }
+
+    override func tearDown() {
+        for folder in [remoteFolderPathForTest, remoteUploadFolderPathForTest] {
+            for index in 0..<fileCount {
+                unlink(folder.stringByAppendingString("/\(index)"))
+            }
+            rmdir(folder)
+        }
+        _ = try? NSFileManager.defaultManager().removeItemAtPath(localFolderPathForTest)
+
+        super.tearDown()
+    }
+
+    // MARK: - helper function
+    func contentOfFile(index: Int) -> String {
+        // mix of small files and files larger than smallFileThreshold
+        var content = "\(index)-0123456789abcd"
+        for _ in 0..<(index % 2 == 0 ? 2 : 14) {
+            content = content.stringByAppendingString(content)
+        }
+        return content
+    }
+
+    func writeFile(filename: String, content: String) {
+        do {
+            let file = try SSHKitSFTPFile.openFileForWrite(channel, path: filename, shouldResume: false, mode: 0o644)
+            let length = content.lengthOfBytesUsingEncoding(NSUTF8StringEncoding)
+            let writeLength = file.write(content.cStringUsingEncoding(NSUTF8StringEncoding)!, size: length, errorPtr: nil)
+            XCTAssertEqual(length, writeLength)
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func runJob(start: (SSHKitSFTPTransferJobCompletionBlock) -> SSHKitSFTPTransferJob) -> SSHKitSFTPTransferJob {
+        let expectation = expectationWithDescription("Transfer Job Finished")
+        let job = start({ (job) in
+            expectation.fulfill()
+        })
+
+        waitForExpectationsWithTimeout(30) { error in
+            if let error=error {
+                XCTFail(error.description)
+            }
+        }
+
+        return job
+    }
+
+    // MARK: - test
+    func testDownloadAndUploadDirectory() {
+        let scheduler = SSHKitSFTPTransferScheduler(channels: [channel!])
+        scheduler.maxConcurrentTransfersPerChannel = 2
+        scheduler.smallFileBatchSize = 8
+
+        var job = runJob { (completionBlock) in
+            scheduler.downloadDirectory(self.remoteFolderPathForTest, toPath: self.localFolderPathForTest, progressBlock: nil, completionBlock: completionBlock)
+        }
+
+        XCTAssertEqual(job.items.count, fileCount)
+        XCTAssertEqual(job.failedItems.count, 0)
+        XCTAssertEqual(job.transferredBytes, job.totalBytes)
+
+        for index in 0..<fileCount {
+            let path = (localFolderPathForTest as NSString).stringByAppendingPathComponent("\(index)")
+            let data = NSData(contentsOfFile: path)
+            XCTAssertEqual(data, contentOfFile(index).dataUsingEncoding(NSUTF8StringEncoding))
+        }
+
+        job = runJob { (completionBlock) in
+            scheduler.uploadDirectory(self.localFolderPathForTest, toPath: self.remoteUploadFolderPathForTest, progressBlock: nil, completionBlock: completionBlock)
+        }
+
+        XCTAssertEqual(job.items.count, fileCount)
+        XCTAssertEqual(job.failedItems.count, 0)
+
+        // files uploaded are stat'ed by the scheduler before they are downloaded again
+        let items = (0..<fileCount).map { (index) -> SSHKitSFTPTransferItem in
+            let remotePath = self.remoteUploadFolderPathForTest.stringByAppendingString("/\(index)")
+            let localPath = (self.localFolderPathForTest as NSString).stringByAppendingPathComponent("copy-\(index)")
+            return SSHKitSFTPTransferItem.downloadItemWithRemotePath(remotePath, localPath: localPath)
+        }
+
+        job = runJob { (completionBlock) in
+            scheduler.downloadItems(items, progressBlock: nil, completionBlock: completionBlock)
+        }
+
+        XCTAssertEqual(job.failedItems.count, 0)
+        for (index, item) in items.enumerate() {
+            XCTAssertEqual(NSData(contentsOfFile: item.localPath), contentOfFile(index).dataUsingEncoding(NSUTF8StringEncoding))
+        }
+    }
+
+    func testDownloadMissingFile() {
+        let scheduler = SSHKitSFTPTransferScheduler(channels: [channel!])
+        let localPath = (localFolderPathForTest as NSString).stringByAppendingPathComponent("missing")
+        let items = [SSHKitSFTPTransferItem.downloadItemWithRemotePath("./not_exist_file", localPath: localPath)]
+
+        let job = runJob { (completionBlock) in
+            scheduler.downloadItems(items, progressBlock: nil, completionBlock: completionBlock)
+        }
+
+        XCTAssertEqual(job.failedItems.count, 1)
+        XCTAssertEqual(job.failedItems.first?.error?.code, SSHKitSFTPErrorCode.NoSuchFile.rawValue)
+    }
+}
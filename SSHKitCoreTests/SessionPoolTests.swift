@@ -0,0 +1,152 @@
+//
+//  SessionPoolTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class SessionPoolTests: SessionTestCase {
+
+    var pool: SSHKitSessionPool!
+
+    override func setUp() {
+        super.setUp()
+
+        let keyPath = NSBundle(forClass: self.dynamicType).pathForResource(identity, ofType: "")!
+        let keyBase64 = try! String(contentsOfFile: keyPath, encoding: NSUTF8StringEncoding)
+
+        pool = SSHKitSessionPool(authenticateBlock: { (session, methods, partialSuccess) in
+            let keyPair = try! SSHKitKeyPair(fromBase64: keyBase64, withAskPass: nil)
+            session.authenticateWithKeyPair(keyPair)
+        }, trustHostKeyBlock: { (session, hostKey) in
+            return true
+        })
+    }
+
+    override func tearDown() {
+        pool.drain()
+        super.tearDown()
+    }
+
+    // MARK: - helper function
+    func acquire(count: Int) -> [SSHKitSession] {
+        let expectation = expectationWithDescription("Acquire \(count) sessions")
+        var sessions = [SSHKitSession]()
+
+        for _ in 0..<count {
+            pool.acquireSessionForHost(sshHost, port: sshPort, user: userForSFA, options: [:]) { (session, error) in
+                XCTAssertNil(error)
+                if let session = session {
+                    sessions.append(session)
+                }
+                if sessions.count == count {
+                    expectation.fulfill()
+                }
+            }
+        }
+
+        waitForExpectationsWithTimeout(10) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+
+        return sessions
+    }
+
+    // MARK: - test
+    func testReuseAuthenticatedSession() {
+        let first = acquire(1)[0]
+        XCTAssert(first.isConnected)
+        pool.releaseSession(first)
+
+        // no new handshake, same session comes back
+        let second = acquire(1)[0]
+        XCTAssert(first === second)
+        XCTAssertEqual(pool.sessionCount, 1)
+        pool.releaseSession(second)
+    }
+
+    func testChannelCapOpensMoreSessions() {
+        pool.maxChannelsPerSession = 2
+        pool.maxSessionsPerKey = 2
+
+        let sessions = acquire(4)
+        XCTAssertEqual(Set(sessions.map { ObjectIdentifier($0) }).count, 2)
+        XCTAssertEqual(pool.sessionCount, 2)
+
+        // fifth request waits for a release
+        let expectation = expectationWithDescription("Acquire after release")
+        pool.acquireSessionForHost(sshHost, port: sshPort, user: userForSFA, options: [:]) { (session, error) in
+            XCTAssert(session === sessions[0] || session === sessions[1] || session === sessions[2] || session === sessions[3])
+            expectation.fulfill()
+        }
+        pool.releaseSession(sessions[0])
+
+        waitForExpectationsWithTimeout(5) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+    }
+
+    func testEvictIdleSessions() {
+        pool.idleTimeout = 1
+
+        let session = acquire(1)[0]
+        pool.releaseSession(session)
+
+        expectationForPredicate(NSPredicate(block: { (_, _) -> Bool in
+            return self.pool.sessionCount == 0
+        }), evaluatedWithObject: self, handler: nil)
+
+        waitForExpectationsWithTimeout(5) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+    }
+
+    func testWarmStandbySurvivesEviction() {
+        pool.idleTimeout = 1
+        pool.warmUpSessionsForHost(sshHost, port: sshPort, user: userForSFA, options: [:], count: 1)
+
+        let session = acquire(1)[0]
+        pool.releaseSession(session)
+
+        // a couple of eviction rounds
+        NSRunLoop.currentRunLoop().runUntilDate(NSDate(timeIntervalSinceNow: 2.5))
+        XCTAssertEqual(pool.sessionCount, 1)
+
+        let again = acquire(1)[0]
+        XCTAssert(session === again)
+        pool.releaseSession(again)
+    }
+
+    func testRefusedHostStopsReconnecting() {
+        pool.maxConnectFailures = 2
+        pool.warmUpSessionsForHost(sshHost, port: refusePort, user: userForSFA, options: [:], count: 1)
+
+        // waits through the first failure and the backoff, fails with the second
+        let expectation = expectationWithDescription("Acquire fails")
+        let startedAt = NSDate()
+        pool.acquireSessionForHost(sshHost, port: refusePort, user: userForSFA, options: [:]) { (session, error) in
+            XCTAssertNil(session)
+            XCTAssertNotNil(error)
+            expectation.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(5) { error in
+            if let error = error {
+                XCTFail(error.description)
+            }
+        }
+        XCTAssertGreaterThanOrEqual(NSDate().timeIntervalSinceDate(startedAt), 1)
+
+        // second failure ended the standby too, no connect follows
+        NSRunLoop.currentRunLoop().runUntilDate(NSDate(timeIntervalSinceNow: 4))
+        XCTAssertEqual(pool.sessionCount, 0)
+        NSRunLoop.currentRunLoop().runUntilDate(NSDate(timeIntervalSinceNow: 3))
+        XCTAssertEqual(pool.sessionCount, 0)
+    }
+}
@@ -14,15 +14,18 @@ enum AuthMethod: String {
     case Interactive    = "keyboard-interactive"
 }
 
+// overridable by environment, runBenchmark.sh points tests to its own sshd
+private let testEnvironment = NSProcessInfo.processInfo().environment
+
 class SessionTestCase: XCTestCase, SSHKitSessionDelegate {
-    let sshHost  = "127.0.0.1"
-    let sshPort : UInt16 = 22
+    let sshHost  = testEnvironment["SSHKIT_TEST_HOST"] ?? "127.0.0.1"
+    let sshPort : UInt16 = UInt16(testEnvironment["SSHKIT_TEST_PORT"] ?? "") ?? 22
     let refusePort : UInt16 = 6009
     
     // for artificially create a connection timeout error
     let nonRoutableIP = "10.255.255.1"
     
-    let userForSFA = "sshtest"
+    let userForSFA = testEnvironment["SSHKIT_TEST_USER"] ?? "sshtest"
     let userForMFA = "sshtest-m"
     let userForNoPass = "sshtest-nopass"
     let invalidUser = "invalid-user"
@@ -34,6 +37,7 @@ class SessionTestCase: XCTestCase, SSHKitSessionDelegate {
     // async test http://nshipster.com/xctestcase/
     private var authExpectation: XCTestExpectation?
     private var disconnectExpectation: XCTestExpectation?
+    private var reconnectExpectation: XCTestExpectation?
     
     private var authMethods = [AuthMethod.Password, ]
     
@@ -45,6 +49,11 @@ class SessionTestCase: XCTestCase, SSHKitSessionDelegate {
     
     var error : NSError?
     
+    var reconnectsAutomatically = false
+    var reactor: SSHKitReactor?
+    var logHandler: SSHKitLogHandler?
+    var reconnectAttempts = 0
+    
     override func setUp() {
         super.setUp()
     }
@@ -55,13 +64,19 @@ class SessionTestCase: XCTestCase, SSHKitSessionDelegate {
     
     // MARK: - Connect Utils
     
-    private func connectAndReturnSessionWithAuthMethods(methods: [AuthMethod], host: String, port: UInt16, user: String, timeout: NSTimeInterval, options:[String:AnyObject]) throws -> SSHKitSession {
+    private func connectAndReturnSessionWithAuthMethods(methods: [AuthMethod], host: String, port: UInt16, user: String, timeout: NSTimeInterval, options:[String:AnyObject], racingAddresses: Bool = false) throws -> SSHKitSession {
         authExpectation = expectationWithDescription("Launch session with \(methods) auth method")
         authMethods = methods
         
-        let session = SSHKitSession(host: host, port: port, user: user, options:options, delegate: self)
+        let session = SSHKitSession(host: host, port: port, user: user, options:options, delegate: self, reactor: reactor)
+        session.reconnectsAutomatically = reconnectsAutomatically
+        session.logHandler = logHandler
         
-        session.connectWithTimeout(timeout)
+        if racingAddresses {
+            session.connectRacingAddressesWithTimeout(timeout)
+        } else {
+            session.connectWithTimeout(timeout)
+        }
         
         waitForExpectationsWithTimeout(5) { error in
             if let error = error {
@@ -92,6 +107,10 @@ class SessionTestCase: XCTestCase, SSHKitSessionDelegate {
         return try connectAndReturnSessionWithAuthMethods(methods, host: sshHost, port: sshPort, user: user, timeout: 1, options: options)
     }
     
+    func launchSessionRacingAddresses(host: String, port: UInt16, timeout: NSTimeInterval = 1) throws -> SSHKitSession {
+        return try connectAndReturnSessionWithAuthMethods([.PublicKey,], host: host, port: port, user: userForSFA, timeout: timeout, options: [:], racingAddresses: true)
+    }
+    
     func disconnectSessionAndWait(session: SSHKitSession) throws {
         disconnectExpectation = expectationWithDescription("Disconnect session")
         session.disconnect()
@@ -107,6 +126,23 @@ class SessionTestCase: XCTestCase, SSHKitSessionDelegate {
         }
     }
     
+    func dropConnectionAndWaitForReconnect(session: SSHKitSession) throws {
+        reconnectExpectation = expectationWithDescription("Reconnect session")
+        
+        // connection dies under libssh, as if network went away
+        shutdown(session.fd, SHUT_RDWR)
+        
+        waitForExpectationsWithTimeout(5) { error in
+            if let error = error {
+                self.error = error
+            }
+        }
+        
+        if let error = self.error {
+            throw error
+        }
+    }
+    
     // MARK: - SSHKitSessionDelegate
     
     func session(session: SSHKitSession!, didNegotiateWithHMAC hmac: String!, cipher: String!, kexAlgorithm: String!) {
@@ -129,6 +165,22 @@ class SessionTestCase: XCTestCase, SSHKitSessionDelegate {
             expectation.fulfill()
             authExpectation = nil
         }
+        
+        if let expectation = reconnectExpectation {
+            expectation.fulfill()
+            reconnectExpectation = nil
+        }
+    }
+    
+    func session(session: SSHKitSession!, willReconnectAfterError error: NSError!, attempt: Int, delay: NSTimeInterval) {
+        reconnectAttempts = attempt
+    }
+    
+    func sessionDidReconnect(session: SSHKitSession!) {
+        if let expectation = reconnectExpectation {
+            expectation.fulfill()
+            reconnectExpectation = nil
+        }
     }
     
     func session(session: SSHKitSession!, shouldTrustHostKey hostKey: SSHKitHostKey!) -> Bool {
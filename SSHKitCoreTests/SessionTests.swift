@@ -47,6 +47,51 @@ class SessionTests: SessionTestCase {
         XCTFail("An connect error not raised as expected")
     }
     
+    func testSessionConnectRacingAddresses() {
+        do {
+            // localhost usually resolves to both ::1 and 127.0.0.1
+            let session = try launchSessionRacingAddresses("localhost", port: sshPort)
+            XCTAssert(session.connected)
+            
+            let durations = session.metrics().handshakeDurations
+            XCTAssertNotNil(durations[SSHKitHandshakePhaseResolve])
+            XCTAssertNotNil(durations[SSHKitHandshakePhaseTCPConnect])
+            XCTAssertNotNil(durations[SSHKitHandshakePhaseBanner])
+            XCTAssertNotNil(durations[SSHKitHandshakePhaseKeyExchange])
+            XCTAssertNotNil(durations[SSHKitHandshakePhaseAuthenticate])
+            
+            // the aggregate covers the finer phases instead of following them
+            let setup = durations[SSHKitHandshakePhaseTotalSetup]!.doubleValue
+            XCTAssertGreaterThanOrEqual(setup, durations[SSHKitHandshakePhaseBanner]!.doubleValue + durations[SSHKitHandshakePhaseKeyExchange]!.doubleValue)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testSessionConnectRacingAddressesWithRefusePort() {
+        do {
+            let session = try launchSessionRacingAddresses(sshHost, port: refusePort)
+            XCTAssertNotNil(session)
+        } catch let error as NSError {
+            XCTAssertEqual(SSHKitErrorCode.ConnectFailure.rawValue, error.code, error.description)
+            return
+        }
+        
+        XCTFail("An connect error not raised as expected")
+    }
+    
+    func testSessionConnectRacingAddressesWithNonRoutableIP() {
+        do {
+            let session = try launchSessionRacingAddresses(nonRoutableIP, port: sshPort, timeout: 1.5)
+            XCTAssertNotNil(session)
+        } catch let error as NSError {
+            XCTAssertEqual(SSHKitErrorCode.Timeout.rawValue, error.code, error.description)
+            return
+        }
+        
+        XCTFail("An connect error not raised as expected")
+    }
+    
     // MARK: - Disconnect
     
     func testSessionDisconnect() {
@@ -63,6 +108,58 @@ class SessionTests: SessionTestCase {
         }
     }
     
+    // MARK: - Reconnect
+    
+    func testReconnectDefaults() {
+        let session = SSHKitSession(host: sshHost, port: sshPort, user: userForSFA, options: [:], delegate: self)
+        XCTAssertFalse(session.reconnectsAutomatically)
+        XCTAssertEqual(session.maxReconnectAttempts, 8)
+        XCTAssertEqual(session.reconnectDelay, 1)
+        XCTAssertFalse(session.reconnecting)
+    }
+    
+    func testSessionReconnectsAfterConnectionLoss() {
+        reconnectsAutomatically = true
+        defer {
+            reconnectsAutomatically = false
+        }
+        
+        do {
+            // password is replayed without asking delegate
+            let session = try launchSessionWithAuthMethod(.Password, user: userForSFA)
+            XCTAssert(session.connected)
+            
+            try dropConnectionAndWaitForReconnect(session)
+            XCTAssertEqual(reconnectAttempts, 1)
+            XCTAssert(session.connected)
+            XCTAssertFalse(session.reconnecting)
+            
+            try disconnectSessionAndWait(session)
+            XCTAssertFalse(session.reconnecting)
+            XCTAssert(session.disconnected)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+    
+    func testSessionNeverAuthenticatedDoesNotReconnect() {
+        reconnectsAutomatically = true
+        reconnectAttempts = 0
+        defer {
+            reconnectsAutomatically = false
+        }
+        
+        do {
+            try launchSessionWithRefusePort()
+        } catch let error as NSError {
+            XCTAssertEqual(SSHKitErrorCode.Fatal.rawValue, error.code, error.description)
+            XCTAssertEqual(reconnectAttempts, 0)
+            return
+        }
+        
+        XCTFail("An connect error not raised as expected")
+    }
+    
     // MARK: - Trivial Properties
     
     func testTrivialProperties() {
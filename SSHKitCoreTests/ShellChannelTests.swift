@@ -22,6 +22,9 @@ class ShellChannelTests: SessionTestCase, SSHKitShellChannelDelegate {
     
     private let stdoutData = NSMutableData()
     
+    private var shellChannel: SSHKitShellChannel?
+    private var discardedBytes = 0
+    
     override func setUp() {
         super.setUp()
     }
@@ -131,6 +134,44 @@ class ShellChannelTests: SessionTestCase, SSHKitShellChannelDelegate {
         }
     }
     
+    func testReconnectDropsUnsentInput() {
+        reconnectsAutomatically = true
+        defer {
+            reconnectsAutomatically = false
+        }
+        
+        do {
+            let session = try self.launchSessionWithAuthMethod(.PublicKey, user: userForSFA)
+            
+            openExpectation = expectationWithDescription("Open Shell Channel")
+            shellChannel = session.openShellChannelWithTerminalType("xterm", columns: 20, rows: 50, delegate: self)
+            waitForExpectationsWithTimeout(5) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            // typed while the connection is down, see willReconnectAfterError, waited for along with reconnect
+            openExpectation = expectationWithDescription("Open Shell Channel Again")
+            try dropConnectionAndWaitForReconnect(session)
+            XCTAssertEqual(discardedBytes, command.utf8.count)
+            
+            // new shell works
+            readResultExpectation = expectationWithDescription("Read remote system name")
+            shellChannel!.writeData((command as NSString).dataUsingEncoding(NSUTF8StringEncoding))
+            waitForExpectationsWithTimeout(10) { error in
+                if let error = error {
+                    XCTFail(error.description)
+                }
+            }
+            
+            shellChannel = nil
+            try disconnectSessionAndWait(session)
+        } catch let error as NSError {
+            XCTFail(error.localizedDescription)
+        }
+    }
+    
     // TODO: add case for stderr data
     
     // MARK: - SSHKitChannelDelegate
@@ -162,8 +203,19 @@ class ShellChannelTests: SessionTestCase, SSHKitShellChannelDelegate {
         openExpectation?.fulfill()
     }
     
+    // MARK: - SSHKitSessionDelegate
+    
+    override func session(session: SSHKitSession!, willReconnectAfterError error: NSError!, attempt: Int, delay: NSTimeInterval) {
+        super.session(session, willReconnectAfterError: error, attempt: attempt, delay: delay)
+        shellChannel?.writeData((command as NSString).dataUsingEncoding(NSUTF8StringEncoding))
+    }
+    
     // MARK: - SSHKitShellChannelDelegate
     
+    func channel(channel: SSHKitShellChannel, didDiscardUnsentBytes length: Int) {
+        discardedBytes += length
+    }
+    
     func channel(channel: SSHKitShellChannel, didChangePtySizeToColumns columns: Int, rows: Int, withError error: NSError) {
         self.error = error
         resizeExpectation?.fulfill()
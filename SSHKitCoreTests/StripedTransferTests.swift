@@ -0,0 +1,194 @@
+//
+//  StripedTransferTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class StripedTransferTests: SFTPTests {
+
+    let remoteFilePathForTest = "./striped"
+    let remoteUploadFilePathForTest = "./striped_upload"
+    let remoteLargeFilePathForTest = "./striped_large"
+    var localFolderPathForTest = ""
+    var content = NSData()
+
+    // MARK: - setUp
+    override func setUp() {
+        super.setUp()
+
+        localFolderPathForTest = (NSTemporaryDirectory() as NSString).stringByAppendingPathComponent(NSUUID().UUIDString)
+        _ = try? NSFileManager.defaultManager().createDirectoryAtPath(localFolderPathForTest, withIntermediateDirectories: true, attributes: nil)
+
+        // not a multiple of stripe size, last range takes the remainder
+        var string = "0123456789abcdef-"
+        for _ in 0..<14 {
+            string = string.stringByAppendingString(string)
+        }
+        content = string.dataUsingEncoding(NSUTF8StringEncoding)!
+
+        do {
+            let file = try SSHKitSFTPFile.openFileForWrite(channel, path: remoteFilePathForTest, shouldResume: false, mode: 0o644)
+            let writeLength = file.write(content.bytes, size: content.length, errorPtr: nil)
+            XCTAssertEqual(content.length, writeLength)
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    override func tearDown() {
+        unlink(remoteFilePathForTest)
+        unlink(remoteUploadFilePathForTest)
+        unlink(remoteLargeFilePathForTest)
+        _ = try? NSFileManager.defaultManager().removeItemAtPath(localFolderPathForTest)
+
+        super.tearDown()
+    }
+
+    // MARK: - helper function
+    func runTransfer(start: (SSHKitSFTPStripedTransferCompletionBlock) -> Void) -> (NSData?, NSError?) {
+        let expectation = expectationWithDescription("Striped Transfer Finished")
+        var result: (NSData?, NSError?) = (nil, nil)
+        start({ (resumeData, error) in
+            result = (resumeData, error)
+            expectation.fulfill()
+        })
+
+        waitForExpectationsWithTimeout(30) { error in
+            if let error=error {
+                XCTFail(error.description)
+            }
+        }
+
+        return result
+    }
+
+    // large enough for ranges to be caught running, bytes depend on offset so misplaced ranges show
+    func writeLargeRemoteFile() -> NSData {
+        let length = 16 * 1024 * 1024
+        let data = NSMutableData(length: length)!
+        let bytes = UnsafeMutablePointer<UInt8>(data.mutableBytes)
+        for i in 0..<length {
+            bytes[i] = UInt8(truncatingBitPattern: (i &* 31) ^ (i >> 16))
+        }
+
+        do {
+            let file = try SSHKitSFTPFile.openFileForWrite(channel, path: remoteLargeFilePathForTest, shouldResume: false, mode: 0o644)
+            XCTAssertEqual(file.write(data.bytes, size: data.length, errorPtr: nil), data.length)
+            file.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+
+        return data
+    }
+
+    // MARK: - test
+    func testDownloadAndUploadInStripes() {
+        do {
+            let secondChannel = try openSFTPChannel(session!)
+            let transfer = SSHKitSFTPStripedTransfer(channels: [channel!, secondChannel])
+            transfer.stripeCount = 4
+            transfer.minStripeSize = 32 * 1024
+
+            let localPath = (localFolderPathForTest as NSString).stringByAppendingPathComponent("striped")
+            var (resumeData, error) = runTransfer { (completion) in
+                transfer.downloadFile(self.remoteFilePathForTest, toPath: localPath, resumeData: nil, completion: completion)
+            }
+
+            XCTAssertNil(error)
+            XCTAssertNil(resumeData)
+            XCTAssertEqual(transfer.transferredBytes, UInt64(content.length))
+            XCTAssertEqual(NSData(contentsOfFile: localPath), content)
+
+            (resumeData, error) = runTransfer { (completion) in
+                transfer.uploadFile(localPath, toPath: self.remoteUploadFilePathForTest, resumeData: nil, completion: completion)
+            }
+
+            XCTAssertNil(error)
+            XCTAssertEqual(transfer.transferredBytes, UInt64(content.length))
+
+            // uploaded ranges come back in the right order
+            let copyPath = (localFolderPathForTest as NSString).stringByAppendingPathComponent("copy")
+            (resumeData, error) = runTransfer { (completion) in
+                transfer.downloadFile(self.remoteUploadFilePathForTest, toPath: copyPath, resumeData: nil, completion: completion)
+            }
+
+            XCTAssertNil(error)
+            XCTAssertEqual(NSData(contentsOfFile: copyPath), content)
+
+            secondChannel.close()
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testFailedRangeRetriesOnAnotherChannel() {
+        do {
+            let largeContent = writeLargeRemoteFile()
+            let secondChannel = try openSFTPChannel(session!)
+            let transfer = SSHKitSFTPStripedTransfer(channels: [channel!, secondChannel])
+            transfer.stripeCount = 4
+            transfer.minStripeSize = 1024 * 1024
+
+            let localPath = (localFolderPathForTest as NSString).stringByAppendingPathComponent("retried")
+            let (resumeData, error) = runTransfer { (completion) in
+                transfer.downloadFile(self.remoteLargeFilePathForTest, toPath: localPath, resumeData: nil, completion: completion)
+                // ranges of second channel fail while opening or running, first channel takes them over
+                secondChannel.close()
+            }
+
+            XCTAssertNil(error)
+            XCTAssertNil(resumeData)
+            XCTAssertFalse(secondChannel.isOpen)
+            XCTAssertEqual(NSData(contentsOfFile: localPath), largeContent)
+        } catch let error as NSError {
+            XCTFail(error.description)
+        }
+    }
+
+    func testCancelAndResumeDownload() {
+        let largeContent = writeLargeRemoteFile()
+        let transfer = SSHKitSFTPStripedTransfer(channels: [channel!])
+        transfer.stripeCount = 4
+        transfer.minStripeSize = 1024 * 1024
+
+        var cancelled = false
+        transfer.progressBlock = { (_, _, _) in
+            if !cancelled {
+                cancelled = true
+                transfer.cancel()
+            }
+        }
+
+        let localPath = (localFolderPathForTest as NSString).stringByAppendingPathComponent("resumed")
+        var (resumeData, error) = runTransfer { (completion) in
+            transfer.downloadFile(self.remoteLargeFilePathForTest, toPath: localPath, resumeData: nil, completion: completion)
+        }
+
+        XCTAssertEqual(error?.code, SSHKitErrorCode.Stop.rawValue)
+        XCTAssertNotNil(resumeData)
+
+        transfer.progressBlock = nil
+        (resumeData, error) = runTransfer { (completion) in
+            transfer.downloadFile(self.remoteLargeFilePathForTest, toPath: localPath, resumeData: resumeData, completion: completion)
+        }
+
+        XCTAssertNil(error)
+        XCTAssertNil(resumeData)
+        XCTAssertEqual(NSData(contentsOfFile: localPath), largeContent)
+    }
+
+    func testDownloadMissingFile() {
+        let transfer = SSHKitSFTPStripedTransfer(channels: [channel!])
+        let localPath = (localFolderPathForTest as NSString).stringByAppendingPathComponent("missing")
+
+        let (resumeData, error) = runTransfer { (completion) in
+            transfer.downloadFile("./not_exist_file", toPath: localPath, resumeData: nil, completion: completion)
+        }
+
+        XCTAssertNil(resumeData)
+        XCTAssertEqual(error?.code, SSHKitSFTPErrorCode.NoSuchFile.rawValue)
+    }
+}
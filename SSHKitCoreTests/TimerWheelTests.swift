@@ -0,0 +1,79 @@
+//
+//  TimerWheelTests.swift
+//  SSHKitCore
+//
+
+import XCTest
+
+class TimerWheelTests: XCTestCase {
+
+    let queue = dispatch_queue_create("com.codinn.timer_wheel_tests", DISPATCH_QUEUE_SERIAL)
+
+    func testTimerFiresAfterDelay() {
+        let wheel = SSHKitTimerWheel(tickInterval: 0.05)
+        let expectation = expectationWithDescription("Timer fired")
+        let scheduledAt = CFAbsoluteTimeGetCurrent()
+
+        wheel.scheduleTimerWithDelay(0.3, queue: queue) {
+            XCTAssertGreaterThanOrEqual(CFAbsoluteTimeGetCurrent() - scheduledAt, 0.3)
+            expectation.fulfill()
+        }
+        XCTAssertEqual(wheel.timerCount, 1)
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+        XCTAssertEqual(wheel.timerCount, 0)
+        XCTAssertEqual(wheel.firedCount, 1)
+    }
+
+    func testCancelledTimerNeverFires() {
+        let wheel = SSHKitTimerWheel(tickInterval: 0.05)
+        let expectation = expectationWithDescription("Later timer fired")
+
+        let timer = wheel.scheduleTimerWithDelay(0.1, queue: queue) {
+            XCTFail("Cancelled timer fired")
+        }
+        wheel.scheduleTimerWithDelay(0.3, queue: queue) {
+            expectation.fulfill()
+        }
+
+        timer.cancel()
+        XCTAssert(timer.cancelled)
+        XCTAssertEqual(wheel.timerCount, 1)
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+        XCTAssertEqual(wheel.firedCount, 1)
+    }
+
+    func testTimersOfSameTickAreCoalesced() {
+        let wheel = SSHKitTimerWheel(tickInterval: 0.05)
+        let expectation = expectationWithDescription("Timers fired")
+        var fired = 0
+
+        for _ in 0..<100 {
+            wheel.scheduleTimerWithDelay(0.2, queue: queue) {
+                fired += 1
+                if fired == 100 {
+                    expectation.fulfill()
+                }
+            }
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+        XCTAssertEqual(wheel.firedCount, 100)
+        XCTAssertLessThanOrEqual(wheel.wakeups, 2)
+    }
+
+    func testFarTimerCascadesToNearLevel() {
+        // 300 ticks is beyond first level of 256 slots
+        let wheel = SSHKitTimerWheel(tickInterval: 0.005)
+        let expectation = expectationWithDescription("Timer fired")
+        let scheduledAt = CFAbsoluteTimeGetCurrent()
+
+        wheel.scheduleTimerWithDelay(1.5, queue: queue) {
+            XCTAssertGreaterThanOrEqual(CFAbsoluteTimeGetCurrent() - scheduledAt, 1.5)
+            expectation.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+    }
+}
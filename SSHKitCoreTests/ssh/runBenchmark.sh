@@ -0,0 +1,131 @@
+#!/bin/sh
+
+#  runBenchmark.sh
+#  SSHKitCore
+#
+#  Start a throwaway sshd on loopback and run BenchmarkTests against it.
+#  Results are written one JSON object per line to benchmark-results/<commit>.jsonl
+#
+#  Usage: ./runBenchmark.sh [-l latency_ms] [-b bandwidth_mbit] [-c baseline.jsonl]
+#
+#  Latency and bandwidth are injected with dummynet on OS X and netem on Linux, both need sudo.
+
+set -e
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(cd "$SCRIPT_DIR/../.." && pwd)
+
+SSHD=${SSHD:-/usr/sbin/sshd}
+SSHD_PORT=${SSHD_PORT:-2222}
+LATENCY=""
+BANDWIDTH=""
+BASELINE=""
+
+while getopts "l:b:c:" opt; do
+    case $opt in
+        l) LATENCY=$OPTARG ;;
+        b) BANDWIDTH=$OPTARG ;;
+        c) BASELINE=$OPTARG ;;
+        *) echo "Usage: $0 [-l latency_ms] [-b bandwidth_mbit] [-c baseline.jsonl]"; exit 1 ;;
+    esac
+done
+
+RESULT_DIR="$REPO_DIR/benchmark-results"
+COMMIT=$(cd "$REPO_DIR" && git rev-parse --short HEAD)
+RESULT_FILE="$RESULT_DIR/$COMMIT.jsonl"
+WORK_DIR=$(mktemp -d -t sshkit-benchmark.XXXXXX)
+
+mkdir -p "$RESULT_DIR"
+rm -f "$RESULT_FILE"
+
+# sshd running as current user only lets current user in
+ssh-keygen -q -t rsa -N "" -f "$WORK_DIR/host_rsa_key"
+cp "$SCRIPT_DIR/ssh_rsa_key.pub" "$WORK_DIR/authorized_keys"
+chmod 600 "$WORK_DIR/authorized_keys"
+
+cat > "$WORK_DIR/sshd_config" <<EOF
+Port $SSHD_PORT
+ListenAddress 127.0.0.1
+HostKey $WORK_DIR/host_rsa_key
+PidFile $WORK_DIR/sshd.pid
+AuthorizedKeysFile $WORK_DIR/authorized_keys
+PubkeyAuthentication yes
+PasswordAuthentication no
+ChallengeResponseAuthentication no
+UsePAM no
+StrictModes no
+AllowTcpForwarding yes
+Subsystem sftp internal-sftp
+EOF
+
+shape_traffic() {
+    if [ -z "$LATENCY" ] && [ -z "$BANDWIDTH" ]; then
+        return
+    fi
+
+    if [ "$(uname -s)" = "Darwin" ]; then
+        PIPE_CONFIG=""
+        [ -n "$LATENCY" ] && PIPE_CONFIG="$PIPE_CONFIG delay ${LATENCY}ms"
+        [ -n "$BANDWIDTH" ] && PIPE_CONFIG="$PIPE_CONFIG bw ${BANDWIDTH}Mbit/s"
+
+        sudo dnctl pipe 1 config $PIPE_CONFIG
+        (cat /etc/pf.conf; echo 'dummynet-anchor "sshkit"'; echo 'anchor "sshkit"') | sudo pfctl -q -f -
+        echo "dummynet in quick proto tcp from any to any port $SSHD_PORT pipe 1" | sudo pfctl -q -a sshkit -f -
+        sudo pfctl -q -E
+    else
+        NETEM=""
+        [ -n "$LATENCY" ] && NETEM="$NETEM delay ${LATENCY}ms"
+        [ -n "$BANDWIDTH" ] && NETEM="$NETEM rate ${BANDWIDTH}mbit"
+
+        # shapes all loopback traffic
+        sudo tc qdisc add dev lo root netem $NETEM
+    fi
+}
+
+cleanup() {
+    if [ -f "$WORK_DIR/sshd.pid" ]; then
+        kill "$(cat "$WORK_DIR/sshd.pid")" 2>/dev/null || true
+    fi
+
+    if [ -n "$LATENCY" ] || [ -n "$BANDWIDTH" ]; then
+        if [ "$(uname -s)" = "Darwin" ]; then
+            sudo pfctl -q -f /etc/pf.conf
+            sudo dnctl -q flush
+        else
+            sudo tc qdisc del dev lo root 2>/dev/null || true
+        fi
+    fi
+
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+"$SSHD" -f "$WORK_DIR/sshd_config"
+shape_traffic
+
+# xcodebuild passes TEST_RUNNER_ prefixed variables to the test process
+cd "$REPO_DIR"
+env TEST_RUNNER_SSHKIT_BENCHMARK=1 \
+    TEST_RUNNER_SSHKIT_BENCHMARK_OUTPUT="$RESULT_FILE" \
+    TEST_RUNNER_SSHKIT_TEST_HOST=127.0.0.1 \
+    TEST_RUNNER_SSHKIT_TEST_PORT="$SSHD_PORT" \
+    TEST_RUNNER_SSHKIT_TEST_USER="$(id -un)" \
+    xcodebuild test -project SSHKitCore.xcodeproj -scheme SSHKitCore-Mac -configuration Release \
+        -only-testing:SSHKitCoreTests/BenchmarkTests \
+        -only-testing:SSHKitCoreTests/MainLoopBenchmarkTests
+
+echo "Results written to $RESULT_FILE"
+
+if [ -n "$BASELINE" ]; then
+    # name, baseline, current, change in percent
+    awk -F'"' '
+        function value(line) { sub(/.*"value":/, "", line); sub(/[,}].*/, "", line); return line + 0 }
+        FNR == NR { for (i = 1; i < NF; i++) if ($i == "name") base[$(i + 2)] = value($0); next }
+        { for (i = 1; i < NF; i++) if ($i == "name") name = $(i + 2)
+          current = value($0)
+          if (name in base && base[name] != 0)
+              printf "%-32s %12.3f %12.3f %+8.1f%%\n", name, base[name], current, (current - base[name]) * 100 / base[name]
+          else
+              printf "%-32s %12s %12.3f\n", name, "-", current }
+    ' "$BASELINE" "$RESULT_FILE"
+fi